@@ -0,0 +1,154 @@
+#include "Async.h"
+#include "Metrics/Metrics.h"
+#include "NVS/NVS.h"
+
+namespace Async {
+/* Flows spawned since the last poll, handed to the executor under the lock.
+ * The polled list belongs to the task calling poll(). */
+static Flow *spawned_head = nullptr;
+static Flow *spawned_tail = nullptr;
+static Flow *flows = nullptr;
+
+static Port::Mutex spawn_lock;
+static Port::Signal wake;
+static Port::Task executor;
+static std::atomic<bool> running(false);
+
+static Metrics::Gauge active_flows("async.flows");
+static Metrics::Counter resumes("async.resumes");
+
+static void executor_task(void *arg) {
+  while (running) {
+    wake.take(poll());
+  }
+}
+}  // namespace Async
+
+esp_err_t Async::Call::start(Function fn, void *arg) {
+  if (pending_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  fn_ = fn;
+  arg_ = arg;
+  pending_ = true;
+  esp_err_t err = Work::submit(run, this);
+  if (err != ESP_OK) {
+    pending_ = false;
+  }
+  return err;
+}
+
+void Async::Call::run(void *self) {
+  Call *call = static_cast<Call *>(self);
+  call->result_ = call->fn_(call->arg_);
+  call->pending_ = false;
+  notify();
+}
+
+esp_err_t Async::Flush::start() { return Call::start(commit, nullptr); }
+
+esp_err_t Async::Flush::commit(void *arg) { return NVSStatic::nvsCommit(); }
+
+esp_err_t Async::Resolve::start(const char *url) {
+  if (pending_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  query_.done = found;
+  query_.arg = this;
+  result_ = ESP_OK;
+  pending_ = true;
+  /* A cached answer calls found() before this returns */
+  esp_err_t err = DNS::resolve_async(url, &query_);
+  if (err != ESP_OK) {
+    result_ = err;
+    pending_ = false;
+  }
+  return err;
+}
+
+void Async::Resolve::found(DNS::Query *query, esp_err_t result) {
+  Resolve *self = static_cast<Resolve *>(query->arg);
+  self->result_ = result;
+  self->pending_ = false;
+  notify();
+}
+
+esp_err_t Async::spawn(Flow *flow) {
+  if (!flow->done_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  flow->line_ = 0;
+  flow->deadline_us_ = 0;
+  flow->next_ = nullptr;
+  flow->done_ = false;
+  active_flows.add(1);
+  {
+    Port::Lock lock(spawn_lock);
+    if (spawned_tail == nullptr) {
+      spawned_head = flow;
+    } else {
+      spawned_tail->next_ = flow;
+    }
+    spawned_tail = flow;
+  }
+  notify();
+  return ESP_OK;
+}
+
+void Async::notify() { wake.give(); }
+
+uint32_t Async::poll() {
+  Flow **link = &flows;
+  while (*link != nullptr) {
+    link = &(*link)->next_;
+  }
+  {
+    Port::Lock lock(spawn_lock);
+    *link = spawned_head;
+    spawned_head = spawned_tail = nullptr;
+  }
+
+  uint64_t next = Port::micros() + ASYNC_POLL_MS * 1000;
+  link = &flows;
+  while (*link != nullptr) {
+    Flow *flow = *link;
+    resumes.add();
+    if (flow->resume() == Status::DONE) {
+      /* The owner may reuse the flow as soon as it is marked done */
+      *link = flow->next_;
+      active_flows.add(-1);
+      flow->done_ = true;
+      continue;
+    }
+    if (flow->deadline_us_ != 0 && flow->deadline_us_ < next) {
+      next = flow->deadline_us_;
+    }
+    link = &flow->next_;
+  }
+
+  uint64_t now = Port::micros();
+  return next > now ? (next - now + 999) / 1000 : 0;
+}
+
+uint32_t Async::active() { return active_flows.value(); }
+
+esp_err_t Async::start() {
+  if (running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  running = true;
+  esp_err_t err = executor.start(executor_task, nullptr, "async",
+                                 ASYNC_TASK_STACK_SIZE, ASYNC_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    running = false;
+  }
+  return err;
+}
+
+void Async::stop() {
+  if (running) {
+    running = false;
+    wake.give();
+    executor.join();
+  }
+}
@@ -0,0 +1,237 @@
+/**
+ * Cooperative executor. Many flows share one task and its stack, each
+ * resuming where it last waited instead of blocking a task of its own:
+ *
+ *   class Report : public Async::Flow {
+ *     Async::Status resume() override {
+ *       ASYNC_BEGIN();
+ *       ASYNC_AWAIT_MS(EasyWifi::is_connected(), 20000);
+ *       lookup_.start("tidalpaladin.com");
+ *       ASYNC_AWAIT(lookup_.ready());
+ *       ASYNC_SLEEP_MS(1000);
+ *       ASYNC_END();
+ *     }
+ *     Async::Resolve lookup_;
+ *   };
+ *
+ *   static Report report;
+ *   Async::spawn(&report);
+ *
+ * Flows are stackless: resume() returns at every ASYNC_ macro and comes
+ * back through a switch, so locals do not survive a wait. Keep state in
+ * members, and do not put the macros inside another switch.
+ *
+ * The executor polls the waiting flows when woken by notify(), at their
+ * deadlines, and at least every ASYNC_POLL_MS for conditions nothing
+ * notifies about. Work that has to block, such as an NVS commit, runs on the
+ * Work pool through Call.
+ */
+
+#ifndef __ASYNC_H__
+#define __ASYNC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "DNS/DNS.h"
+#include "Port/Port.h"
+#include "Work/Work.h"
+
+/* Longest the executor sleeps without being notified */
+#define ASYNC_POLL_MS 100
+
+#define ASYNC_TASK_STACK_SIZE 3072
+#define ASYNC_TASK_PRIORITY 5
+
+/* Opens the body of Flow::resume() */
+#define ASYNC_BEGIN() \
+  switch (line_) {    \
+    case 0:
+
+/* Returns until 'cond' holds, then carries on after the macro */
+#define ASYNC_AWAIT(cond)            \
+  line_ = __LINE__;                  \
+  case __LINE__:                     \
+    if (!(cond)) {                   \
+      return Async::Status::WAITING; \
+    }
+
+/* As ASYNC_AWAIT, giving up after 'ms'. Check timed_out() after it. */
+#define ASYNC_AWAIT_MS(cond, ms)                                        \
+  deadline_us_ = Port::micros() + (uint64_t)(ms) * 1000;               \
+  expired_ = false;                                                    \
+  ASYNC_AWAIT((cond) || (expired_ = Port::micros() >= deadline_us_)); \
+  deadline_us_ = 0;
+
+#define ASYNC_SLEEP_MS(ms) ASYNC_AWAIT_MS(false, ms)
+
+/* Closes the body, the flow is done */
+#define ASYNC_END() \
+  }                 \
+  line_ = 0;        \
+  return Async::Status::DONE;
+
+namespace Async {
+
+enum class Status { WAITING, DONE };
+
+/**
+ * A resumable sequence of steps, run by the executor. Derive from it and
+ * implement resume() with the ASYNC_ macros.
+ */
+class Flow {
+ public:
+  Flow()
+      : line_(0),
+        deadline_us_(0),
+        expired_(false),
+        done_(true),
+        next_(nullptr) {}
+  virtual ~Flow() {}
+
+  /**
+   * @brief Runs until the next wait or the end
+   *
+   * @return DONE once the flow finished, WAITING otherwise
+   */
+  virtual Status resume() = 0;
+
+  /* False from spawn() until the flow finishes */
+  bool done() const { return done_.load(); }
+
+ protected:
+  /* True if the last ASYNC_AWAIT_MS gave up */
+  bool timed_out() const { return expired_; }
+
+  /* Used by the ASYNC_ macros */
+  uint32_t line_;
+  uint64_t deadline_us_;
+  bool expired_;
+
+ private:
+  Flow(const Flow &) = delete;
+  Flow &operator=(const Flow &) = delete;
+  friend esp_err_t spawn(Flow *flow);
+  friend uint32_t poll();
+
+  std::atomic<bool> done_;
+  Flow *next_;
+};
+
+/**
+ * Runs a blocking function on the Work pool, see Work::start(). ready()
+ * once it returned.
+ */
+class Call {
+ public:
+  typedef esp_err_t (*Function)(void *arg);
+
+  Call() : fn_(nullptr), arg_(nullptr), result_(ESP_OK), pending_(false) {}
+
+  /**
+   * @brief Queues 'fn(arg)' as a normal priority job
+   *
+   * @return
+   *  - ESP_ERR_INVALID_STATE The previous call is pending
+   *  - Else as Work::submit()
+   */
+  esp_err_t start(Function fn, void *arg);
+
+  bool ready() const { return !pending_.load(); }
+
+  /* What the function returned */
+  esp_err_t result() const { return result_; }
+
+ private:
+  Call(const Call &) = delete;
+  Call &operator=(const Call &) = delete;
+  static void run(void *self);
+
+  Function fn_;
+  void *arg_;
+  esp_err_t result_;
+  std::atomic<bool> pending_;
+};
+
+/**
+ * Commits pending NVS changes on the Work pool, see NVSStatic::nvsCommit()
+ */
+class Flush : public Call {
+ public:
+  esp_err_t start();
+
+ private:
+  static esp_err_t commit(void *arg);
+};
+
+/**
+ * A DNS lookup. ready() once answered.
+ */
+class Resolve {
+ public:
+  Resolve() : result_(ESP_OK), pending_(false) {}
+
+  /**
+   * @return As DNS::resolve_async()
+   */
+  esp_err_t start(const char *url);
+
+  bool ready() const { return !pending_.load(); }
+
+  /* ESP_OK, ESP_ERR_NOT_FOUND or ESP_ERR_INVALID_ARG */
+  esp_err_t result() const { return result_; }
+  const ip_addr_t &addr() const { return query_.addr; }
+
+ private:
+  Resolve(const Resolve &) = delete;
+  Resolve &operator=(const Resolve &) = delete;
+  static void found(DNS::Query *query, esp_err_t result);
+
+  DNS::Query query_;
+  esp_err_t result_;
+  std::atomic<bool> pending_;
+};
+
+/**
+ * @brief Adds a flow, which starts at the next poll. It must stay alive
+ * until done().
+ *
+ * @return ESP_ERR_INVALID_STATE if it is already running
+ */
+esp_err_t spawn(Flow *flow);
+
+/**
+ * @brief Wakes the executor to poll the flows. Call from anywhere once a
+ * condition a flow may wait on changed.
+ */
+void notify();
+
+/**
+ * @brief Resumes every waiting flow once. The executor task calls this,
+ * tests may instead.
+ *
+ * @return Milliseconds until the nearest deadline, at most ASYNC_POLL_MS
+ */
+uint32_t poll();
+
+/**
+ * @brief Gets the number of flows not yet done
+ */
+uint32_t active();
+
+/**
+ * @brief Starts the executor task
+ *
+ * @return As Port::Task::start()
+ */
+esp_err_t start();
+
+/**
+ * @brief Stops the executor after the current poll. Flows keep their state
+ * and resume after start().
+ */
+void stop();
+
+}  // namespace Async
+
+#endif
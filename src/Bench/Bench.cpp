@@ -0,0 +1,63 @@
+#include "Bench.h"
+#include <stdio.h>
+#include <algorithm>
+
+namespace Bench {
+static uint32_t samples[BENCH_MAX_ITERATIONS];
+
+/* Nearest rank percentile of the sorted samples */
+static uint32_t percentile(uint32_t n, uint32_t percent) {
+  uint32_t rank = (n * percent + 99) / 100;
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+}  // namespace Bench
+
+esp_err_t Bench::run(const Scenario &scenario, Result &result) {
+  if (scenario.iterations == 0 ||
+      scenario.iterations > BENCH_MAX_ITERATIONS) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  for (uint32_t i = 0; i < scenario.warmup; i++) {
+    if (scenario.sample(scenario.arg) == BENCH_FAILED) {
+      return ESP_FAIL;
+    }
+  }
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < scenario.iterations; i++) {
+    samples[i] = scenario.sample(scenario.arg);
+    if (samples[i] == BENCH_FAILED) {
+      return ESP_FAIL;
+    }
+    sum += samples[i];
+  }
+
+  uint32_t n = scenario.iterations;
+  std::sort(samples, samples + n);
+  result.name = scenario.name;
+  result.unit = scenario.unit;
+  result.n = n;
+  result.min = samples[0];
+  result.p50 = percentile(n, 50);
+  result.p90 = percentile(n, 90);
+  result.p99 = percentile(n, 99);
+  result.max = samples[n - 1];
+  result.mean = sum / n;
+  return ESP_OK;
+}
+
+int Bench::write_json(const Result &result, char *dest, size_t size) {
+  return snprintf(dest, size,
+                  "{\"bench\":\"%s\",\"platform\":\"" BENCH_PLATFORM
+                  "\",\"unit\":\"%s\",\"n\":%u,\"min\":%u,\"p50\":%u,"
+                  "\"p90\":%u,\"p99\":%u,\"max\":%u,\"mean\":%u}",
+                  result.name, result.unit, (unsigned)result.n,
+                  (unsigned)result.min, (unsigned)result.p50,
+                  (unsigned)result.p90, (unsigned)result.p99,
+                  (unsigned)result.max, (unsigned)result.mean);
+}
+
+void Bench::print(const Result &result) {
+  char line[256];
+  write_json(result, line, sizeof(line));
+  printf("%s\n", line);
+}
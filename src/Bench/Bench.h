@@ -0,0 +1,85 @@
+/**
+ * Benchmark harness shared by the native and on-device suites. A scenario
+ * runs a few warm-up iterations, then records one sample per iteration and
+ * reports percentiles of them as a single JSON line:
+ *
+ *   {"bench":"nvs.write_u32","platform":"esp32","unit":"ns","n":200,
+ *    "min":..,"p50":..,"p90":..,"p99":..,"max":..,"mean":..}
+ *
+ * Collect the lines of two releases and compare them with tools/benchdiff.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+/* Samples kept per scenario, in a static buffer */
+#define BENCH_MAX_ITERATIONS 1000
+
+/* Return from a Sample to abort the scenario */
+#define BENCH_FAILED UINT32_MAX
+
+#ifdef ESP_PLATFORM
+#define BENCH_PLATFORM "esp32"
+#else
+#define BENCH_PLATFORM "native"
+#endif
+
+namespace Bench {
+
+/**
+ * Runs one iteration of a scenario
+ *
+ * @return The measurement in the scenario's unit, or BENCH_FAILED
+ */
+typedef uint32_t (*Sample)(void *arg);
+
+struct Scenario {
+  const char *name;   /* module.operation, e.g. "nvs.read_u32" */
+  const char *unit;   /* Of the samples, e.g. "ns", "us" or "KiB/s" */
+  Sample sample;
+  void *arg;          /* Passed to 'sample' */
+  uint32_t warmup;    /* Iterations run before sampling */
+  uint32_t iterations;
+};
+
+struct Result {
+  const char *name;
+  const char *unit;
+  uint32_t n;
+  uint32_t min;
+  uint32_t p50;
+  uint32_t p90;
+  uint32_t p99;
+  uint32_t max;
+  uint32_t mean;
+};
+
+/**
+ * @brief Runs a scenario. Not reentrant, the samples share one buffer.
+ *
+ * @return
+ *  - ESP_OK                'result' holds the percentiles
+ *  - ESP_ERR_INVALID_SIZE  'iterations' is 0 or over BENCH_MAX_ITERATIONS
+ *  - ESP_FAIL              An iteration returned BENCH_FAILED
+ */
+esp_err_t run(const Scenario &scenario, Result &result);
+
+/**
+ * @brief Formats 'result' as one JSON line, without the newline
+ *
+ * @return Length of the line, as snprintf() does
+ */
+int write_json(const Result &result, char *dest, size_t size);
+
+/**
+ * @brief Prints 'result' as one JSON line on stdout
+ */
+void print(const Result &result);
+
+}  // namespace Bench
+
+#endif
@@ -0,0 +1,409 @@
+#include "Scenarios.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "DNS/DNS.h"
+#include "Delay/Delay.h"
+#include "NVS/NVS.h"
+#include "NVS/RtcMirror.h"
+#include "Work/Work.h"
+#include "freertos/event_groups.h"
+
+#define BENCH_STR_(x) #x
+#define BENCH_STR(x) BENCH_STR_(x)
+
+namespace Bench {
+static const char *TAG = "Bench";
+
+/* Runs, prints and returns a scenario */
+static esp_err_t report(const char *name, const char *unit, Sample sample,
+                        void *arg, const Options &options, Result &result) {
+  Scenario scenario = {name, unit, sample, arg, options.warmup,
+                       options.iterations};
+  esp_err_t err = run(scenario, result);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) running %s", err, name);
+    return err;
+  }
+  print(result);
+  return ESP_OK;
+}
+
+static uint32_t elapsed_ns(uint64_t start) { return Port::nanos() - start; }
+
+static uint32_t nvs_read_once(void *) {
+  uint32_t value;
+  uint64_t start = Port::nanos();
+  esp_err_t err = NVS.read("bench_u32", value);
+  uint32_t ns = elapsed_ns(start);
+  return err == ESP_OK ? ns : BENCH_FAILED;
+}
+
+static uint32_t nvs_write_once(void *arg) {
+  uint32_t &value = *static_cast<uint32_t *>(arg);
+  value++;
+  uint64_t start = Port::nanos();
+  esp_err_t err = NVS.write("bench_u32", value);
+  uint32_t ns = elapsed_ns(start);
+  return err == ESP_OK ? ns : BENCH_FAILED;
+}
+
+static uint32_t nvs_commit_once(void *arg) {
+  nvs_handle handle = *static_cast<nvs_handle *>(arg);
+  static uint32_t value = 0;
+  if (nvs_set_u32(handle, "commit", ++value) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  uint64_t start = Port::nanos();
+  esp_err_t err = ::nvs_commit(handle);
+  uint32_t ns = elapsed_ns(start);
+  return err == ESP_OK ? ns : BENCH_FAILED;
+}
+
+static uint32_t delay_once(void *) {
+  uint64_t start = Port::micros();
+  Delay::delay(BENCH_DELAY_MS);
+  return Port::micros() - start;
+}
+
+struct Period {
+  TickType_t wake;
+  uint64_t last_us;
+};
+
+static uint32_t period_once(void *arg) {
+  Period &period = *static_cast<Period *>(arg);
+  Delay::delay_until_ms(BENCH_DELAY_MS, &period.wake);
+  uint64_t now = Port::micros();
+  uint32_t us = now - period.last_us;
+  period.last_us = now;
+  return us;
+}
+
+static uint32_t resolve_once(void *arg) {
+  const char *host = static_cast<const char *>(arg);
+  ip_addr_t addr;
+  uint64_t start = Port::nanos();
+  esp_err_t err = DNS::resolve(host, &addr);
+  uint32_t ns = elapsed_ns(start);
+  return err == ESP_OK ? ns : BENCH_FAILED;
+}
+
+static uint32_t resolve_new_once(void *arg) {
+  const char *domain = static_cast<const char *>(arg);
+  static uint32_t serial = 0;
+  char host[128];
+  snprintf(host, sizeof(host), "bench%u.%s", (unsigned)++serial, domain);
+  ip_addr_t addr;
+  uint64_t start = Port::micros();
+  esp_err_t err = DNS::resolve(host, &addr);
+  uint32_t us = Port::micros() - start;
+  return err == ESP_OK || err == ESP_ERR_NOT_FOUND ? us : BENCH_FAILED;
+}
+
+static uint32_t ota_write_once(void *arg) {
+  Update::Partition &partition = *static_cast<Update::Partition *>(arg);
+  static uint8_t chunk[OTA_SECTOR_SIZE];
+  uint64_t start = Port::micros();
+  if (partition.erase(0, BENCH_OTA_SIZE) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  for (size_t offset = 0; offset < BENCH_OTA_SIZE; offset += sizeof(chunk)) {
+    memset(chunk, offset / sizeof(chunk), sizeof(chunk));
+    if (partition.write(offset, chunk, sizeof(chunk)) != ESP_OK) {
+      return BENCH_FAILED;
+    }
+  }
+  uint64_t us = Port::micros() - start;
+  return (uint64_t)BENCH_OTA_SIZE * 1000000 / 1024 / (us > 0 ? us : 1);
+}
+}  // namespace Bench
+
+esp_err_t Bench::nvs_read(const Options &options, Result &result) {
+  uint32_t value = 0;
+  esp_err_t err = NVS.write("bench_u32", value);
+  if (err != ESP_OK) {
+    return err;
+  }
+  return report("nvs.read_u32", "ns", nvs_read_once, nullptr, options,
+                result);
+}
+
+esp_err_t Bench::nvs_write(const Options &options, Result &result) {
+  uint32_t value = 0;
+  return report("nvs.write_u32", "ns", nvs_write_once, &value, options,
+                result);
+}
+
+esp_err_t Bench::nvs_commit(const Options &options, Result &result) {
+  nvs_handle handle;
+  esp_err_t err = nvs_open(BENCH_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = report("nvs.commit", "ns", nvs_commit_once, &handle, options, result);
+  nvs_erase_all(handle);
+  ::nvs_commit(handle);
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t Bench::delay_accuracy(const Options &options, Result &result) {
+  return report("delay." BENCH_STR(BENCH_DELAY_MS) "ms", "us", delay_once,
+                nullptr, options, result);
+}
+
+esp_err_t Bench::delay_period(const Options &options, Result &result) {
+  Period period = {xTaskGetTickCount(), Port::micros()};
+  return report("delay.until_" BENCH_STR(BENCH_DELAY_MS) "ms", "us",
+                period_once, &period, options, result);
+}
+
+/* Shared by the work scenarios, the jobs write here and give 'done' */
+struct WorkRun {
+  uint64_t started_ns;
+  std::atomic<uint32_t> remaining;
+  uint32_t checksum[BENCH_WORK_BATCH];
+  Port::Signal done;
+};
+
+static void started_job(void *arg) {
+  WorkRun &run = *static_cast<WorkRun *>(arg);
+  run.started_ns = Port::nanos();
+  run.done.give();
+}
+
+/* A few hundred ns of hashing, standing in for a small job */
+static void small_job(void *arg) {
+  WorkRun &run = *static_cast<WorkRun *>(arg);
+  uint32_t index = run.remaining.load() % BENCH_WORK_BATCH;
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < 64; i++) {
+    hash = (hash ^ i) * 16777619u;
+  }
+  run.checksum[index] = hash;
+  if (run.remaining.fetch_sub(1) == 1) {
+    run.done.give();
+  }
+}
+
+static uint32_t work_latency_once(void *arg) {
+  WorkRun &run = *static_cast<WorkRun *>(arg);
+  /* Let the workers go idle, so the wake-up is timed too */
+  Port::sleep_ms(1);
+  uint64_t start = Port::nanos();
+  if (Work::submit(started_job, &run) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  run.done.take();
+  return run.started_ns - start;
+}
+
+static uint32_t work_throughput_once(void *arg) {
+  WorkRun &run = *static_cast<WorkRun *>(arg);
+  run.remaining = BENCH_WORK_BATCH;
+  uint64_t start = Port::micros();
+  for (uint32_t i = 0; i < BENCH_WORK_BATCH; i++) {
+    if (Work::submit(small_job, &run) != ESP_OK) {
+      /* Wait for the jobs queued before failing */
+      uint32_t missing = BENCH_WORK_BATCH - i;
+      if (run.remaining.fetch_sub(missing) != missing) {
+        run.done.take();
+      }
+      return BENCH_FAILED;
+    }
+  }
+  run.done.take();
+  uint64_t us = Port::micros() - start;
+  return us > 0 ? (uint64_t)BENCH_WORK_BATCH * 1000000 / us : UINT32_MAX;
+}
+
+/* Shared by the wake-up scenarios. The waiter stamps 'woken_ns' as soon
+ * as it runs and gives 'done'. */
+struct WakeRun {
+  EventGroupHandle_t group;
+  Port::Notification notification;
+  uint64_t woken_ns;
+  Port::Signal done;
+  Port::Task waiter;
+};
+
+static void group_waiter(void *arg) {
+  WakeRun &run = *static_cast<WakeRun *>(arg);
+  for (;;) {
+    EventBits_t bits =
+        xEventGroupWaitBits(run.group, BENCH_WAKE_BIT | BENCH_STOP_BIT,
+                            pdTRUE, pdFALSE, portMAX_DELAY);
+    run.woken_ns = Port::nanos();
+    if (bits & BENCH_STOP_BIT) {
+      return;
+    }
+    run.done.give();
+  }
+}
+
+static void notification_waiter(void *arg) {
+  WakeRun &run = *static_cast<WakeRun *>(arg);
+  for (;;) {
+    uint32_t bits = run.notification.wait(BENCH_WAKE_BIT | BENCH_STOP_BIT);
+    run.woken_ns = Port::nanos();
+    run.notification.clear();
+    if (bits & BENCH_STOP_BIT) {
+      return;
+    }
+    run.done.give();
+  }
+}
+
+static uint32_t wake_group_once(void *arg) {
+  WakeRun &run = *static_cast<WakeRun *>(arg);
+  /* Let the waiter block again */
+  Port::sleep_ms(1);
+  uint64_t start = Port::nanos();
+  xEventGroupSetBits(run.group, BENCH_WAKE_BIT);
+  run.done.take();
+  return run.woken_ns - start;
+}
+
+static uint32_t wake_notification_once(void *arg) {
+  WakeRun &run = *static_cast<WakeRun *>(arg);
+  Port::sleep_ms(1);
+  uint64_t start = Port::nanos();
+  run.notification.post(BENCH_WAKE_BIT);
+  run.done.take();
+  return run.woken_ns - start;
+}
+
+static const char *const wake_keys[BENCH_WAKE_KEYS] = {"wake_0", "wake_1",
+                                                      "wake_2", "wake_3"};
+
+/* What NVSStatic::begin() and NVS.read() cost on a wake, without the
+ * library's logging */
+static uint32_t wake_nvs_once(void *) {
+  uint64_t start = Port::micros();
+  nvs_handle handle;
+  if (nvs_flash_init() != ESP_OK ||
+      nvs_open("storage", NVS_READONLY, &handle) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  esp_err_t err = ESP_OK;
+  for (int i = 0; i < BENCH_WAKE_KEYS && err == ESP_OK; i++) {
+    uint32_t value;
+    err = nvs_get_u32(handle, wake_keys[i], &value);
+  }
+  nvs_close(handle);
+  uint32_t us = Port::micros() - start;
+  return err == ESP_OK ? us : BENCH_FAILED;
+}
+
+static uint32_t wake_rtc_once(void *) {
+  uint64_t start = Port::micros();
+  esp_err_t err = RtcMirror::begin();
+  for (int i = 0; i < BENCH_WAKE_KEYS && err == ESP_OK; i++) {
+    uint32_t value;
+    err = RtcMirror::read(wake_keys[i], value);
+  }
+  uint32_t us = Port::micros() - start;
+  return err == ESP_OK && !RtcMirror::nvs_opened() ? us : BENCH_FAILED;
+}
+
+static esp_err_t write_wake_keys() {
+  for (uint32_t i = 0; i < BENCH_WAKE_KEYS; i++) {
+    esp_err_t err = NVS.write(wake_keys[i], i);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t Bench::dns_cached(const char *host, const Options &options,
+                            Result &result) {
+  return report("dns.resolve_cached", "ns", resolve_once,
+                const_cast<char *>(host), options, result);
+}
+
+esp_err_t Bench::dns_uncached(const char *domain, const Options &options,
+                              Result &result) {
+  return report("dns.resolve", "us", resolve_new_once,
+                const_cast<char *>(domain), options, result);
+}
+
+esp_err_t Bench::ota_write(Update::Partition &partition,
+                           const Options &options, Result &result) {
+  if (partition.size() < BENCH_OTA_SIZE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return report("ota.write", "KiB/s", ota_write_once, &partition, options,
+                result);
+}
+
+esp_err_t Bench::work_latency(const Options &options, Result &result) {
+  static WorkRun run;
+  return report("work.latency", "ns", work_latency_once, &run, options,
+                result);
+}
+
+esp_err_t Bench::work_throughput(const Options &options, Result &result) {
+  static WorkRun run;
+  return report("work.throughput", "jobs/s", work_throughput_once, &run,
+                options, result);
+}
+
+esp_err_t Bench::wake_event_group(const Options &options, Result &result) {
+  static StaticEventGroup_t buffer;
+  static EventGroupHandle_t group = xEventGroupCreateStatic(&buffer);
+  static WakeRun run;
+  run.group = group;
+  esp_err_t err = run.waiter.start(group_waiter, &run, "bench_wake",
+                                   PORT_SMALL_STACK_SIZE, BENCH_WAKE_PRIORITY);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = report("wake.event_group", "ns", wake_group_once, &run, options,
+               result);
+  xEventGroupSetBits(run.group, BENCH_STOP_BIT);
+  run.waiter.join();
+  return err;
+}
+
+esp_err_t Bench::wake_notification(const Options &options, Result &result) {
+  static WakeRun run;
+  esp_err_t err =
+      run.waiter.start(notification_waiter, &run, "bench_wake",
+                       PORT_SMALL_STACK_SIZE, BENCH_WAKE_PRIORITY);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = report("wake.notification", "ns", wake_notification_once, &run,
+               options, result);
+  run.notification.post(BENCH_STOP_BIT);
+  run.waiter.join();
+  return err;
+}
+
+esp_err_t Bench::wake_ready_nvs(const Options &options, Result &result) {
+  esp_err_t err = write_wake_keys();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return report("wake_ready.nvs", "us", wake_nvs_once, nullptr, options,
+                result);
+}
+
+esp_err_t Bench::wake_ready_rtc(const Options &options, Result &result) {
+  esp_err_t err = write_wake_keys();
+  /* The first boot reads through to NVS and fills the mirror */
+  if (err == ESP_OK) {
+    RtcMirror::begin();
+    for (int i = 0; i < BENCH_WAKE_KEYS && err == ESP_OK; i++) {
+      uint32_t value;
+      err = RtcMirror::read(wake_keys[i], value);
+    }
+  }
+  if (err != ESP_OK) {
+    return err;
+  }
+  return report("wake_ready.rtc", "us", wake_rtc_once, nullptr, options,
+                result);
+}
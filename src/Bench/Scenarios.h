@@ -0,0 +1,143 @@
+/**
+ * Benchmark scenarios for the utility modules. The native and on-device
+ * suites run these same functions, natively against the stand-ins in
+ * src/Host, so the two sets of numbers line up by name. Each prints its
+ * JSON line (see Bench.h) and fills 'result' for the caller to check.
+ */
+
+#ifndef __BENCH_SCENARIOS_H__
+#define __BENCH_SCENARIOS_H__
+
+#include "Bench.h"
+#include "Update/Partition.h"
+#include "Work/Work.h"
+
+#define BENCH_WARMUP 10
+#define BENCH_ITERATIONS 200
+
+/* Requested delay, two ticks at the default 100 Hz tick */
+#define BENCH_DELAY_MS 20
+
+/* Written per OTA iteration */
+#define BENCH_OTA_SIZE (64 * 1024)
+
+/* Namespace of the raw NVS handle used to time commits */
+#define BENCH_NVS_NAMESPACE "bench"
+
+/* Jobs per throughput iteration, as many as the work queues hold */
+#define BENCH_WORK_BATCH (WORK_WORKERS * WORK_QUEUE_SIZE)
+
+/* Bits the wake-up scenarios post to their waiting task */
+#define BENCH_WAKE_BIT 1
+#define BENCH_STOP_BIT 2
+
+/* Above the caller's, so a post switches straight to the waiter */
+#define BENCH_WAKE_PRIORITY 5
+
+/* Config values a wake from deep sleep reads before it is ready */
+#define BENCH_WAKE_KEYS 4
+
+namespace Bench {
+
+struct Options {
+  uint32_t warmup;
+  uint32_t iterations;
+};
+
+static const Options DEFAULT_OPTIONS = {BENCH_WARMUP, BENCH_ITERATIONS};
+
+/**
+ * @brief Times NVS.read() of a uint32_t in ns. Call NVS.begin() first.
+ */
+esp_err_t nvs_read(const Options &options, Result &result);
+
+/**
+ * @brief Times NVS.write() of a uint32_t, which commits, in ns
+ */
+esp_err_t nvs_write(const Options &options, Result &result);
+
+/**
+ * @brief Times nvs_commit() after nvs_set_u32() in ns, without the
+ * library's logging and metrics
+ */
+esp_err_t nvs_commit(const Options &options, Result &result);
+
+/**
+ * @brief Measures Delay::delay(BENCH_DELAY_MS) in us. The first tick may
+ * be partial, so samples can fall up to a tick short of the request.
+ */
+esp_err_t delay_accuracy(const Options &options, Result &result);
+
+/**
+ * @brief Measures the period of a Delay::delay_until_ms(BENCH_DELAY_MS)
+ * loop in us
+ */
+esp_err_t delay_period(const Options &options, Result &result);
+
+/**
+ * @brief Times DNS::resolve() of 'host' in ns, after the first lookup has
+ * cached it
+ */
+esp_err_t dns_cached(const char *host, const Options &options,
+                     Result &result);
+
+/**
+ * @brief Times DNS::resolve() in us of a new name under 'domain' every
+ * iteration, so every lookup goes to the server. Names that do not resolve
+ * are timed too.
+ */
+esp_err_t dns_uncached(const char *domain, const Options &options,
+                       Result &result);
+
+/**
+ * @brief Measures erasing and writing BENCH_OTA_SIZE to the start of
+ * 'partition' in KiB/s, in OTA_SECTOR_SIZE writes. Overwrites the
+ * partition.
+ */
+esp_err_t ota_write(Update::Partition &partition, const Options &options,
+                    Result &result);
+
+/**
+ * @brief Times Work::submit() of one job until the job starts in ns, the
+ * workers idle in between. Call Work::start() first.
+ */
+esp_err_t work_latency(const Options &options, Result &result);
+
+/**
+ * @brief Measures running BENCH_WORK_BATCH small jobs on the workers in
+ * jobs/s, from the first submit to the last job's end. Call Work::start()
+ * first.
+ */
+esp_err_t work_throughput(const Options &options, Result &result);
+
+/**
+ * @brief Times xEventGroupSetBits() until the task waiting on the bit runs,
+ * in ns
+ */
+esp_err_t wake_event_group(const Options &options, Result &result);
+
+/**
+ * @brief Times Port::Notification::post() until the task waiting on it
+ * runs, in ns. Compare with wake_event_group().
+ */
+esp_err_t wake_notification(const Options &options, Result &result);
+
+/**
+ * @brief Times a wake that initialises NVS, opens it and reads
+ * BENCH_WAKE_KEYS values, in us. Call NVS.begin() first.
+ *
+ * A model for the native suite, with Host::nvs_set_init_us() and
+ * Host::nvs_set_read_us() standing in for the flash. On the device the
+ * partition is already initialised and cannot be again.
+ */
+esp_err_t wake_ready_nvs(const Options &options, Result &result);
+
+/**
+ * @brief Times the same wake through RtcMirror, restoring the mirror and
+ * reading the values from it, in us. Call NVS.begin() first.
+ */
+esp_err_t wake_ready_rtc(const Options &options, Result &result);
+
+}  // namespace Bench
+
+#endif
@@ -0,0 +1,276 @@
+#include "Boot.h"
+#include <stdio.h>
+#include "Metrics/Metrics.h"
+#include "Work/Work.h"
+#include "esp_log.h"
+
+namespace Boot {
+static const char *TAG = "Boot";
+
+static Stage *head = nullptr;
+static Stage *tail = nullptr;
+
+/* One run() at a time. The state lock guards the stages' scheduling
+ * fields, the stage functions run without it. */
+static Port::Mutex run_lock;
+static Port::Mutex state_lock;
+static Port::Signal finished;
+static uint32_t remaining = 0;
+static esp_err_t first_error = ESP_OK;
+
+static Metrics::Counter failures("boot.failures");
+static Metrics::Histogram stage_us("boot.stage_us");
+static Metrics::Gauge done_ms("boot.done_ms");
+
+struct Scheduler {
+  /* Queues 'stage' on the Work pool */
+  static void start(Stage *stage) {
+    stage->state_ = State::RUNNING;
+    if (Work::submit(execute, stage, Work::Priority::HIGH) != ESP_OK) {
+      finish(stage, State::FAILED, ESP_ERR_NO_MEM);
+    }
+  }
+
+  static void execute(void *arg) {
+    Stage *stage = static_cast<Stage *>(arg);
+    stage->core_ = Port::core();
+    stage->start_us_ = Port::micros();
+    esp_err_t result = stage->fn_();
+    uint64_t end = Port::micros();
+    stage_us.record(end - stage->start_us_);
+
+    Port::Lock lock(state_lock);
+    stage->end_us_ = end;
+    finish(stage, result == ESP_OK ? State::DONE : State::FAILED, result);
+  }
+
+  /* Records the outcome, then starts the stages that were waiting only on
+   * this one, or skips them if it did not finish */
+  static void finish(Stage *stage, State state, esp_err_t result) {
+    stage->state_ = state;
+    stage->result_ = result;
+    if (state == State::FAILED) {
+      failures.add();
+      ESP_LOGE(TAG, "Stage %s failed (%i)", stage->name_, result);
+      if (first_error == ESP_OK) {
+        first_error = result;
+      }
+    }
+    for (Stage *next = head; next != nullptr; next = next->next_) {
+      if (next->state_ != State::PENDING) {
+        continue;
+      }
+      bool waited = false;
+      for (uint8_t i = 0; i < next->deps_; i++) {
+        if (next->after_[i] == stage) {
+          waited = true;
+          next->waiting_--;
+        }
+      }
+      if (!waited) {
+        continue;
+      }
+      if (state != State::DONE) {
+        next->blocked_ = true;
+      }
+      if (next->waiting_ == 0) {
+        if (next->blocked_) {
+          finish(next, State::SKIPPED, ESP_ERR_INVALID_STATE);
+        } else {
+          start(next);
+        }
+      }
+    }
+    if (--remaining == 0) {
+      finished.give();
+    }
+  }
+
+  /* Marks the pending stages whose dependencies can all finish. The rest
+   * are in, or wait on, a cycle. */
+  static void mark_reachable() {
+    for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+      stage->mark_ = false;
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+        if (stage->state_ != State::PENDING || stage->mark_) {
+          continue;
+        }
+        bool reachable = true;
+        for (uint8_t i = 0; i < stage->deps_; i++) {
+          const Stage *dep = stage->after_[i];
+          if (dep->state_ == State::PENDING && !dep->mark_) {
+            reachable = false;
+          }
+        }
+        if (reachable) {
+          stage->mark_ = true;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  static esp_err_t run() {
+    Port::Lock serial(run_lock);
+    {
+      Port::Lock lock(state_lock);
+      first_error = ESP_OK;
+      remaining = 0;
+      mark_reachable();
+      for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+        if (stage->state_ != State::PENDING) {
+          continue;
+        }
+        remaining++;
+        stage->waiting_ = 0;
+        stage->blocked_ = false;
+        for (uint8_t i = 0; i < stage->deps_; i++) {
+          State dep = stage->after_[i]->state_;
+          if (dep == State::PENDING) {
+            stage->waiting_++;
+          } else if (dep != State::DONE) {
+            stage->blocked_ = true;
+          }
+        }
+      }
+      if (remaining == 0) {
+        return ESP_OK;
+      }
+
+      /* Stages may finish, and change state, while others are started */
+      for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+        if (stage->state_ != State::PENDING) {
+          continue;
+        }
+        if (stage->overflow_) {
+          finish(stage, State::FAILED, ESP_ERR_NO_MEM);
+        } else if (!stage->mark_) {
+          ESP_LOGE(TAG, "Stage %s is in a dependency cycle", stage->name_);
+          finish(stage, State::FAILED, ESP_ERR_INVALID_STATE);
+        } else if (stage->waiting_ == 0) {
+          if (stage->blocked_) {
+            finish(stage, State::SKIPPED, ESP_ERR_INVALID_STATE);
+          } else {
+            start(stage);
+          }
+        }
+      }
+    }
+    finished.take();
+    done_ms.set(Port::micros() / 1000);
+    Port::Lock lock(state_lock);
+    return first_error;
+  }
+
+  /* Earliest started stage not listed yet */
+  static Stage *next_started() {
+    Stage *best = nullptr;
+    for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+      if (stage->mark_ || stage->start_us_ == 0) {
+        continue;
+      }
+      if (best == nullptr || stage->start_us_ < best->start_us_) {
+        best = stage;
+      }
+    }
+    return best;
+  }
+
+  static void report() {
+    Port::Lock lock(state_lock);
+    for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+      stage->mark_ = false;
+    }
+    ESP_LOGI(TAG, "%-15s %4s %8s %8s %8s  %s", "stage", "core", "start_ms",
+             "end_ms", "took_ms", "result");
+    for (Stage *stage = next_started(); stage != nullptr;
+         stage = next_started()) {
+      stage->mark_ = true;
+      char result[16];
+      describe(stage, result, sizeof(result));
+      ESP_LOGI(TAG, "%-15.15s %4u %8u %8u %8u  %s", stage->name_,
+               (unsigned)stage->core_, (unsigned)(stage->start_us_ / 1000),
+               (unsigned)(stage->end_us_ / 1000),
+               (unsigned)((stage->end_us_ - stage->start_us_) / 1000),
+               result);
+    }
+    /* Then those that never started, in definition order */
+    for (Stage *stage = head; stage != nullptr; stage = stage->next_) {
+      if (stage->mark_) {
+        continue;
+      }
+      char result[16];
+      describe(stage, result, sizeof(result));
+      ESP_LOGI(TAG, "%-15.15s %4s %8s %8s %8s  %s", stage->name_, "-", "-",
+               "-", "-", result);
+    }
+    ESP_LOGI(TAG, "Boot done %u ms after reset", (unsigned)done_ms.value());
+  }
+
+  static void describe(const Stage *stage, char *out, size_t size) {
+    switch (stage->state_) {
+      case State::DONE:
+        snprintf(out, size, "ok");
+        break;
+      case State::FAILED:
+        snprintf(out, size, "failed (%i)", stage->result_);
+        break;
+      case State::SKIPPED:
+        snprintf(out, size, "skipped");
+        break;
+      default:
+        snprintf(out, size, "pending");
+        break;
+    }
+  }
+};
+}  // namespace Boot
+
+Boot::Stage::Stage(const char *name, Function fn,
+                   std::initializer_list<Stage *> after)
+    : name_(name),
+      fn_(fn),
+      deps_(0),
+      overflow_(false),
+      state_(State::PENDING),
+      result_(ESP_ERR_INVALID_STATE),
+      core_(0),
+      start_us_(0),
+      end_us_(0),
+      waiting_(0),
+      blocked_(false),
+      mark_(false),
+      next_(nullptr) {
+  for (Stage *stage : after) {
+    this->after(stage);
+  }
+  /* Appended, so the timeline lists unstarted stages in definition order */
+  if (tail == nullptr) {
+    head = this;
+  } else {
+    tail->next_ = this;
+  }
+  tail = this;
+}
+
+esp_err_t Boot::Stage::after(Stage *stage) {
+  if (state_ != State::PENDING) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (deps_ == BOOT_MAX_DEPS) {
+    overflow_ = true;
+    return ESP_ERR_NO_MEM;
+  }
+  after_[deps_++] = stage;
+  return ESP_OK;
+}
+
+Boot::Stage *Boot::first() { return head; }
+
+esp_err_t Boot::run() { return Scheduler::run(); }
+
+void Boot::report() { Scheduler::report(); }
@@ -0,0 +1,136 @@
+/**
+ * Boot orchestrator. Each init step is a Stage naming the stages it needs,
+ * and run() starts every stage as soon as those are done, so independent
+ * steps overlap on both cores:
+ *
+ *   static Boot::Stage nvs("nvs", init_nvs);
+ *   static Boot::Stage netif("netif", EasyWifi::init_hardware);
+ *   static Boot::Stage wifi("wifi.config", EasyWifi::configure,
+ *                           {&nvs, &netif});
+ *
+ *   Work::start();
+ *   Boot::run();
+ *   Boot::report();
+ *
+ * Stages register themselves when constructed, like metrics, and each runs
+ * once: a later run() only starts stages defined since. Stages run as HIGH
+ * priority jobs on the Work pool, so keep a stage to one step of init and
+ * call Work::start() first.
+ *
+ * A stage that fails skips the stages after it. report() prints the
+ * timeline, one row per stage with its core and times since reset.
+ */
+
+#ifndef __BOOT_H__
+#define __BOOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <initializer_list>
+#include "Port/Port.h"
+
+/* Stages one stage may wait for */
+#ifndef BOOT_MAX_DEPS
+#define BOOT_MAX_DEPS 4
+#endif
+
+namespace Boot {
+
+typedef esp_err_t (*Function)();
+
+enum class State : uint8_t {
+  PENDING, /*!< Not run yet */
+  RUNNING, /*!< Queued or running */
+  DONE,    /*!< Returned ESP_OK */
+  FAILED,  /*!< Returned an error, or is part of a dependency cycle */
+  SKIPPED, /*!< A stage it needs did not finish */
+};
+
+struct Scheduler;
+
+/**
+ * One step of init. Define stages at namespace scope, they register during
+ * static initialisation and are never unregistered.
+ */
+class Stage {
+ public:
+  /**
+   * @param name   For the timeline, kept by pointer
+   * @param fn     The step, returning ESP_OK on success
+   * @param after  Stages that must be done first, at most BOOT_MAX_DEPS
+   */
+  Stage(const char *name, Function fn,
+        std::initializer_list<Stage *> after = {});
+
+  /**
+   * @brief Adds a stage that must be done first, for stages defined in
+   * other files or out of order
+   *
+   * @return
+   *  - ESP_OK                The dependency is added
+   *  - ESP_ERR_NO_MEM        The stage already has BOOT_MAX_DEPS
+   *  - ESP_ERR_INVALID_STATE The stage has already run
+   */
+  esp_err_t after(Stage *stage);
+
+  const char *name() const { return name_; }
+  State state() const { return state_; }
+
+  /* What the step returned, ESP_ERR_INVALID_STATE when it did not run */
+  esp_err_t result() const { return result_; }
+
+  /* Core the step ran on, and its start and end in us since reset */
+  uint32_t core() const { return core_; }
+  uint64_t start_us() const { return start_us_; }
+  uint64_t end_us() const { return end_us_; }
+
+  /* Next registered stage, or nullptr */
+  Stage *next() const { return next_; }
+
+ private:
+  Stage(const Stage &) = delete;
+  Stage &operator=(const Stage &) = delete;
+  friend struct Scheduler;
+
+  const char *name_;
+  Function fn_;
+  Stage *after_[BOOT_MAX_DEPS];
+  uint8_t deps_;
+  bool overflow_;  // More dependencies than fit, the stage fails
+  State state_;
+  esp_err_t result_;
+  uint32_t core_;
+  uint64_t start_us_;
+  uint64_t end_us_;
+
+  /* Scheduling, under the scheduler's lock */
+  uint8_t waiting_;
+  bool blocked_;
+  bool mark_;
+  Stage *next_;
+};
+
+/**
+ * @brief Gets the first registered stage, stages follow in definition order
+ */
+Stage *first();
+
+/**
+ * @brief Runs every pending stage, each once the stages it needs are done,
+ * and blocks until all have finished
+ *
+ * @return
+ *  - ESP_OK                Every stage is done
+ *  - ESP_ERR_INVALID_STATE A dependency cycle, its stages do not run
+ *  - Other                 The error of the first stage that failed
+ */
+esp_err_t run();
+
+/**
+ * @brief Logs the boot timeline, one row per stage in start order
+ */
+void report();
+
+}  // namespace Boot
+
+#endif
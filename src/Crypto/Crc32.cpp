@@ -0,0 +1,33 @@
+#include "Crc32.h"
+
+namespace {
+struct Table {
+  uint32_t entries[256];
+
+  Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+/* Built on first use, so static constructors may call crc32() */
+const Table &table() {
+  static const Table instance;
+  return instance;
+}
+}  // namespace
+
+uint32_t crc32(const void *data, size_t size, uint32_t crc) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  const uint32_t *entries = table().entries;
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
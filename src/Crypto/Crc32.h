@@ -0,0 +1,19 @@
+/**
+ * CRC-32 as used by zlib and Ethernet, table driven. Frames data in flash
+ * and RTC memory against torn writes and bit rot, not against tampering.
+ */
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Computes the CRC-32 of 'data'
+ *
+ * @param crc  The CRC of the data before, to compute it in pieces
+ */
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,505 @@
+#include "Ed25519.h"
+#include <string.h>
+
+/* Field and group arithmetic follows TweetNaCl (public domain). Elements of
+ * GF(2^255 - 19) are 16 limbs of 16 bits. */
+
+namespace {
+
+typedef int64_t gf[16];
+
+const gf gf0 = {0};
+const gf gf1 = {1};
+const gf D = {0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070,
+              0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203};
+const gf D2 = {0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0,
+               0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406};
+const gf X = {0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c,
+              0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169};
+const gf Y = {0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666,
+              0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666};
+const gf I = {0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43,
+              0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83};
+
+/* The group order */
+const uint8_t L[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+                       0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+                       0,    0,    0,    0,    0,    0,    0,    0,
+                       0,    0,    0,    0,    0,    0,    0,    0x10};
+
+/* SHA-512, only used on short messages so kept local */
+class Sha512 {
+ public:
+  Sha512() : length_(0), used_(0) {
+    static const uint64_t H[8] = {
+        0x6a09e667f3bcc908ULL,
+        0xbb67ae8584caa73bULL,
+        0x3c6ef372fe94f82bULL,
+        0xa54ff53a5f1d36f1ULL,
+        0x510e527fade682d1ULL,
+        0x9b05688c2b3e6c1fULL,
+        0x1f83d9abfb41bd6bULL,
+        0x5be0cd19137e2179ULL,
+    };
+    memcpy(state_, H, sizeof(state_));
+  }
+
+  void update(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    length_ += size;
+    while (size > 0) {
+      size_t n = 128 - used_ < size ? 128 - used_ : size;
+      memcpy(block_ + used_, bytes, n);
+      used_ += n;
+      bytes += n;
+      size -= n;
+      if (used_ == 128) {
+        compress();
+        used_ = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t *digest) {
+    uint64_t bits = length_ * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used_ != 112) {
+      update(&pad, 1);
+    }
+    uint8_t len[16] = {0};
+    for (int i = 0; i < 8; i++) {
+      len[8 + i] = bits >> (56 - 8 * i);
+    }
+    update(len, 16);
+    for (int i = 0; i < 64; i++) {
+      digest[i] = state_[i / 8] >> (56 - 8 * (i % 8));
+    }
+  }
+
+ private:
+  static uint64_t rotr(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+  void compress() {
+    static const uint64_t K[80] = {
+        0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+        0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+        0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+        0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+        0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+        0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+        0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+        0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+        0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+        0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+        0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+        0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+        0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+        0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+        0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+        0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+        0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+        0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+        0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+        0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+        0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+        0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+        0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+        0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+        0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+        0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+        0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+        0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+        0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+        0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+        0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+        0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+        0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+        0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+        0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+        0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+        0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+        0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+        0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+        0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+    };
+    uint64_t w[80];
+    for (int i = 0; i < 16; i++) {
+      w[i] = 0;
+      for (int j = 0; j < 8; j++) {
+        w[i] = w[i] << 8 | block_[8 * i + j];
+      }
+    }
+    for (int i = 16; i < 80; i++) {
+      uint64_t s0 = rotr(w[i - 15], 1) ^ rotr(w[i - 15], 8) ^ (w[i - 15] >> 7);
+      uint64_t s1 = rotr(w[i - 2], 19) ^ rotr(w[i - 2], 61) ^ (w[i - 2] >> 6);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint64_t v[8];
+    memcpy(v, state_, sizeof(v));
+    for (int i = 0; i < 80; i++) {
+      uint64_t t1 = v[7] + (rotr(v[4], 14) ^ rotr(v[4], 18) ^ rotr(v[4], 41)) +
+                    ((v[4] & v[5]) ^ (~v[4] & v[6])) + K[i] + w[i];
+      uint64_t t2 = (rotr(v[0], 28) ^ rotr(v[0], 34) ^ rotr(v[0], 39)) +
+                    ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+      memmove(v + 1, v, 7 * sizeof(uint64_t));
+      v[4] += t1;
+      v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) {
+      state_[i] += v[i];
+    }
+  }
+
+  uint64_t state_[8];
+  uint64_t length_;
+  uint8_t block_[128];
+  size_t used_;
+};
+
+void set(gf r, const gf a) { memcpy(r, a, sizeof(gf)); }
+
+void carry(gf o) {
+  for (int i = 0; i < 16; i++) {
+    o[i] += (int64_t)1 << 16;
+    int64_t c = o[i] >> 16;
+    o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+    o[i] -= c * 65536;
+  }
+}
+
+/* Swaps p and q if b is 1, in constant time */
+void select(gf p, gf q, int b) {
+  int64_t c = ~(b - 1);
+  for (int i = 0; i < 16; i++) {
+    int64_t t = c & (p[i] ^ q[i]);
+    p[i] ^= t;
+    q[i] ^= t;
+  }
+}
+
+void pack(uint8_t *o, const gf n) {
+  gf m, t;
+  set(t, n);
+  carry(t);
+  carry(t);
+  carry(t);
+  for (int j = 0; j < 2; j++) {
+    m[0] = t[0] - 0xffed;
+    for (int i = 1; i < 15; i++) {
+      m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+      m[i - 1] &= 0xffff;
+    }
+    m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+    int b = (m[15] >> 16) & 1;
+    m[14] &= 0xffff;
+    select(t, m, 1 - b);
+  }
+  for (int i = 0; i < 16; i++) {
+    o[2 * i] = t[i] & 0xff;
+    o[2 * i + 1] = t[i] >> 8;
+  }
+}
+
+bool differ(const gf a, const gf b) {
+  uint8_t c[32], d[32];
+  pack(c, a);
+  pack(d, b);
+  return memcmp(c, d, 32) != 0;
+}
+
+uint8_t parity(const gf a) {
+  uint8_t d[32];
+  pack(d, a);
+  return d[0] & 1;
+}
+
+void unpack(gf o, const uint8_t *n) {
+  for (int i = 0; i < 16; i++) {
+    o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+  }
+  o[15] &= 0x7fff;
+}
+
+void add(gf o, const gf a, const gf b) {
+  for (int i = 0; i < 16; i++) {
+    o[i] = a[i] + b[i];
+  }
+}
+
+void sub(gf o, const gf a, const gf b) {
+  for (int i = 0; i < 16; i++) {
+    o[i] = a[i] - b[i];
+  }
+}
+
+void mul(gf o, const gf a, const gf b) {
+  int64_t t[31] = {0};
+  for (int i = 0; i < 16; i++) {
+    for (int j = 0; j < 16; j++) {
+      t[i + j] += a[i] * b[j];
+    }
+  }
+  for (int i = 0; i < 15; i++) {
+    t[i] += 38 * t[i + 16];
+  }
+  memcpy(o, t, sizeof(gf));
+  carry(o);
+  carry(o);
+}
+
+void square(gf o, const gf a) { mul(o, a, a); }
+
+void invert(gf o, const gf i) {
+  gf c;
+  set(c, i);
+  for (int a = 253; a >= 0; a--) {
+    square(c, c);
+    if (a != 2 && a != 4) {
+      mul(c, c, i);
+    }
+  }
+  set(o, c);
+}
+
+void pow2523(gf o, const gf i) {
+  gf c;
+  set(c, i);
+  for (int a = 250; a >= 0; a--) {
+    square(c, c);
+    if (a != 1) {
+      mul(c, c, i);
+    }
+  }
+  set(o, c);
+}
+
+/* Points are extended coordinates (X, Y, Z, T) */
+void point_add(gf p[4], gf q[4]) {
+  gf a, b, c, d, t, e, f, g, h;
+  sub(a, p[1], p[0]);
+  sub(t, q[1], q[0]);
+  mul(a, a, t);
+  add(b, p[0], p[1]);
+  add(t, q[0], q[1]);
+  mul(b, b, t);
+  mul(c, p[3], q[3]);
+  mul(c, c, D2);
+  mul(d, p[2], q[2]);
+  add(d, d, d);
+  sub(e, b, a);
+  sub(f, d, c);
+  add(g, d, c);
+  add(h, b, a);
+  mul(p[0], e, f);
+  mul(p[1], h, g);
+  mul(p[2], g, f);
+  mul(p[3], e, h);
+}
+
+void point_swap(gf p[4], gf q[4], uint8_t b) {
+  for (int i = 0; i < 4; i++) {
+    select(p[i], q[i], b);
+  }
+}
+
+void point_pack(uint8_t *r, gf p[4]) {
+  gf tx, ty, zi;
+  invert(zi, p[2]);
+  mul(tx, p[0], zi);
+  mul(ty, p[1], zi);
+  pack(r, ty);
+  r[31] ^= parity(tx) << 7;
+}
+
+void scalar_mult(gf p[4], gf q[4], const uint8_t *s) {
+  set(p[0], gf0);
+  set(p[1], gf1);
+  set(p[2], gf1);
+  set(p[3], gf0);
+  for (int i = 255; i >= 0; i--) {
+    uint8_t b = (s[i / 8] >> (i & 7)) & 1;
+    point_swap(p, q, b);
+    point_add(q, p);
+    point_add(p, p);
+    point_swap(p, q, b);
+  }
+}
+
+void scalar_base(gf p[4], const uint8_t *s) {
+  gf q[4];
+  set(q[0], X);
+  set(q[1], Y);
+  set(q[2], gf1);
+  mul(q[3], X, Y);
+  scalar_mult(p, q, s);
+}
+
+/* r = x mod L, x is 64 limbs of 8 bits */
+void mod_l(uint8_t *r, int64_t x[64]) {
+  int64_t c;
+  for (int i = 63; i >= 32; i--) {
+    c = 0;
+    int j;
+    for (j = i - 32; j < i - 12; j++) {
+      x[j] += c - 16 * x[i] * L[j - (i - 32)];
+      c = (x[j] + 128) >> 8;
+      x[j] -= c * 256;
+    }
+    x[j] += c;
+    x[i] = 0;
+  }
+  c = 0;
+  for (int j = 0; j < 32; j++) {
+    x[j] += c - (x[31] >> 4) * L[j];
+    c = x[j] >> 8;
+    x[j] &= 255;
+  }
+  for (int j = 0; j < 32; j++) {
+    x[j] -= c * L[j];
+  }
+  for (int i = 0; i < 32; i++) {
+    x[i + 1] += x[i] >> 8;
+    r[i] = x[i] & 255;
+  }
+}
+
+/* Reduces a 64 byte hash mod L into its first 32 bytes */
+void reduce(uint8_t *r) {
+  int64_t x[64];
+  for (int i = 0; i < 64; i++) {
+    x[i] = r[i];
+  }
+  memset(r, 0, 64);
+  mod_l(r, x);
+}
+
+/* Decodes a public key into -A, false if it is not a point */
+bool unpack_neg(gf r[4], const uint8_t *p) {
+  gf t, chk, num, den, den2, den4, den6;
+  set(r[2], gf1);
+  unpack(r[1], p);
+  square(num, r[1]);
+  mul(den, num, D);
+  sub(num, num, r[2]);
+  add(den, r[2], den);
+
+  square(den2, den);
+  square(den4, den2);
+  mul(den6, den4, den2);
+  mul(t, den6, num);
+  mul(t, t, den);
+
+  pow2523(t, t);
+  mul(t, t, num);
+  mul(t, t, den);
+  mul(t, t, den);
+  mul(r[0], t, den);
+
+  square(chk, r[0]);
+  mul(chk, chk, den);
+  if (differ(chk, num)) {
+    mul(r[0], r[0], I);
+  }
+  square(chk, r[0]);
+  mul(chk, chk, den);
+  if (differ(chk, num)) {
+    return false;
+  }
+
+  if (parity(r[0]) == (p[31] >> 7)) {
+    sub(r[0], gf0, r[0]);
+  }
+  mul(r[3], r[0], r[1]);
+  return true;
+}
+
+/* True if the little endian scalar s is below L */
+bool canonical(const uint8_t *s) {
+  for (int i = 31; i >= 0; i--) {
+    if (s[i] != L[i]) {
+      return s[i] < L[i];
+    }
+  }
+  return false;
+}
+
+/* Expands a seed into the clamped scalar and the nonce prefix */
+void expand(const uint8_t *seed, uint8_t *d) {
+  Sha512 hash;
+  hash.update(seed, ED25519_SEED_SIZE);
+  hash.finish(d);
+  d[0] &= 248;
+  d[31] &= 127;
+  d[31] |= 64;
+}
+
+}  // namespace
+
+bool Ed25519::verify(const uint8_t *signature, const void *message,
+                     size_t size, const uint8_t *public_key) {
+  gf p[4], q[4];
+  if (!canonical(signature + 32) || !unpack_neg(q, public_key)) {
+    return false;
+  }
+
+  uint8_t h[64];
+  Sha512 hash;
+  hash.update(signature, 32);
+  hash.update(public_key, ED25519_PUBLIC_KEY_SIZE);
+  hash.update(message, size);
+  hash.finish(h);
+  reduce(h);
+
+  /* R == [S]B - [h]A */
+  scalar_mult(p, q, h);
+  scalar_base(q, signature + 32);
+  point_add(p, q);
+  uint8_t r[32];
+  point_pack(r, p);
+  return memcmp(r, signature, 32) == 0;
+}
+
+void Ed25519::public_key(const uint8_t *seed, uint8_t *public_key) {
+  uint8_t d[64];
+  gf p[4];
+  expand(seed, d);
+  scalar_base(p, d);
+  point_pack(public_key, p);
+}
+
+void Ed25519::sign(const uint8_t *seed, const void *message, size_t size,
+                   uint8_t *signature) {
+  uint8_t d[64], r[64], h[64], pk[ED25519_PUBLIC_KEY_SIZE];
+  gf p[4];
+  expand(seed, d);
+  public_key(seed, pk);
+
+  Sha512 nonce;
+  nonce.update(d + 32, 32);
+  nonce.update(message, size);
+  nonce.finish(r);
+  reduce(r);
+  scalar_base(p, r);
+  point_pack(signature, p);
+
+  Sha512 hash;
+  hash.update(signature, 32);
+  hash.update(pk, sizeof(pk));
+  hash.update(message, size);
+  hash.finish(h);
+  reduce(h);
+
+  int64_t x[64] = {0};
+  for (int i = 0; i < 32; i++) {
+    x[i] = r[i];
+  }
+  for (int i = 0; i < 32; i++) {
+    for (int j = 0; j < 32; j++) {
+      x[i + j] += h[i] * (int64_t)d[j];
+    }
+  }
+  mod_l(signature + 32, x);
+}
@@ -0,0 +1,48 @@
+/**
+ * Ed25519 signatures (RFC 8032), used to authenticate firmware manifests.
+ * Portable, as mbedTLS on the device has no Ed25519. Verification takes a
+ * few tens of milliseconds on the ESP32, once per update.
+ *
+ * Signing is meant for host tools and tests, the device only verifies.
+ */
+
+#ifndef __ED25519_H__
+#define __ED25519_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ED25519_SEED_SIZE 32
+#define ED25519_PUBLIC_KEY_SIZE 32
+#define ED25519_SIGNATURE_SIZE 64
+
+namespace Ed25519 {
+
+/**
+ * @brief Checks 'signature' over 'message'
+ *
+ * @return true if the signature was made with the key for 'public_key'
+ */
+bool verify(const uint8_t *signature, const void *message, size_t size,
+            const uint8_t *public_key);
+
+/**
+ * @brief Derives the public key for a secret seed
+ *
+ * @param seed        ED25519_SEED_SIZE random bytes, the secret key
+ * @param public_key  Receives ED25519_PUBLIC_KEY_SIZE bytes
+ */
+void public_key(const uint8_t *seed, uint8_t *public_key);
+
+/**
+ * @brief Signs 'message'
+ *
+ * @param seed       The secret key
+ * @param signature  Receives ED25519_SIGNATURE_SIZE bytes
+ */
+void sign(const uint8_t *seed, const void *message, size_t size,
+          uint8_t *signature);
+
+}  // namespace Ed25519
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * Incremental SHA-256. Uses the hardware accelerated mbedTLS implementation
+ * on the device and a portable implementation natively.
+ */
+
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "mbedtls/sha256.h"
+#endif
+
+#define SHA256_DIGEST_SIZE 32
+
+class Sha256 {
+ public:
+  Sha256();
+  ~Sha256();
+  Sha256(const Sha256 &other);
+  Sha256 &operator=(const Sha256 &other);
+
+  /**
+   * @brief Discards any hashed data and starts a new digest
+   */
+  void reset();
+
+  void update(const void *data, size_t size);
+
+  /**
+   * @brief Writes the digest of everything passed to update(). The hash
+   * must be reset() before it is used again. Copy it first to take an
+   * intermediate digest and keep hashing.
+   *
+   * @param digest  SHA256_DIGEST_SIZE bytes
+   */
+  void finish(uint8_t *digest);
+
+  /**
+   * @brief Hashes a buffer in one call
+   */
+  static void digest(const void *data, size_t size, uint8_t *digest);
+
+ private:
+#ifdef ESP_PLATFORM
+  mbedtls_sha256_context ctx_;
+#else
+  void compress(const uint8_t *block);
+
+  uint32_t state_[8];
+  uint64_t length_;
+  uint8_t block_[64];
+  size_t used_;
+#endif
+};
+
+#endif
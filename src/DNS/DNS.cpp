@@ -1,24 +1,93 @@
 #include "DNS.h"
+#include "Mdns.h"
 
 namespace DNS {
 const char *TAG = "DNS";
-EventGroupHandle_t dns_event_group;
+
+/* Posted by dns_found_cb() to the one task inside resolve() */
+static Port::Notification dns_done;
+static Port::Mutex resolve_lock;
+
+static Metrics::Counter lookups("dns.lookups");
+static Metrics::Histogram resolve_us("dns.resolve_us");
+static Profile::Site wait_us("dns.wait_us");
+
+/* The shared querier, started by the first ".local" lookup if nothing
+ * started it before */
+static Mdns &local() {
+  Mdns &querier = mdns();
+  if (!querier.running()) {
+    querier.start();
+  }
+  return querier;
+}
 }  // namespace DNS
 
 esp_err_t DNS::resolve(const char *url, ip_addr_t *dest) {
-  ESP_LOGI(TAG, "Resolve URL: %s", url);
-  dns_event_group = xEventGroupCreate();
+  BLOGI(TAG, "Resolve URL: %s", url);
+  lookups.add();
+  Metrics::Timer timer(resolve_us);
+  if (is_local(url)) {
+    return local().resolve(url, dest);
+  }
 
-  /* Start DNS query, block until completion */
-  esp_err_t result = dns_gethostbyname(url, dest, dns_found_cb, NULL);
-  xEventGroupWaitBits(dns_event_group, DNS_DONE_BIT, pdTRUE, pdFALSE,
-                      portMAX_DELAY);
+  /* One query at a time, so the notification has a single waiter */
+  Port::Lock lock(resolve_lock);
+  dns_done.clear();
 
-  return result;
+  /* Start DNS query, block until completion unless the answer was cached */
+  err_t result = dns_gethostbyname(url, dest, dns_found_cb, dest);
+  if (result == ERR_OK) {
+    return ESP_OK;
+  } else if (result != ERR_INPROGRESS) {
+    ESP_LOGE(TAG, "Error (%i) resolving %s", result, url);
+    return ESP_ERR_INVALID_ARG;
+  }
+  Profile::Blocked blocked(wait_us);
+  uint32_t bits = dns_done.wait(DNS_DONE_BIT | DNS_FAILED_BIT);
+  return (bits & DNS_DONE_BIT) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static void query_found_cb(const char *name, const ip_addr_t *ipaddr,
+                           void *callback_arg) {
+  DNS::Query *query = static_cast<DNS::Query *>(callback_arg);
+  DNS::resolve_us.record(Port::micros() - query->start_us);
+  if (ipaddr == nullptr) {
+    BLOGI(DNS::TAG, "DNS not found: %s", name);
+    query->done(query, ESP_ERR_NOT_FOUND);
+    return;
+  }
+  BLOGI(DNS::TAG, "DNS found:" IPSTR, IP2STR(&ipaddr->u_addr.ip4));
+  query->addr = *ipaddr;
+  query->done(query, ESP_OK);
+}
+
+esp_err_t DNS::resolve_async(const char *url, Query *query) {
+  BLOGI(TAG, "Resolve URL: %s", url);
+  lookups.add();
+  if (is_local(url)) {
+    return local().resolve_async(url, query);
+  }
+  query->start_us = Port::micros();
+  err_t result = dns_gethostbyname(url, &query->addr, query_found_cb, query);
+  if (result == ERR_OK) {
+    resolve_us.record(Port::micros() - query->start_us);
+    query->done(query, ESP_OK);
+  } else if (result != ERR_INPROGRESS) {
+    ESP_LOGE(TAG, "Error (%i) resolving %s", result, url);
+    return ESP_ERR_INVALID_ARG;
+  }
+  return ESP_OK;
 }
 
 void DNS::dns_found_cb(const char *name, const ip_addr_t *ipaddr,
                        void *callback_arg) {
-  ESP_LOGI(TAG, "DNS found:" IPSTR, IP2STR(&ipaddr->u_addr.ip4));
-  xEventGroupSetBits(dns_event_group, DNS_DONE_BIT);
-}
\ No newline at end of file
+  if (ipaddr == nullptr) {
+    BLOGI(TAG, "DNS not found: %s", name);
+    dns_done.post(DNS_FAILED_BIT);
+    return;
+  }
+  BLOGI(TAG, "DNS found:" IPSTR, IP2STR(&ipaddr->u_addr.ip4));
+  *static_cast<ip_addr_t *>(callback_arg) = *ipaddr;
+  dns_done.post(DNS_DONE_BIT);
+}
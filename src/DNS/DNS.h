@@ -4,36 +4,73 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "Log/BinLog.h"
+#include "Metrics/Metrics.h"
+#include "Port/Port.h"
+#include "Profile/Profile.h"
 #include "esp_err.h"
-#include "esp_event.h"
-#include "esp_event_loop.h"
 #include "esp_log.h"
-#include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
 #include "lwip/dns.h"
-#include "lwip/inet.h"
 #include "lwip/ip4_addr.h"
 
 #define DNS_DONE_BIT 1
+#define DNS_FAILED_BIT 2
 
 namespace DNS {
 
 extern const char *TAG;
-extern EventGroupHandle_t dns_event_group;
 
 /*
- * @brief Resolve the IP address for a given domain using DNS
+ * @brief Resolve the IP address for a given domain using DNS. Lookups are
+ * serialised, cached answers return without waiting. Names under ".local"
+ * are resolved over multicast DNS instead, see Mdns.h.
  *
  * @param url   The target domain's URL
+ * @param dest  Receives the IP address for 'url'
  *
- * @return The IP address for 'url'
+ * @return
+ *  - ESP_OK                The address is in 'dest'
+ *  - ESP_ERR_NOT_FOUND     The name does not resolve
+ *  - ESP_ERR_INVALID_ARG   lwIP refused the name
+ *  - Else as Mdns::resolve() for ".local" names
  */
 esp_err_t resolve(const char *url, ip_addr_t *dest);
 
+struct Query;
+
+/* Called once a lookup finishes, with ESP_OK or ESP_ERR_NOT_FOUND */
+typedef void (*Callback)(Query *query, esp_err_t result);
+
+/**
+ * A lookup started by resolve_async(). Must stay alive until 'done' runs.
+ */
+struct Query {
+  ip_addr_t addr;  // The address, once 'done' ran with ESP_OK
+  Callback done;
+  void *arg;       // For the caller
+  uint64_t start_us;
+};
+
+/*
+ * @brief Starts resolving 'url' without blocking. 'query->done' runs on the
+ * lwIP task when the answer arrives, or before returning when it is cached.
+ * For ".local" names it runs on the mDNS task instead.
+ *
+ * @param url    The target domain's URL
+ * @param query  Holds the result, with 'done' and 'arg' set by the caller
+ *
+ * @return
+ *  - ESP_OK                The lookup started, 'done' will run
+ *  - ESP_ERR_INVALID_ARG   lwIP refused the name, 'done' will not run
+ *  - Else as Mdns::resolve_async() for ".local" names
+ */
+esp_err_t resolve_async(const char *url, Query *query);
+
 void dns_found_cb(const char *name, const ip_addr_t *ipaddr,
                   void *callback_arg);
 
 }  // namespace DNS
-#endif
\ No newline at end of file
+#endif
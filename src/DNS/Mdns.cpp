@@ -0,0 +1,526 @@
+#include "Mdns.h"
+#include <strings.h>
+
+/* Header flags */
+#define MDNS_FLAG_RESPONSE 0x8000
+#define MDNS_FLAG_AUTHORITATIVE 0x0400
+
+#define MDNS_TYPE_A 1
+#define MDNS_TYPE_ANY 255
+#define MDNS_CLASS_IN 1
+
+/* Top bit of the class, cache-flush in answers, unicast-response in
+ * questions */
+#define MDNS_CLASS_FLUSH 0x8000
+
+/* Compression pointers followed in one name before giving up */
+#define MDNS_MAX_POINTERS 16
+
+namespace DNS {
+static const char *MDNS_TAG = "mDNS";
+
+static Mdns shared;
+
+static Metrics::Counter queries("mdns.queries");
+static Metrics::Counter hits("mdns.hits");
+static Metrics::Counter records("mdns.records");
+static Metrics::Histogram mdns_resolve_us("mdns.resolve_us");
+
+static uint16_t get_be16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+static uint32_t get_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static uint8_t *put_be16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+  return p + 2;
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v) {
+  put_be16(p, v >> 16);
+  return put_be16(p + 2, v);
+}
+
+/* Writes 'name' as labels, nullptr if a label is empty or too long */
+static uint8_t *put_name(uint8_t *p, const char *name) {
+  while (*name != '\0') {
+    const char *dot = strchr(name, '.');
+    size_t len = dot != nullptr ? dot - name : strlen(name);
+    if (len == 0 || len > 63) {
+      return nullptr;
+    }
+    *p++ = len;
+    memcpy(p, name, len);
+    p += len;
+    name += dot != nullptr ? len + 1 : len;
+  }
+  *p++ = 0;
+  return p;
+}
+
+/**
+ * @brief Reads the name at 'offset', following compression pointers
+ *
+ * @return Offset after the name where it started, or 0 if it is malformed
+ * or longer than MDNS_MAX_NAME
+ */
+static size_t read_name(const uint8_t *packet, size_t size, size_t offset,
+                        char *out) {
+  size_t end = 0;
+  size_t len = 0;
+  int pointers = 0;
+  for (;;) {
+    if (offset >= size) {
+      return 0;
+    }
+    uint8_t label = packet[offset];
+    if (label == 0) {
+      offset++;
+      break;
+    }
+    if ((label & 0xc0) == 0xc0) {
+      if (offset + 1 >= size || ++pointers > MDNS_MAX_POINTERS) {
+        return 0;
+      }
+      if (end == 0) {
+        end = offset + 2;
+      }
+      offset = (label & 0x3f) << 8 | packet[offset + 1];
+      continue;
+    }
+    if ((label & 0xc0) != 0 || offset + 1 + label > size ||
+        len + (len > 0) + label > MDNS_MAX_NAME) {
+      return 0;
+    }
+    if (len > 0) {
+      out[len++] = '.';
+    }
+    memcpy(out + len, packet + offset + 1, label);
+    len += label;
+    offset += 1 + label;
+  }
+  out[len] = '\0';
+  return end != 0 ? end : offset;
+}
+
+static void to_ip(uint32_t addr, ip_addr_t *dest) {
+  memset(dest, 0, sizeof(*dest));
+  dest->type = IPADDR_TYPE_V4;
+  dest->u_addr.ip4.addr = htonl(addr);
+}
+
+static bool valid_name(const char *name) {
+  return name != nullptr && is_local(name) && strlen(name) <= MDNS_MAX_NAME;
+}
+
+/* Wakes the caller of resolve() */
+struct Waiter {
+  Port::Signal signal;
+  esp_err_t result;
+};
+
+static void wake(Query *query, esp_err_t result) {
+  Waiter *waiter = static_cast<Waiter *>(query->arg);
+  waiter->result = result;
+  waiter->signal.give();
+}
+}  // namespace DNS
+
+DNS::Mdns &DNS::mdns() { return shared; }
+
+bool DNS::is_local(const char *name) {
+  size_t len = strlen(name);
+  return len > 6 && strncasecmp(name + len - 6, ".local", 6) == 0;
+}
+
+DNS::Mdns::Mdns() : fd_(-1), running_(false), host_addr_(0) {
+  memset(cache_, 0, sizeof(cache_));
+  memset(pending_, 0, sizeof(pending_));
+  hostname_[0] = '\0';
+}
+
+DNS::Mdns::~Mdns() { stop(); }
+
+esp_err_t DNS::Mdns::start(const MdnsOptions &options) {
+  /* The listener takes the lock only once started */
+  Port::Lock lock(lock_);
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  options_ = options;
+  fd_ = Port::udp_multicast(options_.group, options_.port,
+                            options_.interface);
+  if (fd_ < 0) {
+    ESP_LOGE(MDNS_TAG, "Could not join the group");
+    return ESP_FAIL;
+  }
+  /* Wakes regularly to resend queries and notice stop() */
+  Port::set_timeout(fd_, MDNS_POLL_MS);
+  running_ = true;
+  esp_err_t err = runner_.start(task, this, "mdns", MDNS_TASK_STACK_SIZE,
+                                MDNS_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    running_ = false;
+    Port::close_socket(fd_);
+    fd_ = -1;
+  }
+  return err;
+}
+
+void DNS::Mdns::stop() {
+  if (!running_) {
+    return;
+  }
+  if (hostname_[0] != '\0') {
+    send_answer(0);
+  }
+  running_ = false;
+  runner_.join();
+  Port::close_socket(fd_);
+  fd_ = -1;
+
+  Query *left[MDNS_MAX_PENDING];
+  size_t count = 0;
+  {
+    Port::Lock lock(lock_);
+    for (Pending &pending : pending_) {
+      if (pending.query != nullptr) {
+        left[count++] = pending.query;
+        pending.query = nullptr;
+      }
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    finish(left[i], ESP_ERR_NOT_FOUND);
+  }
+}
+
+esp_err_t DNS::Mdns::set_hostname(const char *name, uint32_t addr) {
+  if (name != nullptr && !valid_name(name)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  /* The old name says goodbye */
+  if (hostname_[0] != '\0') {
+    send_answer(0);
+  }
+  {
+    Port::Lock lock(lock_);
+    if (name == nullptr) {
+      hostname_[0] = '\0';
+      return ESP_OK;
+    }
+    strcpy(hostname_, name);
+    host_addr_ = addr;
+  }
+  return send_answer(MDNS_HOST_TTL_S) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t DNS::Mdns::resolve(const char *name, ip_addr_t *dest) {
+  Waiter waiter;
+  Query query;
+  query.done = wake;
+  query.arg = &waiter;
+  esp_err_t err = resolve_async(name, &query);
+  if (err != ESP_OK) {
+    return err;
+  }
+  waiter.signal.take();
+  if (waiter.result == ESP_OK) {
+    *dest = query.addr;
+  }
+  return waiter.result;
+}
+
+esp_err_t DNS::Mdns::resolve_async(const char *name, Query *query) {
+  if (!valid_name(name)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  query->start_us = Port::micros();
+
+  bool hit = false;
+  {
+    Port::Lock lock(lock_);
+    Entry *entry = find(name, query->start_us);
+    if (entry != nullptr) {
+      hit = true;
+      to_ip(entry->addr, &query->addr);
+    } else {
+      Pending *slot = nullptr;
+      for (Pending &pending : pending_) {
+        if (pending.query == nullptr) {
+          slot = &pending;
+          break;
+        }
+      }
+      if (slot == nullptr) {
+        return ESP_ERR_NO_MEM;
+      }
+      strcpy(slot->name, name);
+      slot->query = query;
+      slot->resend_us = query->start_us + options_.retry_ms * 1000ull;
+      slot->deadline_us = query->start_us + options_.timeout_ms * 1000ull;
+    }
+  }
+
+  if (hit) {
+    hits.add();
+    finish(query, ESP_OK);
+  } else {
+    /* A lost query is sent again by the listener */
+    send_query(name);
+  }
+  return ESP_OK;
+}
+
+bool DNS::Mdns::lookup(const char *name, uint32_t *addr) {
+  Port::Lock lock(lock_);
+  Entry *entry = find(name, Port::micros());
+  if (entry == nullptr) {
+    return false;
+  }
+  *addr = entry->addr;
+  return true;
+}
+
+size_t DNS::Mdns::cached() {
+  Port::Lock lock(lock_);
+  uint64_t now = Port::micros();
+  size_t count = 0;
+  for (const Entry &entry : cache_) {
+    count += entry.expires_us > now;
+  }
+  return count;
+}
+
+void DNS::Mdns::flush() {
+  Port::Lock lock(lock_);
+  memset(cache_, 0, sizeof(cache_));
+}
+
+void DNS::Mdns::task(void *self) {
+  Mdns *mdns = static_cast<Mdns *>(self);
+  while (mdns->running_) {
+    uint32_t addr;
+    int n = Port::udp_receive(mdns->fd_, mdns->packet_,
+                              sizeof(mdns->packet_), &addr);
+    if (n > 0) {
+      mdns->receive(mdns->packet_, n);
+    }
+    mdns->expire(Port::micros());
+  }
+}
+
+void DNS::Mdns::receive(const uint8_t *packet, size_t size) {
+  if (size < 12) {
+    return;
+  }
+  if ((get_be16(packet + 2) & MDNS_FLAG_RESPONSE) == 0) {
+    answer(packet, size);
+    return;
+  }
+
+  /* Every A record of a response is worth keeping, asked for or not */
+  char name[MDNS_MAX_NAME + 1];
+  size_t offset = 12;
+  for (uint16_t i = get_be16(packet + 4); i > 0; i--) {
+    offset = read_name(packet, size, offset, name);
+    if (offset == 0 || offset + 4 > size) {
+      return;
+    }
+    offset += 4;
+  }
+  uint32_t count = (uint32_t)get_be16(packet + 6) + get_be16(packet + 8) +
+                   get_be16(packet + 10);
+  for (; count > 0; count--) {
+    offset = read_name(packet, size, offset, name);
+    if (offset == 0 || offset + 10 > size) {
+      return;
+    }
+    uint16_t type = get_be16(packet + offset);
+    uint16_t klass = get_be16(packet + offset + 2) & ~MDNS_CLASS_FLUSH;
+    uint32_t ttl_s = get_be32(packet + offset + 4);
+    uint16_t length = get_be16(packet + offset + 8);
+    offset += 10;
+    if (offset + length > size) {
+      return;
+    }
+    if (type == MDNS_TYPE_A && klass == MDNS_CLASS_IN && length == 4 &&
+        is_local(name)) {
+      store(name, get_be32(packet + offset), ttl_s);
+    }
+    offset += length;
+  }
+}
+
+void DNS::Mdns::answer(const uint8_t *packet, size_t size) {
+  {
+    Port::Lock lock(lock_);
+    if (hostname_[0] == '\0') {
+      return;
+    }
+  }
+  char name[MDNS_MAX_NAME + 1];
+  size_t offset = 12;
+  for (uint16_t i = get_be16(packet + 4); i > 0; i--) {
+    offset = read_name(packet, size, offset, name);
+    if (offset == 0 || offset + 4 > size) {
+      return;
+    }
+    uint16_t type = get_be16(packet + offset);
+    uint16_t klass = get_be16(packet + offset + 2) & ~MDNS_CLASS_FLUSH;
+    offset += 4;
+    if ((type == MDNS_TYPE_A || type == MDNS_TYPE_ANY) &&
+        klass == MDNS_CLASS_IN) {
+      bool ours;
+      {
+        Port::Lock lock(lock_);
+        ours = strcasecmp(name, hostname_) == 0;
+      }
+      if (ours) {
+        send_answer(MDNS_HOST_TTL_S);
+        return;
+      }
+    }
+  }
+}
+
+void DNS::Mdns::store(const char *name, uint32_t addr, uint32_t ttl_s) {
+  Query *answered[MDNS_MAX_PENDING];
+  size_t count = 0;
+  {
+    Port::Lock lock(lock_);
+    uint64_t now = Port::micros();
+    Entry *entry = nullptr;
+    for (Entry &candidate : cache_) {
+      if (candidate.expires_us != 0 &&
+          strcasecmp(candidate.name, name) == 0) {
+        entry = &candidate;
+        break;
+      }
+    }
+    if (ttl_s == 0) {
+      /* A goodbye */
+      if (entry != nullptr) {
+        entry->expires_us = 0;
+      }
+      return;
+    }
+    if (entry == nullptr) {
+      /* A free entry, or else the one closest to expiring */
+      entry = &cache_[0];
+      for (Entry &candidate : cache_) {
+        if (candidate.expires_us < entry->expires_us) {
+          entry = &candidate;
+        }
+      }
+      strcpy(entry->name, name);
+    }
+    entry->addr = addr;
+    entry->expires_us =
+        now + (uint64_t)(ttl_s < MDNS_MAX_TTL_S ? ttl_s : MDNS_MAX_TTL_S) *
+                  1000000;
+    records.add();
+
+    for (Pending &pending : pending_) {
+      if (pending.query != nullptr && strcasecmp(pending.name, name) == 0) {
+        to_ip(addr, &pending.query->addr);
+        answered[count++] = pending.query;
+        pending.query = nullptr;
+      }
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    finish(answered[i], ESP_OK);
+  }
+}
+
+bool DNS::Mdns::send_query(const char *name) {
+  uint8_t query[12 + MDNS_MAX_NAME + 2 + 4];
+  memset(query, 0, 12);
+  put_be16(query + 4, 1);
+  uint8_t *p = put_name(query + 12, name);
+  if (p == nullptr) {
+    return false;
+  }
+  p = put_be16(p, MDNS_TYPE_A);
+  p = put_be16(p, MDNS_CLASS_IN);
+  queries.add();
+  return Port::udp_send(fd_, options_.group, options_.port, query,
+                        p - query);
+}
+
+bool DNS::Mdns::send_answer(uint32_t ttl_s) {
+  uint8_t response[12 + MDNS_MAX_NAME + 2 + 14];
+  memset(response, 0, 12);
+  put_be16(response + 2, MDNS_FLAG_RESPONSE | MDNS_FLAG_AUTHORITATIVE);
+  put_be16(response + 6, 1);
+  uint8_t *p;
+  {
+    Port::Lock lock(lock_);
+    p = put_name(response + 12, hostname_);
+    if (p == nullptr) {
+      return false;
+    }
+    p = put_be16(p, MDNS_TYPE_A);
+    p = put_be16(p, MDNS_CLASS_IN | MDNS_CLASS_FLUSH);
+    p = put_be32(p, ttl_s);
+    p = put_be16(p, 4);
+    p = put_be32(p, host_addr_);
+  }
+  return Port::udp_send(fd_, options_.group, options_.port, response,
+                        p - response);
+}
+
+void DNS::Mdns::expire(uint64_t now) {
+  Query *expired[MDNS_MAX_PENDING];
+  char resend[MDNS_MAX_PENDING][MDNS_MAX_NAME + 1];
+  size_t count = 0;
+  size_t resends = 0;
+  {
+    Port::Lock lock(lock_);
+    for (Pending &pending : pending_) {
+      if (pending.query == nullptr) {
+        continue;
+      }
+      if (now >= pending.deadline_us) {
+        expired[count++] = pending.query;
+        pending.query = nullptr;
+      } else if (now >= pending.resend_us) {
+        pending.resend_us = now + options_.retry_ms * 1000ull;
+        strcpy(resend[resends++], pending.name);
+      }
+    }
+  }
+  for (size_t i = 0; i < resends; i++) {
+    send_query(resend[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    finish(expired[i], ESP_ERR_NOT_FOUND);
+  }
+}
+
+void DNS::Mdns::finish(Query *query, esp_err_t result) {
+  mdns_resolve_us.record(Port::micros() - query->start_us);
+  if (result != ESP_OK) {
+    BLOGI(MDNS_TAG, "Nobody answered");
+  }
+  query->done(query, result);
+}
+
+DNS::Mdns::Entry *DNS::Mdns::find(const char *name, uint64_t now) {
+  for (Entry &entry : cache_) {
+    if (entry.expires_us > now && strcasecmp(entry.name, name) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,183 @@
+/**
+ * Multicast DNS (RFC 6762) for names under ".local", which unicast DNS
+ * does not answer. DNS::resolve() and DNS::resolve_async() hand such names
+ * to the shared instance, see DNS::mdns().
+ *
+ * Every A record heard on the group is cached until its TTL runs out,
+ * whether it answers our query, someone else's, or is an announcement, so
+ * most lookups of LAN names are answered without sending anything. A miss
+ * sends a one-shot query, repeated every 'retry_ms' until 'timeout_ms'.
+ * A record with a TTL of 0 says goodbye and removes the name.
+ *
+ * With set_hostname() the node also answers queries for its own name and
+ * announces it. Only A records in the IN class are handled; the other
+ * records of a response are skipped.
+ */
+
+#ifndef __DNS_MDNS_H__
+#define __DNS_MDNS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "DNS.h"
+#include "Port/Port.h"
+#include "Port/Socket.h"
+
+/* 224.0.0.251 */
+#define MDNS_GROUP PORT_IPV4(224, 0, 0, 251)
+#define MDNS_PORT 5353
+
+/* Longest name, with the dots, without the terminator */
+#define MDNS_MAX_NAME 63
+#define MDNS_CACHE_SIZE 16
+
+/* Lookups waiting for an answer at once */
+#define MDNS_MAX_PENDING 4
+
+#define MDNS_RETRY_MS 250
+#define MDNS_TIMEOUT_MS 1000
+
+/* What we announce our own name with, RFC 6762 section 10 */
+#define MDNS_HOST_TTL_S 120
+
+/* Cached records live at most this long, whatever their TTL */
+#define MDNS_MAX_TTL_S 3600
+
+/* The largest datagram read, the RFC's limit without jumbo frames */
+#define MDNS_PACKET_SIZE 1500
+
+/* How often the listener looks at the pending lookups */
+#define MDNS_POLL_MS 20
+
+#define MDNS_TASK_STACK_SIZE 4096
+#define MDNS_TASK_PRIORITY 4
+
+namespace DNS {
+
+struct MdnsOptions {
+  uint32_t group = MDNS_GROUP;
+  uint16_t port = MDNS_PORT;
+  uint32_t interface = PORT_IPV4_ANY; /*!< Interface for the group */
+  uint32_t retry_ms = MDNS_RETRY_MS;
+  uint32_t timeout_ms = MDNS_TIMEOUT_MS;
+};
+
+class Mdns {
+ public:
+  Mdns();
+  ~Mdns();
+
+  /**
+   * @brief Joins the group and starts listening
+   *
+   * @return
+   *  - ESP_OK                Listening
+   *  - ESP_ERR_INVALID_STATE Already running
+   *  - ESP_FAIL              The group could not be joined
+   *  - Any error from starting the task
+   */
+  esp_err_t start(const MdnsOptions &options = MdnsOptions());
+
+  /**
+   * @brief Stops listening. Pending lookups finish with ESP_ERR_NOT_FOUND.
+   */
+  void stop();
+
+  bool running() const { return running_; }
+
+  /**
+   * @brief Answers queries for 'name' with 'addr', and announces it
+   *
+   * @param name  e.g. "sensor-3.local", nullptr to stop answering
+   * @param addr  IPv4 address in host byte order
+   *
+   * @return
+   *  - ESP_OK                Answering
+   *  - ESP_ERR_INVALID_ARG   Not a ".local" name, or too long
+   *  - ESP_ERR_INVALID_STATE Not running
+   */
+  esp_err_t set_hostname(const char *name, uint32_t addr);
+
+  /**
+   * @brief Resolves a ".local" name, from the cache or by asking the group
+   *
+   * @return
+   *  - ESP_OK                The address is in 'dest'
+   *  - ESP_ERR_NOT_FOUND     Nobody answered within 'timeout_ms'
+   *  - ESP_ERR_INVALID_ARG   Not a ".local" name, or too long
+   *  - ESP_ERR_INVALID_STATE Not running
+   *  - ESP_ERR_NO_MEM        MDNS_MAX_PENDING lookups are waiting
+   */
+  esp_err_t resolve(const char *name, ip_addr_t *dest);
+
+  /**
+   * @brief As resolve() without blocking. 'query->done' runs on the
+   * listener task when answered or timed out, or before returning when the
+   * name is cached. It does not run when an error is returned.
+   */
+  esp_err_t resolve_async(const char *name, Query *query);
+
+  /**
+   * @brief Looks a name up in the cache only
+   *
+   * @param addr  Receives the IPv4 address in host byte order
+   *
+   * @return true if cached and not expired
+   */
+  bool lookup(const char *name, uint32_t *addr);
+
+  /* Names cached and not expired */
+  size_t cached();
+
+  /* Forgets every cached name */
+  void flush();
+
+ private:
+  Mdns(const Mdns &) = delete;
+  Mdns &operator=(const Mdns &) = delete;
+
+  struct Entry {
+    char name[MDNS_MAX_NAME + 1];
+    uint32_t addr;
+    uint64_t expires_us; /*!< 0 for a free entry */
+  };
+
+  struct Pending {
+    char name[MDNS_MAX_NAME + 1];
+    Query *query;         /*!< nullptr for a free slot */
+    uint64_t resend_us;
+    uint64_t deadline_us;
+  };
+
+  static void task(void *self);
+  void receive(const uint8_t *packet, size_t size);
+  void answer(const uint8_t *packet, size_t size);
+  void store(const char *name, uint32_t addr, uint32_t ttl_s);
+  bool send_query(const char *name);
+  bool send_answer(uint32_t ttl_s);
+  void expire(uint64_t now);
+  void finish(Query *query, esp_err_t result);
+  Entry *find(const char *name, uint64_t now);
+
+  MdnsOptions options_;
+  int fd_;
+  std::atomic<bool> running_;
+  Port::Task runner_;
+  Port::Mutex lock_;
+  Entry cache_[MDNS_CACHE_SIZE];
+  Pending pending_[MDNS_MAX_PENDING];
+  char hostname_[MDNS_MAX_NAME + 1];
+  uint32_t host_addr_;
+  uint8_t packet_[MDNS_PACKET_SIZE];
+};
+
+/* The instance DNS::resolve() uses for ".local" names */
+Mdns &mdns();
+
+/* True if 'name' ends in ".local" */
+bool is_local(const char *name);
+
+}  // namespace DNS
+
+#endif
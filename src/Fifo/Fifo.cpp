@@ -0,0 +1,640 @@
+#include "Fifo.h"
+#include <stddef.h>
+#include <string.h>
+#include "Crypto/Crc32.h"
+#include "Metrics/Metrics.h"
+#include "esp_log.h"
+
+#define FIFO_MAGIC 0x31464946  // "FIF1"
+
+/* Record states, consuming only clears bits */
+#define FIFO_LIVE 0xFF
+#define FIFO_CONSUMED 0x00
+
+namespace Fifo {
+static const char *TAG = "Fifo";
+
+struct SectorHeader {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t crc;  // Of the above
+  uint32_t reserved;
+};
+
+struct RecordHeader {
+  uint16_t size;
+  uint8_t state;
+  uint8_t reserved;
+  uint32_t crc;  // Of the size and payload
+};
+
+static_assert(sizeof(SectorHeader) == 16, "Sector header layout");
+static_assert(sizeof(RecordHeader) == 8, "Record header layout");
+static_assert(FIFO_WRITE_BUFFER_SIZE >=
+                  sizeof(RecordHeader) + FIFO_MAX_RECORD_SIZE + 3,
+              "A record must fit the write buffer");
+
+static Metrics::Counter appends("fifo.appends");
+static Metrics::Counter consumed_records("fifo.drained");
+static Metrics::Counter drops("fifo.dropped");
+
+/* Flash taken by a record of 'size' */
+static size_t footprint(size_t size) {
+  return (sizeof(RecordHeader) + size + 3) & ~(size_t)3;
+}
+
+static uint32_t record_crc(const RecordHeader &header, const void *payload) {
+  return crc32(payload, header.size,
+               crc32(&header.size, sizeof(header.size)));
+}
+
+static bool blank(const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t address(size_t sector, size_t offset) {
+  return sector * FIFO_SECTOR_SIZE + offset;
+}
+}  // namespace Fifo
+
+Fifo::Queue::Queue(Update::Partition &partition, bool overwrite)
+    : partition_(partition),
+      overwrite_(overwrite),
+      opened_(false),
+      sectors_(0),
+      used_(0),
+      head_(0),
+      tail_(0),
+      tail_offset_(0),
+      head_closed_(false),
+      sequence_(0),
+      count_(0),
+      buffered_(0) {
+  memset(ends_, 0, sizeof(ends_));
+  memset(live_, 0, sizeof(live_));
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+esp_err_t Fifo::Queue::open() {
+  Port::Lock guard(lock_);
+  opened_ = false;
+  sectors_ = partition_.size() / FIFO_SECTOR_SIZE;
+  if (sectors_ > FIFO_MAX_SECTORS) {
+    sectors_ = FIFO_MAX_SECTORS;
+  }
+  if (sectors_ < 2) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  used_ = 0;
+  head_ = sectors_ - 1;
+  head_closed_ = false;
+  sequence_ = 0;
+  count_ = 0;
+  buffered_ = 0;
+  memset(ends_, 0, sizeof(ends_));
+  memset(live_, 0, sizeof(live_));
+
+  /* The newest sector is the head */
+  uint32_t sequences[FIFO_MAX_SECTORS];
+  bool valid[FIFO_MAX_SECTORS];
+  for (size_t s = 0; s < sectors_; s++) {
+    SectorHeader header;
+    esp_err_t err = partition_.read(address(s, 0), &header, sizeof(header));
+    if (err != ESP_OK) {
+      return err;
+    }
+    valid[s] = header.magic == FIFO_MAGIC &&
+               header.crc == crc32(&header, offsetof(SectorHeader, crc));
+    sequences[s] = header.sequence;
+    if (valid[s]) {
+      if (used_ == 0 || (int32_t)(header.sequence - sequence_) > 0) {
+        head_ = s;
+        sequence_ = header.sequence;
+      }
+      used_ = 1;
+    } else if (!blank(&header, sizeof(header))) {
+      ESP_LOGW(TAG, "Sector %u damaged, erasing", (unsigned)s);
+      err = partition_.erase(address(s, 0), FIFO_SECTOR_SIZE);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+  }
+
+  /* Back from the head while the sequence counts down, sectors are opened
+   * in ring order */
+  tail_ = head_;
+  while (used_ > 0 && used_ < sectors_) {
+    size_t prev = (tail_ + sectors_ - 1) % sectors_;
+    if (!valid[prev] || sequences[prev] != sequences[tail_] - 1) {
+      break;
+    }
+    tail_ = prev;
+    used_++;
+  }
+  for (size_t i = 0; i < sectors_; i++) {
+    size_t s = (tail_ + i) % sectors_;
+    esp_err_t err = ESP_OK;
+    if (i < used_) {
+      err = recover(s, s == head_);
+    } else if (valid[s]) {
+      /* Left behind by an interrupted clear() */
+      err = partition_.erase(address(s, 0), FIFO_SECTOR_SIZE);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  sequence_++;
+
+  tail_offset_ = sizeof(SectorHeader);
+  esp_err_t err = settle();
+  opened_ = err == ESP_OK;
+  return err;
+}
+
+esp_err_t Fifo::Queue::push(const void *data, size_t size) {
+  Record record = {data, size};
+  return push(&record, 1);
+}
+
+esp_err_t Fifo::Queue::push(const Record *records, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (records[i].size > FIFO_MAX_RECORD_SIZE) {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  Port::Lock guard(lock_);
+  if (!opened_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!overwrite_ && !fits(records, count)) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  buffered_ = 0;
+  size_t pending = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t size = footprint(records[i].size);
+    esp_err_t err = ESP_OK;
+    if (used_ == 0 || head_closed_ ||
+        ends_[head_] + buffered_ + size > FIFO_SECTOR_SIZE) {
+      err = flush(pending);
+      if (err == ESP_OK) {
+        err = open_sector();
+      }
+      pending = 0;
+    } else if (buffered_ + size > sizeof(buffer_)) {
+      err = flush(pending);
+      pending = 0;
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+
+    RecordHeader header;
+    header.size = records[i].size;
+    header.state = FIFO_LIVE;
+    header.reserved = 0xFF;
+    header.crc = record_crc(header, records[i].data);
+    uint8_t *dest = buffer_ + buffered_;
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), records[i].data, records[i].size);
+    /* Padding is left erased */
+    memset(dest + sizeof(header) + records[i].size, 0xFF,
+           size - sizeof(header) - records[i].size);
+    buffered_ += size;
+    pending++;
+  }
+  return flush(pending);
+}
+
+esp_err_t Fifo::Queue::peek(void *dest, size_t capacity, size_t *size) {
+  Port::Lock guard(lock_);
+  if (!opened_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (count_ > 0) {
+    bool live;
+    size_t next;
+    esp_err_t err =
+        read_record(tail_, tail_offset_, static_cast<uint8_t *>(dest),
+                    capacity, size, &live, &next);
+    if (err != ESP_ERR_INVALID_CRC) {
+      return err;
+    }
+    err = discard_tail();
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t Fifo::Queue::pop(size_t count) {
+  Port::Lock guard(lock_);
+  if (!opened_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return consume(count);
+}
+
+esp_err_t Fifo::Queue::drain(Consumer consumer, void *arg, size_t max,
+                             size_t *drained) {
+  *drained = 0;
+  Port::Lock guard(lock_);
+  if (!opened_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  /* The records of the tail sector are handed over, then consumed at once.
+   * The write buffer is free while the lock is held. */
+  esp_err_t err = ESP_OK;
+  bool stop = false;
+  while (err == ESP_OK && !stop && *drained < max && count_ > 0) {
+    size_t offset = tail_offset_;
+    size_t taken = 0;
+    while (*drained + taken < max && taken < live_[tail_]) {
+      size_t size, next;
+      bool live;
+      err = read_record(tail_, offset, buffer_, sizeof(buffer_), &size, &live,
+                        &next);
+      if (err != ESP_OK) {
+        break;
+      }
+      offset = next;
+      if (!live) {
+        continue;
+      }
+      if (!consumer(buffer_, size, arg)) {
+        stop = true;
+        break;
+      }
+      taken++;
+    }
+
+    esp_err_t consumed = consume(taken);
+    *drained += taken;
+    if (consumed != ESP_OK) {
+      return consumed;
+    }
+    if (err == ESP_ERR_INVALID_CRC) {
+      /* The bad record is at the tail now */
+      err = discard_tail();
+    }
+  }
+  return err;
+}
+
+esp_err_t Fifo::Queue::clear() {
+  Port::Lock guard(lock_);
+  if (!opened_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (used_ > 0) {
+    esp_err_t err = free_tail();
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+size_t Fifo::Queue::size() {
+  Port::Lock guard(lock_);
+  return count_;
+}
+
+size_t Fifo::Queue::used() {
+  Port::Lock guard(lock_);
+  return used_;
+}
+
+Fifo::Stats Fifo::Queue::stats() {
+  Port::Lock guard(lock_);
+  return stats_;
+}
+
+/* Walks the records of a sector to find its end and unconsumed records.
+ * Only the head can end in a torn write, it is closed to further appends. */
+esp_err_t Fifo::Queue::recover(size_t sector, bool head) {
+  size_t offset = sizeof(SectorHeader);
+  uint16_t live = 0;
+  bool torn = false;
+  while (offset + sizeof(RecordHeader) <= FIFO_SECTOR_SIZE) {
+    RecordHeader header;
+    esp_err_t err =
+        partition_.read(address(sector, offset), &header, sizeof(header));
+    if (err != ESP_OK) {
+      return err;
+    }
+    if (blank(&header, sizeof(header))) {
+      break;
+    }
+    size_t next = offset + footprint(header.size);
+    if (header.size > FIFO_MAX_RECORD_SIZE || next > FIFO_SECTOR_SIZE) {
+      torn = true;
+      break;
+    }
+    err = partition_.read(address(sector, offset + sizeof(header)), buffer_,
+                          header.size);
+    if (err != ESP_OK) {
+      return err;
+    }
+    if (header.crc != record_crc(header, buffer_)) {
+      torn = true;
+      break;
+    }
+    if (header.state == FIFO_LIVE) {
+      live++;
+    }
+    offset = next;
+  }
+
+  /* Appends go after the last record, so the rest must be erased */
+  for (size_t at = offset; head && !torn && at < FIFO_SECTOR_SIZE;
+       at += sizeof(buffer_)) {
+    size_t size = FIFO_SECTOR_SIZE - at < sizeof(buffer_)
+                      ? FIFO_SECTOR_SIZE - at
+                      : sizeof(buffer_);
+    esp_err_t err = partition_.read(address(sector, at), buffer_, size);
+    if (err != ESP_OK) {
+      return err;
+    }
+    torn = !blank(buffer_, size);
+  }
+
+  if (torn && head) {
+    ESP_LOGW(TAG, "Write to sector %u cut short at %u", (unsigned)sector,
+             (unsigned)offset);
+    stats_.corrupt++;
+    head_closed_ = true;
+  }
+  ends_[sector] = offset;
+  live_[sector] = live;
+  count_ += live;
+  return ESP_OK;
+}
+
+/* Call with 'lock_' held and the write buffer flushed */
+esp_err_t Fifo::Queue::open_sector() {
+  bool closed = head_closed_;
+  if (used_ > 0) {
+    /* An emptied head is freed rather than followed */
+    head_closed_ = true;
+    esp_err_t err = settle();
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  if (used_ == sectors_) {
+    if (!overwrite_) {
+      head_closed_ = closed;
+      return ESP_ERR_NO_MEM;
+    }
+    stats_.dropped += live_[tail_];
+    drops.add(live_[tail_]);
+    esp_err_t err = free_tail();
+    if (err == ESP_OK) {
+      err = settle();
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+
+  /* Erased when freed, unless a reset cut the erase short */
+  size_t next = (head_ + 1) % sectors_;
+  for (size_t at = 0; at < FIFO_SECTOR_SIZE; at += sizeof(buffer_)) {
+    esp_err_t err = partition_.read(address(next, at), buffer_,
+                                    sizeof(buffer_));
+    if (err == ESP_OK && !blank(buffer_, sizeof(buffer_))) {
+      err = partition_.erase(address(next, 0), FIFO_SECTOR_SIZE);
+      at = FIFO_SECTOR_SIZE;
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+
+  SectorHeader header;
+  header.magic = FIFO_MAGIC;
+  header.sequence = sequence_++;
+  header.crc = crc32(&header, offsetof(SectorHeader, crc));
+  header.reserved = 0xFFFFFFFF;
+  esp_err_t err = partition_.write(address(next, 0), &header, sizeof(header));
+  if (err != ESP_OK) {
+    return err;
+  }
+  head_ = next;
+  head_closed_ = false;
+  ends_[next] = sizeof(SectorHeader);
+  live_[next] = 0;
+  if (used_++ == 0) {
+    tail_ = next;
+    tail_offset_ = sizeof(SectorHeader);
+  }
+  return ESP_OK;
+}
+
+/* Call with 'lock_' held */
+esp_err_t Fifo::Queue::free_tail() {
+  esp_err_t err = partition_.erase(address(tail_, 0), FIFO_SECTOR_SIZE);
+  if (err != ESP_OK) {
+    return err;
+  }
+  count_ -= live_[tail_];
+  live_[tail_] = 0;
+  ends_[tail_] = 0;
+  if (--used_ > 0) {
+    tail_ = (tail_ + 1) % sectors_;
+  }
+  tail_offset_ = sizeof(SectorHeader);
+  return ESP_OK;
+}
+
+/* Moves the tail to the oldest unconsumed record, freeing emptied sectors.
+ * Call with 'lock_' held. */
+esp_err_t Fifo::Queue::settle() {
+  while (used_ > 0) {
+    if (live_[tail_] == 0) {
+      if (!erasable(tail_)) {
+        tail_offset_ = ends_[tail_];
+        return ESP_OK;
+      }
+      esp_err_t err = free_tail();
+      if (err != ESP_OK) {
+        return err;
+      }
+      continue;
+    }
+
+    RecordHeader header;
+    size_t next = tail_offset_ + footprint(0);
+    esp_err_t err = ESP_OK;
+    if (next <= ends_[tail_]) {
+      err = partition_.read(address(tail_, tail_offset_), &header,
+                            sizeof(header));
+      next = tail_offset_ + footprint(header.size);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+    if (next > ends_[tail_]) {
+      err = discard_tail();
+      if (err != ESP_OK) {
+        return err;
+      }
+      continue;
+    }
+    if (header.state == FIFO_LIVE) {
+      return ESP_OK;
+    }
+    tail_offset_ = next;
+  }
+  return ESP_OK;
+}
+
+/* Call with 'lock_' held */
+esp_err_t Fifo::Queue::consume(size_t count) {
+  size_t done = 0;
+  esp_err_t err = ESP_OK;
+  while (err == ESP_OK && done < count && count_ > 0) {
+    size_t live = live_[tail_];
+    if (count - done >= live && erasable(tail_)) {
+      err = free_tail();
+      if (err == ESP_OK) {
+        done += live;
+      }
+    } else {
+      /* Part of a sector, or the head still taking appends */
+      while (err == ESP_OK && done < count && live_[tail_] > 0) {
+        RecordHeader header;
+        err = partition_.read(address(tail_, tail_offset_), &header,
+                              sizeof(header));
+        if (err != ESP_OK) {
+          break;
+        }
+        if (header.state == FIFO_LIVE) {
+          uint8_t state = FIFO_CONSUMED;
+          err = partition_.write(
+              address(tail_, tail_offset_ + offsetof(RecordHeader, state)),
+              &state, sizeof(state));
+          if (err == ESP_OK) {
+            live_[tail_]--;
+            count_--;
+            done++;
+          }
+        }
+        tail_offset_ += footprint(header.size);
+        if (tail_offset_ > ends_[tail_]) {
+          break;
+        }
+      }
+    }
+    if (err == ESP_OK) {
+      err = settle();
+    }
+  }
+  stats_.consumed += done;
+  consumed_records.add(done);
+  return err;
+}
+
+/* Drops the records from the tail to the end of its sector after a bad one.
+ * Call with 'lock_' held. */
+esp_err_t Fifo::Queue::discard_tail() {
+  ESP_LOGW(TAG, "Bad record in sector %u at %u, dropping %u",
+           (unsigned)tail_, (unsigned)tail_offset_, (unsigned)live_[tail_]);
+  stats_.corrupt += live_[tail_];
+  count_ -= live_[tail_];
+  live_[tail_] = 0;
+  ends_[tail_] = tail_offset_;
+  if (tail_ == head_) {
+    head_closed_ = true;
+  }
+  return settle();
+}
+
+/* Reads the record at 'offset' of 'sector', its payload only if it is
+ * unconsumed. Call with 'lock_' held. */
+esp_err_t Fifo::Queue::read_record(size_t sector, size_t offset,
+                                   uint8_t *dest, size_t capacity,
+                                   size_t *size, bool *live, size_t *next) {
+  if (offset + sizeof(RecordHeader) > ends_[sector]) {
+    return ESP_ERR_INVALID_CRC;
+  }
+  RecordHeader header;
+  esp_err_t err =
+      partition_.read(address(sector, offset), &header, sizeof(header));
+  if (err != ESP_OK) {
+    return err;
+  }
+  *next = offset + footprint(header.size);
+  if (header.size > FIFO_MAX_RECORD_SIZE || *next > ends_[sector]) {
+    return ESP_ERR_INVALID_CRC;
+  }
+  *size = header.size;
+  *live = header.state == FIFO_LIVE;
+  if (!*live) {
+    return ESP_OK;
+  }
+  if (header.size > capacity) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  err = partition_.read(address(sector, offset + sizeof(header)), dest,
+                        header.size);
+  if (err != ESP_OK) {
+    return err;
+  }
+  return header.crc == record_crc(header, dest) ? ESP_OK
+                                                : ESP_ERR_INVALID_CRC;
+}
+
+/* Writes the gathered records after the head's last. Call with 'lock_'
+ * held. */
+esp_err_t Fifo::Queue::flush(size_t records) {
+  if (buffered_ == 0) {
+    return ESP_OK;
+  }
+  esp_err_t err =
+      partition_.write(address(head_, ends_[head_]), buffer_, buffered_);
+  size_t size = buffered_;
+  buffered_ = 0;
+  if (err != ESP_OK) {
+    /* Perhaps partly written, recovery would cut the sector there */
+    head_closed_ = true;
+    return err;
+  }
+  ends_[head_] += size;
+  live_[head_] += records;
+  count_ += records;
+  stats_.appended += records;
+  appends.add(records);
+  return ESP_OK;
+}
+
+/* Whether 'records' fit the free space, without dropping any. Call with
+ * 'lock_' held. */
+bool Fifo::Queue::fits(const Record *records, size_t count) const {
+  size_t offset = used_ == 0 || head_closed_ ? FIFO_SECTOR_SIZE : ends_[head_];
+  size_t free = sectors_ - used_;
+  for (size_t i = 0; i < count; i++) {
+    size_t size = footprint(records[i].size);
+    if (offset + size > FIFO_SECTOR_SIZE) {
+      if (free == 0) {
+        return false;
+      }
+      free--;
+      offset = sizeof(SectorHeader);
+    }
+    offset += size;
+  }
+  return true;
+}
@@ -0,0 +1,194 @@
+/**
+ * Persistent FIFO of records on a data partition of its own, so readings
+ * taken while offline survive a reset and are sent in order once the
+ * network is back:
+ *
+ *   Fifo::Queue queue(partition);
+ *   queue.open();
+ *   queue.push(&reading, sizeof(reading));
+ *   ...
+ *   queue.drain(send, &client, 64, &sent);
+ *
+ * The partition is a ring of 4 KiB sectors, each starting with a header
+ * holding a sequence number. Records are appended after it, framed by a
+ * header with their size and CRC-32, padded to 4 bytes and never split
+ * across sectors:
+ *
+ *   sector: "FIF1", u32 sequence, u32 CRC of the two, u32 reserved
+ *   record: u16 size, u8 state, u8 reserved, u32 CRC of size and payload
+ *
+ * Nothing else is kept in flash. open() finds the oldest and newest sectors
+ * by their sequence, and the write position at the first blank record
+ * header of the newest. A record cut short by a reset fails its CRC and
+ * closes its sector. Consumed records are cleared in their state byte, or
+ * their whole sector is erased once none is left, so a reset while
+ * consuming may deliver a record again but never loses one.
+ */
+
+#ifndef __FIFO_H__
+#define __FIFO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+#include "Update/Partition.h"
+
+#define FIFO_SECTOR_SIZE OTA_SECTOR_SIZE
+
+/* Sectors used, from the start of the partition */
+#ifndef FIFO_MAX_SECTORS
+#define FIFO_MAX_SECTORS 32
+#endif
+
+#ifndef FIFO_MAX_RECORD_SIZE
+#define FIFO_MAX_RECORD_SIZE 512
+#endif
+
+/* Appends are gathered here and written once per batch */
+#ifndef FIFO_WRITE_BUFFER_SIZE
+#define FIFO_WRITE_BUFFER_SIZE 1024
+#endif
+
+/* Label of the data partition in partitions.csv */
+#define FIFO_PARTITION_LABEL "fifo"
+
+namespace Fifo {
+
+struct Record {
+  const void *data;
+  size_t size;
+};
+
+/**
+ * @brief Takes one record from drain()
+ *
+ * @return false to stop, leaving this record queued
+ */
+typedef bool (*Consumer)(const uint8_t *data, size_t size, void *arg);
+
+struct Stats {
+  uint32_t appended;
+  uint32_t consumed;
+  uint32_t dropped;  /*!< Overwritten while the queue was full */
+  uint32_t corrupt;  /*!< Lost to a torn write or a bad CRC */
+};
+
+class Queue {
+ public:
+  /**
+   * @param overwrite  When full, drop the oldest sector of records instead
+   *                   of refusing new ones
+   */
+  explicit Queue(Update::Partition &partition, bool overwrite = false);
+
+  /**
+   * @brief Recovers the queue left in the partition. Call before anything
+   * else, and again to reread the partition.
+   *
+   * @return
+   *  - ESP_OK                The queue is ready, perhaps empty
+   *  - ESP_ERR_INVALID_SIZE  The partition is under two sectors
+   *  - Else the partition error
+   */
+  esp_err_t open();
+
+  /**
+   * @brief Appends one record
+   *
+   * @return
+   *  - ESP_OK                Written to flash
+   *  - ESP_ERR_INVALID_ARG   Over FIFO_MAX_RECORD_SIZE
+   *  - ESP_ERR_NO_MEM        Full, without 'overwrite'
+   *  - ESP_ERR_INVALID_STATE Not open
+   *  - Else the partition error
+   */
+  esp_err_t push(const void *data, size_t size);
+
+  /**
+   * @brief Appends several records, with one flash write per
+   * FIFO_WRITE_BUFFER_SIZE rather than per record. Without 'overwrite',
+   * either all of them are queued or none is.
+   *
+   * @return As push()
+   */
+  esp_err_t push(const Record *records, size_t count);
+
+  /**
+   * @brief Reads the oldest record without consuming it
+   *
+   * @param size  Set to the record size
+   *
+   * @return
+   *  - ESP_OK                The record is in 'dest'
+   *  - ESP_ERR_NOT_FOUND     The queue is empty
+   *  - ESP_ERR_INVALID_SIZE  It does not fit 'capacity'
+   *  - Else the partition error
+   */
+  esp_err_t peek(void *dest, size_t capacity, size_t *size);
+
+  /**
+   * @brief Consumes up to 'count' of the oldest records
+   */
+  esp_err_t pop(size_t count = 1);
+
+  /**
+   * @brief Hands up to 'max' records to 'consumer', oldest first, then
+   * consumes those it took. Whole sectors are erased rather than cleared
+   * record by record.
+   *
+   * @param drained  Set to the number consumed
+   */
+  esp_err_t drain(Consumer consumer, void *arg, size_t max, size_t *drained);
+
+  /**
+   * @brief Erases every record
+   */
+  esp_err_t clear();
+
+  /* Records queued */
+  size_t size();
+
+  /* Sectors holding records, of sectors() */
+  size_t used();
+  size_t sectors() const { return sectors_; }
+
+  Stats stats();
+
+ private:
+  esp_err_t recover(size_t sector, bool head);
+  esp_err_t open_sector();
+  esp_err_t free_tail();
+  esp_err_t settle();
+  esp_err_t consume(size_t count);
+  esp_err_t discard_tail();
+  esp_err_t read_record(size_t sector, size_t offset, uint8_t *dest,
+                        size_t capacity, size_t *size, bool *live,
+                        size_t *next);
+  esp_err_t flush(size_t records);
+  bool fits(const Record *records, size_t count) const;
+  bool erasable(size_t sector) const {
+    return sector != head_ || head_closed_;
+  }
+
+  Update::Partition &partition_;
+  bool overwrite_;
+  bool opened_;
+  size_t sectors_;
+  size_t used_;
+  size_t head_;
+  size_t tail_;
+  size_t tail_offset_;
+  bool head_closed_;
+  uint32_t sequence_;
+  size_t count_;
+  uint16_t ends_[FIFO_MAX_SECTORS];  // End of the records of each sector
+  uint16_t live_[FIFO_MAX_SECTORS];  // Unconsumed records of each sector
+  uint8_t buffer_[FIFO_WRITE_BUFFER_SIZE];
+  size_t buffered_;
+  Stats stats_;
+  Port::Mutex lock_;
+};
+
+}  // namespace Fifo
+
+#endif
@@ -0,0 +1,116 @@
+#include "Compressor.h"
+#include <algorithm>
+#include <vector>
+#include "Crypto/Sha256.h"
+#include "Update/Compressed.h"
+
+/* Candidates tried per position */
+#define COMPRESS_CHAIN_DEPTH 128
+
+namespace {
+
+/* Packs bits most significant first */
+class BitWriter {
+ public:
+  explicit BitWriter(std::string &out) : out_(out), byte_(0), used_(0) {}
+
+  void put(uint32_t value, uint8_t bits) {
+    while (bits > 0) {
+      bits--;
+      byte_ = byte_ << 1 | ((value >> bits) & 1);
+      if (++used_ == 8) {
+        out_.push_back(static_cast<char>(byte_));
+        byte_ = 0;
+        used_ = 0;
+      }
+    }
+  }
+
+  /* Pads the last byte with zeros */
+  void flush() {
+    if (used_ > 0) {
+      put(0, 8 - used_);
+    }
+  }
+
+ private:
+  std::string &out_;
+  uint8_t byte_;
+  uint8_t used_;
+};
+
+uint32_t hash2(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+}  // namespace
+
+std::string Host::compress(const std::string &image, uint8_t window_bits,
+                           uint8_t lookahead_bits) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(image.data());
+  const int64_t size = image.size();
+  const int64_t window = int64_t(1) << window_bits;
+  const int64_t max_len = int64_t(1) << lookahead_bits;
+
+  /* A match must be cheaper than the literals it replaces */
+  const int64_t min_len = (1 + window_bits + lookahead_bits) / 9 + 1;
+
+  std::string out(COMPRESSED_MAGIC, 4);
+  out.push_back(static_cast<char>(window_bits));
+  out.push_back(static_cast<char>(lookahead_bits));
+  out.append(2, '\0');
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>(size >> (8 * i)));
+  }
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256::digest(data, size, digest);
+  out.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+
+  std::vector<int64_t> head(1 << 16, -1), prev(size, -1);
+  auto insert = [&](int64_t pos) {
+    if (pos + 1 < size) {
+      uint32_t h = hash2(data + pos);
+      prev[pos] = head[h];
+      head[h] = pos;
+    }
+  };
+
+  BitWriter bits(out);
+  int64_t pos = 0;
+  while (pos < size) {
+    int64_t best_len = 0, best_pos = 0;
+    if (pos + 1 < size) {
+      int64_t limit = std::min(max_len, size - pos);
+      int64_t cand = head[hash2(data + pos)];
+      for (int depth = 0; cand >= 0 && pos - cand <= window &&
+                          depth < COMPRESS_CHAIN_DEPTH;
+           depth++, cand = prev[cand]) {
+        int64_t len = 0;
+        while (len < limit && data[cand + len] == data[pos + len]) {
+          len++;
+        }
+        if (len > best_len) {
+          best_len = len;
+          best_pos = cand;
+          if (len == limit) {
+            break;
+          }
+        }
+      }
+    }
+
+    if (best_len >= min_len) {
+      bits.put(0, 1);
+      bits.put(pos - best_pos - 1, window_bits);
+      bits.put(best_len - 1, lookahead_bits);
+    } else {
+      best_len = 1;
+      bits.put(1, 1);
+      bits.put(data[pos], 8);
+    }
+    for (int64_t i = 0; i < best_len; i++) {
+      insert(pos + i);
+    }
+    pos += best_len;
+  }
+  bits.flush();
+  return out;
+}
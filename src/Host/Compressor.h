@@ -0,0 +1,35 @@
+/**
+ * Compresses images for Update::Decompressor, see Update/Compressed.h for
+ * the format. Matches are found through hash chains over the window.
+ *
+ * Native only, used by tools/mkcompressed and the native tests.
+ */
+
+#ifndef __HOST_COMPRESSOR_H__
+#define __HOST_COMPRESSOR_H__
+
+#include <stdint.h>
+#include <string>
+
+/* Defaults, a 2 KiB window on the device */
+#define COMPRESS_WINDOW_BITS 11
+#define COMPRESS_LOOKAHEAD_BITS 4
+
+namespace Host {
+
+/**
+ * @brief Compresses 'image'
+ *
+ * @param image           The firmware image
+ * @param window_bits     log2 of the window, the RAM the device needs
+ * @param lookahead_bits  log2 of the longest match
+ *
+ * @return The compressed image
+ */
+std::string compress(const std::string &image,
+                     uint8_t window_bits = COMPRESS_WINDOW_BITS,
+                     uint8_t lookahead_bits = COMPRESS_LOOKAHEAD_BITS);
+
+}  // namespace Host
+
+#endif
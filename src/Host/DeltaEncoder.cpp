@@ -0,0 +1,231 @@
+#include "DeltaEncoder.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "Crypto/Sha256.h"
+#include "Update/Delta.h"
+
+/* Shortest zero run worth ending a literal for */
+#define DELTA_MIN_ZERO_RUN 3
+
+namespace {
+
+typedef std::vector<int64_t> Index;
+
+/* Suffix array by prefix doubling, including the empty suffix */
+Index suffix_array(const uint8_t *old, int64_t size) {
+  Index sa(size + 1), rank(size + 1), next(size + 1);
+  for (int64_t i = 0; i <= size; i++) {
+    sa[i] = i;
+    rank[i] = i < size ? old[i] : -1;
+  }
+  for (int64_t k = 1;; k *= 2) {
+    auto key = [&](int64_t i) { return i + k <= size ? rank[i + k] : -1; };
+    auto less = [&](int64_t a, int64_t b) {
+      return rank[a] != rank[b] ? rank[a] < rank[b] : key(a) < key(b);
+    };
+    std::sort(sa.begin(), sa.end(), less);
+    next[sa[0]] = 0;
+    for (int64_t i = 1; i <= size; i++) {
+      next[sa[i]] = next[sa[i - 1]] + (less(sa[i - 1], sa[i]) ? 1 : 0);
+    }
+    rank.swap(next);
+    if (rank[sa[size]] == size) {
+      break;
+    }
+  }
+  return sa;
+}
+
+int64_t match_len(const uint8_t *a, int64_t a_size, const uint8_t *b,
+                  int64_t b_size) {
+  int64_t i = 0;
+  while (i < a_size && i < b_size && a[i] == b[i]) {
+    i++;
+  }
+  return i;
+}
+
+/* Longest match for 'target' among the old suffixes in sa[start, end] */
+int64_t search(const Index &sa, const uint8_t *old, int64_t old_size,
+               const uint8_t *target, int64_t target_size, int64_t start,
+               int64_t end, int64_t *pos) {
+  while (end - start >= 2) {
+    int64_t mid = start + (end - start) / 2;
+    int64_t n = std::min(old_size - sa[mid], target_size);
+    if (memcmp(old + sa[mid], target, n) < 0) {
+      start = mid;
+    } else {
+      end = mid;
+    }
+  }
+  int64_t x = match_len(old + sa[start], old_size - sa[start], target,
+                        target_size);
+  int64_t y =
+      match_len(old + sa[end], old_size - sa[end], target, target_size);
+  *pos = x > y ? sa[start] : sa[end];
+  return std::max(x, y);
+}
+
+void put_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void put_le32(std::string &out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+/* Codes diff bytes as (zeros, n, n bytes) pairs */
+void put_diff(std::string &out, const uint8_t *diff, int64_t size) {
+  int64_t i = 0;
+  while (i < size) {
+    int64_t zeros = 0;
+    while (i + zeros < size && diff[i + zeros] == 0) {
+      zeros++;
+    }
+    i += zeros;
+
+    int64_t n = 0;
+    while (i + n < size) {
+      int64_t run = 0;
+      while (i + n + run < size && diff[i + n + run] == 0 &&
+             run < DELTA_MIN_ZERO_RUN) {
+        run++;
+      }
+      if (run == DELTA_MIN_ZERO_RUN || i + n + run == size) {
+        break;
+      }
+      n += run + 1;
+    }
+    put_varint(out, zeros);
+    put_varint(out, n);
+    out.append(reinterpret_cast<const char *>(diff + i), n);
+    i += n;
+  }
+}
+
+}  // namespace
+
+std::string Host::make_delta(const std::string &old_image,
+                             const std::string &new_image) {
+  const uint8_t *old = reinterpret_cast<const uint8_t *>(old_image.data());
+  const uint8_t *neu = reinterpret_cast<const uint8_t *>(new_image.data());
+  const int64_t old_size = old_image.size();
+  const int64_t new_size = new_image.size();
+
+  std::string patch(DELTA_MAGIC, 4);
+  put_le32(patch, new_size);
+  put_le32(patch, old_size);
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256::digest(old, old_size, digest);
+  patch.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+  Sha256::digest(neu, new_size, digest);
+  patch.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+
+  Index sa = suffix_array(old, old_size);
+  std::vector<uint8_t> diff;
+
+  int64_t scan = 0, len = 0, pos = 0;
+  int64_t last_scan = 0, last_pos = 0, last_offset = 0;
+  while (scan < new_size) {
+    int64_t old_score = 0;
+    int64_t scsc = scan += len;
+    for (; scan < new_size; scan++) {
+      len = search(sa, old, old_size, neu + scan, new_size - scan, 0,
+                   old_size, &pos);
+      for (; scsc < scan + len; scsc++) {
+        if (scsc + last_offset < old_size &&
+            old[scsc + last_offset] == neu[scsc]) {
+          old_score++;
+        }
+      }
+      if ((len == old_score && len != 0) || len > old_score + 8) {
+        break;
+      }
+      if (scan + last_offset < old_size &&
+          old[scan + last_offset] == neu[scan]) {
+        old_score--;
+      }
+    }
+
+    if (len == old_score && scan != new_size) {
+      continue;
+    }
+
+    /* Extend the previous match forwards and this one backwards */
+    int64_t s = 0, best = 0, len_f = 0;
+    for (int64_t i = 0; last_scan + i < scan && last_pos + i < old_size;) {
+      if (old[last_pos + i] == neu[last_scan + i]) {
+        s++;
+      }
+      i++;
+      if (s * 2 - i > best * 2 - len_f) {
+        best = s;
+        len_f = i;
+      }
+    }
+
+    int64_t len_b = 0;
+    if (scan < new_size) {
+      s = 0;
+      best = 0;
+      for (int64_t i = 1; scan >= last_scan + i && pos >= i; i++) {
+        if (old[pos - i] == neu[scan - i]) {
+          s++;
+        }
+        if (s * 2 - i > best * 2 - len_b) {
+          best = s;
+          len_b = i;
+        }
+      }
+    }
+
+    if (last_scan + len_f > scan - len_b) {
+      int64_t overlap = (last_scan + len_f) - (scan - len_b);
+      int64_t lens = 0;
+      s = 0;
+      best = 0;
+      for (int64_t i = 0; i < overlap; i++) {
+        if (neu[last_scan + len_f - overlap + i] ==
+            old[last_pos + len_f - overlap + i]) {
+          s++;
+        }
+        if (neu[scan - len_b + i] == old[pos - len_b + i]) {
+          s--;
+        }
+        if (s > best) {
+          best = s;
+          lens = i + 1;
+        }
+      }
+      len_f += lens - overlap;
+      len_b -= lens;
+    }
+
+    int64_t extra = (scan - len_b) - (last_scan + len_f);
+    int64_t seek = (pos - len_b) - (last_pos + len_f);
+    put_varint(patch, len_f);
+    put_varint(patch, extra);
+    put_varint(patch, (static_cast<uint64_t>(seek) << 1) ^
+                          static_cast<uint64_t>(seek >> 63));
+
+    diff.resize(len_f);
+    for (int64_t i = 0; i < len_f; i++) {
+      diff[i] = neu[last_scan + i] - old[last_pos + i];
+    }
+    put_diff(patch, diff.data(), len_f);
+    patch.append(new_image, last_scan + len_f, extra);
+
+    last_scan = scan - len_b;
+    last_pos = pos - len_b;
+    last_offset = pos - scan;
+  }
+  return patch;
+}
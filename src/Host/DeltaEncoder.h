@@ -0,0 +1,29 @@
+/**
+ * Builds delta patches for Update::DeltaDecoder, see Update/Delta.h for the
+ * format. Matching follows bsdiff: a suffix array of the old image finds
+ * long approximate matches, which become diff blocks.
+ *
+ * Native only, used by tools/mkdelta and the native tests.
+ */
+
+#ifndef __HOST_DELTA_ENCODER_H__
+#define __HOST_DELTA_ENCODER_H__
+
+#include <string>
+
+namespace Host {
+
+/**
+ * @brief Makes a patch that rebuilds 'new_image' from 'old_image'
+ *
+ * @param old_image The image running on the device
+ * @param new_image The image to update to
+ *
+ * @return The patch
+ */
+std::string make_delta(const std::string &old_image,
+                       const std::string &new_image);
+
+}  // namespace Host
+
+#endif
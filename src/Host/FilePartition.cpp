@@ -0,0 +1,119 @@
+#include "FilePartition.h"
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+Host::FilePartition::FilePartition(const std::string &path,
+                                   uint32_t us_per_sector, size_t capacity)
+    : path_(path),
+      us_per_sector_(us_per_sector),
+      capacity_(capacity),
+      cursor_(0),
+      file_(nullptr) {}
+
+Host::FilePartition::~FilePartition() { close(); }
+
+esp_err_t Host::FilePartition::open(bool truncate) {
+  close();
+  cursor_ = 0;
+  if (!truncate) {
+    file_ = fopen(path_.c_str(), "r+b");
+  }
+  if (file_ == nullptr) {
+    file_ = fopen(path_.c_str(), "w+b");
+  }
+  return file_ != nullptr ? ESP_OK : ESP_FAIL;
+}
+
+void Host::FilePartition::close() {
+  if (file_ != nullptr) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+esp_err_t Host::FilePartition::write(const uint8_t *data, size_t size) {
+  esp_err_t err = write(cursor_, data, size);
+  if (err == ESP_OK) {
+    cursor_ += size;
+  }
+  return err;
+}
+
+esp_err_t Host::FilePartition::read(size_t offset, void *dest, size_t size) {
+  if (file_ == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (offset + size > capacity_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  /* Never written bytes read as erased */
+  memset(dest, 0xFF, size);
+  fseek(file_, offset, SEEK_SET);
+  fread(dest, 1, size, file_);
+  return ESP_OK;
+}
+
+esp_err_t Host::FilePartition::write(size_t offset, const void *src,
+                                     size_t size) {
+  std::vector<uint8_t> cell(size);
+  esp_err_t err = read(offset, cell.data(), size);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  /* Programming can only clear bits */
+  const uint8_t *bytes = static_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < size; i++) {
+    cell[i] &= bytes[i];
+  }
+  fseek(file_, offset, SEEK_SET);
+  if (fwrite(cell.data(), 1, size, file_) != size) {
+    return ESP_FAIL;
+  }
+  simulate(size);
+  return ESP_OK;
+}
+
+esp_err_t Host::FilePartition::erase(size_t offset, size_t size) {
+  if (file_ == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (offset % OTA_SECTOR_SIZE || size % OTA_SECTOR_SIZE ||
+      offset + size > capacity_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::vector<uint8_t> erased(size, 0xFF);
+  fseek(file_, offset, SEEK_SET);
+  if (fwrite(erased.data(), 1, size, file_) != size) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+std::string Host::FilePartition::contents() const {
+  std::string data;
+  if (file_ != nullptr) {
+    fflush(file_);
+  }
+  FILE *file = fopen(path_.c_str(), "rb");
+  if (file == nullptr) {
+    return data;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    data.append(buf, n);
+  }
+  fclose(file);
+  return data;
+}
+
+void Host::FilePartition::simulate(size_t size) const {
+  if (us_per_sector_) {
+    std::this_thread::sleep_for(
+        std::chrono::microseconds((uint64_t)us_per_sector_ * size / 4096));
+  }
+}
@@ -0,0 +1,70 @@
+/**
+ * File-backed stand-in for an OTA update partition. Writes follow NOR flash
+ * rules, so bits can only be cleared until the sector is erased, and can be
+ * slowed to model the flash erase/write cost of the ESP32.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_FILE_PARTITION_H__
+#define __HOST_FILE_PARTITION_H__
+
+#include <stdio.h>
+#include <string>
+#include "Update/OtaPipeline.h"
+#include "Update/Partition.h"
+
+/* Default capacity, the size of an OTA slot on a 4 MB module */
+#define HOST_PARTITION_SIZE 0x180000
+
+namespace Host {
+
+class FilePartition : public Update::ChunkSink, public Update::Partition {
+ public:
+  /**
+   * @param path          Backing file
+   * @param us_per_sector Simulated erase + write time per 4 KiB
+   * @param capacity      Partition size in bytes
+   */
+  explicit FilePartition(const std::string &path, uint32_t us_per_sector = 0,
+                         size_t capacity = HOST_PARTITION_SIZE);
+  ~FilePartition();
+
+  /**
+   * @brief Opens the backing file
+   *
+   * @param truncate  Start from an erased partition. Pass false to reopen
+   *                  the previous contents, as after a reboot.
+   */
+  esp_err_t open(bool truncate = true);
+  void close();
+
+  /* Appends after the previous append, as esp_ota_write() does */
+  esp_err_t write(const uint8_t *data, size_t size) override;
+
+  esp_err_t read(size_t offset, void *dest, size_t size) override;
+  esp_err_t write(size_t offset, const void *src, size_t size) override;
+  esp_err_t erase(size_t offset, size_t size) override;
+  size_t size() const override { return capacity_; }
+  uint32_t id() const override { return 0x10000; }
+
+  /**
+   * @brief Reads back everything written so far
+   */
+  std::string contents() const;
+
+  const std::string &path() const { return path_; }
+
+ private:
+  void simulate(size_t size) const;
+
+  std::string path_;
+  uint32_t us_per_sector_;
+  size_t capacity_;
+  size_t cursor_;
+  FILE *file_;
+};
+
+}  // namespace Host
+
+#endif
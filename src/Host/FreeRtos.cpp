@@ -0,0 +1,91 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "idf/freertos/event_groups.h"
+#include "idf/freertos/task.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const Clock::duration TICK =
+    std::chrono::microseconds(1000000 / configTICK_RATE_HZ);
+
+/* Tick 0 starts at the first use */
+static Clock::time_point epoch() {
+  static const Clock::time_point start = Clock::now();
+  return start;
+}
+
+static Clock::time_point tick_time(TickType_t tick) {
+  return epoch() + TICK * tick;
+}
+
+TickType_t xTaskGetTickCount() {
+  return (Clock::now() - epoch()) / TICK;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_until(tick_time(xTaskGetTickCount() + ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+  *previous_wake += increment;
+  std::this_thread::sleep_until(tick_time(*previous_wake));
+}
+
+EventGroupHandle_t xEventGroupCreate() { return new HostEventGroup; }
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer) {
+  HostEventGroup *group = new (buffer->storage) HostEventGroup;
+  group->is_static = true;
+  return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+  if (group->is_static) {
+    group->~HostEventGroup();
+  } else {
+    delete group;
+  }
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  std::lock_guard<std::mutex> lock(group->mutex);
+  group->bits |= bits;
+  group->cond.notify_all();
+  return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  std::lock_guard<std::mutex> lock(group->mutex);
+  EventBits_t before = group->bits;
+  group->bits &= ~bits;
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  std::lock_guard<std::mutex> lock(group->mutex);
+  return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(group->mutex);
+  auto done = [&] {
+    EventBits_t set = group->bits & bits;
+    return wait_for_all ? set == bits : set != 0;
+  };
+  if (ticks == portMAX_DELAY) {
+    group->cond.wait(lock, done);
+  } else {
+    group->cond.wait_until(lock, tick_time(xTaskGetTickCount() + ticks),
+                           done);
+  }
+  EventBits_t result = group->bits;
+  if (done() && clear_on_exit) {
+    group->bits &= ~bits;
+  }
+  return result;
+}
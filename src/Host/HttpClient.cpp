@@ -0,0 +1,275 @@
+#include "HttpClient.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include "Tls/SessionCache.h"
+
+Host::HttpClient::HttpClient()
+    : fd_(-1),
+      status_(0),
+      content_length_(-1),
+      remaining_(-1),
+      keep_alive_(false),
+      tls_(false),
+      resumed_(false),
+      cert_pem_(nullptr),
+      connects_(0) {}
+
+Host::HttpClient::~HttpClient() { close(); }
+
+esp_err_t Host::HttpClient::get(const std::string &url, uint32_t offset) {
+  return exchange("GET", url, offset, "", "");
+}
+
+esp_err_t Host::HttpClient::post(const std::string &url,
+                                 const std::string &body,
+                                 const std::string &headers) {
+  return exchange("POST", url, 0, headers, body);
+}
+
+esp_err_t Host::HttpClient::exchange(const char *method,
+                                     const std::string &url, uint32_t offset,
+                                     const std::string &headers,
+                                     const std::string &body) {
+  /* http://host:port/path */
+  const std::string scheme = "http://";
+  if (url.compare(0, scheme.size(), scheme) != 0) {
+    close();
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t host_start = scheme.size();
+  size_t path_start = url.find('/', host_start);
+  if (path_start == std::string::npos) {
+    path_start = url.size();
+  }
+  std::string authority = url.substr(host_start, path_start - host_start);
+  std::string path = path_start < url.size() ? url.substr(path_start) : "/";
+
+  /* A kept connection to the host whose last body was read to the end */
+  if (keep_alive_ && authority == authority_ && alive()) {
+    if (request(method, authority, path, offset, headers, body) == ESP_OK) {
+      return ESP_OK;
+    }
+  }
+  close();
+
+  std::string host = authority, port = "80";
+  size_t colon = authority.find(':');
+  if (colon != std::string::npos) {
+    host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+
+  addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    return ESP_FAIL;
+  }
+  fd_ = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd_ >= 0) {
+    /* Match the device TCP window so the kernel cannot buffer the image */
+    int window = HOST_TCP_WINDOW;
+    setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+  }
+  if (fd_ < 0 || connect(fd_, res->ai_addr, res->ai_addrlen) != 0) {
+    freeaddrinfo(res);
+    close();
+    return ESP_FAIL;
+  }
+  freeaddrinfo(res);
+  connects_++;
+  authority_ = authority;
+  if (tls_ && handshake() != ESP_OK) {
+    close();
+    return ESP_FAIL;
+  }
+  return request(method, authority, path, offset, headers, body);
+}
+
+esp_err_t Host::HttpClient::handshake() {
+  std::string key = "http://" + authority_;
+  uint32_t now = time(nullptr);
+  char session[TLS_SESSION_MAX_SIZE];
+  size_t size;
+  std::string hello = "TICKET ";
+  if (Tls::find(key.c_str(), cert_pem_, now, session, sizeof(session),
+                &size) == ESP_OK) {
+    hello.append(session, size);
+  } else {
+    hello += "-";
+  }
+  hello += "\r\n";
+
+  uint64_t start = Port::micros();
+  if (send(fd_, hello.data(), hello.size(), MSG_NOSIGNAL) !=
+      (ssize_t)hello.size()) {
+    return ESP_FAIL;
+  }
+  /* The server sends nothing more before the request */
+  std::string reply;
+  char buf[128];
+  while (reply.find("\r\n") == std::string::npos) {
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return ESP_FAIL;
+    }
+    reply.append(buf, n);
+  }
+  uint32_t us = Port::micros() - start;
+
+  resumed_ = reply.compare(0, 9, "RESUMED\r\n") == 0;
+  if (!resumed_) {
+    char ticket[TLS_SESSION_MAX_SIZE];
+    unsigned lifetime;
+    if (sscanf(reply.c_str(), "NEW %191s %u", ticket, &lifetime) != 2) {
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    Tls::store(key.c_str(), cert_pem_, ticket, strlen(ticket), now, lifetime);
+  }
+  Tls::record_handshake(us, resumed_);
+  return ESP_OK;
+}
+
+esp_err_t Host::HttpClient::request(const char *method,
+                                    const std::string &authority,
+                                    const std::string &path, uint32_t offset,
+                                    const std::string &headers,
+                                    const std::string &body) {
+  status_ = 0;
+  content_length_ = -1;
+  remaining_ = -1;
+  pending_.clear();
+
+  std::string request = std::string(method) + " " + path + " HTTP/1.1\r\nHost: " + authority +
+                        (keep_alive_ ? "\r\nConnection: keep-alive\r\n"
+                                     : "\r\nConnection: close\r\n");
+  if (offset > 0) {
+    request += "Range: bytes=" + std::to_string(offset) + "-\r\n";
+  }
+  if (!body.empty()) {
+    request += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  request += headers + "\r\n" + body;
+  if (send(fd_, request.data(), request.size(), MSG_NOSIGNAL) !=
+      (ssize_t)request.size()) {
+    close();
+    return ESP_FAIL;
+  }
+
+  /* Read until the end of the head, keeping any body bytes */
+  std::string head;
+  size_t head_end;
+  char buf[512];
+  while ((head_end = head.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      close();
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    head.append(buf, n);
+  }
+  pending_ = head.substr(head_end + 4);
+  head.resize(head_end + 2);
+
+  if (sscanf(head.c_str(), "HTTP/1.%*d %d", &status_) != 1) {
+    close();
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  for (size_t pos = head.find("\r\n"); pos != std::string::npos;) {
+    size_t next = head.find("\r\n", pos + 2);
+    if (next == std::string::npos) {
+      break;
+    }
+    std::string line = head.substr(pos + 2, next - pos - 2);
+    if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0) {
+      content_length_ = strtoll(line.c_str() + 15, nullptr, 10);
+    }
+    pos = next;
+  }
+  remaining_ = content_length_;
+  return ESP_OK;
+}
+
+bool Host::HttpClient::alive() {
+  if (fd_ < 0 || remaining_ != 0 || !pending_.empty()) {
+    return false;
+  }
+  /* Nothing to read and not closed by the peer */
+  char byte;
+  ssize_t n = recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int Host::HttpClient::read(uint8_t *dest, size_t size) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  if (remaining_ == 0) {
+    return 0;
+  }
+  if (remaining_ > 0) {
+    size = std::min<int64_t>(size, remaining_);
+  }
+
+  int n;
+  if (!pending_.empty()) {
+    n = std::min(size, pending_.size());
+    memcpy(dest, pending_.data(), n);
+    pending_.erase(0, n);
+  } else {
+    n = recv(fd_, dest, size, 0);
+    if (n == 0 && remaining_ > 0) {
+      /* Closed before Content-Length bytes arrived */
+      return -1;
+    }
+  }
+  if (n > 0 && remaining_ > 0) {
+    remaining_ -= n;
+  }
+  return n;
+}
+
+void Host::HttpClient::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  status_ = 0;
+  content_length_ = -1;
+  remaining_ = -1;
+  pending_.clear();
+  authority_.clear();
+}
+
+esp_err_t Host::HttpRangeSource::open(uint32_t offset, uint32_t *start,
+                                      uint32_t *total) {
+  esp_err_t err = client_.get(url_, offset);
+  if (err != ESP_OK) {
+    return err;
+  }
+  int64_t length = client_.content_length();
+  if (client_.status() == 206) {
+    *start = offset;
+  } else if (client_.status() == 200) {
+    *start = 0;
+  } else {
+    client_.close();
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  *total = length >= 0 ? *start + length : 0;
+  return ESP_OK;
+}
+
+int Host::HttpRangeSource::read(uint8_t *dest, size_t size) {
+  return client_.read(dest, size);
+}
@@ -0,0 +1,169 @@
+/**
+ * Minimal blocking HTTP/1.1 client over POSIX sockets, standing in for
+ * esp_http_client when running natively. Exposes the response body as an
+ * Update::ChunkSource.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_HTTP_CLIENT_H__
+#define __HOST_HTTP_CLIENT_H__
+
+#include <stdint.h>
+#include <string>
+#include "Http/Pool.h"
+#include "Update/OtaPipeline.h"
+#include "Update/Resumable.h"
+
+/* CONFIG_TCP_WND_DEFAULT from sdkconfig.h */
+#define HOST_TCP_WINDOW 5744
+
+namespace Host {
+
+class HttpClient : public Update::ChunkSource {
+ public:
+  HttpClient();
+  ~HttpClient();
+
+  /**
+   * @brief Sends a GET and reads the response head. With keep-alive set,
+   * over the open connection if it is to the same host and alive().
+   *
+   * @param url     http://host:port/path
+   * @param offset  Requests the body from this offset on with a Range header
+   *
+   * @return
+   *  - ESP_OK                The head was read, the body is ready to read()
+   *  - ESP_ERR_INVALID_ARG   Malformed URL
+   *  - ESP_FAIL              Connection failed
+   *  - ESP_ERR_INVALID_RESPONSE  Malformed response
+   */
+  esp_err_t get(const std::string &url, uint32_t offset = 0);
+
+  /**
+   * @brief Sends a POST and reads the response head, as get()
+   *
+   * @param headers  Extra header lines, each ending in "\r\n"
+   */
+  esp_err_t post(const std::string &url, const std::string &body,
+                 const std::string &headers = "");
+
+  int read(uint8_t *dest, size_t size) override;
+
+  void close();
+
+  /**
+   * @brief Asks the server to keep the connection open after each response
+   */
+  void set_keep_alive(bool keep_alive) { keep_alive_ = keep_alive; }
+
+  /**
+   * @brief Checks the connection can take another request: the body was
+   * read to the end and the server has not closed it
+   */
+  bool alive();
+
+  /**
+   * @brief Opens each connection with the ticket exchange of an HttpServer
+   * with tickets on, resuming through the Tls session cache
+   *
+   * @param cert_pem  Pins the cached sessions, kept by reference
+   */
+  void set_tls(const char *cert_pem) {
+    tls_ = true;
+    cert_pem_ = cert_pem;
+  }
+
+  /* Whether the last connection resumed a cached session */
+  bool resumed() const { return resumed_; }
+
+  /* Number of connections made */
+  uint32_t connects() const { return connects_; }
+
+  int status() const { return status_; }
+
+  /* Value of Content-Length, -1 if absent */
+  int64_t content_length() const { return content_length_; }
+
+ private:
+  HttpClient(const HttpClient &) = delete;
+  HttpClient &operator=(const HttpClient &) = delete;
+
+  /* Connects, or reuses the kept connection, and sends the request */
+  esp_err_t exchange(const char *method, const std::string &url,
+                     uint32_t offset, const std::string &headers,
+                     const std::string &body);
+
+  /* Sends the request on the open connection and reads the head */
+  esp_err_t request(const char *method, const std::string &authority,
+                    const std::string &path, uint32_t offset,
+                    const std::string &headers, const std::string &body);
+
+  /* Offers the cached session and stores the one the server issues */
+  esp_err_t handshake();
+
+  int fd_;
+  int status_;
+  int64_t content_length_;
+  int64_t remaining_;
+
+  bool keep_alive_;
+  bool tls_;
+  bool resumed_;
+  const char *cert_pem_;
+  uint32_t connects_;
+
+  /* host:port of the open connection */
+  std::string authority_;
+
+  /* Body bytes received together with the head */
+  std::string pending_;
+};
+
+/**
+ * Http::Connection over an HttpClient with keep-alive, for Http::Pool
+ */
+class HttpConnection : public Http::Connection {
+ public:
+  HttpConnection() { client_.set_keep_alive(true); }
+
+  bool reusable() override { return client_.alive(); }
+
+  HttpClient &client() { return client_; }
+
+ private:
+  HttpClient client_;
+};
+
+class HttpConnector : public Http::Connector {
+ public:
+  /* A certificate turns on the ticket exchange, as for https:// */
+  Http::Connection *create(const char *url, const char *cert_pem) override {
+    HttpConnection *connection = new HttpConnection();
+    if (cert_pem != nullptr) {
+      connection->client().set_tls(cert_pem);
+    }
+    return connection;
+  }
+  void destroy(Http::Connection *connection) override { delete connection; }
+};
+
+/**
+ * Update::RangeSource for one URL, reconnecting on every open()
+ */
+class HttpRangeSource : public Update::RangeSource {
+ public:
+  explicit HttpRangeSource(const std::string &url) : url_(url) {}
+
+  esp_err_t open(uint32_t offset, uint32_t *start, uint32_t *total) override;
+  int read(uint8_t *dest, size_t size) override;
+  void close() override { client_.close(); }
+
+ private:
+  std::string url_;
+  HttpClient client_;
+};
+
+}  // namespace Host
+
+#endif
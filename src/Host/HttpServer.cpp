@@ -0,0 +1,391 @@
+#include "HttpServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+
+Host::HttpServer::HttpServer()
+    : listen_fd_(-1),
+      port_(0),
+      running_(false),
+      requests_(0),
+      bytes_sent_(0),
+      connections_(0),
+      resumptions_(0),
+      drop_posts_(0),
+      duplicates_(0),
+      certificate_(0),
+      next_ticket_(0) {}
+
+Host::HttpServer::~HttpServer() { stop(); }
+
+esp_err_t Host::HttpServer::start(const std::string &body,
+                                  const HttpServerOptions &options) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  body_ = body;
+  options_ = options;
+  requests_ = 0;
+  bytes_sent_ = 0;
+  connections_ = 0;
+  resumptions_ = 0;
+  duplicates_ = 0;
+  posts_.clear();
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    return ESP_FAIL;
+  }
+  int yes = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd_, 16) != 0 ||
+      getsockname(listen_fd_, (sockaddr *)&addr, &len) != 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return ESP_FAIL;
+  }
+  port_ = ntohs(addr.sin_port);
+
+  running_ = true;
+  acceptor_ = std::thread(&HttpServer::accept_loop, this);
+  return ESP_OK;
+}
+
+void Host::HttpServer::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  shutdown(listen_fd_, SHUT_RDWR);
+  close(listen_fd_);
+  listen_fd_ = -1;
+  acceptor_.join();
+
+  std::lock_guard<std::mutex> lock(workers_lock_);
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void Host::HttpServer::add_file(const std::string &path,
+                                const std::string &body) {
+  files_[path] = body;
+}
+
+std::string Host::HttpServer::url(const char *path) const {
+  return "http://127.0.0.1:" + std::to_string(port_) + path;
+}
+
+void Host::HttpServer::accept_loop() {
+  while (running_) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(workers_lock_);
+    workers_.push_back(std::thread(&HttpServer::handle, this, fd));
+  }
+}
+
+void Host::HttpServer::handle(int fd) {
+  int window = 5744;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+  /* The head and a small body would otherwise wait out a delayed ACK on a
+   * kept connection */
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  connections_++;
+
+  std::string received;
+  if (options_.tickets) {
+    if (!handshake(fd, received)) {
+      close(fd);
+      return;
+    }
+  } else if (options_.handshake_us) {
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(options_.handshake_us));
+  }
+
+  char buf[512];
+  for (bool first = true;; first = false) {
+    /* Read a request head, then the body of a POST */
+    size_t head_end;
+    while ((head_end = received.find("\r\n\r\n")) == std::string::npos) {
+      if (!first && !wait_request(fd)) {
+        close(fd);
+        return;
+      }
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      received.append(buf, n);
+    }
+    std::string request = received.substr(0, head_end + 4);
+    received.erase(0, head_end + 4);
+    size_t length = 0;
+    size_t field = request.find("\r\nContent-Length: ");
+    if (field != std::string::npos) {
+      length = strtoul(request.c_str() + field + 18, nullptr, 10);
+    }
+    while (received.size() < length) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      received.append(buf, n);
+    }
+    std::string body = received.substr(0, length);
+    received.erase(0, length);
+    if (!respond(fd, request, body)) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+bool Host::HttpServer::handshake(int fd, std::string &received) {
+  char buf[128];
+  size_t line_end;
+  while ((line_end = received.find("\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    received.append(buf, n);
+  }
+  std::string line = received.substr(0, line_end);
+  received.erase(0, line_end + 2);
+  if (line.compare(0, 7, "TICKET ") != 0) {
+    return false;
+  }
+
+  std::string ticket = line.substr(7);
+  bool resume;
+  {
+    std::lock_guard<std::mutex> lock(tickets_lock_);
+    auto issued = tickets_.find(ticket);
+    resume = issued != tickets_.end() && issued->second == certificate_;
+    if (!resume) {
+      ticket = "t" + std::to_string(certificate_) + "-" +
+               std::to_string(next_ticket_++);
+      tickets_[ticket] = certificate_;
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(
+      resume ? options_.resume_us : options_.handshake_us));
+
+  std::string reply;
+  if (resume) {
+    resumptions_++;
+    reply = "RESUMED\r\n";
+  } else {
+    reply = "NEW " + ticket + " " +
+            std::to_string(options_.ticket_lifetime_s) + "\r\n";
+  }
+  return send_all(fd, reply.data(), reply.size());
+}
+
+void Host::HttpServer::rotate_certificate() {
+  std::lock_guard<std::mutex> lock(tickets_lock_);
+  certificate_++;
+}
+
+bool Host::HttpServer::wait_request(int fd) {
+  /* In slices, so stop() does not wait out the keep-alive */
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(options_.keep_alive_ms);
+  while (running_ && std::chrono::steady_clock::now() < deadline) {
+    pollfd readable = {fd, POLLIN, 0};
+    if (poll(&readable, 1, 10) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Host::HttpServer::respond(int fd, const std::string &request,
+                               const std::string &content) {
+  requests_++;
+  bool keep = options_.keep_alive_ms > 0 &&
+              request.find("\r\nConnection: close") == std::string::npos;
+  const char *connection = keep ? "keep-alive" : "close";
+  if (options_.request_us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(options_.request_us));
+  }
+
+  if (request.compare(0, 5, "POST ") == 0) {
+    if (!store(request, content)) {
+      return false;
+    }
+    char head[128];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 %d Stored\r\n"
+                            "Content-Length: 0\r\n"
+                            "Connection: %s\r\n\r\n",
+                            options_.post_status, connection);
+    return send_all(fd, head, head_len) && keep;
+  }
+
+  const std::string *body = &body_;
+  size_t path = request.find(' ');
+  if (path != std::string::npos) {
+    size_t end = request.find(' ', path + 1);
+    auto file = files_.find(request.substr(path + 1, end - path - 1));
+    if (file != files_.end()) {
+      body = &file->second;
+    }
+  }
+
+  /* Only open ended ranges are needed by the OTA client */
+  size_t start = 0;
+  size_t range = request.find("\r\nRange: bytes=");
+  if (options_.ranges && range != std::string::npos) {
+    start = strtoul(request.c_str() + range + 15, nullptr, 10);
+  }
+
+  char head[256];
+  int head_len;
+  if (start >= body->size() && start > 0) {
+    head_len = snprintf(head, sizeof(head),
+                        "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: %s\r\n\r\n",
+                        connection);
+    start = body->size();
+  } else if (start > 0) {
+    head_len = snprintf(head, sizeof(head),
+                        "HTTP/1.1 206 Partial Content\r\n"
+                        "Content-Range: bytes %zu-%zu/%zu\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: %s\r\n\r\n",
+                        start, body->size() - 1, body->size(),
+                        body->size() - start, connection);
+  } else {
+    head_len = snprintf(head, sizeof(head),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: %s\r\n\r\n",
+                        body->size(), connection);
+  }
+
+  if (!send_all(fd, head, head_len)) {
+    return false;
+  }
+  size_t limit = body->size();
+  if (options_.drop_after && start + options_.drop_after < limit) {
+    limit = start + options_.drop_after;
+    keep = false;
+  }
+  size_t sent = start;
+  while (sent < limit && running_) {
+    size_t n = std::min(options_.chunk_size, limit - sent);
+    pace(n);
+    if (!send_all(fd, body->data() + sent, n)) {
+      return false;
+    }
+    sent += n;
+    bytes_sent_ += n;
+    if (options_.chunk_delay_us) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(options_.chunk_delay_us));
+    }
+  }
+  return keep && sent == limit;
+}
+
+namespace {
+/* Value of the header 'name', including ": ", empty if absent */
+std::string header(const std::string &request, const char *name) {
+  std::string field = std::string("\r\n") + name;
+  size_t start = request.find(field);
+  if (start == std::string::npos) {
+    return "";
+  }
+  start += field.size();
+  return request.substr(start, request.find("\r\n", start) - start);
+}
+}  // namespace
+
+bool Host::HttpServer::store(const std::string &request,
+                             const std::string &body) {
+  HttpPost post;
+  size_t end = request.find(' ', 5);
+  post.path = request.substr(5, end - 5);
+  post.key = header(request, "Idempotency-Key: ");
+  post.encoding = header(request, "Content-Encoding: ");
+  post.body = body;
+  {
+    std::lock_guard<std::mutex> lock(posts_lock_);
+    bool seen = false;
+    for (const HttpPost &stored : posts_) {
+      seen = seen || (!post.key.empty() && stored.key == post.key);
+    }
+    if (seen) {
+      duplicates_++;
+    } else {
+      posts_.push_back(post);
+    }
+  }
+
+  /* Stored, but the reply never arrives */
+  uint32_t drops = drop_posts_;
+  while (drops > 0 && !drop_posts_.compare_exchange_weak(drops, drops - 1)) {
+  }
+  return drops == 0;
+}
+
+std::vector<Host::HttpPost> Host::HttpServer::posts() {
+  std::lock_guard<std::mutex> lock(posts_lock_);
+  return posts_;
+}
+
+void Host::HttpServer::pace(size_t size) {
+  if (options_.uplink_bytes_per_s == 0) {
+    return;
+  }
+  std::chrono::steady_clock::time_point slot;
+  {
+    std::lock_guard<std::mutex> lock(pace_lock_);
+    auto now = std::chrono::steady_clock::now();
+    if (uplink_free_ < now) {
+      uplink_free_ = now;
+    }
+    slot = uplink_free_;
+    uplink_free_ += std::chrono::microseconds(
+        size * 1000000ull / options_.uplink_bytes_per_s);
+  }
+  std::this_thread::sleep_until(slot);
+}
+
+bool Host::HttpServer::send_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
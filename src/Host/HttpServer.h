@@ -0,0 +1,175 @@
+/**
+ * Loopback HTTP/1.1 server standing in for the update and backend servers
+ * when running natively. Serves in-memory bodies, throttled to mimic a slow
+ * link. Honours "Range: bytes=N-" and can drop connections part way through
+ * to mimic a flaky link. Keeps connections alive when asked to, and can
+ * delay each new connection to mimic a TLS handshake. With tickets on, a
+ * client opens with a "TICKET" line, and the server resumes the session it
+ * names or issues a new one, a text model of TLS session tickets. Keeps
+ * the body of every POST, as a telemetry backend, and can drop connections
+ * after storing one to mimic a lost reply.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_HTTP_SERVER_H__
+#define __HOST_HTTP_SERVER_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Port/Port.h"
+
+namespace Host {
+
+struct HttpServerOptions {
+  size_t chunk_size = 1460;    /*!< Bytes per send(), one TCP segment */
+  uint32_t chunk_delay_us = 0; /*!< Delay after each send() */
+  size_t drop_after = 0;       /*!< Close responses after this many body
+                                    bytes, 0 to never drop */
+  bool ranges = true;          /*!< Honour Range requests */
+  uint32_t uplink_bytes_per_s = 0; /*!< Shared by all connections, 0 for
+                                        no limit */
+  uint32_t keep_alive_ms = 0;  /*!< Idle time before closing a kept
+                                    connection, 0 to close after each
+                                    response */
+  uint32_t handshake_us = 0;   /*!< Delay before a new connection's first
+                                    request, as a TLS handshake */
+  bool tickets = false;        /*!< Expect the ticket exchange first */
+  uint32_t resume_us = 0;      /*!< Delay for a resumed session */
+  uint32_t ticket_lifetime_s = 0; /*!< Sent with new tickets */
+  uint32_t request_us = 0;     /*!< Delay before each response, as the
+                                    round trip of a slow link */
+  int post_status = 200;       /*!< Status answered to POSTs */
+};
+
+/* A POST the server stored */
+struct HttpPost {
+  std::string path;
+  std::string key;       /*!< Idempotency-Key, empty if absent */
+  std::string encoding;  /*!< Content-Encoding, empty if absent */
+  std::string body;
+};
+
+class HttpServer {
+ public:
+  HttpServer();
+  ~HttpServer();
+
+  /**
+   * @brief Serves 'body' for GETs of 'path' instead of the default body.
+   * Call before start().
+   */
+  void add_file(const std::string &path, const std::string &body);
+
+  /**
+   * @brief Starts listening on an ephemeral port on 127.0.0.1
+   *
+   * @param body     Returned for every GET of a path without add_file()
+   * @param options  Throttling
+   *
+   * @return esp_err_t
+   */
+  esp_err_t start(const std::string &body,
+                  const HttpServerOptions &options = HttpServerOptions());
+
+  /**
+   * @brief Stops accepting and waits for open connections to finish
+   */
+  void stop();
+
+  uint16_t port() const { return port_; }
+
+  /**
+   * @brief Gets a URL for this server
+   *
+   * @param path  Path part of the URL, starting with '/'
+   */
+  std::string url(const char *path = "/firmware.bin") const;
+
+  /* Number of requests served */
+  uint32_t requests() const { return requests_; }
+
+  /* Body bytes sent over all requests */
+  size_t bytes_sent() const { return bytes_sent_; }
+
+  /* Number of connections accepted */
+  uint32_t connections() const { return connections_; }
+
+  /* Number of sessions resumed from a ticket */
+  uint32_t resumptions() const { return resumptions_; }
+
+  /**
+   * @brief Invalidates the tickets issued so far, as a new certificate or
+   * ticket key would
+   */
+  void rotate_certificate();
+
+  /**
+   * @brief Closes the connection without replying after storing each of
+   * the next 'count' POSTs, as a reply lost on the way back
+   */
+  void drop_posts(uint32_t count) { drop_posts_ = count; }
+
+  /* POSTs stored, one per Idempotency-Key */
+  std::vector<HttpPost> posts();
+
+  /* POSTs repeating an Idempotency-Key already stored */
+  uint32_t duplicates() const { return duplicates_; }
+
+ private:
+  HttpServer(const HttpServer &) = delete;
+  HttpServer &operator=(const HttpServer &) = delete;
+
+  void accept_loop();
+  void handle(int fd);
+
+  /* Reads the client's ticket line and resumes or issues a session */
+  bool handshake(int fd, std::string &received);
+
+  /* Waits up to keep_alive_ms for the next request on a kept connection */
+  bool wait_request(int fd);
+
+  /* Serves one request read into 'request', false to close */
+  bool respond(int fd, const std::string &request, const std::string &body);
+
+  /* Stores a POST, false to drop the connection instead of replying */
+  bool store(const std::string &request, const std::string &body);
+  bool send_all(int fd, const char *data, size_t size);
+
+  /* Waits for the uplink to have room for 'size' more bytes */
+  void pace(size_t size);
+
+  std::string body_;
+  std::map<std::string, std::string> files_;
+  HttpServerOptions options_;
+  int listen_fd_;
+  uint16_t port_;
+  std::atomic<bool> running_;
+  std::atomic<uint32_t> requests_;
+  std::atomic<size_t> bytes_sent_;
+  std::atomic<uint32_t> connections_;
+  std::atomic<uint32_t> resumptions_;
+  std::atomic<uint32_t> drop_posts_;
+  std::atomic<uint32_t> duplicates_;
+  std::mutex posts_lock_;
+  std::vector<HttpPost> posts_;
+  std::mutex tickets_lock_;
+  std::map<std::string, uint32_t> tickets_;  // To the certificate issued under
+  uint32_t certificate_;
+  uint32_t next_ticket_;
+  std::thread acceptor_;
+  std::mutex workers_lock_;
+  std::vector<std::thread> workers_;
+  std::mutex pace_lock_;
+  std::chrono::steady_clock::time_point uplink_free_;
+};
+
+}  // namespace Host
+
+#endif
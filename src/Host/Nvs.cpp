@@ -0,0 +1,257 @@
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "idf/nvs.h"
+#include "idf/nvs_flash.h"
+
+enum NvsType {
+  NVS_TYPE_U8,
+  NVS_TYPE_I8,
+  NVS_TYPE_U16,
+  NVS_TYPE_I16,
+  NVS_TYPE_U32,
+  NVS_TYPE_I32,
+  NVS_TYPE_U64,
+  NVS_TYPE_I64,
+  NVS_TYPE_STR,
+  NVS_TYPE_BLOB
+};
+
+struct NvsItem {
+  NvsType type;
+  std::vector<uint8_t> data;
+};
+
+struct NvsHandle {
+  std::string name_space;
+  bool writable;
+};
+
+/* Entries are keyed by namespace, a NUL and the key */
+static std::mutex lock;
+static bool initialised = false;
+static std::map<std::string, NvsItem> items;
+static std::map<nvs_handle, NvsHandle> handles;
+static nvs_handle next_handle = 1;
+static uint32_t commit_us = 0;
+/* Read outside the lock, so the stalls do not serialise */
+static std::atomic<uint32_t> init_us(0);
+static std::atomic<uint32_t> read_us(0);
+
+static void stall(uint32_t us) {
+  if (us > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+}
+
+static bool valid_name(const char *name) {
+  return name != nullptr && name[0] != '\0' &&
+         strlen(name) <= NVS_KEY_NAME_MAX_SIZE;
+}
+
+/* Checks the handle and key and builds the entry key. Call with 'lock'
+ * held. */
+static esp_err_t find(nvs_handle handle, const char *key, bool write,
+                      std::string *out) {
+  auto it = handles.find(handle);
+  if (it == handles.end()) {
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  if (write && !it->second.writable) {
+    return ESP_ERR_NVS_READ_ONLY;
+  }
+  if (key != nullptr) {
+    if (!valid_name(key)) {
+      return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    *out = it->second.name_space + '\0' + key;
+  } else {
+    *out = it->second.name_space + '\0';
+  }
+  return ESP_OK;
+}
+
+static esp_err_t set(nvs_handle handle, const char *key, NvsType type,
+                     const void *value, size_t length) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string name;
+  esp_err_t result = find(handle, key, true, &name);
+  if (result != ESP_OK) {
+    return result;
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(value);
+  items[name] = NvsItem{type, std::vector<uint8_t>(bytes, bytes + length)};
+  return ESP_OK;
+}
+
+/* Gets a fixed size value. Other types under the same key are not found. */
+static esp_err_t get(nvs_handle handle, const char *key, NvsType type,
+                     void *out, size_t length) {
+  stall(read_us);
+  std::lock_guard<std::mutex> guard(lock);
+  std::string name;
+  esp_err_t result = find(handle, key, false, &name);
+  if (result != ESP_OK) {
+    return result;
+  }
+  auto it = items.find(name);
+  if (it == items.end() || it->second.type != type) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  memcpy(out, it->second.data.data(), length);
+  return ESP_OK;
+}
+
+/* Gets a variable size value into 'out', or its length if 'out' is null */
+static esp_err_t get_sized(nvs_handle handle, const char *key,
+                           NvsType type, void *out, size_t *length) {
+  if (length == nullptr) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  stall(read_us);
+  std::lock_guard<std::mutex> guard(lock);
+  std::string name;
+  esp_err_t result = find(handle, key, false, &name);
+  if (result != ESP_OK) {
+    return result;
+  }
+  auto it = items.find(name);
+  if (it == items.end() || it->second.type != type) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  const std::vector<uint8_t> &data = it->second.data;
+  if (out == nullptr) {
+    *length = data.size();
+    return ESP_OK;
+  }
+  if (*length < data.size()) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  memcpy(out, data.data(), data.size());
+  *length = data.size();
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_init() {
+  stall(init_us);
+  std::lock_guard<std::mutex> guard(lock);
+  initialised = true;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase() {
+  std::lock_guard<std::mutex> guard(lock);
+  items.clear();
+  handles.clear();
+  initialised = false;
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode,
+                   nvs_handle *out_handle) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (!initialised) {
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+  }
+  if (!valid_name(name)) {
+    return ESP_ERR_NVS_INVALID_NAME;
+  }
+  *out_handle = next_handle++;
+  handles[*out_handle] = NvsHandle{name, open_mode == NVS_READWRITE};
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle) {
+  std::lock_guard<std::mutex> guard(lock);
+  handles.erase(handle);
+}
+
+#define HOST_NVS_INT(suffix, type, item)                              \
+  esp_err_t nvs_set_##suffix(nvs_handle handle, const char *key,      \
+                             type value) {                            \
+    return set(handle, key, item, &value, sizeof(value));             \
+  }                                                                   \
+  esp_err_t nvs_get_##suffix(nvs_handle handle, const char *key,      \
+                             type *out_value) {                       \
+    return get(handle, key, item, out_value, sizeof(*out_value));     \
+  }
+
+HOST_NVS_INT(i8, int8_t, NVS_TYPE_I8)
+HOST_NVS_INT(u8, uint8_t, NVS_TYPE_U8)
+HOST_NVS_INT(i16, int16_t, NVS_TYPE_I16)
+HOST_NVS_INT(u16, uint16_t, NVS_TYPE_U16)
+HOST_NVS_INT(i32, int32_t, NVS_TYPE_I32)
+HOST_NVS_INT(u32, uint32_t, NVS_TYPE_U32)
+HOST_NVS_INT(i64, int64_t, NVS_TYPE_I64)
+HOST_NVS_INT(u64, uint64_t, NVS_TYPE_U64)
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value) {
+  return set(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value,
+                       size_t length) {
+  return set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value,
+                      size_t *length) {
+  return get_sized(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value,
+                       size_t *length) {
+  return get_sized(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string name;
+  esp_err_t result = find(handle, key, true, &name);
+  if (result != ESP_OK) {
+    return result;
+  }
+  return items.erase(name) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string prefix;
+  esp_err_t result = find(handle, nullptr, true, &prefix);
+  if (result != ESP_OK) {
+    return result;
+  }
+  auto it = items.lower_bound(prefix);
+  while (it != items.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0) {
+    it = items.erase(it);
+  }
+  return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+  uint32_t delay_us;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (handles.find(handle) == handles.end()) {
+      return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    delay_us = commit_us;
+  }
+  stall(delay_us);
+  return ESP_OK;
+}
+
+void Host::nvs_set_commit_us(uint32_t us) {
+  std::lock_guard<std::mutex> guard(lock);
+  commit_us = us;
+}
+
+void Host::nvs_set_init_us(uint32_t us) { init_us = us; }
+
+void Host::nvs_set_read_us(uint32_t us) { read_us = us; }
@@ -0,0 +1,85 @@
+#include <mutex>
+#include <random>
+#include "idf/esp_wifi.h"
+
+/* IDF 3.x sleeps 3 beacons in MAX_MODEM unless told otherwise */
+#define HOST_DEFAULT_LISTEN_INTERVAL 3
+
+struct WifiModel {
+  std::mutex lock;
+  std::mt19937 random{0x5eed};
+  wifi_ps_type_t ps = WIFI_PS_MIN_MODEM;
+  wifi_config_t config = {};
+  uint32_t beacon_us = 102400;
+  uint8_t dtim = 1;
+};
+
+static WifiModel &model() {
+  static WifiModel wifi;
+  return wifi;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) {
+  if (type > WIFI_PS_MAX_MODEM) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(model().lock);
+  model().ps = type;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type) {
+  if (type == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(model().lock);
+  *type = model().ps;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf) {
+  if (interface != ESP_IF_WIFI_STA || conf == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(model().lock);
+  model().config = *conf;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(esp_interface_t interface, wifi_config_t *conf) {
+  if (interface != ESP_IF_WIFI_STA || conf == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(model().lock);
+  *conf = model().config;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) { return ESP_OK; }
+
+void Host::wifi_set_beacon(uint32_t interval_us, uint8_t dtim) {
+  std::lock_guard<std::mutex> guard(model().lock);
+  model().beacon_us = interval_us;
+  model().dtim = dtim > 0 ? dtim : 1;
+}
+
+uint32_t Host::wifi_wake_delay_us() {
+  WifiModel &wifi = model();
+  std::lock_guard<std::mutex> guard(wifi.lock);
+  uint32_t beacons = 0;
+  switch (wifi.ps) {
+    case WIFI_PS_NONE:
+      return 0;
+    case WIFI_PS_MIN_MODEM:
+      beacons = wifi.dtim;
+      break;
+    case WIFI_PS_MAX_MODEM:
+      beacons = wifi.config.sta.listen_interval > 0
+                    ? wifi.config.sta.listen_interval
+                    : HOST_DEFAULT_LISTEN_INTERVAL;
+      break;
+  }
+  std::uniform_int_distribution<uint32_t> arrival(0,
+                                                  beacons * wifi.beacon_us - 1);
+  return arrival(wifi.random);
+}
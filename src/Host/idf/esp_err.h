@@ -0,0 +1,26 @@
+/**
+ * Native stand-in for the ESP-IDF header of the same name, so device modules
+ * can be built and benchmarked on the host. The error codes come from
+ * Port/Port.h.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_ESP_ERR_H__
+#define __HOST_ESP_ERR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Port/Port.h"
+
+#define ESP_ERROR_CHECK(x)                                          \
+  do {                                                              \
+    esp_err_t __err_rc = (x);                                       \
+    if (__err_rc != ESP_OK) {                                       \
+      fprintf(stderr, "ESP_ERROR_CHECK failed: 0x%x at %s:%d\n",    \
+              (unsigned)__err_rc, __FILE__, __LINE__);              \
+      abort();                                                      \
+    }                                                               \
+  } while (0)
+
+#endif
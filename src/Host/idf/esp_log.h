@@ -0,0 +1,29 @@
+/**
+ * Native stand-in for esp_log.h. Lines are printed to stdout in the device's
+ * "I (time) TAG: message" form. Debug and verbose levels compile to
+ * nothing, as with the default CONFIG_LOG_DEFAULT_LEVEL.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_ESP_LOG_H__
+#define __HOST_ESP_LOG_H__
+
+#include <stdio.h>
+#include "Port/Port.h"
+
+#define HOST_LOG(letter, tag, format, ...)                            \
+  printf(#letter " (%u) %s: " format "\n",                            \
+         (unsigned)(Port::micros() / 1000), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(E, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(W, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(I, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) \
+  do {                             \
+  } while (0)
+#define ESP_LOGV(tag, format, ...) \
+  do {                             \
+  } while (0)
+
+#endif
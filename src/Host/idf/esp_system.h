@@ -0,0 +1,21 @@
+/**
+ * Native stand-in for esp_system.h, which device modules include for
+ * esp_err_t and esp_random().
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_ESP_SYSTEM_H__
+#define __HOST_ESP_SYSTEM_H__
+
+#include <stdint.h>
+#include <random>
+#include "esp_err.h"
+
+/* The hardware RNG on the device */
+inline uint32_t esp_random() {
+  static std::random_device device;
+  return device();
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * Native stand-in for the power save part of the esp_wifi.h API of ESP-IDF
+ * 3.x. There is no radio, the station's sleep is modelled instead: a frame
+ * sent to it waits for its next wake, see Host::wifi_wake_delay_us(). The
+ * beacon interval and DTIM period of the access point are Host:: setters.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_ESP_WIFI_H__
+#define __HOST_ESP_WIFI_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef enum {
+  ESP_IF_WIFI_STA = 0,
+  ESP_IF_WIFI_AP,
+} esp_interface_t;
+
+/* The station fields the stand-in keeps */
+typedef struct {
+  uint16_t listen_interval; /*!< Beacons between MAX_MODEM wakes, 0 for 3 */
+} wifi_sta_config_t;
+
+typedef union {
+  wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef enum {
+  WIFI_STORAGE_FLASH,
+  WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type);
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_get_config(esp_interface_t interface, wifi_config_t *conf);
+
+/* Accepted and ignored, nothing is persisted */
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+
+namespace Host {
+
+/**
+ * @brief Sets the access point's beacon interval and DTIM period. The
+ * default is 102400 us, 100 TU, and 1.
+ */
+void wifi_set_beacon(uint32_t interval_us, uint8_t dtim);
+
+/**
+ * @brief Gets how long a frame arriving now waits for the station to wake,
+ * under the current power save type. Wakes are every DTIM for MIN_MODEM and
+ * every listen interval for MAX_MODEM, the frame arrives at a random point
+ * between two.
+ */
+uint32_t wifi_wake_delay_us();
+
+}  // namespace Host
+
+#endif
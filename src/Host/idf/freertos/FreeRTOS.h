@@ -0,0 +1,32 @@
+/**
+ * Native stand-in for the parts of FreeRTOS used by device modules. Ticks
+ * advance with the host clock at the device's tick rate, so delays round
+ * to ticks as they do on the ESP32.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CONFIG_FREERTOS_HZ from sdkconfig.h */
+#define configTICK_RATE_HZ 100
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) \
+  ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#endif
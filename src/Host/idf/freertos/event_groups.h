@@ -0,0 +1,45 @@
+/**
+ * Native stand-in for freertos/event_groups.h. See FreeRTOS.h.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_FREERTOS_EVENT_GROUPS_H__
+#define __HOST_FREERTOS_EVENT_GROUPS_H__
+
+#include <condition_variable>
+#include <mutex>
+#include "FreeRTOS.h"
+
+typedef TickType_t EventBits_t;
+
+struct HostEventGroup {
+  std::mutex mutex;
+  std::condition_variable cond;
+  EventBits_t bits = 0;
+  bool is_static = false;
+};
+typedef struct HostEventGroup *EventGroupHandle_t;
+
+/* Storage for xEventGroupCreateStatic(), constructed by it */
+typedef struct {
+  alignas(HostEventGroup) unsigned char storage[sizeof(HostEventGroup)];
+} StaticEventGroup_t;
+
+EventGroupHandle_t xEventGroupCreate();
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer);
+void vEventGroupDelete(EventGroupHandle_t group);
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+
+/**
+ * Blocks until any, or with 'wait_for_all' every, bit of 'bits' is set or
+ * 'ticks' pass. Returns the bits before clearing.
+ */
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks);
+
+#endif
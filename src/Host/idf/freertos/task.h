@@ -0,0 +1,23 @@
+/**
+ * Native stand-in for freertos/task.h, delays only. See FreeRTOS.h.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_FREERTOS_TASK_H__
+#define __HOST_FREERTOS_TASK_H__
+
+#include "FreeRTOS.h"
+
+/* Ticks since the first call */
+TickType_t xTaskGetTickCount();
+
+/* Blocks until the tick count has advanced by 'ticks', so the first tick
+ * may be partial */
+void vTaskDelay(TickType_t ticks);
+
+/* Blocks until tick '*previous_wake + increment', then stores it in
+ * '*previous_wake' */
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * Native stand-in for the lwIP resolver. Like lwIP, it answers from a cache
+ * when it can and otherwise calls back later from its own thread. Lookups
+ * take the time set with Host::dns_set_latency_ms(). Names under
+ * ".invalid" fail, others resolve to a fixed address made from the name,
+ * and "localhost" to 127.0.0.1.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_LWIP_DNS_H__
+#define __HOST_LWIP_DNS_H__
+
+#include <stdint.h>
+#include "err.h"
+#include "ip_addr.h"
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr,
+                                   void *callback_arg);
+
+/**
+ * @return
+ *  - ERR_OK          Cached, 'addr' holds the address
+ *  - ERR_INPROGRESS  'found' will be called with the address, or nullptr if
+ *                    the name does not resolve
+ *  - ERR_ARG         Empty or overlong name
+ */
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+                        dns_found_callback found, void *callback_arg);
+
+namespace Host {
+
+/**
+ * @brief Sets the time uncached lookups take
+ */
+void dns_set_latency_ms(uint32_t ms);
+
+/**
+ * @brief Forgets cached answers
+ */
+void dns_flush();
+
+}  // namespace Host
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * Native stand-in for lwip/ip4_addr.h, with the IPSTR helpers ESP-IDF adds.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_LWIP_IP4_ADDR_H__
+#define __HOST_LWIP_IP4_ADDR_H__
+
+#include <stdint.h>
+
+/* In network byte order */
+typedef struct ip4_addr {
+  uint32_t addr;
+} ip4_addr_t;
+
+#define ip4_addr_get_byte(ipaddr, idx) \
+  (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define ip4_addr1(ipaddr) ip4_addr_get_byte(ipaddr, 0)
+#define ip4_addr2(ipaddr) ip4_addr_get_byte(ipaddr, 1)
+#define ip4_addr3(ipaddr) ip4_addr_get_byte(ipaddr, 2)
+#define ip4_addr4(ipaddr) ip4_addr_get_byte(ipaddr, 3)
+#define ip4_addr1_16(ipaddr) ((uint16_t)ip4_addr1(ipaddr))
+#define ip4_addr2_16(ipaddr) ((uint16_t)ip4_addr2(ipaddr))
+#define ip4_addr3_16(ipaddr) ((uint16_t)ip4_addr3(ipaddr))
+#define ip4_addr4_16(ipaddr) ((uint16_t)ip4_addr4(ipaddr))
+
+#define IP2STR(ipaddr)                                              \
+  ip4_addr1_16(ipaddr), ip4_addr2_16(ipaddr), ip4_addr3_16(ipaddr), \
+      ip4_addr4_16(ipaddr)
+#define IPSTR "%d.%d.%d.%d"
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * Native stand-in for lwip/ip_addr.h, IPv4 only.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_LWIP_IP_ADDR_H__
+#define __HOST_LWIP_IP_ADDR_H__
+
+#include "ip4_addr.h"
+
+#define IPADDR_TYPE_V4 0U
+
+typedef struct ip_addr {
+  union {
+    ip4_addr_t ip4;
+  } u_addr;
+  uint8_t type;
+} ip_addr_t;
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * Native stand-in for the NVS API of ESP-IDF 3.x, keeping entries in memory.
+ * Typed reads of a key written with another type fail with
+ * ESP_ERR_NVS_NOT_FOUND, as on the device. Initialisation, reads and
+ * commits can be slowed with the Host:: setters to model the flash.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_NVS_H__
+#define __HOST_NVS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_REMOVE_FAILED (ESP_ERR_NVS_BASE + 0x08)
+#define ESP_ERR_NVS_KEY_TOO_LONG (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_PAGE_FULL (ESP_ERR_NVS_BASE + 0x0a)
+#define ESP_ERR_NVS_INVALID_STATE (ESP_ERR_NVS_BASE + 0x0b)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_VALUE_TOO_LONG (ESP_ERR_NVS_BASE + 0x0e)
+
+/* Longest key or namespace name, without the terminator */
+#define NVS_KEY_NAME_MAX_SIZE 15
+
+typedef uint32_t nvs_handle;
+
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode,
+                   nvs_handle *out_handle);
+void nvs_close(nvs_handle handle);
+
+esp_err_t nvs_set_i8(nvs_handle handle, const char *key, int8_t value);
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value);
+esp_err_t nvs_set_i16(nvs_handle handle, const char *key, int16_t value);
+esp_err_t nvs_set_u16(nvs_handle handle, const char *key, uint16_t value);
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value);
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+esp_err_t nvs_set_i64(nvs_handle handle, const char *key, int64_t value);
+esp_err_t nvs_set_u64(nvs_handle handle, const char *key, uint64_t value);
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value,
+                       size_t length);
+
+esp_err_t nvs_get_i8(nvs_handle handle, const char *key, int8_t *out_value);
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *out_value);
+esp_err_t nvs_get_i16(nvs_handle handle, const char *key, int16_t *out_value);
+esp_err_t nvs_get_u16(nvs_handle handle, const char *key,
+                      uint16_t *out_value);
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *out_value);
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key,
+                      uint32_t *out_value);
+esp_err_t nvs_get_i64(nvs_handle handle, const char *key, int64_t *out_value);
+esp_err_t nvs_get_u64(nvs_handle handle, const char *key,
+                      uint64_t *out_value);
+
+/* As on the device, pass a null 'out_value' to get the length only */
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value,
+                      size_t *length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value,
+                       size_t *length);
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+esp_err_t nvs_erase_all(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+
+namespace Host {
+
+/**
+ * @brief Sets the time every nvs_commit() blocks for
+ */
+void nvs_set_commit_us(uint32_t us);
+
+/**
+ * @brief Sets the time nvs_flash_init() blocks for, the page scan
+ */
+void nvs_set_init_us(uint32_t us);
+
+/**
+ * @brief Sets the time every nvs_get_*() blocks for
+ */
+void nvs_set_read_us(uint32_t us);
+
+}  // namespace Host
+
+#endif
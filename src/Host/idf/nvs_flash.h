@@ -0,0 +1,17 @@
+/**
+ * Native stand-in for nvs_flash.h, see nvs.h.
+ *
+ * Native only, excluded from device builds.
+ */
+
+#ifndef __HOST_NVS_FLASH_H__
+#define __HOST_NVS_FLASH_H__
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init();
+
+/* Drops every entry, the partition must be initialised again */
+esp_err_t nvs_flash_erase();
+
+#endif
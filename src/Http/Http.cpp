@@ -0,0 +1,94 @@
+#include "Http.h"
+#include <string.h>
+#include <new>
+#include "Tls/SessionCache.h"
+#include "esp_log.h"
+
+namespace Http {
+static const char *TAG = "Http";
+
+static EspConnector connector;
+static Pool shared(connector);
+}  // namespace Http
+
+Http::EspConnection::EspConnection(const char *url, const char *cert_pem)
+    : used_(false) {
+  esp_http_client_config_t config = {};
+  config.url = url;
+  config.cert_pem = cert_pem;
+  client_ = esp_http_client_init(&config);
+}
+
+Http::EspConnection::~EspConnection() {
+  if (client_ != nullptr) {
+    esp_http_client_cleanup(client_);
+  }
+}
+
+bool Http::EspConnection::reusable() {
+  return client_ != nullptr &&
+         esp_http_client_is_complete_data_received(client_);
+}
+
+esp_err_t Http::EspConnection::open(const char *url, int write_len) {
+  /* Keeps the connection if the host is unchanged */
+  esp_http_client_set_url(client_, url);
+  bool fresh = !used_;
+  uint64_t start = Port::micros();
+  esp_err_t err = esp_http_client_open(client_, write_len);
+  if (err != ESP_OK && used_) {
+    ESP_LOGW(TAG, "Kept connection failed (%i), reconnecting", err);
+    esp_http_client_close(client_);
+    fresh = true;
+    start = Port::micros();
+    err = esp_http_client_open(client_, write_len);
+  }
+  used_ = true;
+  /* The TCP connect and the request head are timed with it */
+  if (err == ESP_OK && fresh && strncmp(url, "https://", 8) == 0) {
+    Tls::record_handshake(Port::micros() - start, false);
+  }
+  return err;
+}
+
+Http::Connection *Http::EspConnector::create(const char *url,
+                                             const char *cert_pem) {
+  EspConnection *connection = new (std::nothrow) EspConnection(url, cert_pem);
+  if (connection != nullptr && connection->handle() == nullptr) {
+    delete connection;
+    connection = nullptr;
+  }
+  return connection;
+}
+
+void Http::EspConnector::destroy(Connection *connection) { delete connection; }
+
+Http::Pool &Http::pool() { return shared; }
+
+Http::Session::Session(const char *url, const char *cert_pem)
+    : url_(url),
+      connection_(static_cast<EspConnection *>(shared.acquire(url, cert_pem))) {
+}
+
+Http::Session::~Session() {
+  if (connection_ != nullptr) {
+    shared.release(connection_, connection_->reusable());
+  }
+}
+
+esp_http_client_handle_t Http::Session::client() {
+  return connection_ != nullptr ? connection_->handle() : nullptr;
+}
+
+esp_err_t Http::Session::open(int write_len) {
+  if (connection_ == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  return connection_->open(url_, write_len);
+}
+
+void Http::Session::close() {
+  if (connection_ != nullptr && !connection_->reusable()) {
+    esp_http_client_close(connection_->handle());
+  }
+}
@@ -0,0 +1,102 @@
+/**
+ * esp_http_client connections from a shared keep-alive pool, for the OTA
+ * downloads and the application's own requests:
+ *
+ *   Http::Session session(url, cert_pem);
+ *   esp_http_client_handle_t client = session.client();
+ *   session.open();
+ *   esp_http_client_fetch_headers(client);
+ *   ... esp_http_client_read() to the end of the body ...
+ *
+ * The session goes back to the pool when it is destroyed, and its
+ * connection is kept if the body was read to the end. A later session to
+ * the same host then skips the TCP connect and TLS handshake.
+ */
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "Pool.h"
+#include "esp_http_client.h"
+
+namespace Http {
+
+/**
+ * A pooled esp_http_client handle
+ */
+class EspConnection : public Connection {
+ public:
+  EspConnection(const char *url, const char *cert_pem);
+  ~EspConnection();
+
+  /**
+   * @brief The transport cannot be polled, so this only checks the last
+   * response was read to the end. A connection the server dropped while
+   * idle shows up in open(), which retries it once.
+   */
+  bool reusable() override;
+
+  /**
+   * @brief Points the handle at 'url' and sends the request head. Retries
+   * once on a new connection if a reused one fails.
+   *
+   * @return As esp_http_client_open()
+   */
+  esp_err_t open(const char *url, int write_len = 0);
+
+  esp_http_client_handle_t handle() { return client_; }
+
+ private:
+  esp_http_client_handle_t client_;
+  bool used_;
+};
+
+class EspConnector : public Connector {
+ public:
+  Connection *create(const char *url, const char *cert_pem) override;
+  void destroy(Connection *connection) override;
+};
+
+/**
+ * @brief Gets the pool shared by every Session
+ */
+Pool &pool();
+
+/**
+ * A connection taken from pool() for one or more requests to a host
+ */
+class Session {
+ public:
+  Session(const char *url, const char *cert_pem = nullptr);
+  ~Session();
+
+  /**
+   * @brief Gets the handle, nullptr if out of memory. Its URL is set by
+   * open(), set headers on it as usual.
+   */
+  esp_http_client_handle_t client();
+
+  /**
+   * @brief Sends a request for the URL given to the constructor
+   *
+   * @return As esp_http_client_open(), ESP_ERR_NO_MEM without a handle
+   */
+  esp_err_t open(int write_len = 0);
+
+  /**
+   * @brief Closes the connection unless its response was read to the end,
+   * in which case it is left open for the next request
+   */
+  void close();
+
+ private:
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  const char *url_;
+  EspConnection *connection_;
+};
+
+}  // namespace Http
+
+#endif
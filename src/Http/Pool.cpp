@@ -0,0 +1,159 @@
+#include "Pool.h"
+#include <stdio.h>
+#include <string.h>
+#include "Metrics/Metrics.h"
+
+namespace Http {
+static Metrics::Counter connects("http.connects");
+static Metrics::Counter reuses("http.reuses");
+static Metrics::Counter evictions("http.evictions");
+}  // namespace Http
+
+esp_err_t Http::host_key(const char *url, char *dest, size_t size) {
+  const char *scheme;
+  const char *port;
+  if (strncmp(url, "https://", 8) == 0) {
+    scheme = "https://";
+    port = ":443";
+  } else if (strncmp(url, "http://", 7) == 0) {
+    scheme = "http://";
+    port = ":80";
+  } else {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const char *host = url + strlen(scheme);
+  size_t length = strcspn(host, "/?#");
+  if (length == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (memchr(host, ':', length) != nullptr) {
+    port = "";
+  }
+  int n = snprintf(dest, size, "%s%.*s%s", scheme, (int)length, host, port);
+  return n >= 0 && (size_t)n < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+Http::Pool::Pool(Connector &connector, size_t max_idle, uint32_t idle_ms)
+    : connector_(connector),
+      max_idle_(max_idle < HTTP_POOL_MAX_IDLE ? max_idle : HTTP_POOL_MAX_IDLE),
+      idle_ms_(idle_ms),
+      count_(0) {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+Http::Pool::~Pool() { clear(); }
+
+Http::Connection *Http::Pool::take(const char *key, const char *cert_pem) {
+  size_t best = count_;
+  for (size_t i = 0; i < count_; i++) {
+    if (idle_[i]->cert_ == cert_pem && strcmp(idle_[i]->key_, key) == 0 &&
+        (best == count_ || idle_[i]->used_us_ > idle_[best]->used_us_)) {
+      best = i;
+    }
+  }
+  if (best == count_) {
+    return nullptr;
+  }
+  Connection *connection = idle_[best];
+  idle_[best] = idle_[--count_];
+  return connection;
+}
+
+Http::Connection *Http::Pool::acquire(const char *url, const char *cert_pem) {
+  char key[HTTP_POOL_KEY_SIZE];
+  if (host_key(url, key, sizeof(key)) != ESP_OK) {
+    return nullptr;
+  }
+
+  for (;;) {
+    Connection *connection;
+    {
+      Port::Lock guard(lock_);
+      connection = take(key, cert_pem);
+    }
+    if (connection == nullptr) {
+      break;
+    }
+    /* Checked without the lock, reusable() may be a system call */
+    uint64_t idle_us = Port::micros() - connection->used_us_;
+    if (idle_us <= (uint64_t)idle_ms_ * 1000 && connection->reusable()) {
+      Port::Lock guard(lock_);
+      stats_.reused++;
+      reuses.add();
+      return connection;
+    }
+    {
+      Port::Lock guard(lock_);
+      stats_.stale++;
+    }
+    connector_.destroy(connection);
+  }
+
+  Connection *connection = connector_.create(url, cert_pem);
+  if (connection == nullptr) {
+    return nullptr;
+  }
+  memcpy(connection->key_, key, sizeof(key));
+  connection->cert_ = cert_pem;
+  Port::Lock guard(lock_);
+  stats_.created++;
+  connects.add();
+  return connection;
+}
+
+void Http::Pool::release(Connection *connection, bool keep) {
+  if (connection == nullptr) {
+    return;
+  }
+  if (!keep || max_idle_ == 0) {
+    connector_.destroy(connection);
+    return;
+  }
+
+  connection->used_us_ = Port::micros();
+  Connection *evicted = nullptr;
+  {
+    Port::Lock guard(lock_);
+    if (count_ == max_idle_) {
+      /* Least recently used */
+      size_t oldest = 0;
+      for (size_t i = 1; i < count_; i++) {
+        if (idle_[i]->used_us_ < idle_[oldest]->used_us_) {
+          oldest = i;
+        }
+      }
+      evicted = idle_[oldest];
+      idle_[oldest] = idle_[--count_];
+      stats_.evicted++;
+      evictions.add();
+    }
+    idle_[count_++] = connection;
+  }
+  if (evicted != nullptr) {
+    connector_.destroy(evicted);
+  }
+}
+
+void Http::Pool::clear() {
+  for (;;) {
+    Connection *connection;
+    {
+      Port::Lock guard(lock_);
+      if (count_ == 0) {
+        return;
+      }
+      connection = idle_[--count_];
+    }
+    connector_.destroy(connection);
+  }
+}
+
+size_t Http::Pool::idle() {
+  Port::Lock guard(lock_);
+  return count_;
+}
+
+Http::PoolStats Http::Pool::stats() {
+  Port::Lock guard(lock_);
+  return stats_;
+}
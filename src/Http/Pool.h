@@ -0,0 +1,162 @@
+/**
+ * Keep-alive connection pool. A TLS handshake costs the ESP32 one to three
+ * seconds, so requests to a host reuse an idle connection to it rather
+ * than connecting again:
+ *
+ *   Http::Connection *conn = pool.acquire(url, cert_pem);
+ *   ... request on conn, read the whole body ...
+ *   pool.release(conn, true);
+ *
+ * Idle connections are keyed by scheme, host and port, and by the CA
+ * certificate they were checked against. At most 'max_idle' are kept; a
+ * release past that closes the least recently used one. Each is checked
+ * with reusable() before it is handed out again, and one idle for longer
+ * than 'idle_ms' is closed instead, as the server has likely dropped it.
+ *
+ * The pool is platform independent. Connector makes the connections, over
+ * esp_http_client on the device (Http.h) and POSIX sockets natively.
+ */
+
+#ifndef __HTTP_POOL_H__
+#define __HTTP_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+/* Idle connections kept. An mbedTLS session holds about 40 KiB of heap. */
+#ifndef HTTP_POOL_MAX_IDLE
+#ifdef ESP_PLATFORM
+#define HTTP_POOL_MAX_IDLE 2
+#else
+#define HTTP_POOL_MAX_IDLE 4
+#endif
+#endif
+
+/* Below the keep-alive timeout of common servers, Apache's is 5 s */
+#ifndef HTTP_POOL_IDLE_MS
+#define HTTP_POOL_IDLE_MS 4000
+#endif
+
+/* "https://host:port" with the terminator */
+#define HTTP_POOL_KEY_SIZE 72
+
+namespace Http {
+
+/**
+ * One connection the pool can hold between requests
+ */
+class Connection {
+ public:
+  Connection() : cert_(nullptr), used_us_(0) { key_[0] = '\0'; }
+  virtual ~Connection() {}
+
+  /**
+   * @brief Checks that an idle connection can take another request, without
+   * blocking. False if the peer closed it or a response was left unread.
+   */
+  virtual bool reusable() = 0;
+
+  /* "scheme://host:port" it connects to */
+  const char *key() const { return key_; }
+
+ private:
+  friend class Pool;
+
+  char key_[HTTP_POOL_KEY_SIZE];
+  const char *cert_;
+  uint64_t used_us_;
+};
+
+/**
+ * Makes and closes the pool's connections
+ */
+class Connector {
+ public:
+  virtual ~Connector() {}
+
+  /**
+   * @brief Makes a connection for requests to 'url'. It may connect lazily,
+   * on the first request.
+   *
+   * @return nullptr if out of memory
+   */
+  virtual Connection *create(const char *url, const char *cert_pem) = 0;
+
+  virtual void destroy(Connection *connection) = 0;
+};
+
+struct PoolStats {
+  uint32_t created;  /*!< Connections made */
+  uint32_t reused;   /*!< Requests served by an idle connection */
+  uint32_t evicted;  /*!< Closed to stay within max_idle */
+  uint32_t stale;    /*!< Closed when found expired or not reusable */
+};
+
+/**
+ * @brief Gets "scheme://host:port" of 'url', with the scheme's default port
+ * if it names none
+ *
+ * @return
+ *  - ESP_OK                The key is in 'dest'
+ *  - ESP_ERR_INVALID_ARG   'url' is not http:// or https://
+ *  - ESP_ERR_INVALID_SIZE  The key does not fit 'size'
+ */
+esp_err_t host_key(const char *url, char *dest, size_t size);
+
+class Pool {
+ public:
+  /**
+   * @param max_idle  Idle connections kept, at most HTTP_POOL_MAX_IDLE
+   * @param idle_ms   How long one may stay idle and still be reused
+   */
+  explicit Pool(Connector &connector, size_t max_idle = HTTP_POOL_MAX_IDLE,
+                uint32_t idle_ms = HTTP_POOL_IDLE_MS);
+  ~Pool();
+
+  /**
+   * @brief Gets a connection for 'url', an idle one to its host if any is
+   * still reusable, else a new one
+   *
+   * @return nullptr if 'url' is malformed or out of memory
+   */
+  Connection *acquire(const char *url, const char *cert_pem = nullptr);
+
+  /**
+   * @brief Returns a connection from acquire()
+   *
+   * @param keep  true if its last response was read to the end, so it can
+   *              take another request. Else it is closed.
+   */
+  void release(Connection *connection, bool keep);
+
+  /**
+   * @brief Closes the idle connections, before sleeping say
+   */
+  void clear();
+
+  /* Number of idle connections */
+  size_t idle();
+
+  PoolStats stats();
+
+ private:
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  /* Takes the most recently used idle connection matching, call with
+   * 'lock_' held */
+  Connection *take(const char *key, const char *cert_pem);
+
+  Connector &connector_;
+  size_t max_idle_;
+  uint32_t idle_ms_;
+  Connection *idle_[HTTP_POOL_MAX_IDLE];
+  size_t count_;
+  PoolStats stats_;
+  Port::Mutex lock_;
+};
+
+}  // namespace Http
+
+#endif
@@ -0,0 +1,340 @@
+#include "TlsConnection.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include "Port/Port.h"
+#include "Tls/SessionCache.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+namespace Http {
+static const char *TAG = "Tls";
+
+/* The mbedTLS of ESP-IDF 3.x has no mbedtls_ssl_session_save(), so the
+ * fields a client resumes with are copied out, followed by the ticket. The
+ * peer certificate is left out, a resumed session does not check it. */
+struct SavedSession {
+  int32_t ciphersuite;
+  int32_t compression;
+  uint32_t verify_result;
+  uint32_t ticket_lifetime;
+  uint16_t ticket_len;
+  uint8_t id_len;
+  uint8_t mfl_code;
+  uint8_t encrypt_then_mac;
+  uint8_t trunc_hmac;
+  uint8_t reserved[2];
+  uint8_t id[32];
+  uint8_t master[48];
+};
+
+/* Copies 'session' into 'dest', returning the size or 0 if it does not
+ * fit 'capacity' */
+static size_t save_session(const mbedtls_ssl_session &session, uint8_t *dest,
+                           size_t capacity) {
+  SavedSession saved;
+  memset(&saved, 0, sizeof(saved));
+  saved.ciphersuite = session.ciphersuite;
+  saved.compression = session.compression;
+  saved.verify_result = session.verify_result;
+  saved.id_len = session.id_len;
+  memcpy(saved.id, session.id, sizeof(saved.id));
+  memcpy(saved.master, session.master, sizeof(saved.master));
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  saved.ticket_lifetime = session.ticket_lifetime;
+  saved.ticket_len = session.ticket != nullptr ? session.ticket_len : 0;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  saved.mfl_code = session.mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+  saved.encrypt_then_mac = session.encrypt_then_mac;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+  saved.trunc_hmac = session.trunc_hmac;
+#endif
+  size_t size = sizeof(saved) + saved.ticket_len;
+  if (size > capacity) {
+    return 0;
+  }
+  memcpy(dest, &saved, sizeof(saved));
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  if (saved.ticket_len > 0) {
+    memcpy(dest + sizeof(saved), session.ticket, saved.ticket_len);
+  }
+#endif
+  return size;
+}
+
+/* Fills 'session' from save_session(). Its ticket points into 'src', so
+ * wipe it rather than mbedtls_ssl_session_free() it. */
+static bool load_session(uint8_t *src, size_t size,
+                         mbedtls_ssl_session &session) {
+  SavedSession saved;
+  if (size < sizeof(saved)) {
+    return false;
+  }
+  memcpy(&saved, src, sizeof(saved));
+  if (size != sizeof(saved) + saved.ticket_len ||
+      saved.id_len > sizeof(saved.id)) {
+    return false;
+  }
+  memset(&session, 0, sizeof(session));
+#if defined(MBEDTLS_HAVE_TIME)
+  session.start = time(nullptr);
+#endif
+  session.ciphersuite = saved.ciphersuite;
+  session.compression = saved.compression;
+  session.verify_result = saved.verify_result;
+  session.id_len = saved.id_len;
+  memcpy(session.id, saved.id, sizeof(saved.id));
+  memcpy(session.master, saved.master, sizeof(saved.master));
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  session.ticket_lifetime = saved.ticket_lifetime;
+  if (saved.ticket_len > 0) {
+    session.ticket = src + sizeof(saved);
+    session.ticket_len = saved.ticket_len;
+  }
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  session.mfl_code = saved.mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+  session.encrypt_then_mac = saved.encrypt_then_mac;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+  session.trunc_hmac = saved.trunc_hmac;
+#endif
+  return true;
+}
+
+static uint32_t lifetime_s(const mbedtls_ssl_session &session) {
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  return session.ticket != nullptr ? session.ticket_lifetime : 0;
+#else
+  return 0;
+#endif
+}
+}  // namespace Http
+
+Http::TlsConnection::TlsConnection(const char *url, const char *cert_pem)
+    : cert_pem_(cert_pem), ready_(false), connected_(false), resumed_(false) {
+  mbedtls_net_init(&net_);
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  mbedtls_x509_crt_init(&ca_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_ctr_drbg_init(&drbg_);
+
+  /* host_key() adds the default port, split it off again */
+  char key[HTTP_POOL_KEY_SIZE];
+  if (strncmp(url, "https://", 8) != 0 ||
+      host_key(url, key, sizeof(key)) != ESP_OK) {
+    ESP_LOGE(TAG, "Not an https URL: %s", url);
+    return;
+  }
+  char *host = key + 8;
+  char *colon = strrchr(host, ':');
+  if (colon == nullptr || strlen(colon + 1) >= sizeof(port_)) {
+    ESP_LOGE(TAG, "Bad port in %s", url);
+    return;
+  }
+  *colon = '\0';
+  strcpy(host_, host);
+  strcpy(port_, colon + 1);
+
+  int ret = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_,
+                                  nullptr, 0);
+  if (ret == 0) {
+    ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (ret == 0 && cert_pem != nullptr) {
+    ret = mbedtls_x509_crt_parse(&ca_, (const unsigned char *)cert_pem,
+                                 strlen(cert_pem) + 1);
+  }
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Error (-0x%04x) setting up TLS", -ret);
+    return;
+  }
+  if (cert_pem != nullptr) {
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&conf_, &ca_, nullptr);
+  } else {
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+  }
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+  mbedtls_ssl_conf_read_timeout(&conf_, HTTP_TLS_TIMEOUT_MS);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&conf_,
+                                   MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+  ret = mbedtls_ssl_setup(&ssl_, &conf_);
+  if (ret == 0) {
+    ret = mbedtls_ssl_set_hostname(&ssl_, host_);
+  }
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Error (-0x%04x) setting up TLS", -ret);
+    return;
+  }
+  mbedtls_ssl_set_bio(&ssl_, &net_, mbedtls_net_send, nullptr,
+                      mbedtls_net_recv_timeout);
+  ready_ = true;
+}
+
+Http::TlsConnection::~TlsConnection() {
+  close();
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  mbedtls_x509_crt_free(&ca_);
+  mbedtls_ctr_drbg_free(&drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+bool Http::TlsConnection::reusable() {
+  if (!connected_ || mbedtls_ssl_get_bytes_avail(&ssl_) > 0) {
+    return false;
+  }
+  /* Nothing to read and not closed by the peer */
+  char byte;
+  ssize_t n = recv(net_.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+esp_err_t Http::TlsConnection::connect() {
+  if (connected_) {
+    return ESP_OK;
+  }
+  if (!ready_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = handshake(true);
+  if (err == ESP_ERR_INVALID_RESPONSE) {
+    ESP_LOGW(TAG, "Cached session for %s failed, handshaking in full",
+             key());
+    Tls::forget(key());
+    err = handshake(false);
+  }
+  return err == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+/* ESP_ERR_INVALID_RESPONSE if the handshake failed on an offered session */
+esp_err_t Http::TlsConnection::handshake(bool offer) {
+  int ret = mbedtls_net_connect(&net_, host_, port_, MBEDTLS_NET_PROTO_TCP);
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Error (-0x%04x) connecting to %s", -ret, key());
+    return ESP_FAIL;
+  }
+
+  uint32_t now_s = time(nullptr);
+  uint8_t blob[TLS_SESSION_MAX_SIZE];
+  size_t size;
+  mbedtls_ssl_session offered;
+  mbedtls_ssl_session_init(&offered);
+  bool offering =
+      offer &&
+      Tls::find(key(), cert_pem_, now_s, blob, sizeof(blob), &size) ==
+          ESP_OK &&
+      load_session(blob, size, offered) &&
+      mbedtls_ssl_set_session(&ssl_, &offered) == 0;
+
+  uint64_t start = Port::micros();
+  do {
+    ret = mbedtls_ssl_handshake(&ssl_);
+  } while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+           ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+  uint32_t us = Port::micros() - start;
+
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Error (-0x%04x) in handshake with %s", -ret, key());
+    memset(&offered, 0, sizeof(offered));
+    close();
+    return offering ? ESP_ERR_INVALID_RESPONSE : ESP_FAIL;
+  }
+  connected_ = true;
+
+  /* A resumed session keeps its master secret, a new one does not */
+  mbedtls_ssl_session current;
+  mbedtls_ssl_session_init(&current);
+  if (mbedtls_ssl_get_session(&ssl_, &current) == 0) {
+    resumed_ = offering && memcmp(current.master, offered.master,
+                                  sizeof(current.master)) == 0;
+    if (!resumed_) {
+      size = save_session(current, blob, sizeof(blob));
+      if (size > 0) {
+        Tls::store(key(), cert_pem_, blob, size, now_s, lifetime_s(current));
+      } else {
+        ESP_LOGD(TAG, "Session for %s too large to cache", key());
+      }
+    }
+  }
+  mbedtls_ssl_session_free(&current);
+  memset(&offered, 0, sizeof(offered));
+  memset(blob, 0, sizeof(blob));
+
+  Tls::record_handshake(us, resumed_);
+  return ESP_OK;
+}
+
+int Http::TlsConnection::write(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  size_t sent = 0;
+  while (sent < size) {
+    int ret = mbedtls_ssl_write(&ssl_, p + sent, size - sent);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      continue;
+    }
+    if (ret < 0) {
+      ESP_LOGE(TAG, "Error (-0x%04x) writing to %s", -ret, key());
+      close();
+      return -1;
+    }
+    sent += ret;
+  }
+  return size;
+}
+
+int Http::TlsConnection::read(void *dest, size_t size) {
+  int ret;
+  do {
+    ret = mbedtls_ssl_read(&ssl_, static_cast<unsigned char *>(dest), size);
+  } while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+           ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+  if (ret > 0) {
+    return ret;
+  }
+  if (ret != 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+    ESP_LOGE(TAG, "Error (-0x%04x) reading from %s", -ret, key());
+  }
+  close();
+  return ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ? 0 : -1;
+}
+
+void Http::TlsConnection::close() {
+  if (connected_) {
+    mbedtls_ssl_close_notify(&ssl_);
+  }
+  mbedtls_net_free(&net_);
+  if (ready_) {
+    mbedtls_ssl_session_reset(&ssl_);
+  }
+  connected_ = false;
+  resumed_ = false;
+}
+
+Http::Connection *Http::TlsConnector::create(const char *url,
+                                             const char *cert_pem) {
+  TlsConnection *connection = new (std::nothrow) TlsConnection(url, cert_pem);
+  if (connection != nullptr && !connection->ready()) {
+    delete connection;
+    connection = nullptr;
+  }
+  return connection;
+}
+
+void Http::TlsConnector::destroy(Connection *connection) {
+  delete connection;
+}
@@ -0,0 +1,133 @@
+/**
+ * Pooled TLS connections made over mbedTLS directly, for requests that do
+ * not go through esp_http_client. Each handshake offers the session cached
+ * for the host (Tls/SessionCache.h), so a reconnect, or the first connect
+ * after a reboot with Tls::persist(), resumes in one round trip instead of
+ * a full ECDHE handshake:
+ *
+ *   static Http::TlsConnector connector;
+ *   static Http::Pool pool(connector);
+ *
+ *   Http::TlsConnection *conn =
+ *       static_cast<Http::TlsConnection *>(pool.acquire(url, cert_pem));
+ *   conn->connect();
+ *   conn->write(request, length);
+ *   ... conn->read() to the end of the response ...
+ *   pool.release(conn, true);
+ *
+ * Sessions are cached under Http::host_key() of the URL and the cert_pem
+ * pointer, as the pool keys its connections. Session IDs and tickets both
+ * resume. Handshakes are timed in tls.handshake_us and tls.resume_us.
+ *
+ * Device only. Natively, Host::HttpClient resumes through the same cache
+ * against the loopback server.
+ */
+
+#ifndef __HTTP_TLS_CONNECTION_H__
+#define __HTTP_TLS_CONNECTION_H__
+
+#include <stddef.h>
+#include "Pool.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+
+/* Longest wait for the server during the handshake or a read */
+#ifndef HTTP_TLS_TIMEOUT_MS
+#define HTTP_TLS_TIMEOUT_MS 10000
+#endif
+
+namespace Http {
+
+/**
+ * A TLS stream to one host. Take it from a Pool, whose key() names the
+ * session it resumes.
+ */
+class TlsConnection : public Connection {
+ public:
+  /**
+   * @param cert_pem  CA certificate the server is checked against, kept by
+   *                  reference. nullptr skips the check, as esp_http_client
+   *                  does.
+   */
+  TlsConnection(const char *url, const char *cert_pem);
+  ~TlsConnection();
+
+  /**
+   * @brief Checks without blocking that the connection is open, that the
+   * peer has not closed it and that nothing was left unread
+   */
+  bool reusable() override;
+
+  /**
+   * @brief Connects and handshakes, offering the host's cached session.
+   * Does nothing if already connected. A server that rejects the offered
+   * session gets one more try with a full handshake.
+   *
+   * @return
+   *  - ESP_OK                Connected
+   *  - ESP_ERR_INVALID_STATE The connection could not be set up
+   *  - ESP_FAIL              The connect or the handshake failed
+   */
+  esp_err_t connect();
+
+  /**
+   * @brief Sends all of 'data', closing the connection on an error
+   *
+   * @return 'size', or -1 on an error
+   */
+  int write(const void *data, size_t size);
+
+  /**
+   * @brief Reads up to 'size' bytes, waiting up to HTTP_TLS_TIMEOUT_MS
+   *
+   * @return Bytes read, 0 once the peer has closed, or -1 on an error or
+   * timeout. The connection is closed unless it returns bytes.
+   */
+  int read(void *dest, size_t size);
+
+  /**
+   * @brief Sends close_notify and closes the socket. connect() opens a new
+   * one.
+   */
+  void close();
+
+  /* Whether the last handshake resumed a cached session */
+  bool resumed() const { return resumed_; }
+
+  bool ready() const { return ready_; }
+
+ private:
+  TlsConnection(const TlsConnection &) = delete;
+  TlsConnection &operator=(const TlsConnection &) = delete;
+
+  /* Connects and handshakes once, with the cached session if 'offer' */
+  esp_err_t handshake(bool offer);
+
+  char host_[HTTP_POOL_KEY_SIZE];
+  char port_[6];
+  const char *cert_pem_;
+  bool ready_;
+  bool connected_;
+  bool resumed_;
+
+  mbedtls_net_context net_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_x509_crt ca_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+};
+
+class TlsConnector : public Connector {
+ public:
+  /* nullptr if out of memory or 'url' is not https:// */
+  Connection *create(const char *url, const char *cert_pem) override;
+  void destroy(Connection *connection) override;
+};
+
+}  // namespace Http
+
+#endif
@@ -0,0 +1,448 @@
+#include "Iperf.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "Tuning/Tuning.h"
+#include "esp_log.h"
+
+namespace Iperf {
+static const char *TAG = "Iperf";
+
+/* Sending side of run(), one test at a time */
+static Port::Mutex client_lock;
+static uint8_t client_buffer[IPERF_BUFFER_SIZE];
+
+static void put_le32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+static void put_le16(uint8_t *p, uint16_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint16_t get_le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t kbps(uint64_t bytes, uint32_t elapsed_us) {
+  return elapsed_us > 0 ? bytes * 8000 / elapsed_us : 0;
+}
+
+static void put_report(uint8_t *p, const Report &report) {
+  put_le32(p, report.bytes);
+  put_le32(p + 4, report.bytes >> 32);
+  put_le32(p + 8, report.elapsed_us);
+  put_le32(p + 12, report.datagrams);
+  put_le32(p + 16, report.lost);
+  put_le32(p + 20, report.jitter_us);
+}
+
+static void get_report(const uint8_t *p, Report &report) {
+  report.bytes = get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+  report.elapsed_us = get_le32(p + 8);
+  report.datagrams = get_le32(p + 12);
+  report.lost = get_le32(p + 16);
+  report.jitter_us = get_le32(p + 20);
+  report.kbps = kbps(report.bytes, report.elapsed_us);
+}
+
+/* Waits until 'due_us', sleeping whole milliseconds */
+static void pace(uint64_t due_us) {
+  uint64_t now = Port::micros();
+  if (due_us > now) {
+    Port::sleep_ms((due_us - now + 999) / 1000);
+  }
+}
+
+struct Echo {
+  int fd;
+  uint16_t length;
+};
+
+/* One round trip in us */
+static uint32_t echo_once(void *arg) {
+  Echo *echo = static_cast<Echo *>(arg);
+  uint64_t start = Port::micros();
+  if (!Port::send_all(echo->fd, client_buffer, echo->length) ||
+      !Port::recv_all(echo->fd, client_buffer, echo->length)) {
+    return BENCH_FAILED;
+  }
+  return Port::micros() - start;
+}
+
+static esp_err_t upload_tcp(int fd, const Test &test, Report &report) {
+  uint64_t end = Port::micros() + test.duration_ms * 1000ull;
+  while (Port::micros() < end) {
+    if (!Port::send_all(fd, client_buffer, test.length)) {
+      return ESP_FAIL;
+    }
+  }
+  shutdown(fd, SHUT_WR);
+  uint8_t answer[IPERF_REPORT_SIZE];
+  if (!Port::recv_all(fd, answer, sizeof(answer))) {
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  get_report(answer, report);
+  return ESP_OK;
+}
+
+static esp_err_t download_tcp(int fd, Report &report) {
+  uint64_t first = 0, last = 0;
+  int n;
+  while ((n = recv(fd, client_buffer, sizeof(client_buffer), 0)) > 0) {
+    last = Port::micros();
+    if (report.bytes == 0) {
+      first = last;
+    }
+    report.bytes += n;
+  }
+  if (n < 0) {
+    return ESP_FAIL;
+  }
+  report.elapsed_us = last - first;
+  report.kbps = kbps(report.bytes, report.elapsed_us);
+  return ESP_OK;
+}
+
+static esp_err_t upload_udp(int fd, const Test &test, uint32_t id,
+                            Report &report) {
+  uint16_t local = 0;
+  int udp = Port::udp_bind(PORT_IPV4_ANY, &local);
+  if (udp < 0) {
+    return ESP_FAIL;
+  }
+  uint32_t sent = 0;
+  uint64_t start = Port::micros();
+  uint64_t end = start + test.duration_ms * 1000ull;
+  put_le32(client_buffer, id);
+  for (uint64_t now = start; now < end; now = Port::micros()) {
+    put_le32(client_buffer + 4, sent);
+    put_le32(client_buffer + 8, now);
+    if (Port::udp_send(udp, test.addr, test.port, client_buffer,
+                       test.length)) {
+      sent++;
+    } else {
+      /* Out of buffers, give the stack a moment */
+      Port::sleep_ms(1);
+    }
+    if (test.rate_bytes_per_s > 0) {
+      pace(start + (uint64_t)sent * test.length * 1000000 /
+                       test.rate_bytes_per_s);
+    }
+  }
+  Port::close_socket(udp);
+
+  uint8_t count[4];
+  put_le32(count, sent);
+  uint8_t answer[IPERF_REPORT_SIZE];
+  if (!Port::send_all(fd, count, sizeof(count))) {
+    return ESP_FAIL;
+  }
+  if (!Port::recv_all(fd, answer, sizeof(answer))) {
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  get_report(answer, report);
+  return ESP_OK;
+}
+}  // namespace Iperf
+
+Iperf::Server::Server()
+    : listen_fd_(-1), udp_fd_(-1), port_(0), running_(false), tests_(0) {}
+
+Iperf::Server::~Server() { stop(); }
+
+esp_err_t Iperf::Server::start(uint16_t port) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  port_ = port;
+  listen_fd_ = Port::tcp_listen(PORT_IPV4_ANY, &port_, 2);
+  udp_fd_ = listen_fd_ >= 0 ? Port::udp_bind(PORT_IPV4_ANY, &port_) : -1;
+  if (listen_fd_ < 0 || udp_fd_ < 0) {
+    Port::close_socket(listen_fd_);
+    Port::close_socket(udp_fd_);
+    listen_fd_ = udp_fd_ = -1;
+    return ESP_FAIL;
+  }
+  /* Accepted sockets inherit the buffers, before the window is offered */
+  Tuning::apply_socket(listen_fd_);
+  Port::set_timeout(listen_fd_, 200);
+  Port::set_timeout(udp_fd_, 10);
+
+  running_ = true;
+  esp_err_t err = runner_.start(task, this, "iperf", IPERF_TASK_STACK_SIZE,
+                                IPERF_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    stop();
+  }
+  return err;
+}
+
+void Iperf::Server::stop() {
+  if (listen_fd_ < 0) {
+    return;
+  }
+  running_ = false;
+  runner_.join();
+  Port::close_socket(listen_fd_);
+  Port::close_socket(udp_fd_);
+  listen_fd_ = udp_fd_ = -1;
+}
+
+void Iperf::Server::task(void *self) {
+  Server *server = static_cast<Server *>(self);
+  while (server->running_) {
+    int fd = accept(server->listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    Port::set_timeout(fd, IPERF_TIMEOUT_MS);
+    Port::set_no_delay(fd);
+    server->serve(fd);
+    Port::close_socket(fd);
+  }
+}
+
+void Iperf::Server::serve(int fd) {
+  uint8_t request[IPERF_REQUEST_SIZE];
+  if (!Port::recv_all(fd, request, sizeof(request))) {
+    return;
+  }
+  Mode mode = static_cast<Mode>(request[4]);
+  uint16_t length = get_le16(request + 6);
+  uint32_t duration_ms = get_le32(request + 8);
+  uint32_t id = get_le32(request + 16);
+  uint8_t status = memcmp(request, IPERF_MAGIC, 4) == 0 &&
+                           request[4] <= (uint8_t)Mode::ECHO &&
+                           length >= IPERF_DATAGRAM_HEADER_SIZE &&
+                           length <= IPERF_BUFFER_SIZE
+                       ? 0
+                       : 1;
+  if (!Port::send_all(fd, &status, 1) || status != 0) {
+    return;
+  }
+  ESP_LOGD(TAG, "Serving %s", mode_name(mode));
+  tests_++;
+
+  Report report;
+  memset(&report, 0, sizeof(report));
+  switch (mode) {
+    case Mode::TCP_UPLOAD:
+      receive_tcp(fd, report);
+      break;
+    case Mode::TCP_DOWNLOAD:
+      send_tcp(fd, duration_ms, length);
+      break;
+    case Mode::UDP_UPLOAD:
+      receive_udp(fd, id, report);
+      break;
+    case Mode::ECHO:
+      echo(fd, length);
+      break;
+  }
+}
+
+void Iperf::Server::receive_tcp(int fd, Report &report) {
+  uint64_t first = 0, last = 0;
+  int n;
+  while ((n = recv(fd, buffer_, sizeof(buffer_), 0)) > 0) {
+    last = Port::micros();
+    if (report.bytes == 0) {
+      first = last;
+    }
+    report.bytes += n;
+  }
+  if (n < 0) {
+    return;
+  }
+  report.elapsed_us = last - first;
+  uint8_t answer[IPERF_REPORT_SIZE];
+  put_report(answer, report);
+  Port::send_all(fd, answer, sizeof(answer));
+}
+
+void Iperf::Server::send_tcp(int fd, uint32_t duration_ms, uint16_t length) {
+  memset(buffer_, 0x5A, length);
+  uint64_t end = Port::micros() + duration_ms * 1000ull;
+  while (running_ && Port::micros() < end) {
+    if (!Port::send_all(fd, buffer_, length)) {
+      return;
+    }
+  }
+  /* Wait for the client to close, so the last bytes are not reset */
+  shutdown(fd, SHUT_WR);
+  while (recv(fd, buffer_, sizeof(buffer_), 0) > 0) {
+  }
+}
+
+void Iperf::Server::receive_udp(int fd, uint32_t id, Report &report) {
+  uint8_t count[4];
+  size_t counted = 0;
+  uint32_t sent = 0;
+  uint64_t first = 0, last = 0;
+  uint64_t quiet_since = 0;
+  uint32_t last_transit = 0;
+  uint64_t jitter = 0;  // In 1/16 us
+  while (running_) {
+    uint32_t addr;
+    int n = Port::udp_receive(udp_fd_, buffer_, sizeof(buffer_), &addr);
+    uint64_t now = Port::micros();
+    if (n >= IPERF_DATAGRAM_HEADER_SIZE && get_le32(buffer_) == id) {
+      /* The clocks differ, only changes in transit time count */
+      uint32_t transit = (uint32_t)now - get_le32(buffer_ + 8);
+      if (report.datagrams > 0) {
+        int32_t d = transit - last_transit;
+        uint64_t delta = (d < 0 ? -d : d) * 16ull;
+        jitter += ((int64_t)delta - (int64_t)jitter) / 16;
+      } else {
+        first = now;
+      }
+      last_transit = transit;
+      last = now;
+      report.datagrams++;
+      report.bytes += n;
+      quiet_since = now;
+    }
+
+    /* The count of datagrams sent ends the test */
+    if (counted < sizeof(count)) {
+      int got = recv(fd, count + counted, sizeof(count) - counted,
+                     MSG_DONTWAIT);
+      if (got == 0 ||
+          (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return;
+      }
+      if (got > 0) {
+        counted += got;
+        quiet_since = now;
+      }
+    } else if (now - quiet_since >= IPERF_UDP_GRACE_MS * 1000ull) {
+      sent = get_le32(count);
+      break;
+    }
+  }
+  if (!running_) {
+    return;
+  }
+
+  report.elapsed_us = last - first;
+  report.lost = sent > report.datagrams ? sent - report.datagrams : 0;
+  report.jitter_us = jitter / 16;
+  uint8_t answer[IPERF_REPORT_SIZE];
+  put_report(answer, report);
+  Port::send_all(fd, answer, sizeof(answer));
+}
+
+void Iperf::Server::echo(int fd, uint16_t length) {
+  while (running_ && Port::recv_all(fd, buffer_, length)) {
+    if (!Port::send_all(fd, buffer_, length)) {
+      return;
+    }
+  }
+}
+
+esp_err_t Iperf::run(const Test &test, Report &report) {
+  memset(&report, 0, sizeof(report));
+  if (test.length < IPERF_DATAGRAM_HEADER_SIZE ||
+      test.length > IPERF_BUFFER_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  Port::Lock guard(client_lock);
+  int fd = Port::tcp_connect(test.addr, test.port, IPERF_TIMEOUT_MS,
+                             Tuning::apply_socket);
+  if (fd < 0) {
+    return ESP_FAIL;
+  }
+  /* Blocks go out whole, Nagle would only hold back echoes */
+  Port::set_no_delay(fd);
+
+  uint32_t id = Port::micros() ^ (uint32_t)test.mode << 24;
+  uint8_t request[IPERF_REQUEST_SIZE];
+  memcpy(request, IPERF_MAGIC, 4);
+  request[4] = (uint8_t)test.mode;
+  request[5] = 0;
+  put_le16(request + 6, test.length);
+  put_le32(request + 8, test.duration_ms);
+  put_le32(request + 12, test.rate_bytes_per_s);
+  put_le32(request + 16, id);
+  uint8_t status;
+  if (!Port::send_all(fd, request, sizeof(request)) ||
+      !Port::recv_all(fd, &status, 1)) {
+    Port::close_socket(fd);
+    return ESP_FAIL;
+  }
+  if (status != 0) {
+    Port::close_socket(fd);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+
+  memset(client_buffer, 0xA5, sizeof(client_buffer));
+  esp_err_t err = ESP_OK;
+  switch (test.mode) {
+    case Mode::TCP_UPLOAD:
+      err = upload_tcp(fd, test, report);
+      break;
+    case Mode::TCP_DOWNLOAD:
+      err = download_tcp(fd, report);
+      break;
+    case Mode::UDP_UPLOAD:
+      err = upload_udp(fd, test, id, report);
+      break;
+    case Mode::ECHO: {
+      Echo echo = {fd, test.length};
+      uint32_t echoes = test.echoes < BENCH_MAX_ITERATIONS
+                            ? test.echoes
+                            : BENCH_MAX_ITERATIONS;
+      Bench::Scenario scenario = {"iperf.echo", "us", echo_once, &echo, 5,
+                                  echoes};
+      err = Bench::run(scenario, report.rtt);
+      break;
+    }
+  }
+  Port::close_socket(fd);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "%s failed (0x%x)", mode_name(test.mode), err);
+  }
+  return err;
+}
+
+const char *Iperf::mode_name(Mode mode) {
+  switch (mode) {
+    case Mode::TCP_UPLOAD:
+      return "tcp_upload";
+    case Mode::TCP_DOWNLOAD:
+      return "tcp_download";
+    case Mode::UDP_UPLOAD:
+      return "udp_upload";
+    case Mode::ECHO:
+      return "echo";
+  }
+  return "unknown";
+}
+
+void Iperf::print(const Test &test, const Report &report) {
+  char name[48];
+  snprintf(name, sizeof(name), "iperf.%s.%s", mode_name(test.mode),
+           Tuning::current().name);
+  Bench::Result result = report.rtt;
+  if (test.mode != Mode::ECHO) {
+    /* One sample per test, so benchdiff compares it as a throughput */
+    result.unit = "kbit/s";
+    result.n = 1;
+    result.min = result.p50 = result.p90 = result.p99 = result.max =
+        result.mean = report.kbps;
+  }
+  result.name = name;
+  Bench::print(result);
+  if (test.mode == Mode::UDP_UPLOAD) {
+    printf("%u datagrams, %u lost, %u us jitter\n",
+           (unsigned)report.datagrams, (unsigned)report.lost,
+           (unsigned)report.jitter_us);
+  }
+}
@@ -0,0 +1,164 @@
+/**
+ * iperf-style throughput and latency benchmark between two endpoints, a
+ * device and the host tool tools/iperf, or two of either. One side runs a
+ * Server, the other run()s a test against it:
+ *
+ *   TCP_UPLOAD    The client sends for 'duration_ms', the server counts
+ *   TCP_DOWNLOAD  The server sends, the client counts
+ *   UDP_UPLOAD    The client sends datagrams at 'rate_bytes_per_s', the
+ *                 server counts them, the lost ones and the jitter
+ *   ECHO          Round trips of 'length' bytes, timed with Bench
+ *
+ * Every test opens a TCP connection to the server for control, with the
+ * request
+ *
+ *   "EIP1", u8 mode, u8 reserved, u16 length, u32 duration_ms,
+ *   u32 rate_bytes_per_s, u32 test id
+ *
+ * answered by a u8 status, 0 to go ahead. TCP tests then run on the same
+ * connection. Datagrams go to the same port number over UDP, each starting
+ * with the test id, a sequence number and the send time in us. Uploads end
+ * with the client closing its side, or for UDP sending the u32 number of
+ * datagrams sent, and the server answering with its counts:
+ *
+ *   u64 bytes, u32 elapsed_us, u32 datagrams, u32 lost, u32 jitter_us
+ *
+ * Sockets take the current Tuning profile.
+ */
+
+#ifndef __IPERF_H__
+#define __IPERF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "Bench/Bench.h"
+#include "Port/Port.h"
+#include "Port/Socket.h"
+
+#define IPERF_MAGIC "EIP1"
+#define IPERF_REQUEST_SIZE 20
+#define IPERF_REPORT_SIZE 24
+
+/* Test id, sequence number and send time */
+#define IPERF_DATAGRAM_HEADER_SIZE 12
+
+#define IPERF_PORT 5001
+
+/* Largest block or datagram, two segments of CONFIG_TCP_MSS */
+#define IPERF_BUFFER_SIZE 2872
+
+/* One segment, so each send() fills a frame */
+#define IPERF_DEFAULT_LENGTH 1436
+
+#define IPERF_TIMEOUT_MS 3000
+
+/* How long the server waits for datagrams still on their way */
+#define IPERF_UDP_GRACE_MS 100
+
+#define IPERF_TASK_STACK_SIZE 4096
+#define IPERF_TASK_PRIORITY 4
+
+namespace Iperf {
+
+enum class Mode : uint8_t {
+  TCP_UPLOAD = 0,
+  TCP_DOWNLOAD = 1,
+  UDP_UPLOAD = 2,
+  ECHO = 3,
+};
+
+struct Test {
+  Mode mode = Mode::TCP_UPLOAD;
+  uint32_t addr = PORT_IPV4_LOOPBACK;
+  uint16_t port = IPERF_PORT;
+  uint32_t duration_ms = 3000;
+  uint16_t length = IPERF_DEFAULT_LENGTH; /*!< Bytes per send() or
+                                               datagram, at most
+                                               IPERF_BUFFER_SIZE */
+  uint32_t rate_bytes_per_s = 0;          /*!< UDP pacing, 0 for as fast as
+                                               the stack takes them */
+  uint32_t echoes = 200;                  /*!< Round trips for ECHO */
+};
+
+struct Report {
+  uint64_t bytes;      /*!< Received by the receiving side */
+  uint32_t elapsed_us; /*!< From its first byte to its last */
+  uint32_t kbps;       /*!< Kilobits per second */
+  uint32_t datagrams;  /*!< UDP, received */
+  uint32_t lost;       /*!< UDP, sent and never received */
+  uint32_t jitter_us;  /*!< UDP, RFC 3550 interarrival jitter */
+  Bench::Result rtt;   /*!< ECHO, round trips in us */
+};
+
+class Server {
+ public:
+  Server();
+  ~Server();
+
+  /**
+   * @brief Listens for tests on TCP and UDP 'port', one test at a time
+   *
+   * @param port  0 for an ephemeral port, see port()
+   *
+   * @return
+   *  - ESP_OK                Listening
+   *  - ESP_ERR_INVALID_STATE Already running
+   *  - ESP_FAIL              The port could not be bound
+   *  - Any error from starting the task
+   */
+  esp_err_t start(uint16_t port = IPERF_PORT);
+
+  /**
+   * @brief Stops after the test in progress
+   */
+  void stop();
+
+  uint16_t port() const { return port_; }
+
+  /* Tests accepted */
+  uint32_t tests() const { return tests_; }
+
+ private:
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  static void task(void *self);
+  void serve(int fd);
+  void receive_tcp(int fd, Report &report);
+  void send_tcp(int fd, uint32_t duration_ms, uint16_t length);
+  void receive_udp(int fd, uint32_t id, Report &report);
+  void echo(int fd, uint16_t length);
+
+  int listen_fd_;
+  int udp_fd_;
+  uint16_t port_;
+  std::atomic<bool> running_;
+  std::atomic<uint32_t> tests_;
+  Port::Task runner_;
+  uint8_t buffer_[IPERF_BUFFER_SIZE];
+};
+
+/**
+ * @brief Runs one test against a Server
+ *
+ * @return
+ *  - ESP_OK                    'report' holds the results
+ *  - ESP_ERR_INVALID_ARG       'length' out of range
+ *  - ESP_FAIL                  Connection failed or closed early
+ *  - ESP_ERR_INVALID_RESPONSE  The server refused or answered garbage
+ */
+esp_err_t run(const Test &test, Report &report);
+
+/* Name of a mode, e.g. "tcp_upload" */
+const char *mode_name(Mode mode);
+
+/**
+ * @brief Prints a report as one JSON line, with the mode and the current
+ * Tuning profile, for tools/benchdiff-style collection
+ */
+void print(const Test &test, const Report &report);
+
+}  // namespace Iperf
+
+#endif
@@ -0,0 +1,190 @@
+#include "BinLog.h"
+#include <stdio.h>
+#include <atomic>
+#include "Ring/SpscRing.h"
+
+namespace BinLog {
+/* One producer per ring, the tasks of a core serialised by Port::CoreGuard,
+ * and one consumer */
+static SpscRing<Record, BINLOG_RING_SIZE> rings[PORT_CORES];
+static std::atomic<uint32_t> dropped_records(0);
+
+/* Oldest record of each ring, taken out to compare times */
+static Record heads[PORT_CORES];
+static bool has_head[PORT_CORES];
+
+static Port::Task task;
+static std::atomic<bool> running(false);
+static Output output;
+}  // namespace BinLog
+
+static void print(uint8_t level, const char *line) { printf("%s\n", line); }
+
+static void flush_task(void *arg) {
+  while (BinLog::running) {
+    BinLog::flush();
+    Port::sleep_ms(BINLOG_FLUSH_MS);
+  }
+  BinLog::flush();
+}
+
+/* Formats one conversion with a recorded argument, dropping any length
+ * modifier as every argument was stored in 32 bits */
+static int convert(char *dest, size_t size, const char *spec, size_t length,
+                   uint32_t word, const char *text) {
+  char plain[16];
+  size_t n = 0;
+  for (size_t i = 0; i < length && n + 2 < sizeof(plain); i++) {
+    if (strchr("hlLqjzt", spec[i]) == nullptr) {
+      plain[n++] = spec[i];
+    }
+  }
+  plain[n] = '\0';
+
+  char conversion = spec[length - 1];
+  switch (conversion) {
+    case 'd':
+    case 'i':
+    case 'c':
+      return snprintf(dest, size, plain, static_cast<int>(word));
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      return snprintf(dest, size, plain, static_cast<unsigned>(word));
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+      float value;
+      memcpy(&value, &word, sizeof(value));
+      return snprintf(dest, size, plain, static_cast<double>(value));
+    }
+    case 's':
+      return snprintf(dest, size, plain, text);
+    case 'p':
+      return snprintf(dest, size, plain,
+                      reinterpret_cast<void *>(static_cast<uintptr_t>(word)));
+    default:
+      return snprintf(dest, size, "%.*s", static_cast<int>(length), spec);
+  }
+}
+
+size_t BinLog::format(const Record &record, char *dest, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  static const char letters[] = "NEWIDV";
+  uint8_t level = record.site->level <= BINLOG_VERBOSE ? record.site->level
+                                                       : BINLOG_NONE;
+  int n = snprintf(dest, size, "%c (%u) %s: ", letters[level],
+                   static_cast<unsigned>(record.time_ms), record.tag);
+  size_t length = n < 0 ? 0 : n;
+
+  const char *p = record.site->format;
+  size_t arg = 0;
+  while (*p != '\0' && length + 1 < size) {
+    if (*p != '%') {
+      dest[length++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      dest[length++] = '%';
+      p += 2;
+      continue;
+    }
+
+    /* Flags, width, precision and length up to the conversion */
+    size_t spec = 1;
+    while (p[spec] != '\0' && strchr("-+ #0123456789.hlLqjzt", p[spec])) {
+      spec++;
+    }
+    if (p[spec] != '\0') {
+      spec++;
+    }
+    uint32_t word = arg < BINLOG_MAX_ARGS ? record.args[arg] : 0;
+    arg++;
+    n = convert(dest + length, size - length, p, spec, word, record.text);
+    length += n < 0 ? 0 : n;
+    p += spec;
+  }
+  if (length >= size) {
+    length = size - 1;
+  }
+  dest[length] = '\0';
+  return length;
+}
+
+void BinLog::push(Record &record) {
+  Port::CoreGuard guard;
+  record.time_ms = Port::micros() / 1000;
+  if (!rings[guard.core()].push(record)) {
+    dropped_records.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool BinLog::pop(Record &record) {
+  int oldest = -1;
+  for (int core = 0; core < PORT_CORES; core++) {
+    if (!has_head[core]) {
+      has_head[core] = rings[core].pop(heads[core]);
+    }
+    if (has_head[core] &&
+        (oldest < 0 || heads[core].time_ms < heads[oldest].time_ms)) {
+      oldest = core;
+    }
+  }
+  if (oldest < 0) {
+    return false;
+  }
+  record = heads[oldest];
+  has_head[oldest] = false;
+  return true;
+}
+
+uint32_t BinLog::dropped() {
+  return dropped_records.exchange(0, std::memory_order_relaxed);
+}
+
+void BinLog::set_output(Output out) { output = out; }
+
+void BinLog::flush() {
+  Output out = output != nullptr ? output : print;
+  char line[BINLOG_LINE_SIZE];
+  uint32_t lost = dropped();
+  if (lost > 0) {
+    snprintf(line, sizeof(line), "W (%u) BinLog: %u records dropped",
+             static_cast<unsigned>(Port::micros() / 1000),
+             static_cast<unsigned>(lost));
+    out(BINLOG_WARN, line);
+  }
+  Record record;
+  while (pop(record)) {
+    format(record, line, sizeof(line));
+    out(record.site->level, line);
+  }
+}
+
+esp_err_t BinLog::start() {
+  if (running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  running = true;
+  esp_err_t err = task.start(flush_task, nullptr, "binlog",
+                             BINLOG_TASK_STACK_SIZE, BINLOG_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    running = false;
+  }
+  return err;
+}
+
+void BinLog::stop() {
+  if (running) {
+    running = false;
+    task.join();
+  }
+}
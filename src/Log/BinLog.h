@@ -0,0 +1,249 @@
+/**
+ * Deferred binary logging for hot paths. A call site stores a pointer to its
+ * static format and the raw arguments in a ring of the core it runs on. It
+ * never formats, blocks or allocates. A low priority task formats the
+ * records later, in the "I (time) TAG: message" form of ESP_LOGx.
+ *
+ *   BLOGI(TAG, "Read key \"%s\" from NVS", key);
+ *
+ * Arguments may be integers of up to 32 bits, floats, pointers and at most
+ * one string, which is copied and cut to BINLOG_TEXT_SIZE - 1 characters.
+ * Levels above BINLOG_LEVEL compile to nothing. Records are dropped, and
+ * counted, while a ring is full.
+ */
+
+#ifndef __BIN_LOG_H__
+#define __BIN_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "Port/Port.h"
+
+/* Same values as esp_log_level_t */
+#define BINLOG_NONE 0
+#define BINLOG_ERROR 1
+#define BINLOG_WARN 2
+#define BINLOG_INFO 3
+#define BINLOG_DEBUG 4
+#define BINLOG_VERBOSE 5
+
+/* Most verbose level compiled in */
+#ifndef BINLOG_LEVEL
+#ifdef CONFIG_LOG_DEFAULT_LEVEL
+#define BINLOG_LEVEL CONFIG_LOG_DEFAULT_LEVEL
+#else
+#define BINLOG_LEVEL BINLOG_INFO
+#endif
+#endif
+
+/* Records buffered per core, a power of two */
+#ifndef BINLOG_RING_SIZE
+#define BINLOG_RING_SIZE 64
+#endif
+
+#define BINLOG_MAX_ARGS 4
+
+/* Holds a NVS key or a short host name */
+#define BINLOG_TEXT_SIZE 20
+
+/* Longest formatted line, longer ones are cut */
+#define BINLOG_LINE_SIZE 128
+
+#define BINLOG_FLUSH_MS 50
+#define BINLOG_TASK_STACK_SIZE 2048
+#define BINLOG_TASK_PRIORITY 1
+
+#define BINLOG_RECORD(level, tag, format, ...)                  \
+  do {                                                          \
+    static const BinLog::Site _binlog_site = {level, format};   \
+    BinLog::record(&_binlog_site, tag, ##__VA_ARGS__);          \
+  } while (0)
+
+#if BINLOG_LEVEL >= BINLOG_ERROR
+#define BLOGE(tag, format, ...) \
+  BINLOG_RECORD(BINLOG_ERROR, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGE(tag, format, ...) \
+  do {                          \
+  } while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_WARN
+#define BLOGW(tag, format, ...) \
+  BINLOG_RECORD(BINLOG_WARN, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGW(tag, format, ...) \
+  do {                          \
+  } while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_INFO
+#define BLOGI(tag, format, ...) \
+  BINLOG_RECORD(BINLOG_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGI(tag, format, ...) \
+  do {                          \
+  } while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_DEBUG
+#define BLOGD(tag, format, ...) \
+  BINLOG_RECORD(BINLOG_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGD(tag, format, ...) \
+  do {                          \
+  } while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_VERBOSE
+#define BLOGV(tag, format, ...) \
+  BINLOG_RECORD(BINLOG_VERBOSE, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGV(tag, format, ...) \
+  do {                          \
+  } while (0)
+#endif
+
+namespace BinLog {
+
+/**
+ * The constant part of a call site, its address identifies the format
+ */
+struct Site {
+  uint8_t level;
+  const char *format;
+};
+
+struct Record {
+  const Site *site;
+  const char *tag;
+  uint32_t time_ms;
+  uint32_t args[BINLOG_MAX_ARGS];
+  char text[BINLOG_TEXT_SIZE];
+};
+
+/* Receives each formatted line, without a newline */
+typedef void (*Output)(uint8_t level, const char *line);
+
+/**
+ * @brief Starts the task that formats records and passes them to the output
+ * every BINLOG_FLUSH_MS
+ *
+ * @return As Port::Task::start()
+ */
+esp_err_t start();
+
+/**
+ * @brief Flushes and stops the task
+ */
+void stop();
+
+/**
+ * @brief Replaces the output, stdout by default
+ */
+void set_output(Output output);
+
+/**
+ * @brief Formats and outputs every buffered record in time order. Call from
+ * one task at a time, and not while the task started by start() runs.
+ */
+void flush();
+
+/**
+ * @brief Takes the oldest buffered record of any core. Same constraints as
+ * flush().
+ *
+ * @return false if none are buffered
+ */
+bool pop(Record &record);
+
+/**
+ * @brief Formats a record like ESP_LOGx, cut to fit 'size'
+ *
+ * @return Length of the line
+ */
+size_t format(const Record &record, char *dest, size_t size);
+
+/**
+ * @brief Gets the number of records dropped because a ring was full, and
+ * resets it
+ */
+uint32_t dropped();
+
+/* Stores a record in the ring of the calling core */
+void push(Record &record);
+
+namespace detail {
+
+template <typename... Args>
+struct Strings;
+
+template <>
+struct Strings<> {
+  static const int value = 0;
+};
+
+template <typename T, typename... Rest>
+struct Strings<T, Rest...> {
+  static const int value =
+      std::is_convertible<T, const char *>::value + Strings<Rest...>::value;
+};
+
+inline uint32_t encode(Record &record, const char *text) {
+  if (text == nullptr) {
+    text = "(null)";
+  }
+  size_t length = 0;
+  while (length + 1 < BINLOG_TEXT_SIZE && text[length] != '\0') {
+    record.text[length] = text[length];
+    length++;
+  }
+  record.text[length] = '\0';
+  return 0;
+}
+
+inline uint32_t encode(Record &record, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline uint32_t encode(Record &record, double value) {
+  return encode(record, static_cast<float>(value));
+}
+
+template <typename T>
+inline typename std::enable_if<
+    std::is_integral<T>::value || std::is_enum<T>::value, uint32_t>::type
+encode(Record &record, T value) {
+  static_assert(sizeof(T) <= sizeof(uint32_t), "Integers up to 32 bits");
+  return static_cast<uint32_t>(value);
+}
+
+template <typename T>
+inline uint32_t encode(Record &record, const T *pointer) {
+  return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pointer));
+}
+
+}  // namespace detail
+
+/**
+ * @brief Records one call of a site. Use the BLOGx macros instead.
+ */
+template <typename... Args>
+inline void record(const Site *site, const char *tag, Args... args) {
+  static_assert(sizeof...(Args) <= BINLOG_MAX_ARGS, "Too many arguments");
+  static_assert(detail::Strings<Args...>::value <= 1, "At most one string");
+  Record entry;
+  entry.site = site;
+  entry.tag = tag;
+  const uint32_t words[] = {0, detail::encode(entry, args)...};
+  memcpy(entry.args, words + 1, sizeof...(Args) * sizeof(uint32_t));
+  push(entry);
+}
+
+}  // namespace BinLog
+
+#endif
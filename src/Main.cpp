@@ -1,4 +1,13 @@
+#include "Async/Async.h"
+#include "Boot/Boot.h"
 #include "DNS/DNS.h"
+#include "DNS/Mdns.h"
+#include "Iperf/Iperf.h"
+#include "Log/BinLog.h"
+#include "NVS/NVS.h"
+#include "NVS/RtcMirror.h"
+#include "PowerSave/PowerSave.h"
+#include "Profile/Profile.h"
 #include "SmartConfig/EasyWifi.h"
 #include "SmartConfig/SmartConfig.h"
 
@@ -19,21 +28,69 @@ extern "C" {
 void app_main();
 }
 
-static void dns_resolve_task(void *parm) {
-  EasyWifi::wait_for_wifi(20);
-  ip_addr_t result;
-  DNS::resolve("tidalpaladin.com", &result);
-  ESP_LOGI("MAIN", "DNS resolve done");
-  vTaskDelete(NULL);
+/* Waits for wifi, then resolves, on the shared executor task */
+class ResolveFlow : public Async::Flow {
+ public:
+  Async::Status resume() override {
+    ASYNC_BEGIN();
+    ASYNC_AWAIT_MS(EasyWifi::is_connected(), 20000);
+    /* Cache LAN announcements from now on, ".local" lookups are local */
+    DNS::mdns().start();
+    lookup_.start("tidalpaladin.com");
+    ASYNC_AWAIT(lookup_.ready());
+    ESP_LOGI("MAIN", "DNS resolve done");
+    ASYNC_END();
+  }
+
+ private:
+  Async::Resolve lookup_;
+};
+
+static ResolveFlow resolve_flow;
+
+#ifdef IPERF_APP
+/* The iperf build target serves the network benchmark, see tools/iperf */
+static Iperf::Server iperf;
+#endif
+
+/* Restores the RTC mirror, NVS itself opens on the first miss. A cold boot
+ * or a damaged image only means the mirror starts empty. */
+static esp_err_t begin_nvs() {
+  RtcMirror::begin();
+  return ESP_OK;
 }
 
-void connect_wifi() { EasyWifi::connect(); }
+static esp_err_t connect_wifi() { return EasyWifi::connect(); }
+
+/* Deepest power save the requirements allow, re-evaluated on the executor */
+static esp_err_t begin_power_save() { return PowerSave::begin(); }
+
+/* NVS and the network interface come up side by side, the radio starts as
+ * soon as both are ready. The executor does not depend on either. */
+static Boot::Stage nvs("nvs", begin_nvs);
+static Boot::Stage netif("netif", EasyWifi::init_hardware);
+static Boot::Stage wifi_config("wifi.config", EasyWifi::configure,
+                               {&nvs, &netif});
+static Boot::Stage radio("wifi.start", EasyWifi::start_radio, {&wifi_config});
+static Boot::Stage wifi_connect("wifi.connect", connect_wifi, {&radio});
+static Boot::Stage executor("async", Async::start);
+static Boot::Stage power_save("wifi.power", begin_power_save,
+                              {&radio, &executor});
 
 void app_main() {
-  EasyWifi::init_hardware();
-  EasyWifi::init_software();
-  uint32_t timeout_s = 120;
-  connect_wifi();
-  // SmartConfig::sc_start(&timeout_s);
-  xTaskCreate(dns_resolve_task, "task", 2048, nullptr, 5, nullptr);
+  BinLog::start();
+  Profile::start();
+  Work::start();
+  Boot::run();
+  Boot::report();
+  // SmartConfig::sc_start(120);
+  Async::spawn(&resolve_flow);
+#ifdef IPERF_APP
+  EasyWifi::wait_for_wifi(30);
+  if (iperf.start() == ESP_OK) {
+    ip4_addr_t ip = EasyWifi::getIP();
+    ESP_LOGI("MAIN", "iperf on " IPSTR ":%u, profile %s", IP2STR(&ip),
+             iperf.port(), Tuning::current().name);
+  }
+#endif
 }
@@ -0,0 +1,163 @@
+#include "Metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace Metrics {
+/* Constant initialised, so metrics of any translation unit can register
+ * during static initialisation */
+static Metric *head = nullptr;
+static Metric *tail = nullptr;
+}  // namespace Metrics
+
+Metrics::Metric::Metric(const char *name, Type type)
+    : name_(name), type_(type), next_(nullptr) {
+  /* Appended, so output follows definition order within a module */
+  if (tail == nullptr) {
+    head = this;
+  } else {
+    tail->next_ = this;
+  }
+  tail = this;
+}
+
+Metrics::Counter::Counter(const char *name) : Metric(name, COUNTER) {
+  for (int i = 0; i < PORT_CORES; i++) {
+    shards_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint32_t Metrics::Counter::value() const {
+  uint32_t total = 0;
+  for (int i = 0; i < PORT_CORES; i++) {
+    total += shards_[i].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+Metrics::Gauge::Gauge(const char *name) : Metric(name, GAUGE), value_(0) {}
+
+Metrics::Histogram::Histogram(const char *name) : Metric(name, HISTOGRAM) {
+  for (int i = 0; i < PORT_CORES; i++) {
+    shards_[i].count.store(0, std::memory_order_relaxed);
+    shards_[i].sum.store(0, std::memory_order_relaxed);
+    for (uint32_t j = 0; j < METRICS_BUCKETS; j++) {
+      shards_[i].buckets[j].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+uint32_t Metrics::Histogram::bucket(uint32_t value) {
+  if (value < METRICS_SUB_BUCKETS) {
+    return value;
+  }
+  uint32_t bits = 31 - __builtin_clz(value);
+  if (bits >= METRICS_MAX_BITS) {
+    return METRICS_BUCKETS - 1;
+  }
+  /* The METRICS_SUB_BITS bits below the leading one pick the bucket */
+  uint32_t shift = bits - METRICS_SUB_BITS;
+  uint32_t sub = (value >> shift) & (METRICS_SUB_BUCKETS - 1);
+  return (shift + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+uint32_t Metrics::Histogram::upper_bound(uint32_t index) {
+  if (index < METRICS_SUB_BUCKETS) {
+    return index;
+  }
+  if (index >= METRICS_BUCKETS - 1) {
+    return UINT32_MAX;
+  }
+  uint32_t shift = index / METRICS_SUB_BUCKETS - 1;
+  uint32_t sub = index % METRICS_SUB_BUCKETS;
+  uint32_t lower = (METRICS_SUB_BUCKETS + sub) << shift;
+  return lower + (1u << shift) - 1;
+}
+
+void Metrics::Histogram::snapshot(HistogramSnapshot &out) const {
+  memset(&out, 0, sizeof(out));
+  for (int i = 0; i < PORT_CORES; i++) {
+    const Shard &shard = shards_[i];
+    out.count += shard.count.load(std::memory_order_relaxed);
+    out.sum += shard.sum.load(std::memory_order_relaxed);
+    for (uint32_t j = 0; j < METRICS_BUCKETS; j++) {
+      out.buckets[j] += shard.buckets[j].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+uint32_t Metrics::HistogramSnapshot::quantile(float q) const {
+  /* The bucket counts may not add up to 'count' while others record */
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+    total += buckets[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint32_t rank = q * total;
+  if (rank >= total) {
+    rank = total - 1;
+  }
+  uint32_t seen = 0;
+  for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return Histogram::upper_bound(i);
+    }
+  }
+  return UINT32_MAX;
+}
+
+Metrics::Metric *Metrics::first() { return head; }
+
+Metrics::Metric *Metrics::find(const char *name) {
+  for (Metric *metric = head; metric != nullptr; metric = metric->next()) {
+    if (strcmp(metric->name(), name) == 0) {
+      return metric;
+    }
+  }
+  return nullptr;
+}
+
+/* Formats one metric, returns its length as snprintf() does */
+static int write_metric(const Metrics::Metric *metric, char *dest,
+                        size_t size) {
+  switch (metric->type()) {
+    case Metrics::COUNTER:
+      return snprintf(
+          dest, size, "%s %u\n", metric->name(),
+          (unsigned)static_cast<const Metrics::Counter *>(metric)->value());
+    case Metrics::GAUGE:
+      return snprintf(
+          dest, size, "%s %d\n", metric->name(),
+          (int)static_cast<const Metrics::Gauge *>(metric)->value());
+    case Metrics::HISTOGRAM: {
+      Metrics::HistogramSnapshot snap;
+      static_cast<const Metrics::Histogram *>(metric)->snapshot(snap);
+      return snprintf(dest, size, "%s count=%u sum=%u p50=%u p90=%u p99=%u\n",
+                      metric->name(), (unsigned)snap.count,
+                      (unsigned)snap.sum, (unsigned)snap.quantile(0.5f),
+                      (unsigned)snap.quantile(0.9f),
+                      (unsigned)snap.quantile(0.99f));
+    }
+  }
+  return 0;
+}
+
+size_t Metrics::write_text(char *dest, size_t size) {
+  size_t length = 0;
+  if (size == 0) {
+    return 0;
+  }
+  dest[0] = '\0';
+  for (Metric *metric = head; metric != nullptr; metric = metric->next()) {
+    int n = write_metric(metric, dest + length, size - length);
+    if (n < 0 || length + n >= size) {
+      /* Drop the partial line */
+      dest[length] = '\0';
+      break;
+    }
+    length += n;
+  }
+  return length;
+}
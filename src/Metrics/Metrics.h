@@ -0,0 +1,192 @@
+/**
+ * Runtime statistics shared by all modules. Counters, gauges and histograms
+ * are defined at namespace scope and register themselves by name:
+ *
+ *   static Metrics::Counter reads("nvs.reads");
+ *   static Metrics::Histogram commit_us("nvs.commit_us");
+ *
+ *   reads.add();
+ *   commit_us.record(elapsed_us);
+ *
+ * Counters and histograms keep one shard per core, so recording is a few
+ * relaxed atomic adds that never wait on another task. Values are 32 bits
+ * and wrap, readers should take differences. Reading merges the shards and
+ * may miss updates made at the same time.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "Port/Port.h"
+
+/* Linear buckets per power of two, as a power of two. 4 buckets bound the
+ * error of a value to 25%. */
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+
+/* Values of 2^METRICS_MAX_BITS and above share the last bucket */
+#define METRICS_MAX_BITS 24
+
+#define METRICS_BUCKETS \
+  ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS + 1)
+
+namespace Metrics {
+
+enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+/**
+ * Base of every metric. Define metrics at namespace scope, they register
+ * during static initialisation and are never unregistered.
+ */
+class Metric {
+ public:
+  const char *name() const { return name_; }
+  Type type() const { return type_; }
+
+  /* Next registered metric, or nullptr */
+  Metric *next() const { return next_; }
+
+ protected:
+  Metric(const char *name, Type type);
+
+ private:
+  Metric(const Metric &) = delete;
+  Metric &operator=(const Metric &) = delete;
+
+  const char *name_;
+  Type type_;
+  Metric *next_;
+};
+
+/**
+ * Counts events
+ */
+class Counter : public Metric {
+ public:
+  explicit Counter(const char *name);
+
+  void add(uint32_t n = 1) {
+    shards_[Port::core()].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint32_t value() const;
+
+ private:
+  std::atomic<uint32_t> shards_[PORT_CORES];
+};
+
+/**
+ * A level that goes up and down, such as a connection state
+ */
+class Gauge : public Metric {
+ public:
+  explicit Gauge(const char *name);
+
+  void set(int32_t value) { value_.store(value, std::memory_order_relaxed); }
+  void add(int32_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int32_t> value_;
+};
+
+/**
+ * Merged state of a Histogram
+ */
+struct HistogramSnapshot {
+  uint32_t count;
+  uint32_t sum;
+  uint32_t buckets[METRICS_BUCKETS];
+
+  /**
+   * @brief Gets the upper bound of the bucket holding quantile 'q', 0 if
+   * empty
+   *
+   * @param q  Between 0 and 1
+   */
+  uint32_t quantile(float q) const;
+};
+
+/**
+ * Distribution of values in log-linear buckets, METRICS_SUB_BUCKETS per
+ * power of two. Small values are exact.
+ */
+class Histogram : public Metric {
+ public:
+  explicit Histogram(const char *name);
+
+  void record(uint32_t value) {
+    Shard &shard = shards_[Port::core()];
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+    shard.buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void snapshot(HistogramSnapshot &out) const;
+
+  /* Index of the bucket holding 'value' */
+  static uint32_t bucket(uint32_t value);
+
+  /* Largest value in bucket 'index' */
+  static uint32_t upper_bound(uint32_t index);
+
+ private:
+  struct Shard {
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> sum;
+    std::atomic<uint32_t> buckets[METRICS_BUCKETS];
+  };
+
+  Shard shards_[PORT_CORES];
+};
+
+/**
+ * Records the microseconds from construction to destruction
+ */
+class Timer {
+ public:
+  explicit Timer(Histogram &histogram)
+      : histogram_(histogram), start_(Port::micros()) {}
+  ~Timer() { histogram_.record(Port::micros() - start_); }
+
+ private:
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+  Histogram &histogram_;
+  uint64_t start_;
+};
+
+/**
+ * @brief Gets the first registered metric, follow Metric::next() for the
+ * rest
+ */
+Metric *first();
+
+/**
+ * @brief Finds a metric by name
+ *
+ * @return The metric, or nullptr if none is registered with 'name'
+ */
+Metric *find(const char *name);
+
+/**
+ * @brief Writes every metric, one per line, for export over MQTT, HTTP or
+ * the UART:
+ *
+ *   nvs.reads 12
+ *   wifi.connected 1
+ *   dns.resolve_us count=3 sum=45210 p50=14335 p90=16383 p99=16383
+ *
+ * Quantiles are bucket upper bounds. Allocates nothing.
+ *
+ * @return Length written, cut to fit 'size' at a line boundary
+ */
+size_t write_text(char *dest, size_t size);
+
+}  // namespace Metrics
+
+#endif
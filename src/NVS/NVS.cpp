@@ -4,7 +4,20 @@ NVSStatic NVS;
 nvs_handle NVSStatic::my_handle;
 const char *NVSStatic::TAG = "NVS";
 
-esp_err_t NVSStatic::begin(const char *name_space) {
+static Metrics::Counter reads("nvs.reads");
+static Metrics::Counter writes("nvs.writes");
+static Metrics::Counter errors("nvs.errors");
+static Metrics::Histogram commit_us("nvs.commit_us");
+
+/* Boot stages may initialise flash from several tasks at once */
+static Port::Mutex flash_lock;
+static bool flash_ready = false;
+
+esp_err_t NVSStatic::init_flash() {
+  Port::Lock lock(flash_lock);
+  if (flash_ready) {
+    return ESP_OK;
+  }
   ESP_LOGI(TAG, "Initializing NVS");
   esp_err_t result = nvs_flash_init();
   if (result == ESP_ERR_NVS_NO_FREE_PAGES) {
@@ -18,6 +31,15 @@ esp_err_t NVSStatic::begin(const char *name_space) {
     ESP_LOGW(TAG, "Error (%d) while initializing NVS", result);
     return result;
   }
+  flash_ready = true;
+  return ESP_OK;
+}
+
+esp_err_t NVSStatic::begin(const char *name_space) {
+  esp_err_t result = init_flash();
+  if (result != ESP_OK) {
+    return result;
+  }
 
   ESP_LOGI(TAG, "Opening NVS");
   result = nvs_open(name_space, NVS_READWRITE, &my_handle);
@@ -86,6 +108,10 @@ esp_err_t NVSStatic::write(const char *key, const char *data) {
   esp_err_t ret = nvs_set_str(my_handle, key, data);
   return checkWriteResult(ret, key);
 }
+esp_err_t NVSStatic::write(const char *key, const void *src, size_t size) {
+  esp_err_t ret = nvs_set_blob(my_handle, key, src, size);
+  return checkWriteResult(ret, key);
+}
 
 esp_err_t NVSStatic::end() {
   nvs_close(my_handle);
@@ -94,8 +120,12 @@ esp_err_t NVSStatic::end() {
 }
 
 esp_err_t NVSStatic::nvsCommit() {
-  ESP_LOGV(TAG, "Commit NVS changes");
-  esp_err_t err = nvs_commit(my_handle);
+  BLOGV(TAG, "Commit NVS changes");
+  esp_err_t err;
+  {
+    Metrics::Timer timer(commit_us);
+    err = nvs_commit(my_handle);
+  }
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error (%i) in NVS commit", err);
   }
@@ -104,7 +134,7 @@ esp_err_t NVSStatic::nvsCommit() {
 
 esp_err_t NVSStatic::erase_key(const char *key) {
   esp_err_t result = nvs_erase_key(my_handle, key);
-  if (result != ESP_OK) {
+  if (result != ESP_OK && result != ESP_ERR_NVS_NOT_FOUND) {
     ESP_LOGE(TAG, "Error (%i) erasing key \"%s\"", result, key);
   }
   return result;
@@ -119,22 +149,26 @@ esp_err_t NVSStatic::erase_all() {
 }
 
 esp_err_t NVSStatic::checkReadResult(esp_err_t result, const char *key) {
+  reads.add();
   if (result != ESP_OK) {
+    errors.add();
     ESP_LOGE(TAG, "Error (%i) reading key \"%s\" from NVS", result, key);
     errToName(result);
   } else {
-    ESP_LOGI(TAG, "Read key \"%s\" from NVS", key);
+    BLOGI(TAG, "Read key \"%s\" from NVS", key);
   }
   return result;
 }
 
 esp_err_t NVSStatic::checkWriteResult(esp_err_t result, const char *key) {
+  writes.add();
   if (result != ESP_OK) {
+    errors.add();
     ESP_LOGE(TAG, "Error (%i) writing key \"%s\" to NVS", result, key);
     errToName(result);
   } else {
     nvsCommit();
-    ESP_LOGI(TAG, "Wrote key \"%s\" to NVS", key);
+    BLOGI(TAG, "Wrote key \"%s\" to NVS", key);
   }
   return result;
 }
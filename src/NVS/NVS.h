@@ -10,6 +10,8 @@
 #ifndef __NVS_HELPER_H__
 #define __NVS_HELPER_H__
 
+#include "Log/BinLog.h"
+#include "Metrics/Metrics.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_system.h"
@@ -33,6 +35,15 @@ class NVSStatic {
    */
   static esp_err_t begin(const char *name_space = "storage");
 
+  /**
+   * @brief Initialises the NVS partition, erasing it if it was truncated.
+   * begin() calls this, as does EasyWifi::init_hardware(). Only the first
+   * successful call does the work, so callers need not coordinate.
+   *
+   * @return esp_err_t
+   */
+  static esp_err_t init_flash();
+
   /**
    * @brief This must be called to close the NVS dialog
    *
@@ -110,6 +121,15 @@ class NVSStatic {
    */
   static esp_err_t write(const char *key, const char *src);
 
+  /**
+   * @brief Writes 'size' bytes at 'src' to NVS as a blob, as write() does
+   * for types it has no overload for
+   *
+   * @return
+   *  - ESP_OK                    The write was successful
+   */
+  static esp_err_t write(const char *key, const void *src, size_t size);
+
   /**
    * @brief Erases the given key from NVS
    *
@@ -117,6 +137,7 @@ class NVSStatic {
    *
    * @return
    *  - ESP_OK		The erase was successful
+   *  - ESP_ERR_NVS_NOT_FOUND	The key was not set, not logged
    */
   static esp_err_t erase_key(const char *key);
 
@@ -128,14 +149,16 @@ class NVSStatic {
    */
   static esp_err_t erase_all();
 
- private:
   /**
-   * @brief Call after write() to commit the change to NVS
+   * @brief Commits pending changes to NVS. write() commits by itself, call
+   * this after erase_key() or erase_all().
    *
    * @return esp_err_t
    */
   static esp_err_t nvsCommit();
 
+ private:
+
   /**
    * @brief Prints error messages for read methods
    *
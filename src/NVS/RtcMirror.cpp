@@ -0,0 +1,263 @@
+#include "RtcMirror.h"
+#include <string.h>
+#include "Crypto/Crc32.h"
+#include "Metrics/Metrics.h"
+#include "esp_log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+/* Not cleared at startup, unlike RTC_DATA_ATTR which is reloaded on every
+ * reset but a deep sleep wake. Garbage after power on fails intact(). */
+#define RTC_MIRROR_ATTR RTC_NOINIT_ATTR
+#else
+/* Natively a static survives the simulated wakes of one process */
+#define RTC_MIRROR_ATTR
+#endif
+
+#define RTC_MIRROR_MAGIC 0x52544d31  // "RTM1"
+
+namespace RtcMirror {
+static const char *TAG = "RtcMirror";
+
+struct Entry {
+  char key[RTC_MIRROR_KEY_SIZE];
+  uint8_t kind;
+  uint8_t size;
+  uint8_t used;
+  uint8_t dirty;
+  uint8_t value[RTC_MIRROR_VALUE_SIZE];
+};
+
+struct Image {
+  uint32_t magic;
+  uint32_t generation;
+  Entry entries[RTC_MIRROR_ENTRIES];
+  WifiState wifi;
+  uint32_t wifi_valid;
+  uint32_t crc;  // Over everything above
+};
+
+/* Kept over deep sleep and resets, random after power on */
+RTC_MIRROR_ATTR static Image images[2];
+
+/* Working copy, written to the older image by save() */
+static Image current;
+static bool opened = false;
+static Port::Mutex lock;
+
+static Metrics::Counter hits("rtc.hits");
+static Metrics::Counter misses("rtc.misses");
+
+static bool intact(const Image &image) {
+  return image.magic == RTC_MIRROR_MAGIC &&
+         image.crc == crc32(&image, offsetof(Image, crc));
+}
+
+/* Call with 'lock' held */
+static void save() {
+  current.generation++;
+  current.crc = crc32(&current, offsetof(Image, crc));
+  memcpy(&images[current.generation & 1], &current, sizeof(current));
+}
+
+/* Call with 'lock' held */
+static Entry *find(const char *key) {
+  for (int i = 0; i < RTC_MIRROR_ENTRIES; i++) {
+    Entry &entry = current.entries[i];
+    if (entry.used && strncmp(entry.key, key, RTC_MIRROR_KEY_SIZE) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+/* Writes one entry back as the type it was mirrored as */
+static esp_err_t write_back(const Entry &entry) {
+  switch (entry.kind) {
+#define RTC_MIRROR_WRITE(tag, type)              \
+  case tag: {                                    \
+    type value;                                  \
+    memcpy(&value, entry.value, sizeof(value));  \
+    return NVS.write(entry.key, value);          \
+  }
+    RTC_MIRROR_WRITE(I8, int8_t)
+    RTC_MIRROR_WRITE(I16, int16_t)
+    RTC_MIRROR_WRITE(I32, int32_t)
+    RTC_MIRROR_WRITE(U8, uint8_t)
+    RTC_MIRROR_WRITE(U16, uint16_t)
+    RTC_MIRROR_WRITE(U32, uint32_t)
+#undef RTC_MIRROR_WRITE
+    default:
+      return NVS.write(entry.key, entry.value, entry.size);
+  }
+}
+}  // namespace RtcMirror
+
+esp_err_t RtcMirror::begin() {
+  Port::Lock guard(lock);
+  opened = false;
+  bool ok0 = intact(images[0]);
+  bool ok1 = intact(images[1]);
+  if (ok0 || ok1) {
+    /* The newer intact copy, generations may wrap */
+    const Image *newest = &images[ok0 ? 0 : 1];
+    if (ok0 && ok1 &&
+        (int32_t)(images[1].generation - images[0].generation) > 0) {
+      newest = &images[1];
+    }
+    memcpy(&current, newest, sizeof(current));
+    return ESP_OK;
+  }
+
+  bool blank = images[0].magic == 0 && images[1].magic == 0;
+  if (!blank) {
+    ESP_LOGW(TAG, "Retained image damaged, starting empty");
+  }
+  memset(&current, 0, sizeof(current));
+  current.magic = RTC_MIRROR_MAGIC;
+  save();
+  return blank ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_CRC;
+}
+
+esp_err_t RtcMirror::lookup(const char *key, void *dest, size_t size) {
+  Port::Lock guard(lock);
+  const Entry *entry = find(key);
+  if (entry == nullptr) {
+    misses.add();
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (entry->size != size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  hits.add();
+  memcpy(dest, entry->value, size);
+  return ESP_OK;
+}
+
+esp_err_t RtcMirror::store(const char *key, const void *src, size_t size,
+                           Kind kind, bool dirty) {
+  if (strlen(key) >= RTC_MIRROR_KEY_SIZE || size > RTC_MIRROR_VALUE_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  Port::Lock guard(lock);
+  if (current.magic != RTC_MIRROR_MAGIC) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  Entry *entry = find(key);
+  if (entry == nullptr) {
+    for (int i = 0; i < RTC_MIRROR_ENTRIES && entry == nullptr; i++) {
+      if (!current.entries[i].used) {
+        entry = &current.entries[i];
+      }
+    }
+    if (entry == nullptr) {
+      return ESP_ERR_NO_MEM;
+    }
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->key, key, RTC_MIRROR_KEY_SIZE - 1);
+    entry->used = 1;
+  } else if (entry->size == size && entry->kind == kind &&
+             memcmp(entry->value, src, size) == 0) {
+    /* Unchanged, only a newly dirty entry needs saving */
+    if (!dirty || entry->dirty) {
+      return ESP_OK;
+    }
+  }
+  entry->kind = kind;
+  entry->size = size;
+  entry->dirty = entry->dirty || dirty;
+  memcpy(entry->value, src, size);
+  save();
+  return ESP_OK;
+}
+
+esp_err_t RtcMirror::open_nvs() {
+  Port::Lock guard(lock);
+  if (opened) {
+    return ESP_OK;
+  }
+  esp_err_t err = NVS.begin();
+  opened = err == ESP_OK;
+  return err;
+}
+
+esp_err_t RtcMirror::flush() {
+  if (dirty() == 0) {
+    return ESP_OK;
+  }
+  esp_err_t err = open_nvs();
+  if (err != ESP_OK) {
+    return err;
+  }
+  Port::Lock guard(lock);
+  esp_err_t first = ESP_OK;
+  for (int i = 0; i < RTC_MIRROR_ENTRIES; i++) {
+    Entry &entry = current.entries[i];
+    if (!entry.used || !entry.dirty) {
+      continue;
+    }
+    err = write_back(entry);
+    if (err == ESP_OK) {
+      entry.dirty = 0;
+    } else if (first == ESP_OK) {
+      first = err;
+    }
+  }
+  save();
+  return first;
+}
+
+size_t RtcMirror::dirty() {
+  Port::Lock guard(lock);
+  size_t count = 0;
+  for (int i = 0; i < RTC_MIRROR_ENTRIES; i++) {
+    if (current.entries[i].used && current.entries[i].dirty) {
+      count++;
+    }
+  }
+  return count;
+}
+
+uint32_t RtcMirror::generation() {
+  Port::Lock guard(lock);
+  return current.generation;
+}
+
+bool RtcMirror::nvs_opened() {
+  Port::Lock guard(lock);
+  return opened;
+}
+
+esp_err_t RtcMirror::wifi(WifiState *state) {
+  Port::Lock guard(lock);
+  if (!current.wifi_valid) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  *state = current.wifi;
+  return ESP_OK;
+}
+
+void RtcMirror::set_wifi(const WifiState &state) {
+  Port::Lock guard(lock);
+  if (current.magic != RTC_MIRROR_MAGIC ||
+      (current.wifi_valid &&
+       memcmp(&current.wifi, &state, sizeof(state)) == 0)) {
+    return;
+  }
+  current.wifi = state;
+  current.wifi_valid = 1;
+  save();
+}
+
+void RtcMirror::forget_wifi() {
+  Port::Lock guard(lock);
+  if (current.wifi_valid) {
+    current.wifi_valid = 0;
+    save();
+  }
+}
+
+uint8_t *RtcMirror::retained(size_t *size) {
+  *size = sizeof(images);
+  return reinterpret_cast<uint8_t *>(images);
+}
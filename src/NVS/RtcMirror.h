@@ -0,0 +1,197 @@
+/**
+ * Mirror of hot NVS values and the Wi-Fi reconnect state in RTC slow
+ * memory, which survives deep sleep. A sensor that wakes every minute reads
+ * its config from RTC RAM instead of initialising NVS and rereading flash:
+ *
+ *   RtcMirror::begin();
+ *   uint32_t interval;
+ *   RtcMirror::read("interval", interval);  // NVS only on the first boot
+ *   ...
+ *   RtcMirror::write("count", count);        // Dirty until flush()
+ *   esp_deep_sleep_start();
+ *
+ * NVS is opened lazily, only for a key the mirror does not hold or when
+ * flush() has dirty entries to write back. Use RtcMirror rather than
+ * NVS.begin() on a wake path for that reason.
+ *
+ * The retained image is kept twice, each with a generation number and a
+ * CRC. Updates go to the older copy, so a reset in the middle of one leaves
+ * the previous copy to restore from. The images are left alone at startup,
+ * so dirty values survive deep sleep and software, watchdog and panic
+ * resets. After power loss they hold garbage that fails the CRC; flush()
+ * values that must survive it.
+ */
+
+#ifndef __RTC_MIRROR_H__
+#define __RTC_MIRROR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "NVS.h"
+#include "Port/Port.h"
+
+/* Keys the mirror holds */
+#ifndef RTC_MIRROR_ENTRIES
+#define RTC_MIRROR_ENTRIES 16
+#endif
+
+/* Largest value mirrored, in bytes */
+#ifndef RTC_MIRROR_VALUE_SIZE
+#define RTC_MIRROR_VALUE_SIZE 16
+#endif
+
+/* NVS keys are at most 15 characters */
+#define RTC_MIRROR_KEY_SIZE 16
+
+namespace RtcMirror {
+
+/* NVS type a value is written back as */
+enum Kind : uint8_t { I8, I16, I32, U8, U16, U32, BLOB };
+
+inline Kind kind(const int8_t &) { return I8; }
+inline Kind kind(const int16_t &) { return I16; }
+inline Kind kind(const int32_t &) { return I32; }
+inline Kind kind(const uint8_t &) { return U8; }
+inline Kind kind(const uint16_t &) { return U16; }
+inline Kind kind(const uint32_t &) { return U32; }
+template <typename T>
+Kind kind(const T &) {
+  return BLOB;
+}
+
+/**
+ * State for reconnecting to the last access point without a scan
+ */
+struct WifiState {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t gw;
+};
+
+/**
+ * @brief Restores the mirror from RTC memory. Call once per boot or wake,
+ * before the other functions.
+ *
+ * @return
+ *  - ESP_OK                Restored, reads need no NVS
+ *  - ESP_ERR_NOT_FOUND     Cold boot, the mirror starts empty
+ *  - ESP_ERR_INVALID_CRC   Neither copy was intact, the mirror starts empty
+ */
+esp_err_t begin();
+
+/**
+ * @brief Looks up a mirrored value without touching NVS
+ *
+ * @return
+ *  - ESP_OK                The value is in 'dest'
+ *  - ESP_ERR_NOT_FOUND     The key is not mirrored
+ *  - ESP_ERR_INVALID_SIZE  The key is mirrored with another size
+ */
+esp_err_t lookup(const char *key, void *dest, size_t size);
+
+/**
+ * @brief Sets a mirrored value, adding the key if needed
+ *
+ * @param dirty  true if NVS does not hold the value yet
+ *
+ * @return
+ *  - ESP_OK                The value is mirrored
+ *  - ESP_ERR_INVALID_ARG   The key or value is too long
+ *  - ESP_ERR_NO_MEM        RTC_MIRROR_ENTRIES keys are mirrored already
+ *  - ESP_ERR_INVALID_STATE begin() was not called
+ */
+esp_err_t store(const char *key, const void *src, size_t size, Kind kind,
+                bool dirty);
+
+/**
+ * @brief Opens NVS for this boot, once
+ *
+ * @return As NVSStatic::begin()
+ */
+esp_err_t open_nvs();
+
+/**
+ * @brief Reads a value, from the mirror if it holds the key, else from NVS
+ * and then mirrored
+ *
+ * @return As lookup(), or NVSStatic::read() on a miss
+ */
+template <typename T>
+esp_err_t read(const char *key, T &dest) {
+  static_assert(sizeof(T) <= RTC_MIRROR_VALUE_SIZE, "Value too large");
+  esp_err_t err = lookup(key, &dest, sizeof(T));
+  if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+  err = open_nvs();
+  if (err == ESP_OK) {
+    err = NVS.read(key, dest);
+  }
+  if (err == ESP_OK) {
+    err = store(key, &dest, sizeof(T), kind(dest), false);
+  }
+  return err;
+}
+
+/**
+ * @brief Writes a value to the mirror. It reaches NVS on flush().
+ *
+ * @return As store()
+ */
+template <typename T>
+esp_err_t write(const char *key, const T &src) {
+  static_assert(sizeof(T) <= RTC_MIRROR_VALUE_SIZE, "Value too large");
+  return store(key, &src, sizeof(T), kind(src), true);
+}
+
+/**
+ * @brief Writes the dirty values back to NVS
+ *
+ * @return ESP_OK, or the first NVS error. Values that failed stay dirty.
+ */
+esp_err_t flush();
+
+/**
+ * @brief Gets the number of values not yet in NVS
+ */
+size_t dirty();
+
+/**
+ * @brief Gets the generation of the retained image, counting its updates
+ */
+uint32_t generation();
+
+/**
+ * @brief Checks whether NVS was opened since begin()
+ */
+bool nvs_opened();
+
+/**
+ * @brief Gets the access point of the last connection
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if none is remembered
+ */
+esp_err_t wifi(WifiState *state);
+
+/**
+ * @brief Remembers the access point connected to. Ignored before begin(),
+ * so EasyWifi may call it whether or not the application uses the mirror.
+ */
+void set_wifi(const WifiState &state);
+
+/**
+ * @brief Drops the remembered access point, so the next connect scans
+ */
+void forget_wifi();
+
+/**
+ * @brief Gets the retained copies, for tests that damage them
+ */
+uint8_t *retained(size_t *size);
+
+}  // namespace RtcMirror
+
+#endif
@@ -0,0 +1,313 @@
+#include "Port.h"
+
+struct Port::TaskSlot {
+  uint32_t stack_size;
+  bool used;
+#ifdef ESP_PLATFORM
+  StackType_t *stack;
+  StaticTask_t tcb;
+#endif
+};
+
+namespace Port {
+#ifdef ESP_PLATFORM
+static StackType_t small_stacks[PORT_SMALL_TASKS][PORT_SMALL_STACK_SIZE];
+static StackType_t large_stacks[PORT_LARGE_TASKS][PORT_LARGE_STACK_SIZE];
+#endif
+
+/* Small slots first, so the first fit is also the smallest */
+static TaskSlot slots[PORT_TASKS];
+static bool slots_ready = false;
+static Mutex pool_lock;
+static PoolStats pool = {PORT_TASKS, 0, 0, 0};
+
+static void init_slots() {
+  for (int i = 0; i < PORT_TASKS; i++) {
+    bool small = i < PORT_SMALL_TASKS;
+    slots[i].stack_size =
+        small ? PORT_SMALL_STACK_SIZE : PORT_LARGE_STACK_SIZE;
+    slots[i].used = false;
+#ifdef ESP_PLATFORM
+    slots[i].stack =
+        small ? small_stacks[i] : large_stacks[i - PORT_SMALL_TASKS];
+#endif
+  }
+  slots_ready = true;
+}
+
+/* Takes the smallest free slot holding 'stack_size' bytes */
+static esp_err_t acquire(uint32_t stack_size, TaskSlot **out) {
+  if (stack_size > PORT_LARGE_STACK_SIZE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  Lock lock(pool_lock);
+  if (!slots_ready) {
+    init_slots();
+  }
+  for (int i = 0; i < PORT_TASKS; i++) {
+    if (!slots[i].used && slots[i].stack_size >= stack_size) {
+      slots[i].used = true;
+      if (++pool.in_use > pool.peak) {
+        pool.peak = pool.in_use;
+      }
+      *out = &slots[i];
+      return ESP_OK;
+    }
+  }
+  pool.exhausted++;
+  return ESP_ERR_NO_MEM;
+}
+
+static void release(TaskSlot *slot) {
+  Lock lock(pool_lock);
+  slot->used = false;
+  pool.in_use--;
+}
+}  // namespace Port
+
+Port::PoolStats Port::task_pool() {
+  Lock lock(pool_lock);
+  return pool;
+}
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+
+uint64_t Port::micros() { return esp_timer_get_time(); }
+
+uint64_t Port::nanos() { return esp_timer_get_time() * 1000; }
+
+void Port::sleep_ms(uint32_t ms) {
+  /* Round up so short sleeps still yield for at least one tick */
+  vTaskDelay((ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+}
+
+uint32_t Port::core() { return xPortGetCoreID(); }
+
+static TickType_t to_ticks(uint32_t timeout_ms) {
+  return timeout_ms == PORT_WAIT_FOREVER ? portMAX_DELAY
+                                         : pdMS_TO_TICKS(timeout_ms);
+}
+
+Port::Signal::Signal() { handle_ = xSemaphoreCreateBinaryStatic(&buffer_); }
+
+Port::Signal::~Signal() { vSemaphoreDelete(handle_); }
+
+void Port::Signal::give() { xSemaphoreGive(handle_); }
+
+bool Port::Signal::take(uint32_t timeout_ms) {
+  return xSemaphoreTake(handle_, to_ticks(timeout_ms)) == pdTRUE;
+}
+
+Port::Notification::Notification() : bits_(0), waiter_(nullptr) {}
+
+void Port::Notification::post(uint32_t bits) {
+  bits_ |= bits;
+  /* Pairs with wait(), which publishes the waiter before reading the bits,
+   * so either the waiter sees them or this sees the waiter */
+  TaskHandle_t waiter = waiter_;
+  if (waiter != nullptr) {
+    xTaskNotify(waiter, bits, eSetBits);
+  }
+}
+
+uint32_t Port::Notification::wait(uint32_t bits, uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks = to_ticks(timeout_ms);
+  waiter_ = xTaskGetCurrentTaskHandle();
+  uint32_t posted;
+  /* Notifications left from other posts only cost a spurious wake-up */
+  while (((posted = bits_) & bits) == 0) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (ticks != portMAX_DELAY && waited >= ticks) {
+      break;
+    }
+    uint32_t value;
+    xTaskNotifyWait(0, UINT32_MAX, &value,
+                    ticks == portMAX_DELAY ? portMAX_DELAY : ticks - waited);
+  }
+  waiter_ = nullptr;
+  return posted;
+}
+
+void Port::Notification::clear(uint32_t bits) { bits_ &= ~bits; }
+
+Port::Mutex::Mutex() { handle_ = xSemaphoreCreateMutexStatic(&buffer_); }
+
+Port::Mutex::~Mutex() { vSemaphoreDelete(handle_); }
+
+void Port::Mutex::lock() { xSemaphoreTake(handle_, portMAX_DELAY); }
+
+void Port::Mutex::unlock() { xSemaphoreGive(handle_); }
+
+Port::Task::Task()
+    : fn_(nullptr),
+      arg_(nullptr),
+      running_(false),
+      slot_(nullptr),
+      handle_(nullptr) {}
+
+Port::Task::~Task() { join(); }
+
+esp_err_t Port::Task::start(Function fn, void *arg, const char *name,
+                            uint32_t stack_size, uint32_t priority,
+                            int32_t core) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = acquire(stack_size, &slot_);
+  if (err != ESP_OK) {
+    return err;
+  }
+  fn_ = fn;
+  arg_ = arg;
+  handle_ = xTaskCreateStaticPinnedToCore(
+      trampoline, name, slot_->stack_size, this, priority, slot_->stack,
+      &slot_->tcb, core == PORT_ANY_CORE ? tskNO_AFFINITY : core);
+  running_ = true;
+  return ESP_OK;
+}
+
+void Port::Task::join() {
+  if (running_) {
+    done_.take();
+    /* The slot's stack and TCB are in use until the task is off the CPU */
+    while (eTaskGetState(handle_) != eSuspended) {
+      vTaskDelay(1);
+    }
+    vTaskDelete(handle_);
+    release(slot_);
+    handle_ = nullptr;
+    slot_ = nullptr;
+    running_ = false;
+  }
+}
+
+void Port::Task::trampoline(void *self) {
+  Task *task = static_cast<Task *>(self);
+  task->fn_(task->arg_);
+  task->done_.give();
+  /* Parked until join() deletes it, a static task cannot delete itself */
+  for (;;) {
+    vTaskSuspend(NULL);
+  }
+}
+
+#else
+#include <chrono>
+
+uint64_t Port::micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t Port::nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Port::sleep_ms(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+uint32_t Port::core() { return 0; }
+
+Port::Signal::Signal() : set_(false) {}
+
+Port::Signal::~Signal() {}
+
+void Port::Signal::give() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    set_ = true;
+  }
+  cond_.notify_one();
+}
+
+bool Port::Signal::take(uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (timeout_ms == PORT_WAIT_FOREVER) {
+    cond_.wait(lock, [this] { return set_; });
+  } else if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                             [this] { return set_; })) {
+    return false;
+  }
+  set_ = false;
+  return true;
+}
+
+Port::Notification::Notification() : bits_(0) {}
+
+void Port::Notification::post(uint32_t bits) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bits_ |= bits;
+  }
+  cond_.notify_all();
+}
+
+uint32_t Port::Notification::wait(uint32_t bits, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (timeout_ms == PORT_WAIT_FOREVER) {
+    cond_.wait(lock, [this, bits] { return (bits_ & bits) != 0; });
+  } else {
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                   [this, bits] { return (bits_ & bits) != 0; });
+  }
+  return bits_;
+}
+
+void Port::Notification::clear(uint32_t bits) { bits_ &= ~bits; }
+
+Port::Mutex::Mutex() {}
+
+Port::Mutex::~Mutex() {}
+
+void Port::Mutex::lock() { mutex_.lock(); }
+
+void Port::Mutex::unlock() { mutex_.unlock(); }
+
+std::mutex &Port::CoreGuard::mutex() {
+  static std::mutex core;
+  return core;
+}
+
+Port::Task::Task()
+    : fn_(nullptr), arg_(nullptr), running_(false), slot_(nullptr) {}
+
+Port::Task::~Task() { join(); }
+
+esp_err_t Port::Task::start(Function fn, void *arg, const char *name,
+                            uint32_t stack_size, uint32_t priority,
+                            int32_t core) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = acquire(stack_size, &slot_);
+  if (err != ESP_OK) {
+    return err;
+  }
+  fn_ = fn;
+  arg_ = arg;
+  thread_ = std::thread(trampoline, this);
+  running_ = true;
+  return ESP_OK;
+}
+
+void Port::Task::join() {
+  if (running_) {
+    thread_.join();
+    release(slot_);
+    slot_ = nullptr;
+    running_ = false;
+  }
+}
+
+void Port::Task::trampoline(void *self) {
+  Task *task = static_cast<Task *>(self);
+  task->fn_(task->arg_);
+}
+
+#endif
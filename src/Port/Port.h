@@ -0,0 +1,324 @@
+/**
+ * Thin portability layer over FreeRTOS. Platform independent parts of the
+ * library are written against it so they can also be built for the native
+ * PlatformIO environment, where tests and benchmarks run on the host.
+ */
+
+#ifndef __PORT_H__
+#define __PORT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/* Subset of esp_err.h so shared code can report errors the same way */
+typedef int32_t esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+#endif
+
+/* Task slots, each with a statically allocated stack and control block.
+ * Every Port::Task runs in one, so tasks never allocate from the heap. */
+#ifndef PORT_SMALL_TASKS
+#define PORT_SMALL_TASKS 3
+#endif
+#ifndef PORT_SMALL_STACK_SIZE
+#define PORT_SMALL_STACK_SIZE 3072
+#endif
+#ifndef PORT_LARGE_TASKS
+#define PORT_LARGE_TASKS 8
+#endif
+#ifndef PORT_LARGE_STACK_SIZE
+#define PORT_LARGE_STACK_SIZE 4096
+#endif
+#define PORT_TASKS (PORT_SMALL_TASKS + PORT_LARGE_TASKS)
+
+/* Pass as a timeout to block until signalled */
+#define PORT_WAIT_FOREVER UINT32_MAX
+
+/* Pass as a core to let the scheduler pick */
+#define PORT_ANY_CORE -1
+
+/* Cores tasks may run on */
+#ifdef ESP_PLATFORM
+#define PORT_CORES portNUM_PROCESSORS
+#else
+#define PORT_CORES 1
+#endif
+
+namespace Port {
+
+/**
+ * @brief Gets a monotonic timestamp
+ *
+ * @return Microseconds since boot (device) or an arbitrary epoch (native)
+ */
+uint64_t micros();
+
+/**
+ * @brief Gets a monotonic timestamp for timing short operations
+ *
+ * @return Nanoseconds on the same epoch as micros(). The resolution is a
+ * microsecond on device.
+ */
+uint64_t nanos();
+
+/**
+ * @brief Blocks the calling task for at least the given time
+ *
+ * @param ms  Milliseconds to sleep
+ */
+void sleep_ms(uint32_t ms);
+
+/**
+ * @brief Gets the core the caller runs on, below PORT_CORES. A task may
+ * move to another core right after.
+ */
+uint32_t core();
+
+/**
+ * Binary semaphore. give() wakes one waiter, or the next call to take() if
+ * nobody is waiting. Storage is inline, so no heap is used.
+ */
+class Signal {
+ public:
+  Signal();
+  ~Signal();
+
+  void give();
+
+  /**
+   * @brief Waits for the signal
+   *
+   * @param timeout_ms  Maximum time to block, PORT_WAIT_FOREVER for no limit
+   *
+   * @return true if signalled, false on timeout
+   */
+  bool take(uint32_t timeout_ms = PORT_WAIT_FOREVER);
+
+ private:
+  Signal(const Signal &) = delete;
+  Signal &operator=(const Signal &) = delete;
+#ifdef ESP_PLATFORM
+  StaticSemaphore_t buffer_;
+  SemaphoreHandle_t handle_;
+#else
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool set_;
+#endif
+};
+
+/**
+ * Event bits with a single waiting task. post() wakes the waiter with a
+ * direct task notification, cheaper than an event group or semaphore and
+ * with no kernel object behind it. Bits stay set until clear(), like an
+ * event group without clear-on-exit.
+ *
+ * One task may wait at a time, and it must not use its task notification
+ * for anything else. State that several tasks wait on belongs in an event
+ * group. post() must not be called from an ISR.
+ */
+class Notification {
+ public:
+  Notification();
+
+  /**
+   * @brief Sets 'bits' and wakes the waiter
+   */
+  void post(uint32_t bits);
+
+  /**
+   * @brief Waits for any of 'bits' to be posted
+   *
+   * @param bits        Bits to wait for
+   * @param timeout_ms  Maximum time to block, PORT_WAIT_FOREVER for no limit
+   *
+   * @return Every bit posted, none of 'bits' on timeout
+   */
+  uint32_t wait(uint32_t bits, uint32_t timeout_ms = PORT_WAIT_FOREVER);
+
+  /**
+   * @brief Gets the bits posted, without waiting
+   */
+  uint32_t bits() const { return bits_; }
+
+  void clear(uint32_t bits = UINT32_MAX);
+
+ private:
+  Notification(const Notification &) = delete;
+  Notification &operator=(const Notification &) = delete;
+
+  std::atomic<uint32_t> bits_;
+#ifdef ESP_PLATFORM
+  std::atomic<TaskHandle_t> waiter_;
+#else
+  std::mutex mutex_;
+  std::condition_variable cond_;
+#endif
+};
+
+/**
+ * Mutual exclusion between tasks. Storage is inline, so no heap is used.
+ */
+class Mutex {
+ public:
+  Mutex();
+  ~Mutex();
+
+  void lock();
+  void unlock();
+
+ private:
+  Mutex(const Mutex &) = delete;
+  Mutex &operator=(const Mutex &) = delete;
+#ifdef ESP_PLATFORM
+  StaticSemaphore_t buffer_;
+  SemaphoreHandle_t handle_;
+#else
+  std::mutex mutex_;
+#endif
+};
+
+/**
+ * Holds a Mutex for the lifetime of the Lock
+ */
+class Lock {
+ public:
+  explicit Lock(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+  ~Lock() { mutex_.unlock(); }
+
+ private:
+  Lock(const Lock &) = delete;
+  Lock &operator=(const Lock &) = delete;
+
+  Mutex &mutex_;
+};
+
+/**
+ * Keeps other tasks and interrupts that may use the same data off the
+ * calling core while it exists, without stopping the other core. Hold it for
+ * a few instructions only. Natively there is one core, guarded by a mutex.
+ */
+class CoreGuard {
+ public:
+#ifdef ESP_PLATFORM
+  CoreGuard()
+      : state_(portSET_INTERRUPT_MASK_FROM_ISR()), core_(xPortGetCoreID()) {}
+  ~CoreGuard() { portCLEAR_INTERRUPT_MASK_FROM_ISR(state_); }
+
+  /* Core the caller runs on, below PORT_CORES */
+  uint32_t core() const { return core_; }
+#else
+  CoreGuard() : lock_(mutex()) {}
+
+  uint32_t core() const { return 0; }
+#endif
+
+ private:
+  CoreGuard(const CoreGuard &) = delete;
+  CoreGuard &operator=(const CoreGuard &) = delete;
+#ifdef ESP_PLATFORM
+  uint32_t state_;
+  uint32_t core_;
+#else
+  static std::mutex &mutex();
+  std::lock_guard<std::mutex> lock_;
+#endif
+};
+
+/* Slot usage, see task_pool() */
+struct PoolStats {
+  uint32_t capacity;
+  uint32_t in_use;
+  uint32_t peak;
+  uint32_t exhausted;  // Starts refused for want of a slot
+};
+
+/**
+ * @brief Gets the task slot usage since boot
+ */
+PoolStats task_pool();
+
+struct TaskSlot;
+
+/**
+ * A joinable background task, running in a slot of the static pool. The
+ * slot is returned by join() or destruction. On device this is a FreeRTOS
+ * task, natively a std::thread.
+ */
+class Task {
+ public:
+  typedef void (*Function)(void *arg);
+
+  Task();
+  ~Task();
+
+  /**
+   * @brief Starts running 'fn(arg)' in a new task
+   *
+   * @param fn          The task body. Return from it to end the task
+   * @param arg         Passed to 'fn'
+   * @param name        Task name, for debugging
+   * @param stack_size  Stack size in bytes. The task gets the smallest
+   *                    free slot that fits, which may be larger.
+   * @param priority    FreeRTOS priority (ignored natively)
+   * @param core        Core to pin the task to, or PORT_ANY_CORE (ignored
+   *                    natively)
+   *
+   * @return
+   *  - ESP_OK                The task was started
+   *  - ESP_ERR_INVALID_STATE This task is already running
+   *  - ESP_ERR_INVALID_SIZE  'stack_size' exceeds PORT_LARGE_STACK_SIZE
+   *  - ESP_ERR_NO_MEM        Every slot that fits is in use
+   */
+  esp_err_t start(Function fn, void *arg, const char *name,
+                  uint32_t stack_size, uint32_t priority,
+                  int32_t core = PORT_ANY_CORE);
+
+  /**
+   * @brief Blocks until the task body returns. Must be called before the
+   * Task is destroyed or restarted.
+   */
+  void join();
+
+ private:
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  static void trampoline(void *self);
+
+  Function fn_;
+  void *arg_;
+  bool running_;
+  TaskSlot *slot_;
+#ifdef ESP_PLATFORM
+  Signal done_;
+  TaskHandle_t handle_;
+#else
+  std::thread thread_;
+#endif
+};
+
+}  // namespace Port
+
+#endif
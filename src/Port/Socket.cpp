@@ -0,0 +1,197 @@
+#include "Socket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifndef ESP_PLATFORM
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+static sockaddr_in make_addr(uint32_t addr, uint16_t port) {
+  sockaddr_in out;
+  memset(&out, 0, sizeof(out));
+  out.sin_family = AF_INET;
+  out.sin_addr.s_addr = htonl(addr);
+  out.sin_port = htons(port);
+  return out;
+}
+
+int Port::tcp_listen(uint32_t addr, uint16_t *port, int backlog) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in local = make_addr(addr, *port);
+  socklen_t len = sizeof(local);
+  if (bind(fd, (sockaddr *)&local, sizeof(local)) != 0 ||
+      listen(fd, backlog) != 0 ||
+      getsockname(fd, (sockaddr *)&local, &len) != 0) {
+    close_socket(fd);
+    return -1;
+  }
+  *port = ntohs(local.sin_port);
+  return fd;
+}
+
+int Port::tcp_connect(uint32_t addr, uint16_t port, uint32_t timeout_ms,
+                      esp_err_t (*prepare)(int fd)) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (prepare != nullptr) {
+    prepare(fd);
+  }
+
+  /* Non-blocking connect, so an unreachable peer costs 'timeout_ms' rather
+   * than the full SYN retry schedule */
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  sockaddr_in remote = make_addr(addr, port);
+  int ret = connect(fd, (sockaddr *)&remote, sizeof(remote));
+  if (ret != 0 && errno == EINPROGRESS) {
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    timeval timeout = {(long)(timeout_ms / 1000),
+                       (long)(timeout_ms % 1000) * 1000};
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (select(fd + 1, nullptr, &writable, nullptr, &timeout) == 1 &&
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+        error == 0) {
+      ret = 0;
+    }
+  }
+  if (ret != 0) {
+    close_socket(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, flags);
+  set_timeout(fd, timeout_ms);
+  return fd;
+}
+
+int Port::udp_multicast(uint32_t group, uint16_t port, uint32_t interface) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+  /* Natively several simulated devices share the port */
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+#endif
+
+  sockaddr_in local = make_addr(PORT_IPV4_ANY, port);
+  ip_mreq membership;
+  membership.imr_multiaddr.s_addr = htonl(group);
+  membership.imr_interface.s_addr = htonl(interface);
+  if (bind(fd, (sockaddr *)&local, sizeof(local)) != 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+                 sizeof(membership)) != 0) {
+    close_socket(fd);
+    return -1;
+  }
+  if (interface != PORT_IPV4_ANY) {
+    in_addr out;
+    out.s_addr = htonl(interface);
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &out, sizeof(out));
+  }
+  return fd;
+}
+
+int Port::udp_bind(uint32_t addr, uint16_t *port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in local = make_addr(addr, *port);
+  socklen_t len = sizeof(local);
+  if (bind(fd, (sockaddr *)&local, sizeof(local)) != 0 ||
+      getsockname(fd, (sockaddr *)&local, &len) != 0) {
+    close_socket(fd);
+    return -1;
+  }
+  *port = ntohs(local.sin_port);
+  return fd;
+}
+
+bool Port::udp_send(int fd, uint32_t addr, uint16_t port, const void *data,
+                    size_t size) {
+  sockaddr_in remote = make_addr(addr, port);
+  return sendto(fd, data, size, 0, (sockaddr *)&remote, sizeof(remote)) ==
+         (int)size;
+}
+
+int Port::udp_receive(int fd, void *dest, size_t size, uint32_t *addr) {
+  sockaddr_in remote;
+  socklen_t len = sizeof(remote);
+  int n = recvfrom(fd, dest, size, 0, (sockaddr *)&remote, &len);
+  if (n >= 0) {
+    *addr = ntohl(remote.sin_addr.s_addr);
+  }
+  return n;
+}
+
+esp_err_t Port::set_timeout(int fd, uint32_t timeout_ms) {
+  timeval timeout = {(long)(timeout_ms / 1000),
+                     (long)(timeout_ms % 1000) * 1000};
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) !=
+          0 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) !=
+          0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t Port::set_no_delay(int fd) {
+  int yes = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) != 0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+bool Port::send_all(int fd, const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+#ifdef MSG_NOSIGNAL
+    int n = send(fd, p, size, MSG_NOSIGNAL);
+#else
+    int n = send(fd, p, size, 0);
+#endif
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool Port::recv_all(int fd, void *dest, size_t size) {
+  uint8_t *p = static_cast<uint8_t *>(dest);
+  while (size > 0) {
+    int n = recv(fd, p, size, 0);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+void Port::close_socket(int fd) {
+  if (fd >= 0) {
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+  }
+}
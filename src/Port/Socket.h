@@ -0,0 +1,121 @@
+/**
+ * BSD socket helpers shared by the device (lwIP) and native builds. Sockets
+ * are plain file descriptors, addresses are IPv4 in host byte order.
+ */
+
+#ifndef __PORT_SOCKET_H__
+#define __PORT_SOCKET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port.h"
+
+#ifdef ESP_PLATFORM
+#include "lwip/sockets.h"
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+/* Builds an IPv4 address in host byte order */
+#define PORT_IPV4(a, b, c, d)                                        \
+  ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | \
+   (uint32_t)(d))
+
+#define PORT_IPV4_ANY 0
+#define PORT_IPV4_LOOPBACK PORT_IPV4(127, 0, 0, 1)
+
+namespace Port {
+
+/**
+ * @brief Opens a listening TCP socket
+ *
+ * @param addr  Local address, PORT_IPV4_ANY for all interfaces
+ * @param port  Local port, 0 for an ephemeral one. Set to the bound port.
+ *
+ * @return The socket, or -1 on error
+ */
+int tcp_listen(uint32_t addr, uint16_t *port, int backlog);
+
+/**
+ * @brief Connects to a TCP server, giving up after 'timeout_ms'
+ *
+ * @param prepare  Called with the socket before it connects, e.g. to size
+ *                 its buffers before the window is offered
+ *
+ * @return The connected socket, or -1 on error
+ */
+int tcp_connect(uint32_t addr, uint16_t port, uint32_t timeout_ms,
+                esp_err_t (*prepare)(int fd) = nullptr);
+
+/**
+ * @brief Opens a UDP socket bound to 'port' on all interfaces and joined
+ * to a multicast group. Other sockets may bind the same port.
+ *
+ * @param group      Multicast group
+ * @param interface  Interface address for the group, PORT_IPV4_ANY for the
+ *                   default one
+ *
+ * @return The socket, or -1 on error
+ */
+int udp_multicast(uint32_t group, uint16_t port, uint32_t interface);
+
+/**
+ * @brief Opens a UDP socket bound to a local port
+ *
+ * @param addr  Local address, PORT_IPV4_ANY for all interfaces
+ * @param port  Local port, 0 for an ephemeral one. Set to the bound port.
+ *
+ * @return The socket, or -1 on error
+ */
+int udp_bind(uint32_t addr, uint16_t *port);
+
+/**
+ * @brief Sends one datagram
+ *
+ * @return false if it could not be sent
+ */
+bool udp_send(int fd, uint32_t addr, uint16_t port, const void *data,
+              size_t size);
+
+/**
+ * @brief Receives one datagram, blocking up to the socket timeout
+ *
+ * @param addr  Set to the sender address
+ *
+ * @return Size of the datagram, or -1 on timeout or error
+ */
+int udp_receive(int fd, void *dest, size_t size, uint32_t *addr);
+
+/**
+ * @brief Limits how long recv(), send() and accept() block
+ */
+esp_err_t set_timeout(int fd, uint32_t timeout_ms);
+
+/**
+ * @brief Turns off Nagle's algorithm, for sockets that write whole
+ * messages and wait for an answer
+ */
+esp_err_t set_no_delay(int fd);
+
+/**
+ * @brief Sends all of 'data', retrying short sends
+ *
+ * @return false if the connection failed
+ */
+bool send_all(int fd, const void *data, size_t size);
+
+/**
+ * @brief Receives exactly 'size' bytes
+ *
+ * @return false if the connection failed, closed or timed out first
+ */
+bool recv_all(int fd, void *dest, size_t size);
+
+void close_socket(int fd);
+
+}  // namespace Port
+
+#endif
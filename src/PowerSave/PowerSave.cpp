@@ -0,0 +1,325 @@
+#include "PowerSave.h"
+#include "Metrics/Metrics.h"
+#include "esp_log.h"
+
+namespace PowerSave {
+static const char *TAG = "PowerSave";
+
+static Metrics::Counter switches("power.switches");
+static Metrics::Gauge policy_gauge("power.policy");
+static Metrics::Histogram rtt_us("power.rtt_us");
+
+/* Constant initialised, so requirements of any translation unit can
+ * register during static initialisation */
+static Requirement *head = nullptr;
+static Requirement *tail = nullptr;
+
+static Port::Mutex state_lock;
+static Config config;
+static bool running = false;
+
+/* The driver starts in MIN_MODEM */
+static Policy in_use = Policy::MIN_MODEM;
+static uint64_t entered_us = 0;
+static uint64_t accounted_us = 0;
+static uint64_t hint_until_us = 0;
+static Stats figures[POWERSAVE_POLICY_COUNT];
+
+/* Re-evaluates when a relax falls due, and after every change */
+class Governor : public Async::Flow {
+ public:
+  Governor() : stopping_(false), changed_(false) {}
+
+  Async::Status resume() override;
+
+  std::atomic<bool> stopping_;
+  std::atomic<bool> changed_;
+};
+
+static Governor governor;
+
+static size_t slot(Policy policy) { return (size_t)policy; }
+
+static wifi_ps_type_t ps_type(Policy policy) {
+  switch (policy) {
+    case Policy::NONE:
+      return WIFI_PS_NONE;
+    case Policy::MIN_MODEM:
+      return WIFI_PS_MIN_MODEM;
+    case Policy::MAX_MODEM:
+    default:
+      return WIFI_PS_MAX_MODEM;
+  }
+}
+
+/* Time between wakes, 0 for NONE */
+static uint64_t wake_interval_us(Policy policy) {
+  switch (policy) {
+    case Policy::MIN_MODEM:
+      return (uint64_t)config.dtim * config.beacon_us;
+    case Policy::MAX_MODEM:
+      return (uint64_t)config.listen_interval * config.beacon_us;
+    case Policy::NONE:
+    default:
+      return 0;
+  }
+}
+
+/* Adds the time since the last call to the policy in use. Callers hold
+ * state_lock, as for the functions below. */
+static void account(uint64_t now) {
+  if (accounted_us == 0) {
+    accounted_us = now;
+    return;
+  }
+  uint64_t elapsed = now - accounted_us;
+  accounted_us = now;
+  Stats &stats = figures[slot(in_use)];
+  stats.time_us += elapsed;
+  uint64_t interval = wake_interval_us(in_use);
+  stats.awake_us += interval == 0
+                        ? elapsed
+                        : elapsed * POWERSAVE_BEACON_AWAKE_US / interval;
+}
+
+static uint32_t expected_locked(Policy policy) {
+  const Stats &stats = figures[slot(policy)];
+  if (stats.rtt_count >= POWERSAVE_MIN_SAMPLES) {
+    return stats.rtt_avg_us;
+  }
+  /* Half a wake on top of what the network takes with the radio on */
+  const Stats &awake = figures[slot(Policy::NONE)];
+  uint32_t base =
+      awake.rtt_count >= POWERSAVE_MIN_SAMPLES ? awake.rtt_avg_us : 0;
+  return base + (uint32_t)(wake_interval_us(policy) / 2);
+}
+
+static Policy wanted_locked(uint64_t now) {
+  if (hint_until_us > now) {
+    return Policy::NONE;
+  }
+  uint32_t bound_ms = 0;
+  for (Requirement *r = head; r != nullptr; r = r->next()) {
+    uint32_t ms = r->max_latency_ms();
+    if (ms != 0 && (bound_ms == 0 || ms < bound_ms)) {
+      bound_ms = ms;
+    }
+  }
+  for (size_t i = slot(config.deepest); i > 0; i--) {
+    Policy policy = (Policy)i;
+    if (bound_ms == 0 ||
+        expected_locked(policy) <= (uint64_t)bound_ms * 1000) {
+      return policy;
+    }
+  }
+  return Policy::NONE;
+}
+
+static esp_err_t switch_to(Policy policy, uint64_t now) {
+  /* A failure is retried after the dwell time rather than at once */
+  entered_us = now;
+  esp_err_t err = esp_wifi_set_ps(ps_type(policy));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Setting %s failed (0x%x)", name(policy), err);
+    return err;
+  }
+  account(now);
+  ESP_LOGI(TAG, "%s -> %s", name(in_use), name(policy));
+  in_use = policy;
+  figures[slot(policy)].entries++;
+  switches.add();
+  policy_gauge.set(slot(policy));
+  return ESP_OK;
+}
+
+/* Faster at once, slower once the policy in use has had its dwell time */
+static void update(uint64_t now) {
+  Policy want = wanted_locked(now);
+  if (want == in_use) {
+    return;
+  }
+  if (want > in_use && now < entered_us + (uint64_t)config.dwell_ms * 1000) {
+    return;
+  }
+  switch_to(want, now);
+}
+
+/* Milliseconds until update() has something new to do */
+static uint32_t next_update_ms(uint64_t now) {
+  uint64_t due = 0;
+  if (hint_until_us > now) {
+    due = hint_until_us;
+  } else if (wanted_locked(now) > in_use) {
+    due = entered_us + (uint64_t)config.dwell_ms * 1000;
+  } else {
+    return POWERSAVE_IDLE_MS;
+  }
+  if (due <= now) {
+    return 0;
+  }
+  uint64_t ms = (due - now + 999) / 1000;
+  return ms < POWERSAVE_IDLE_MS ? (uint32_t)ms : POWERSAVE_IDLE_MS;
+}
+
+static void evaluate() {
+  Port::Lock lock(state_lock);
+  if (running) {
+    update(Port::micros());
+  }
+}
+
+/* Applies a change at once and has the governor look again */
+static void changed() {
+  evaluate();
+  governor.changed_ = true;
+  Async::notify();
+}
+
+static uint32_t wait_ms() {
+  Port::Lock lock(state_lock);
+  return next_update_ms(Port::micros());
+}
+
+Async::Status Governor::resume() {
+  ASYNC_BEGIN();
+  while (!stopping_) {
+    evaluate();
+    ASYNC_AWAIT_MS(stopping_ || changed_.exchange(false), wait_ms());
+  }
+  ASYNC_END();
+}
+}  // namespace PowerSave
+
+PowerSave::Requirement::Requirement(const char *name)
+    : name_(name), max_latency_ms_(0), next_(nullptr) {
+  if (head == nullptr) {
+    head = this;
+  } else {
+    tail->next_ = this;
+  }
+  tail = this;
+}
+
+void PowerSave::Requirement::set(uint32_t max_latency_ms) {
+  max_latency_ms_ = max_latency_ms;
+  changed();
+}
+
+void PowerSave::Requirement::clear() { set(0); }
+
+esp_err_t PowerSave::begin(const Config &settings) {
+  if (settings.beacon_us == 0 || settings.dtim == 0 ||
+      settings.listen_interval == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  {
+    Port::Lock lock(state_lock);
+    if (running) {
+      return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t now = Port::micros();
+    account(now);
+    config = settings;
+
+    Policy want = wanted_locked(now);
+    esp_err_t err = want == in_use ? esp_wifi_set_ps(ps_type(want))
+                         : switch_to(want, now);
+    if (err != ESP_OK) {
+      return err;
+    }
+    running = true;
+  }
+  governor.stopping_ = false;
+  esp_err_t err = Async::spawn(&governor);
+  if (err != ESP_OK) {
+    Port::Lock lock(state_lock);
+    running = false;
+  }
+  return err;
+}
+
+void PowerSave::end() {
+  {
+    Port::Lock lock(state_lock);
+    running = false;
+  }
+  governor.stopping_ = true;
+  Async::notify();
+}
+
+esp_err_t PowerSave::apply() {
+  Port::Lock lock(state_lock);
+  return esp_wifi_set_ps(ps_type(in_use));
+}
+
+void PowerSave::hint(uint32_t ms) {
+  {
+    Port::Lock lock(state_lock);
+    uint64_t until = Port::micros() + (uint64_t)ms * 1000;
+    if (until > hint_until_us) {
+      hint_until_us = until;
+    }
+  }
+  changed();
+}
+
+void PowerSave::record_rtt(uint32_t us) {
+  rtt_us.record(us);
+  {
+    Port::Lock lock(state_lock);
+    Stats &stats = figures[slot(in_use)];
+    if (stats.rtt_count == 0) {
+      stats.rtt_avg_us = us;
+    } else {
+      stats.rtt_avg_us = (uint32_t)((int64_t)stats.rtt_avg_us +
+                                    ((int64_t)us - stats.rtt_avg_us) / 8);
+    }
+    stats.rtt_count++;
+    if (us > stats.rtt_max_us) {
+      stats.rtt_max_us = us;
+    }
+    /* The radio stays on a while after an exchange it woke for */
+    if (in_use != Policy::NONE) {
+      stats.awake_us += POWERSAVE_EXCHANGE_AWAKE_US;
+    }
+  }
+  /* The observed latency may break a requirement */
+  changed();
+}
+
+PowerSave::Policy PowerSave::current() {
+  Port::Lock lock(state_lock);
+  return in_use;
+}
+
+PowerSave::Policy PowerSave::wanted() {
+  Port::Lock lock(state_lock);
+  return wanted_locked(Port::micros());
+}
+
+uint32_t PowerSave::expected_rtt_us(Policy policy) {
+  Port::Lock lock(state_lock);
+  return expected_locked(policy);
+}
+
+PowerSave::Stats PowerSave::stats(Policy policy) {
+  Port::Lock lock(state_lock);
+  account(Port::micros());
+  Stats stats = figures[slot(policy)];
+  uint64_t permille =
+      stats.time_us > 0 ? stats.awake_us * 1000 / stats.time_us : 0;
+  stats.duty_permille = permille < 1000 ? (uint16_t)permille : 1000;
+  return stats;
+}
+
+const char *PowerSave::name(Policy policy) {
+  switch (policy) {
+    case Policy::NONE:
+      return "none";
+    case Policy::MIN_MODEM:
+      return "min_modem";
+    case Policy::MAX_MODEM:
+      return "max_modem";
+  }
+  return "unknown";
+}
@@ -0,0 +1,189 @@
+/**
+ * Chooses the modem power save policy of the station at runtime, trading
+ * round trip latency for radio on time:
+ *
+ *   NONE       Radio always on, lowest latency
+ *   MIN_MODEM  Wakes for every DTIM beacon, the ESP-IDF default
+ *   MAX_MODEM  Wakes every 'listen_interval' beacons
+ *
+ * A frame for a sleeping station waits at the access point until the next
+ * wake, half a wake interval on average. Modules state what they can put up
+ * with, and the deepest policy that meets all of it is used:
+ *
+ *   static PowerSave::Requirement control("mqtt.control");
+ *
+ *   control.set(100);          // answers within about 100 ms
+ *   PowerSave::hint(2000);     // a transfer is about to start
+ *   PowerSave::record_rtt(us); // an exchange took this long
+ *   control.clear();
+ *
+ * A hint holds NONE for its duration. Going to a faster policy is immediate,
+ * going to a slower one waits for the policy to have been in use for
+ * 'dwell_ms', so bursts do not flap the radio. Until a policy has
+ * POWERSAVE_MIN_SAMPLES round trips recorded, its latency is estimated from
+ * the wake interval, then the moving average of what was observed is used.
+ *
+ * Each policy's time in use, estimated radio on time and round trips are
+ * kept, see stats(). The listen interval is a station setting, which
+ * EasyWifi::configure() sets to POWERSAVE_LISTEN_INTERVAL before the radio
+ * starts. Config::listen_interval only models it and must match.
+ */
+
+#ifndef __POWER_SAVE_H__
+#define __POWER_SAVE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "Async/Async.h"
+#include "Port/Port.h"
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+/* 100 TU, what access points send unless configured otherwise */
+#define POWERSAVE_BEACON_US 102400
+#define POWERSAVE_DTIM 1
+#ifndef POWERSAVE_LISTEN_INTERVAL
+#define POWERSAVE_LISTEN_INTERVAL 3
+#endif
+
+/* Radio on time to receive a beacon, and to finish an exchange after the
+ * wake, for the duty cycle estimate */
+#define POWERSAVE_BEACON_AWAKE_US 2000
+#define POWERSAVE_EXCHANGE_AWAKE_US 5000
+
+#define POWERSAVE_DWELL_MS 2000
+#define POWERSAVE_MIN_SAMPLES 8
+
+/* Longest the governor sleeps with nothing to relax */
+#define POWERSAVE_IDLE_MS 1000
+
+namespace PowerSave {
+
+/* Ordered from the most radio on time to the least */
+enum class Policy : uint8_t {
+  NONE = 0,
+  MIN_MODEM = 1,
+  MAX_MODEM = 2,
+};
+
+#define POWERSAVE_POLICY_COUNT 3
+
+struct Config {
+  uint32_t beacon_us = POWERSAVE_BEACON_US; /*!< The access point's beacon
+                                                 interval */
+  uint8_t dtim = POWERSAVE_DTIM;            /*!< Its DTIM period in beacons */
+  uint8_t listen_interval = POWERSAVE_LISTEN_INTERVAL; /*!< Beacons between
+                                                            MAX_MODEM wakes,
+                                                            as the station
+                                                            was given */
+  Policy deepest = Policy::MAX_MODEM; /*!< Most saving allowed */
+  uint32_t dwell_ms = POWERSAVE_DWELL_MS;
+};
+
+struct Stats {
+  uint64_t time_us;       /*!< In use */
+  uint64_t awake_us;      /*!< Estimated radio on time while in use */
+  uint32_t entries;       /*!< Times switched to */
+  uint32_t rtt_count;     /*!< Round trips recorded while in use */
+  uint32_t rtt_avg_us;    /*!< Their moving average, weight 1/8 */
+  uint32_t rtt_max_us;    /*!< The longest */
+  uint16_t duty_permille; /*!< awake_us per 1000 of time_us */
+};
+
+/**
+ * A latency bound of one module. Define requirements at namespace scope,
+ * they register during static initialisation and are never unregistered.
+ */
+class Requirement {
+ public:
+  explicit Requirement(const char *name);
+
+  /**
+   * @brief Asks for round trips of at most 'max_latency_ms' on average,
+   * switching to a faster policy at once if needed
+   */
+  void set(uint32_t max_latency_ms);
+
+  /**
+   * @brief Drops the bound, a slower policy follows after the dwell time
+   */
+  void clear();
+
+  const char *name() const { return name_; }
+
+  /* 0 while cleared */
+  uint32_t max_latency_ms() const { return max_latency_ms_.load(); }
+
+  /* Next registered requirement, or nullptr */
+  Requirement *next() const { return next_; }
+
+ private:
+  Requirement(const Requirement &) = delete;
+  Requirement &operator=(const Requirement &) = delete;
+
+  const char *name_;
+  std::atomic<uint32_t> max_latency_ms_;
+  Requirement *next_;
+};
+
+/**
+ * @brief Applies the deepest policy the requirements allow, and starts
+ * re-evaluating on the Async executor. Call after the Wi-Fi driver is
+ * initialised. Only the power save type is changed, never the station
+ * config, so this may run while the station connects.
+ *
+ * @return
+ *  - ESP_OK                Running
+ *  - ESP_ERR_INVALID_STATE Already running
+ *  - ESP_ERR_INVALID_ARG   A zero beacon interval, DTIM or listen interval
+ *  - Any error of the driver
+ */
+esp_err_t begin(const Config &config = Config());
+
+/**
+ * @brief Stops re-evaluating, the policy in use stays
+ */
+void end();
+
+/**
+ * @brief Gives the current policy to the driver again, e.g. after
+ * esp_wifi_init(). Before begin() that is MIN_MODEM.
+ *
+ * @return As esp_wifi_set_ps()
+ */
+esp_err_t apply();
+
+/**
+ * @brief Announces traffic for the next 'ms', holding NONE until then
+ */
+void hint(uint32_t ms);
+
+/**
+ * @brief Records a round trip, attributed to the policy in use
+ */
+void record_rtt(uint32_t us);
+
+/* The policy in use */
+Policy current();
+
+/* The policy the requirements and hints call for now */
+Policy wanted();
+
+/**
+ * @brief Gets the average round trip expected of a policy, observed or
+ * estimated from its wake interval
+ */
+uint32_t expected_rtt_us(Policy policy);
+
+/**
+ * @brief Gets a policy's figures, including the time up to now
+ */
+Stats stats(Policy policy);
+
+/* Name of a policy, e.g. "min_modem" */
+const char *name(Policy policy);
+
+}  // namespace PowerSave
+
+#endif
@@ -0,0 +1,349 @@
+#include "Profile.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "Ring/SpscRing.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <functional>
+#include <thread>
+#endif
+
+namespace Profile {
+enum EventType : uint8_t { SPAN, COUNTER };
+
+struct Event {
+  uint64_t time_us;
+  const char *site;    /* SPAN only */
+  uint32_t tid;
+  uint32_t value;      /* Duration in us, or CPU permille */
+  uint32_t stack_free; /* COUNTER only */
+  uint8_t type;
+  char task[PROFILE_TASK_NAME_SIZE];
+};
+
+/* One producer per ring, the tasks of a core serialised by Port::CoreGuard,
+ * and one consumer */
+static SpscRing<Event, PROFILE_TRACE_SIZE> rings[PORT_CORES];
+static std::atomic<uint32_t> dropped_events(0);
+static std::atomic<bool> tracing(false);
+
+/* Oldest event of each ring, taken out to compare times */
+static Event heads[PORT_CORES];
+static bool has_head[PORT_CORES];
+
+/* Statistics of the last update, and the counters they were taken from */
+struct Previous {
+  uint32_t id;
+  uint32_t runtime;
+};
+static TaskStats task_stats[PROFILE_MAX_TASKS];
+static size_t task_count = 0;
+static Previous previous[PROFILE_MAX_TASKS];
+static size_t previous_count = 0;
+static uint32_t previous_total = 0;
+static uint32_t sample_time_ms = 0;
+
+static Port::Task task;
+static Port::Signal stop_signal;
+static std::atomic<bool> running(false);
+static uint32_t period;
+static Output output;
+
+#ifdef ESP_PLATFORM
+static TaskStatus_t statuses[PROFILE_MAX_TASKS];
+static TaskSample samples[PROFILE_MAX_TASKS];
+#endif
+}  // namespace Profile
+
+static void print(const char *line) { printf("%s\n", line); }
+
+static void copy_name(char *dest, const char *name) {
+  strncpy(dest, name, PROFILE_TASK_NAME_SIZE - 1);
+  dest[PROFILE_TASK_NAME_SIZE - 1] = '\0';
+}
+
+/* Identifies the calling task */
+static void current_task(uint32_t *tid, char *name) {
+#ifdef ESP_PLATFORM
+  TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+  *tid = reinterpret_cast<uintptr_t>(handle);
+  copy_name(name, pcTaskGetTaskName(handle));
+#else
+  *tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+  copy_name(name, "native");
+#endif
+}
+
+static void push(Profile::Event &event) {
+  Port::CoreGuard guard;
+  if (!Profile::rings[guard.core()].push(event)) {
+    Profile::dropped_events.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Profile::Blocked::~Blocked() {
+  uint64_t now = Port::micros();
+  uint32_t us = now - start_;
+  site_.record(us);
+  if (tracing.load(std::memory_order_relaxed)) {
+    Event event;
+    event.time_us = start_;
+    event.site = site_.name();
+    event.value = us;
+    event.stack_free = 0;
+    event.type = SPAN;
+    current_task(&event.tid, event.task);
+    push(event);
+  }
+}
+
+void Profile::update(const TaskSample *tasks, size_t count, uint32_t total) {
+  count = std::min(count, (size_t)PROFILE_MAX_TASKS);
+  uint32_t elapsed = total - previous_total;
+  for (size_t i = 0; i < count; i++) {
+    const TaskSample &sample = tasks[i];
+    /* New tasks ran for all their run time within the period */
+    uint32_t before = 0;
+    for (size_t j = 0; j < previous_count; j++) {
+      if (previous[j].id == sample.id) {
+        before = previous[j].runtime;
+        break;
+      }
+    }
+    uint64_t permille =
+        elapsed > 0 ? (uint64_t)(sample.runtime - before) * 1000 / elapsed : 0;
+
+    TaskStats &stats = task_stats[i];
+    copy_name(stats.name, sample.name);
+    stats.id = sample.id;
+    stats.cpu_permille = std::min(permille, (uint64_t)1000);
+    stats.stack_free = sample.stack_free;
+    stats.priority = sample.priority;
+    stats.core = sample.core;
+  }
+  task_count = count;
+  std::sort(task_stats, task_stats + count,
+            [](const TaskStats &a, const TaskStats &b) {
+              return a.cpu_permille > b.cpu_permille;
+            });
+
+  for (size_t i = 0; i < count; i++) {
+    previous[i].id = tasks[i].id;
+    previous[i].runtime = tasks[i].runtime;
+  }
+  previous_count = count;
+  previous_total = total;
+
+  uint64_t now = Port::micros();
+  sample_time_ms = now / 1000;
+  if (!tracing.load(std::memory_order_relaxed)) {
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    Event event;
+    event.time_us = now;
+    event.site = nullptr;
+    event.tid = task_stats[i].id;
+    event.value = task_stats[i].cpu_permille;
+    event.stack_free = task_stats[i].stack_free;
+    event.type = COUNTER;
+    copy_name(event.task, task_stats[i].name);
+    push(event);
+  }
+}
+
+size_t Profile::sample() {
+#if defined(ESP_PLATFORM) && configUSE_TRACE_FACILITY && \
+    configGENERATE_RUN_TIME_STATS
+  uint32_t total = 0;
+  UBaseType_t count =
+      uxTaskGetSystemState(statuses, PROFILE_MAX_TASKS, &total);
+  if (count == 0) {
+    /* More tasks than PROFILE_MAX_TASKS */
+    return 0;
+  }
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t &status = statuses[i];
+    copy_name(samples[i].name, status.pcTaskName);
+    samples[i].id = reinterpret_cast<uintptr_t>(status.xHandle);
+    samples[i].runtime = status.ulRunTimeCounter;
+    samples[i].stack_free = status.usStackHighWaterMark;
+    samples[i].priority = status.uxCurrentPriority;
+#if configTASKLIST_INCLUDE_COREID
+    samples[i].core = status.xCoreID == tskNO_AFFINITY ? -1 : status.xCoreID;
+#else
+    samples[i].core = -1;
+#endif
+  }
+  update(samples, count, total);
+  return count;
+#else
+  return 0;
+#endif
+}
+
+size_t Profile::stats(const TaskStats **out) {
+  *out = task_stats;
+  return task_count;
+}
+
+void Profile::report() {
+  Output out = output != nullptr ? output : print;
+  char line[PROFILE_LINE_SIZE];
+  int prefix = snprintf(line, sizeof(line), "I (%u) Profile: ",
+                        static_cast<unsigned>(sample_time_ms));
+  char *rest = line + prefix;
+  size_t size = sizeof(line) - prefix;
+
+  snprintf(rest, size, "%-15s %4s %4s %6s %11s", "task", "core", "prio",
+           "cpu%", "stack_free");
+  out(line);
+  for (size_t i = 0; i < task_count; i++) {
+    const TaskStats &stats = task_stats[i];
+    char core[8];
+    if (stats.core < 0) {
+      strcpy(core, "-");
+    } else {
+      snprintf(core, sizeof(core), "%d", stats.core);
+    }
+    snprintf(rest, size, "%-15.15s %4s %4u %4u.%u %11u", stats.name, core,
+             (unsigned)stats.priority, (unsigned)(stats.cpu_permille / 10),
+             (unsigned)(stats.cpu_permille % 10), (unsigned)stats.stack_free);
+    out(line);
+  }
+}
+
+void Profile::set_output(Output out) { output = out; }
+
+void Profile::set_tracing(bool enabled) { tracing = enabled; }
+
+uint32_t Profile::dropped() {
+  return dropped_events.exchange(0, std::memory_order_relaxed);
+}
+
+/* Takes the oldest event of all rings */
+static bool pop(Profile::Event &event) {
+  using namespace Profile;
+  int oldest = -1;
+  for (int core = 0; core < PORT_CORES; core++) {
+    if (!has_head[core]) {
+      has_head[core] = rings[core].pop(heads[core]);
+    }
+    if (has_head[core] &&
+        (oldest < 0 || heads[core].time_us < heads[oldest].time_us)) {
+      oldest = core;
+    }
+  }
+  if (oldest < 0) {
+    return false;
+  }
+  event = heads[oldest];
+  has_head[oldest] = false;
+  return true;
+}
+
+/* Task names go into JSON strings, quotes and escapes are replaced */
+static void json_name(char *dest, const char *name) {
+  copy_name(dest, name);
+  for (char *p = dest; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\' || (uint8_t)*p < 0x20) {
+      *p = '_';
+    }
+  }
+}
+
+size_t Profile::write_trace(Writer write, void *ctx) {
+  char line[PROFILE_LINE_SIZE];
+  const char *separator = "\n";
+  int n;
+  auto emit = [&](int length) {
+    write(separator, strlen(separator), ctx);
+    write(line, std::min((size_t)length, sizeof(line) - 1), ctx);
+    separator = ",\n";
+  };
+
+  static const char begin[] = "{\"traceEvents\":[";
+  write(begin, sizeof(begin) - 1, ctx);
+
+  /* Name each task the first time it appears */
+  uint32_t named[PROFILE_MAX_TASKS];
+  size_t named_count = 0;
+  size_t events = 0;
+  Event event;
+  while (pop(event)) {
+    char task_name[PROFILE_TASK_NAME_SIZE];
+    json_name(task_name, event.task);
+    if (std::find(named, named + named_count, event.tid) ==
+        named + named_count) {
+      if (named_count < PROFILE_MAX_TASKS) {
+        named[named_count++] = event.tid;
+      }
+      n = snprintf(line, sizeof(line),
+                   "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                   "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                   (unsigned)event.tid, task_name);
+      emit(n);
+    }
+
+    unsigned long long ts = event.time_us;
+    if (event.type == SPAN) {
+      n = snprintf(line, sizeof(line),
+                   "{\"ph\":\"X\",\"cat\":\"block\",\"name\":\"%s\","
+                   "\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%u}",
+                   event.site, (unsigned)event.tid, ts, (unsigned)event.value);
+      emit(n);
+    } else {
+      n = snprintf(line, sizeof(line),
+                   "{\"ph\":\"C\",\"name\":\"%s cpu%%\",\"pid\":1,"
+                   "\"ts\":%llu,\"args\":{\"cpu\":%u.%u}}",
+                   task_name, ts, (unsigned)(event.value / 10),
+                   (unsigned)(event.value % 10));
+      emit(n);
+      n = snprintf(line, sizeof(line),
+                   "{\"ph\":\"C\",\"name\":\"%s stack_free\",\"pid\":1,"
+                   "\"ts\":%llu,\"args\":{\"bytes\":%u}}",
+                   task_name, ts, (unsigned)event.stack_free);
+      emit(n);
+    }
+    events++;
+  }
+
+  static const char end[] = "\n],\"displayTimeUnit\":\"ms\"}\n";
+  write(end, sizeof(end) - 1, ctx);
+  return events;
+}
+
+static void profile_task(void *arg) {
+  do {
+    if (Profile::sample() > 0) {
+      Profile::report();
+    }
+  } while (!Profile::stop_signal.take(Profile::period));
+}
+
+esp_err_t Profile::start(uint32_t period_ms) {
+  if (running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  running = true;
+  period = period_ms;
+  esp_err_t err = task.start(profile_task, nullptr, "profile",
+                             PROFILE_TASK_STACK_SIZE, PROFILE_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    running = false;
+  }
+  return err;
+}
+
+void Profile::stop() {
+  if (running) {
+    stop_signal.give();
+    task.join();
+    running = false;
+  }
+}
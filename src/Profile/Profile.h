@@ -0,0 +1,181 @@
+/**
+ * Task profiler. A low priority task samples the CPU time and stack
+ * high-water mark of every task each PROFILE_PERIOD_MS and prints a report:
+ *
+ *   I (10020) Profile: task            core prio   cpu%  stack_free
+ *   I (10020) Profile: IDLE1              1    0   97.1         576
+ *   I (10020) Profile: dns_resolve        -    5    0.4         612
+ *
+ * CPU is the share of one core over the last period, so pinned tasks top
+ * out at 100% and the sum over both cores at 200%. stack_free is the least
+ * stack the task has had left since it started, in bytes.
+ *
+ * Waits on event groups are timed by a Blocked guard on a Site. A Site is a
+ * histogram of blocked microseconds in the Metrics registry:
+ *
+ *   static Profile::Site dns_wait("dns.wait_us");
+ *
+ *   Profile::Blocked blocked(dns_wait);
+ *   xEventGroupWaitBits(...);
+ *
+ * While tracing, waits and samples are also buffered as events per core.
+ * write_trace() drains them as Chrome trace JSON, which chrome://tracing
+ * and ui.perfetto.dev open.
+ *
+ * Sampling needs CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS. Natively there is no scheduler
+ * to sample, only Blocked and the trace work.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Metrics/Metrics.h"
+#include "Port/Port.h"
+
+/* Tasks sampled, more are left out of the report */
+#define PROFILE_MAX_TASKS 24
+
+/* CONFIG_FREERTOS_MAX_TASK_NAME_LEN */
+#define PROFILE_TASK_NAME_SIZE 16
+
+/* Trace events buffered per core, a power of two */
+#ifndef PROFILE_TRACE_SIZE
+#define PROFILE_TRACE_SIZE 64
+#endif
+
+/* Longest report or trace line */
+#define PROFILE_LINE_SIZE 160
+
+#define PROFILE_PERIOD_MS 5000
+#define PROFILE_TASK_STACK_SIZE 3072
+#define PROFILE_TASK_PRIORITY 1
+
+namespace Profile {
+
+/**
+ * A place tasks block at, such as a wait on an event group. Define at
+ * namespace scope like any metric.
+ */
+class Site : public Metrics::Histogram {
+ public:
+  explicit Site(const char *name) : Metrics::Histogram(name) {}
+};
+
+/**
+ * Records the time from construction to destruction against a Site, and
+ * as a trace event while tracing
+ */
+class Blocked {
+ public:
+  explicit Blocked(Site &site) : site_(site), start_(Port::micros()) {}
+  ~Blocked();
+
+ private:
+  Blocked(const Blocked &) = delete;
+  Blocked &operator=(const Blocked &) = delete;
+
+  Site &site_;
+  uint64_t start_;
+};
+
+/**
+ * A task as seen by one sample of the scheduler
+ */
+struct TaskSample {
+  char name[PROFILE_TASK_NAME_SIZE];
+  uint32_t id;          /* Task number, unique while the task lives */
+  uint32_t runtime;     /* Run time counter, wraps */
+  uint32_t stack_free;  /* High-water mark, in bytes */
+  uint8_t priority;
+  int8_t core;          /* -1 if not pinned */
+};
+
+/**
+ * A task over the last period
+ */
+struct TaskStats {
+  char name[PROFILE_TASK_NAME_SIZE];
+  uint32_t id;
+  uint16_t cpu_permille;  /* Of one core */
+  uint32_t stack_free;
+  uint8_t priority;
+  int8_t core;
+};
+
+/* Receives each line, without a newline */
+typedef void (*Output)(const char *line);
+
+/* Receives the trace in pieces */
+typedef void (*Writer)(const char *data, size_t size, void *ctx);
+
+/**
+ * @brief Starts the task that samples and reports every 'period_ms'
+ *
+ * @return As Port::Task::start()
+ */
+esp_err_t start(uint32_t period_ms = PROFILE_PERIOD_MS);
+
+/**
+ * @brief Stops the profiling task, waiting for it to finish
+ */
+void stop();
+
+/**
+ * @brief Samples the scheduler once and updates the statistics
+ *
+ * @return The number of tasks sampled, 0 natively or when run time stats
+ * are disabled
+ */
+size_t sample();
+
+/**
+ * @brief Updates the statistics from one sample. Runs as part of sample(),
+ * exposed so tests can feed samples.
+ *
+ * @param tasks  The tasks, in any order
+ * @param total  Run time counter of a core, in the units of 'runtime'
+ */
+void update(const TaskSample *tasks, size_t count, uint32_t total);
+
+/**
+ * @brief Gets the statistics of the last update
+ *
+ * @return Number of tasks in 'stats'
+ */
+size_t stats(const TaskStats **out);
+
+/**
+ * @brief Passes the report of the last update to the output, a line per
+ * task, busiest first
+ */
+void report();
+
+/**
+ * @brief Replaces the report output, printf() by default. Pass nullptr to
+ * restore the default.
+ */
+void set_output(Output out);
+
+/**
+ * @brief Starts or stops buffering trace events
+ */
+void set_tracing(bool enabled);
+
+/**
+ * @brief Drains the buffered events as one Chrome trace JSON document
+ *
+ * @return Number of events written
+ */
+size_t write_trace(Writer write, void *ctx);
+
+/**
+ * @brief Gets and resets the number of events lost to full buffers
+ */
+uint32_t dropped();
+
+}  // namespace Profile
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Bounded lock-free ring for any number of producers and consumers
+ */
+
+#ifndef __MPMC_RING_H__
+#define __MPMC_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Fixed capacity FIFO. push() and pop() may be called from any task at
+ * once. Neither call blocks or allocates.
+ *
+ * Each cell carries a sequence number telling whose turn it is: a producer
+ * may fill it when it equals the position, a consumer may empty it when it
+ * is one past. A task preempted between claiming a cell and publishing it
+ * holds up that cell only, others see the ring as full or empty there.
+ *
+ * @tparam T  Element type, copied in and out
+ * @tparam N  Capacity, must be a power of two
+ */
+template <typename T, size_t N>
+class MpmcRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  MpmcRing() : head_(0), tail_(0) {
+    for (size_t i = 0; i < N; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Appends an element
+   *
+   * @return false if the ring is full
+   */
+  bool push(const T &item) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells_[pos & (N - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes the oldest element
+   *
+   * @return false if the ring is empty
+   */
+  bool pop(T &item) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells_[pos & (N - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    item = cell->item;
+    cell->sequence.store(pos + N, std::memory_order_release);
+    return true;
+  }
+
+  /* Approximate while others push or pop */
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  Cell cells_[N];
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * Bounded lock-free ring for exactly one producer and one consumer
+ */
+
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Fixed capacity FIFO. push() may only be called from one task and pop()
+ * from one other task. Neither call blocks or allocates.
+ *
+ * @tparam T  Element type, copied in and out
+ * @tparam N  Capacity, must be a power of two
+ */
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  SpscRing() : head_(0), tail_(0) {}
+
+  /**
+   * @brief Appends an element
+   *
+   * @return false if the ring is full
+   */
+  bool push(const T &item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes the oldest element
+   *
+   * @return false if the ring is empty
+   */
+  bool pop(T &item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) {
+      return false;
+    }
+    item = items_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T items_[N];
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+#endif
@@ -3,6 +3,81 @@
 namespace EasyWifi {
 const char *TAG = "EW";
 EventGroupHandle_t wifi_event_group;
+
+static StaticEventGroup_t wifi_event_buffer;
+
+static Metrics::Gauge connected("wifi.connected");
+static Metrics::Counter connects("wifi.connects");
+static Metrics::Counter reconnects("wifi.reconnects");
+static Metrics::Counter disconnects("wifi.disconnects");
+static Metrics::Gauge first_ip_ms("wifi.first_ip_ms");
+static Profile::Site wait_us("wifi.wait_us");
+
+/* Set while the driver holds the BSSID and channel from RtcMirror */
+static bool hinted = false;
+
+/* Points the stored network at the access point of the last connection,
+ * so a wake joins it without a scan. The hint is kept in RAM only. */
+static void apply_hint() {
+  RtcMirror::WifiState ap;
+  wifi_config_t config;
+  if (RtcMirror::wifi(&ap) != ESP_OK ||
+      esp_wifi_get_config(ESP_IF_WIFI_STA, &config) != ESP_OK ||
+      !is_valid_ssid(&config)) {
+    return;
+  }
+  config.sta.bssid_set = true;
+  memcpy(config.sta.bssid, ap.bssid, sizeof(ap.bssid));
+  config.sta.channel = ap.channel;
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  hinted = esp_wifi_set_config(ESP_IF_WIFI_STA, &config) == ESP_OK;
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+  BLOGI(TAG, "Reconnecting on channel %u", ap.channel);
+}
+
+/* MAX_MODEM wakes every listen interval beacons, see PowerSave. Set before
+ * esp_wifi_start() so the first association uses it, and kept in RAM like
+ * the hint. */
+static void set_listen_interval() {
+  wifi_config_t config;
+  if (esp_wifi_get_config(ESP_IF_WIFI_STA, &config) != ESP_OK) {
+    return;
+  }
+  config.sta.listen_interval = POWERSAVE_LISTEN_INTERVAL;
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  esp_wifi_set_config(ESP_IF_WIFI_STA, &config);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+}
+
+/* Back to scanning for the stored network */
+static void clear_hint() {
+  wifi_config_t config;
+  hinted = false;
+  if (esp_wifi_get_config(ESP_IF_WIFI_STA, &config) != ESP_OK) {
+    return;
+  }
+  config.sta.bssid_set = false;
+  config.sta.channel = 0;
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  esp_wifi_set_config(ESP_IF_WIFI_STA, &config);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+}
+
+/* Remembers the access point for the next wake */
+static void remember_ap(const tcpip_adapter_ip_info_t &ip) {
+  wifi_ap_record_t record;
+  if (esp_wifi_sta_get_ap_info(&record) != ESP_OK) {
+    return;
+  }
+  RtcMirror::WifiState ap;
+  memset(&ap, 0, sizeof(ap));
+  memcpy(ap.bssid, record.bssid, sizeof(ap.bssid));
+  ap.channel = record.primary;
+  ap.ip = ip.ip.addr;
+  ap.netmask = ip.netmask.addr;
+  ap.gw = ip.gw.addr;
+  RtcMirror::set_wifi(ap);
+}
 }  // namespace EasyWifi
 
 esp_err_t EasyWifi::connect() { return connect(nullptr); }
@@ -40,7 +115,9 @@ esp_err_t EasyWifi::connect(wifi_config_t *config) {
 void EasyWifi::wait_for_wifi(uint32_t time_s) {
   const TickType_t ticks_to_wait = Delay::ms_to_ticks(time_s * 1000);
   ESP_LOGI(TAG, "Blocking for wifi connect, %i seconds max", time_s);
-  xEventGroupWaitBits(wifi_event_group, ESP_WIFI_CONN_BIT, pdTRUE, pdFALSE,
+  Profile::Blocked blocked(wait_us);
+  /* Leave the bit set for is_connected() and the other waiters */
+  xEventGroupWaitBits(wifi_event_group, ESP_WIFI_CONN_BIT, pdFALSE, pdFALSE,
                       ticks_to_wait);
   ESP_LOGI(TAG, "Wifi blocking finished");
 }
@@ -49,30 +126,45 @@ esp_err_t EasyWifi::enable_fallback(uint32_t timeout_s) { return ESP_OK; }
 
 esp_err_t EasyWifi::init_software() {
   ESP_LOGI(TAG, "Initializing software");
+  configure();
+  start_radio();
+  ESP_LOGI(TAG, "WiFi software init finished");
+  return ESP_OK;
+}
 
+esp_err_t EasyWifi::configure() {
   /* Create event group that will handle WiFi actions like start and DC */
-  EasyWifi::wifi_event_group = xEventGroupCreate();
+  if (wifi_event_group == nullptr) {
+    wifi_event_group = xEventGroupCreateStatic(&wifi_event_buffer);
+  }
   esp_event_loop_init(wifi_event_handler, NULL);
   xEventGroupClearBits(wifi_event_group, ESP_WIFI_CONN_BIT);
 
-  /* Always create config this way */
+  /* Always create config this way, then size the buffers */
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  Tuning::apply_wifi(&cfg);
 
   // Initialize adapter in client mode, store network in flash
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_FLASH));
   ESP_ERROR_CHECK(esp_wifi_set_auto_connect(true));
-  ESP_ERROR_CHECK(esp_wifi_start());
+  ESP_ERROR_CHECK(PowerSave::apply());
+  set_listen_interval();
+  apply_hint();
+  return ESP_OK;
+}
 
-  ESP_LOGI(TAG, "WiFi software init finished");
+esp_err_t EasyWifi::start_radio() {
+  ESP_ERROR_CHECK(esp_wifi_start());
   return ESP_OK;
 }
 
 esp_err_t EasyWifi::init_hardware() {
   ESP_LOGI(TAG, "Initializing adapter");
   tcpip_adapter_init();
-  nvs_flash_init();
+  /* A no-op if NVS.begin() got there first */
+  NVSStatic::init_flash();
   ESP_LOGI(TAG, "WiFI adapter init finished");
   return ESP_OK;
 }
@@ -84,28 +176,52 @@ esp_err_t EasyWifi::wifi_event_handler(void *ctx, system_event_t *event) {
   // Here we handle WiFi events not related to smart config
   switch (event->event_id) {
     case SYSTEM_EVENT_WIFI_READY:
-      ESP_LOGI(TAG, "SYSTEM_EVENT_WIFI_READY");
+      BLOGI(TAG, "SYSTEM_EVENT_WIFI_READY");
       break;
 
     case SYSTEM_EVENT_STA_START:
-      ESP_LOGI(TAG, "SYSTEM_EVENT_STA_START");
+      BLOGI(TAG, "SYSTEM_EVENT_STA_START");
       break;
 
     case SYSTEM_EVENT_STA_CONNECTED:
-      ESP_LOGI(TAG, "SYSTEM_EVENT_STA_CONNECTED");
+      BLOGI(TAG, "SYSTEM_EVENT_STA_CONNECTED");
       break;
 
     /* Log the IP when connecting */
     case SYSTEM_EVENT_STA_GOT_IP: {
-      ESP_LOGI(TAG, "SYSTEM_EVENT_STA_GOT_IP");
+      BLOGI(TAG, "SYSTEM_EVENT_STA_GOT_IP");
+      connects.add();
+      if (disconnects.value() > 0) {
+        reconnects.add();
+      }
+      /* Reset to first IP, the figure boot ordering is tuned for */
+      if (first_ip_ms.value() == 0) {
+        first_ip_ms.set(Port::micros() / 1000);
+        BLOGI(TAG, "First IP %u ms after reset", (unsigned)first_ip_ms.value());
+      }
+      remember_ap(event->event_info.got_ip.ip_info);
+      connected.set(1);
       xEventGroupSetBits(wifi_event_group, ESP_WIFI_CONN_BIT);
+      Async::notify();
       break;
     }
 
     /* Auto reconnect if autoconnect is enabled */
     case SYSTEM_EVENT_STA_DISCONNECTED:
-      ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
+      BLOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
+      if (connected.value() != 0) {
+        disconnects.add();
+        connected.set(0);
+      }
+      /* The access point moved or is gone, scan from now on */
+      if (hinted) {
+        if (first_ip_ms.value() == 0) {
+          RtcMirror::forget_wifi();
+        }
+        clear_hint();
+      }
       xEventGroupClearBits(wifi_event_group, ESP_WIFI_CONN_BIT);
+      Async::notify();
       break;
 
     default:
@@ -145,9 +261,9 @@ bool EasyWifi::is_connected() {
 
 ip4_addr_t EasyWifi::getIP() {
   tcpip_adapter_ip_info_t ip = getConnectionInfo();
-  ESP_LOGI(TAG, "IP:" IPSTR, IP2STR(&ip.ip));
-  ESP_LOGI(TAG, "MASK:" IPSTR, IP2STR(&ip.netmask));
-  ESP_LOGI(TAG, "GW:" IPSTR, IP2STR(&ip.gw));
+  BLOGI(TAG, "IP:" IPSTR, IP2STR(&ip.ip));
+  BLOGI(TAG, "MASK:" IPSTR, IP2STR(&ip.netmask));
+  BLOGI(TAG, "GW:" IPSTR, IP2STR(&ip.gw));
   return ip.ip;
 }
 
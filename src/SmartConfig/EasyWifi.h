@@ -16,8 +16,15 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "Async/Async.h"
 #include "Delay/Delay.h"
+#include "Log/BinLog.h"
+#include "Metrics/Metrics.h"
 #include "NVS/NVS.h"
+#include "NVS/RtcMirror.h"
+#include "PowerSave/PowerSave.h"
+#include "Profile/Profile.h"
+#include "Tuning/Tuning.h"
 #include "esp_err.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
@@ -45,6 +52,9 @@
 namespace EasyWifi {
 
 extern const char *TAG;
+
+/* ESP_WIFI_CONN_BIT is set while connected. Any number of tasks wait on it,
+ * so it stays an event group rather than a Port::Notification. */
 extern EventGroupHandle_t wifi_event_group;
 
 /**
@@ -62,6 +72,24 @@ esp_err_t init_hardware();
  */
 esp_err_t init_software();
 
+/**
+ * @brief First half of init_software(), the event loop and wifi driver
+ * set up for station mode, with the buffers of the current Tuning profile,
+ * the current PowerSave policy and its listen interval. Needs
+ * init_hardware() first.
+ *
+ * @return esp_err_t
+ */
+esp_err_t configure();
+
+/**
+ * @brief Second half of init_software(), starts the radio. With the
+ * stored config this connects on its own.
+ *
+ * @return esp_err_t
+ */
+esp_err_t start_radio();
+
 /**
  * @brief Attempt wifi connection
  *
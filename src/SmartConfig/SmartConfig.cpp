@@ -2,42 +2,155 @@
 
 namespace SmartConfig {
 const char *TAG = "SC";
-EventGroupHandle_t sc_event_group;
+
+/* Session state, reused by every call to sc_start() */
+static Port::Task sc_runner;
+/* Session events for sc_task alone. Futures may wait from any number of
+ * tasks, so the finished bit stays in an event group. */
+static Port::Notification sc_events;
+static StaticEventGroup_t sc_event_buffer;
+static EventGroupHandle_t sc_event_group = nullptr;
+static bool sc_active = false;
+
+static uint32_t sc_timeout_s;
+static wifi_config_t sc_credentials;
+static volatile Result sc_result = Result::PENDING;
+static portMUX_TYPE sc_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static Metrics::Counter sessions("sc.sessions");
+static Metrics::Counter failures("sc.failures");
+static Profile::Site wait_us("sc.wait_us");
+static Profile::Site wifi_wait_us("sc.wifi_wait_us");
+static Profile::Site result_wait_us("sc.result_wait_us");
+
+/* Saves the received station config as a single blob, so a reboot mid-write
+ * leaves either the old or the new credentials in NVS */
+static void save_credentials(wifi_config_t *config) {
+  esp_err_t result = NVS.write(SC_NVS_KEY, config->sta);
+  if (result != ESP_OK) {
+    ESP_LOGW(TAG, "Error (%i) saving credentials", result);
+  }
+}
+
+/* Waits on the session bits, returning early if cancelled */
+static uint32_t wait_bits(uint32_t bits, TickType_t ticks) {
+  Profile::Blocked blocked(wait_us);
+  return sc_events.wait(bits | ESPTOUCH_CANCEL_BIT,
+                        ticks * portTICK_PERIOD_MS);
+}
+
+/* Ticks left until 'deadline', saturating at zero */
+static TickType_t remaining(TickType_t deadline) {
+  TickType_t now = xTaskGetTickCount();
+  return (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+}
 }  // namespace SmartConfig
 
-esp_err_t SmartConfig::sc_start(uint32_t *timeout_s) {
-  /* Clear bits and launch task */
-  sc_event_group = xEventGroupCreate();
-  void *parm = static_cast<void *>(timeout_s);
-  xTaskCreate(sc_task, "smart_config", 4096, parm, 3, NULL);
+esp_err_t SmartConfig::sc_start(uint32_t timeout_s, Future *future) {
+  /* The session connects and cancels through EasyWifi's group */
+  if (EasyWifi::wifi_event_group == nullptr) {
+    ESP_LOGE(TAG, "Wifi not initialised");
+    return ESP_ERR_INVALID_STATE;
+  }
+  portENTER_CRITICAL(&sc_lock);
+  if (sc_active) {
+    portEXIT_CRITICAL(&sc_lock);
+    ESP_LOGE(TAG, "SmartConfig session already running");
+    return ESP_ERR_INVALID_STATE;
+  }
+  sc_active = true;
+  portEXIT_CRITICAL(&sc_lock);
+
+  /* Reap the previous session's task before reusing its slot */
+  sc_runner.join();
+
+  if (sc_event_group == nullptr) {
+    sc_event_group = xEventGroupCreateStatic(&sc_event_buffer);
+  }
+  xEventGroupClearBits(sc_event_group, ESPTOUCH_FINISHED_BIT);
+  xEventGroupClearBits(EasyWifi::wifi_event_group, ESPTOUCH_CANCEL_BIT);
+  sc_events.clear();
+
+  sessions.add();
+  sc_timeout_s = timeout_s;
+  sc_result = Result::PENDING;
+  memset(&sc_credentials, 0, sizeof(sc_credentials));
+
+  esp_err_t err = sc_runner.start(sc_task, nullptr, "smart_config",
+                                  SC_TASK_STACK_SIZE, SC_TASK_PRIORITY);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) starting SmartConfig task", err);
+    portENTER_CRITICAL(&sc_lock);
+    sc_active = false;
+    portEXIT_CRITICAL(&sc_lock);
+    return err;
+  }
+
+  if (future != nullptr) {
+    *future = Future(true);
+  }
+  return ESP_OK;
+}
+
+esp_err_t SmartConfig::sc_cancel() {
+  if (!is_running() || EasyWifi::wifi_event_group == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  ESP_LOGI(TAG, "Cancelling SmartConfig session");
+  sc_events.post(ESPTOUCH_CANCEL_BIT);
+  /* Also wakes the wait for an IP, which is on EasyWifi's group */
+  xEventGroupSetBits(EasyWifi::wifi_event_group, ESPTOUCH_CANCEL_BIT);
   return ESP_OK;
 }
 
+bool SmartConfig::is_running() { return sc_active; }
+
+esp_err_t SmartConfig::load_credentials(wifi_config_t *config) {
+  memset(config, 0, sizeof(wifi_config_t));
+  return NVS.read(SC_NVS_KEY, config->sta);
+}
+
+SmartConfig::Result SmartConfig::Future::wait(uint32_t timeout_ms) const {
+  if (!valid_) {
+    return Result::PENDING;
+  }
+  TickType_t ticks = timeout_ms == portMAX_DELAY
+                         ? portMAX_DELAY
+                         : Delay::ms_to_ticks(timeout_ms);
+  Profile::Blocked blocked(result_wait_us);
+  xEventGroupWaitBits(sc_event_group, ESPTOUCH_FINISHED_BIT, pdFALSE, pdFALSE,
+                      ticks);
+  return sc_result;
+}
+
+bool SmartConfig::Future::ready() const {
+  return valid_ && (xEventGroupGetBits(sc_event_group) & ESPTOUCH_FINISHED_BIT);
+}
+
 /* Handles SC events */
 void SmartConfig::sc_callback(smartconfig_status_t status, void *pdata) {
-  wifi_config_t *wifi_config;
   switch (status) {
-    /* Link start */
+    /* Credentials received, hand them to the session task */
     case SC_STATUS_LINK:
-      ESP_LOGI(TAG, "SC_STATUS_LINK");
-      wifi_config = (wifi_config_t *)pdata;
-      EasyWifi::connect(wifi_config);
+      BLOGI(TAG, "SC_STATUS_LINK");
+      memcpy(&sc_credentials, pdata, sizeof(wifi_config_t));
+      sc_events.post(ESPTOUCH_LINK_BIT);
       break;
 
     case SC_STATUS_LINK_OVER:
-      ESP_LOGI(TAG, "SC_STATUS_LINK_OVER");
-      xEventGroupSetBits(sc_event_group, ESPTOUCH_DONE_BIT);
+      BLOGI(TAG, "SC_STATUS_LINK_OVER");
+      sc_events.post(ESPTOUCH_DONE_BIT);
       break;
 
     /* Below events are not that important */
     case SC_STATUS_WAIT:
-      ESP_LOGI(TAG, "SC_STATUS_WAIT");
+      BLOGI(TAG, "SC_STATUS_WAIT");
       break;
     case SC_STATUS_FIND_CHANNEL:
-      ESP_LOGI(TAG, "SC_STATUS_FINDING_CHANNEL");
+      BLOGI(TAG, "SC_STATUS_FINDING_CHANNEL");
       break;
     case SC_STATUS_GETTING_SSID_PSWD:
-      ESP_LOGI(TAG, "SC_STATUS_GETTING_SSID_PSWD");
+      BLOGI(TAG, "SC_STATUS_GETTING_SSID_PSWD");
       break;
     default:
       break;
@@ -45,32 +158,69 @@ void SmartConfig::sc_callback(smartconfig_status_t status, void *pdata) {
 }
 
 void SmartConfig::sc_task(void *parm) {
-  ESP_LOGI(TAG, "Starting SC task...\n");
-
-  /* uint32_t timeout_s passed as param */
-  uint32_t *timeout_s = static_cast<uint32_t *>(parm);
-  TickType_t timeout_ticks = Delay::ms_to_ticks(*timeout_s * 1000);
+  ESP_LOGI(TAG, "Starting SC task...");
 
+  const TickType_t deadline =
+      xTaskGetTickCount() + Delay::ms_to_ticks(sc_timeout_s * 1000);
+  Result result = Result::TIMEOUT;
   EventBits_t uxBits;
+
   esp_smartconfig_set_type(SC_TYPE_ESPTOUCH);
   esp_smartconfig_start(sc_callback);
 
-  /* Delay until completion or timeout is reached */
-  uxBits = xEventGroupWaitBits(sc_event_group,
-                               ESPTOUCH_CONNECTED_BIT | ESPTOUCH_DONE_BIT,
-                               pdTRUE, pdFALSE, timeout_ticks);
+  /* Wait for the phone to deliver credentials */
+  uxBits = wait_bits(ESPTOUCH_LINK_BIT, remaining(deadline));
+  if ((uxBits & ESPTOUCH_LINK_BIT) && !(uxBits & ESPTOUCH_CANCEL_BIT)) {
+    /* Leave any earlier network first, so only an IP got with the new
+     * credentials sets the connected bit */
+    if (EasyWifi::is_connected()) {
+      esp_wifi_disconnect();
+    }
+    xEventGroupClearBits(EasyWifi::wifi_event_group, ESP_WIFI_CONN_BIT);
+    EasyWifi::connect(&sc_credentials);
 
-  // When SC wait is over, report results
+    /* Wait for the IP, without clearing the shared connected bit. The
+     * cancel bit is mirrored into the group by sc_cancel(). */
+    {
+      Profile::Blocked blocked(wifi_wait_us);
+      uxBits = xEventGroupWaitBits(EasyWifi::wifi_event_group,
+                                   ESP_WIFI_CONN_BIT | ESPTOUCH_CANCEL_BIT,
+                                   pdFALSE, pdFALSE, remaining(deadline));
+    }
+    if ((uxBits & ESP_WIFI_CONN_BIT) && !(uxBits & ESPTOUCH_CANCEL_BIT)) {
+      sc_events.post(ESPTOUCH_CONNECTED_BIT);
+    }
+
+    /* Let the phone receive the ACK before stopping */
+    wait_bits(ESPTOUCH_DONE_BIT, remaining(deadline));
+  }
+
+  uxBits = sc_events.bits();
   if (uxBits & ESPTOUCH_CONNECTED_BIT) {
     ESP_LOGI(TAG, "ESPTOUCH_CONNECTED_BIT set");
+    save_credentials(&sc_credentials);
+    result = Result::CONNECTED;
+  } else if (uxBits & ESPTOUCH_CANCEL_BIT) {
+    ESP_LOGI(TAG, "smart config cancelled");
+    result = Result::CANCELLED;
   } else {
     ESP_LOGI(TAG, "smart config failed");
+    failures.add();
   }
   if (uxBits & ESPTOUCH_DONE_BIT) {
     ESP_LOGI(TAG, "ESPTOUCH_DONE_BIT set");
   }
 
   esp_smartconfig_stop();
+  xEventGroupClearBits(EasyWifi::wifi_event_group, ESPTOUCH_CANCEL_BIT);
   ESP_LOGI(TAG, "Leaving sc_task");
-  vTaskDelete(NULL);
+
+  /* Not running before the result is out, so a waiter woken by it can start
+   * the next session at once. That sc_start() joins this task before
+   * touching the result, so the two cannot interleave. */
+  portENTER_CRITICAL(&sc_lock);
+  sc_active = false;
+  portEXIT_CRITICAL(&sc_lock);
+  sc_result = result;
+  xEventGroupSetBits(sc_event_group, ESPTOUCH_FINISHED_BIT);
 }
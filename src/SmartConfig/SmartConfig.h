@@ -7,7 +7,16 @@
  *
  * FLOW DESCRIPTION:
  *
- * 1) begin() is called
+ * 1) sc_start() is called, returning a Future for the session
+ * 2) The SC task listens for ESPTOUCH data from the smartphone
+ * 3) Received credentials are used to connect, and saved to NVS once the
+ *    connection succeeds
+ * 4) The task exits and the Future completes with the session result
+ *
+ * Only one session runs at a time. The task control block, stack and event
+ * group are statically allocated and reused by every session, so nothing is
+ * taken from the heap. The finished task is parked until the next session
+ * reclaims its memory.
  */
 
 #ifndef __ESP_SMART_CONFIG_HELPER_H__
@@ -18,6 +27,7 @@
 
 #include "Delay/Delay.h"
 #include "EasyWifi.h"
+#include "NVS/NVS.h"
 #include "esp_err.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
@@ -30,6 +40,14 @@
 
 #define ESPTOUCH_CONNECTED_BIT BIT0
 #define ESPTOUCH_DONE_BIT BIT1
+#define ESPTOUCH_LINK_BIT BIT2     /*!< Credentials received from phone */
+#define ESPTOUCH_CANCEL_BIT BIT3   /*!< sc_cancel() was called, also set
+                                        in EasyWifi::wifi_event_group
+                                        for the session */
+#define ESPTOUCH_FINISHED_BIT BIT4 /*!< Session over, result is valid */
+
+#define SC_TASK_STACK_SIZE 4096
+#define SC_TASK_PRIORITY 3
 
 /* The name of the key for the NVS key-value pair? */
 #define SC_NVS_KEY "SC_KEY"
@@ -40,18 +58,87 @@
   (ESP_ERR_WIFI_BASE + 1) /*!< Field (ssid/psk) not set */
 
 namespace SmartConfig {
-extern EventGroupHandle_t wifi_event_group;
 extern const char *TAG;
 
+/* Outcome of a SmartConfig session */
+enum class Result : uint8_t {
+  PENDING,   /*!< Session still running */
+  CONNECTED, /*!< Credentials received, wifi connected and credentials saved */
+  TIMEOUT,   /*!< No phone or no connection before the timeout */
+  CANCELLED, /*!< sc_cancel() was called */
+};
+
+/**
+ * Completion handle for a SmartConfig session. Copies are cheap and all
+ * refer to the same session. A Future stays valid until the next sc_start().
+ */
+class Future {
+ public:
+  Future() : valid_(false) {}
+
+  /**
+   * @brief Blocks until the session finishes or the timeout is reached
+   *
+   * @param timeout_ms  Maximum time to block, portMAX_DELAY to wait forever
+   *
+   * @return The session result, Result::PENDING on timeout
+   */
+  Result wait(uint32_t timeout_ms = portMAX_DELAY) const;
+
+  /**
+   * @brief Checks if the session has finished without blocking
+   */
+  bool ready() const;
+
+  bool valid() const { return valid_; }
+
+ private:
+  friend esp_err_t sc_start(uint32_t, Future *);
+  explicit Future(bool valid) : valid_(valid) {}
+  bool valid_;
+};
+
 /**
  * @brief Starts the SC task, waiting for smartphone connection
  *
  * @param timeout_s  The time in seconds after which the SC task will be
  * terminated
+ * @param future     Optional handle that completes when the session ends
+ *
+ * @return
+ *  - ESP_OK                The session was started
+ *  - ESP_ERR_INVALID_STATE A session is already running, or
+ *                          EasyWifi::init_software() has not run
+ *  - ESP_ERR_NO_MEM        No task slot was free for the session
+ */
+esp_err_t sc_start(uint32_t timeout_s, Future *future = nullptr);
+
+/**
+ * @brief Requests that a running session stop. The Future completes with
+ * Result::CANCELLED once the task has shut SmartConfig down.
  *
- * @return ESP_OK
+ * @return
+ *  - ESP_OK                Cancel requested
+ *  - ESP_ERR_INVALID_STATE No session is running, or
+ *                          EasyWifi::init_software() has not run
+ */
+esp_err_t sc_cancel();
+
+/**
+ * @brief Checks if a session is currently running
  */
-esp_err_t sc_start(uint32_t *timeout_s);
+bool is_running();
+
+/**
+ * @brief Reads the credentials saved by the last successful session
+ *
+ * @param config  Destination for the saved station config
+ *
+ * @return
+ *  - ESP_OK                    Credentials were loaded into 'config'
+ *  - ESP_ERR_NVS_NOT_FOUND     No session has saved credentials yet
+ */
+esp_err_t load_credentials(wifi_config_t *config);
 
 /**
  * @brief Callback handler for SmartConfig events
@@ -63,20 +150,14 @@ esp_err_t sc_start(uint32_t *timeout_s);
 void sc_callback(smartconfig_status_t status, void *pdata);
 
 /**
- * @brief Creates a task to listen for ESPTOUCH connections
+ * @brief Task body listening for ESPTOUCH connections
  *
- * post: New task created, listening for SSID / passphrase data from
- * smartphone
+ * post: Credentials are applied and saved if the phone provided them, and
+ * the session result is published
  *
  */
 void sc_task(void *parm);
 
-/**
- * @brief Task that handles connecting to wifi
- *
- */
-void wifi_conn_task(void *parm);
-
 }  // namespace SmartConfig
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,51 @@
+#include "Cbor.h"
+#include <string.h>
+
+void Cbor::Writer::head(uint8_t major, uint64_t value) {
+  uint8_t out[9];
+  size_t size;
+  if (value < 24) {
+    out[0] = major << 5 | value;
+    size = 1;
+  } else {
+    /* 1, 2, 4 or 8 byte big endian argument */
+    uint8_t extra = value <= 0xFF ? 0 : value <= 0xFFFF ? 1 :
+                    value <= 0xFFFFFFFF ? 2 : 3;
+    size_t length = (size_t)1 << extra;
+    out[0] = major << 5 | (24 + extra);
+    for (size_t i = 0; i < length; i++) {
+      out[1 + i] = value >> (8 * (length - 1 - i));
+    }
+    size = 1 + length;
+  }
+  raw(out, size);
+}
+
+void Cbor::Writer::bytes(const void *data, size_t size) {
+  head(2, size);
+  raw(data, size);
+}
+
+void Cbor::Writer::text(const char *str) { text(str, strlen(str)); }
+
+void Cbor::Writer::text(const char *str, size_t size) {
+  head(3, size);
+  raw(str, size);
+}
+
+void Cbor::Writer::float32(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t out[5] = {0xFA, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16),
+                    (uint8_t)(bits >> 8), (uint8_t)bits};
+  raw(out, sizeof(out));
+}
+
+void Cbor::Writer::raw(const void *data, size_t size) {
+  if (overflowed_ || size > capacity_ - size_) {
+    overflowed_ = true;
+    return;
+  }
+  memcpy(buf_ + size_, data, size);
+  size_ += size;
+}
@@ -0,0 +1,82 @@
+/**
+ * CBOR (RFC 7049) encoder into a caller's buffer, for compact telemetry:
+ *
+ *   uint8_t buf[32];
+ *   Cbor::Writer cbor(buf, sizeof(buf));
+ *   cbor.map(2);
+ *   cbor.text("t");
+ *   cbor.uinteger(now);
+ *   cbor.text("v");
+ *   cbor.float32(reading);
+ *   if (!cbor.overflowed()) uploader.add(buf, cbor.size());
+ *
+ * Only definite lengths are written. Past the end of the buffer nothing
+ * more is written and overflowed() is set.
+ */
+
+#ifndef __CBOR_H__
+#define __CBOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Cbor {
+
+class Writer {
+ public:
+  Writer(uint8_t *buf, size_t capacity)
+      : buf_(buf), capacity_(capacity), size_(0), overflowed_(false) {}
+
+  void uinteger(uint64_t value) { head(0, value); }
+
+  void integer(int64_t value) {
+    if (value < 0) {
+      head(1, (uint64_t)(-1 - value));
+    } else {
+      head(0, value);
+    }
+  }
+
+  void bytes(const void *data, size_t size);
+  void text(const char *str);
+  void text(const char *str, size_t size);
+
+  /* Followed by 'count' items */
+  void array(size_t count) { head(4, count); }
+
+  /* Followed by 'count' keys and values */
+  void map(size_t count) { head(5, count); }
+
+  void boolean(bool value) { put(value ? 0xF5 : 0xF4); }
+  void null() { put(0xF6); }
+  void float32(float value);
+
+  /* Appends an item encoded elsewhere */
+  void raw(const void *data, size_t size);
+
+  /* Bytes written */
+  size_t size() const { return size_; }
+  bool overflowed() const { return overflowed_; }
+
+  /**
+   * @brief Starts over at the start of the buffer
+   */
+  void reset() {
+    size_ = 0;
+    overflowed_ = false;
+  }
+
+ private:
+  /* Major type and argument, in the shortest form */
+  void head(uint8_t major, uint64_t value);
+  void put(uint8_t byte) { raw(&byte, 1); }
+
+  uint8_t *buf_;
+  size_t capacity_;
+  size_t size_;
+  bool overflowed_;
+};
+
+}  // namespace Cbor
+
+#endif
@@ -0,0 +1,38 @@
+#include "HttpTransport.h"
+#include "Http/Http.h"
+
+esp_err_t Telemetry::HttpTransport::post(const Batch &batch) {
+  Http::Session session(url_, cert_pem_);
+  esp_http_client_handle_t client = session.client();
+  if (client == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_http_client_set_method(client, HTTP_METHOD_POST);
+  esp_http_client_set_header(client, "Content-Type", TELEMETRY_CONTENT_TYPE);
+  esp_http_client_set_header(client, "Idempotency-Key", batch.key);
+  if (batch.compressed) {
+    esp_http_client_set_header(client, "Content-Encoding", TELEMETRY_ENCODING);
+  }
+
+  esp_err_t err = session.open(batch.size);
+  int status = 0;
+  if (err == ESP_OK) {
+    if (esp_http_client_write(client, (const char *)batch.body,
+                              batch.size) == (int)batch.size &&
+        esp_http_client_fetch_headers(client) >= 0) {
+      status = esp_http_client_get_status_code(client);
+      char discard[64];
+      while (esp_http_client_read(client, discard, sizeof(discard)) > 0) {
+      }
+    }
+    session.close();
+  }
+
+  /* The pooled handle goes back as the plain GET the other users expect */
+  esp_http_client_set_method(client, HTTP_METHOD_GET);
+  esp_http_client_delete_header(client, "Content-Type");
+  esp_http_client_delete_header(client, "Idempotency-Key");
+  esp_http_client_delete_header(client, "Content-Encoding");
+  /* Without a status the batch may or may not have arrived, so retry */
+  return status > 0 ? status_error(status) : ESP_FAIL;
+}
@@ -0,0 +1,33 @@
+/**
+ * Telemetry::Transport over a pooled esp_http_client connection, so
+ * batches to the backend share its keep-alive connection and TLS session.
+ *
+ * Device only.
+ */
+
+#ifndef __TELEMETRY_HTTP_TRANSPORT_H__
+#define __TELEMETRY_HTTP_TRANSPORT_H__
+
+#include "Uploader.h"
+
+namespace Telemetry {
+
+class HttpTransport : public Transport {
+ public:
+  /**
+   * @param url       Endpoint taking the POSTs, kept by reference
+   * @param cert_pem  CA certificate for https, kept by reference
+   */
+  HttpTransport(const char *url, const char *cert_pem = nullptr)
+      : url_(url), cert_pem_(cert_pem) {}
+
+  esp_err_t post(const Batch &batch) override;
+
+ private:
+  const char *url_;
+  const char *cert_pem_;
+};
+
+}  // namespace Telemetry
+
+#endif
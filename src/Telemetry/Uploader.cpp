@@ -0,0 +1,342 @@
+#include "Uploader.h"
+#include <stdio.h>
+#include <string.h>
+#include "Crypto/Sha256.h"
+#include "Metrics/Metrics.h"
+#include "Telemetry/Cbor.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#ifdef ESP_PLATFORM
+#include "SmartConfig/EasyWifi.h"
+#endif
+
+namespace Telemetry {
+static const char *TAG = "Telemetry";
+
+static Metrics::Counter records_sent("telemetry.records");
+static Metrics::Counter batches_sent("telemetry.batches");
+static Metrics::Counter retries("telemetry.retries");
+static Metrics::Histogram request_us("telemetry.request_us");
+
+/* Packs bits most significant first, as Host::compress() */
+class BitWriter {
+ public:
+  BitWriter(uint8_t *dest, size_t capacity)
+      : dest_(dest), capacity_(capacity), size_(0), byte_(0), used_(0) {}
+
+  void put(uint32_t value, uint8_t bits) {
+    while (bits > 0) {
+      bits--;
+      byte_ = byte_ << 1 | ((value >> bits) & 1);
+      if (++used_ == 8) {
+        if (size_ < capacity_) {
+          dest_[size_] = byte_;
+        }
+        size_++;
+        byte_ = 0;
+        used_ = 0;
+      }
+    }
+  }
+
+  /* Pads the last byte with zeros, 0 if it did not fit */
+  size_t finish() {
+    if (used_ > 0) {
+      put(0, 8 - used_);
+    }
+    return size_ <= capacity_ ? size_ : 0;
+  }
+
+ private:
+  uint8_t *dest_;
+  size_t capacity_;
+  size_t size_;
+  uint8_t byte_;
+  uint8_t used_;
+};
+}  // namespace Telemetry
+
+esp_err_t Telemetry::status_error(int status) {
+  if (status >= 200 && status < 300) {
+    return ESP_OK;
+  }
+  /* Timeouts and rate limits are worth another try */
+  if (status >= 400 && status < 500 && status != 408 && status != 429) {
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  return ESP_FAIL;
+}
+
+size_t Telemetry::compress(const uint8_t *data, size_t size, uint8_t *dest,
+                           size_t capacity) {
+  const size_t window = (size_t)1 << TELEMETRY_WINDOW_BITS;
+  const size_t max_len = (size_t)1 << TELEMETRY_LOOKAHEAD_BITS;
+  /* A match must be cheaper than the literals it replaces */
+  const size_t min_len =
+      (1 + TELEMETRY_WINDOW_BITS + TELEMETRY_LOOKAHEAD_BITS) / 9 + 1;
+  if (capacity < COMPRESSED_HEADER_SIZE) {
+    return 0;
+  }
+
+  memcpy(dest, COMPRESSED_MAGIC, 4);
+  dest[4] = TELEMETRY_WINDOW_BITS;
+  dest[5] = TELEMETRY_LOOKAHEAD_BITS;
+  dest[6] = 0;
+  dest[7] = 0;
+  for (int i = 0; i < 4; i++) {
+    dest[8 + i] = size >> (8 * i);
+  }
+  Sha256::digest(data, size, dest + 12);
+
+  /* The window is small enough to search every position */
+  BitWriter bits(dest + COMPRESSED_HEADER_SIZE,
+                 capacity - COMPRESSED_HEADER_SIZE);
+  size_t pos = 0;
+  while (pos < size) {
+    size_t limit = size - pos < max_len ? size - pos : max_len;
+    size_t best_len = 0, best_dist = 0;
+    for (size_t dist = 1; dist <= window && dist <= pos; dist++) {
+      const uint8_t *cand = data + pos - dist;
+      size_t len = 0;
+      while (len < limit && cand[len] == data[pos + len]) {
+        len++;
+      }
+      if (len > best_len) {
+        best_len = len;
+        best_dist = dist;
+        if (len == limit) {
+          break;
+        }
+      }
+    }
+
+    if (best_len >= min_len) {
+      bits.put(0, 1);
+      bits.put(best_dist - 1, TELEMETRY_WINDOW_BITS);
+      bits.put(best_len - 1, TELEMETRY_LOOKAHEAD_BITS);
+    } else {
+      best_len = 1;
+      bits.put(1, 1);
+      bits.put(data[pos], 8);
+    }
+    pos += best_len;
+  }
+  size_t body = bits.finish();
+  return body > 0 ? COMPRESSED_HEADER_SIZE + body : 0;
+}
+
+Telemetry::Uploader::Uploader(Transport &transport,
+                              const UploaderConfig &config)
+    : transport_(transport),
+      config_(config),
+      stopping_(false),
+      flushing_(false),
+      sealed_(false),
+      pack_(false),
+      used_(0),
+      count_(0),
+      oldest_us_(0),
+      raw_size_(0),
+      boot_(esp_random()),
+      sequence_(0),
+      started_(ESP_OK),
+      result_(ESP_OK),
+      sent_us_(0),
+      backoff_ms_(0) {
+  memset(&batch_, 0, sizeof(batch_));
+  memset(&stats_, 0, sizeof(stats_));
+  key_[0] = '\0';
+}
+
+esp_err_t Telemetry::Uploader::start() {
+  stopping_ = false;
+  return Async::spawn(this);
+}
+
+void Telemetry::Uploader::stop() {
+  stopping_ = true;
+  Async::notify();
+}
+
+esp_err_t Telemetry::Uploader::add(const void *item, size_t size) {
+  if (size == 0 || size > TELEMETRY_BATCH_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  bool full;
+  {
+    Port::Lock guard(lock_);
+    if (used_ + size > sizeof(items_)) {
+      return ESP_ERR_NO_MEM;
+    }
+    if (count_ == 0) {
+      oldest_us_ = Port::micros();
+    }
+    memcpy(items_ + used_, item, size);
+    used_ += size;
+    count_++;
+    full = used_ >= config_.send_bytes;
+  }
+  if (full) {
+    Async::notify();
+  }
+  return ESP_OK;
+}
+
+void Telemetry::Uploader::flush() {
+  {
+    Port::Lock guard(lock_);
+    flushing_ = true;
+  }
+  Async::notify();
+}
+
+uint32_t Telemetry::Uploader::pending() {
+  Port::Lock guard(lock_);
+  return count_ + (sealed_ ? batch_.records : 0);
+}
+
+Telemetry::UploaderStats Telemetry::Uploader::stats() {
+  Port::Lock guard(lock_);
+  return stats_;
+}
+
+/* Locals do not survive the waits, see Async.h */
+Async::Status Telemetry::Uploader::resume() {
+  ASYNC_BEGIN();
+  while (!stopping_) {
+    if (!sealed_) {
+      ASYNC_AWAIT(stopping_ || (online() && due()));
+      if (stopping_) {
+        break;
+      }
+      seal();
+      if (!sealed_) {
+        continue;
+      }
+    }
+
+    /* A sealed batch is sent, and resent, until the backend answers */
+    ASYNC_AWAIT(stopping_ || online());
+    if (stopping_) {
+      break;
+    }
+    sent_us_ = Port::micros();
+    started_ = call_.start(send, this);
+    ASYNC_AWAIT(started_ != ESP_OK || call_.ready());
+    result_ = started_ == ESP_OK ? call_.result() : started_;
+    settle();
+    if (sealed_) {
+      ASYNC_AWAIT_MS(stopping_, backoff_ms_);
+      backoff_ms_ = backoff_ms_ * 2 < config_.max_retry_ms
+                        ? backoff_ms_ * 2
+                        : config_.max_retry_ms;
+    }
+  }
+  ASYNC_END();
+}
+
+bool Telemetry::Uploader::online() const {
+  if (config_.online != nullptr) {
+    return config_.online();
+  }
+#ifdef ESP_PLATFORM
+  return EasyWifi::is_connected();
+#else
+  return true;
+#endif
+}
+
+bool Telemetry::Uploader::due() {
+  Port::Lock guard(lock_);
+  return count_ > 0 &&
+         (flushing_ || used_ >= config_.send_bytes ||
+          Port::micros() - oldest_us_ >= (uint64_t)config_.max_age_ms * 1000);
+}
+
+/* Moves the gathered records into the next batch, so add() carries on
+ * while it is sent */
+void Telemetry::Uploader::seal() {
+  size_t size;
+  {
+    Port::Lock guard(lock_);
+    Cbor::Writer cbor(body_, sizeof(body_));
+    cbor.map(3);
+    cbor.text("d");
+    cbor.text(config_.device_id);
+    cbor.text("s");
+    cbor.uinteger(sequence_);
+    cbor.text("r");
+    cbor.array(count_);
+    cbor.raw(items_, used_);
+    if (cbor.overflowed()) {
+      ESP_LOGE(TAG, "Device id too long, batch dropped");
+      used_ = 0;
+      count_ = 0;
+      flushing_ = false;
+      return;
+    }
+    size = cbor.size();
+
+    snprintf(key_, sizeof(key_), "%s-%08x-%u", config_.device_id,
+             (unsigned)boot_, (unsigned)sequence_);
+    sequence_++;
+    batch_.records = count_;
+    used_ = 0;
+    count_ = 0;
+    flushing_ = false;
+    sealed_ = true;
+  }
+
+  batch_.key = key_;
+  batch_.body = body_;
+  batch_.size = size;
+  batch_.compressed = false;
+  raw_size_ = size;
+  pack_ = config_.compress;
+  backoff_ms_ = config_.retry_ms;
+}
+
+/* Accounts for the answer to the last request */
+void Telemetry::Uploader::settle() {
+  uint32_t us = Port::micros() - sent_us_;
+  request_us.record(us);
+  Port::Lock guard(lock_);
+  stats_.radio_us += us;
+  if (result_ == ESP_OK) {
+    stats_.records += batch_.records;
+    stats_.batches++;
+    stats_.raw_bytes += raw_size_;
+    stats_.sent_bytes += batch_.size;
+    records_sent.add(batch_.records);
+    batches_sent.add();
+    sealed_ = false;
+  } else if (result_ == ESP_ERR_INVALID_RESPONSE) {
+    ESP_LOGW(TAG, "Batch %s refused, dropping %u records", batch_.key,
+             (unsigned)batch_.records);
+    stats_.rejected += batch_.records;
+    sealed_ = false;
+  } else {
+    ESP_LOGD(TAG, "Batch %s failed (0x%x), retrying in %u ms", batch_.key,
+             result_, (unsigned)backoff_ms_);
+    stats_.retries++;
+    retries.add();
+  }
+}
+
+/* On the Work pool, which also takes the compression off the executor */
+esp_err_t Telemetry::Uploader::send(void *self) {
+  Uploader *uploader = static_cast<Uploader *>(self);
+  Batch &batch = uploader->batch_;
+  if (uploader->pack_) {
+    uploader->pack_ = false;
+    size_t packed = compress(batch.body, batch.size, uploader->packed_,
+                             sizeof(uploader->packed_));
+    if (packed > 0 && packed < batch.size) {
+      batch.body = uploader->packed_;
+      batch.size = packed;
+      batch.compressed = true;
+    }
+  }
+  return uploader->transport_.post(batch);
+}
@@ -0,0 +1,198 @@
+/**
+ * Sends telemetry in batches, one request per batch rather than per
+ * reading, so the radio wakes once for many records:
+ *
+ *   static Telemetry::HttpTransport transport(url, cert_pem);
+ *   static Telemetry::Uploader uploader(transport, config);
+ *   uploader.start();
+ *   ...
+ *   uploader.add(cbor, size);  // One CBOR item per record
+ *
+ * The uploader is an Async flow. It waits until the gathered records reach
+ * 'send_bytes' or the oldest is 'max_age_ms' old, and until 'online()'
+ * holds, by default EasyWifi::is_connected(). EasyWifi notifies the
+ * executor on every connect and disconnect.
+ *
+ * Each batch is a CBOR map {"d": device_id, "s": sequence, "r": [records]},
+ * compressed when that makes it smaller. A failed POST is retried with
+ * backoff under the same Idempotency-Key, "device_id-boot-sequence", so the
+ * backend can drop a batch it already stored before its reply was lost.
+ * A batch the backend rejects with a 4xx is dropped.
+ */
+
+#ifndef __TELEMETRY_UPLOADER_H__
+#define __TELEMETRY_UPLOADER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "Async/Async.h"
+#include "Port/Port.h"
+#include "Update/Compressed.h"
+
+/* Records gathered per batch, in encoded bytes */
+#ifndef TELEMETRY_BATCH_SIZE
+#define TELEMETRY_BATCH_SIZE 2048
+#endif
+
+/* Compression window, 256 bytes spans several records */
+#define TELEMETRY_WINDOW_BITS 8
+#define TELEMETRY_LOOKAHEAD_BITS 4
+
+/* Room for the batch map around the records */
+#define TELEMETRY_ENVELOPE_SIZE 64
+
+/* "device_id-boot-sequence", for ids up to 32 characters */
+#define TELEMETRY_KEY_SIZE 64
+
+#define TELEMETRY_CONTENT_TYPE "application/cbor"
+
+/* Content-Encoding of compressed batches, see Update/Compressed.h */
+#define TELEMETRY_ENCODING "x-euz1"
+
+namespace Telemetry {
+
+struct Batch {
+  const uint8_t *body;
+  size_t size;
+  const char *key;  /*!< Idempotency-Key, the same on every retry */
+  bool compressed;  /*!< Sent with TELEMETRY_ENCODING */
+  uint32_t records;
+};
+
+/**
+ * Sends batches to the backend
+ */
+class Transport {
+ public:
+  virtual ~Transport() {}
+
+  /**
+   * @brief POSTs one batch
+   *
+   * @return
+   *  - ESP_OK                    The backend stored it
+   *  - ESP_ERR_INVALID_RESPONSE  The backend refused it, do not retry
+   *  - Else the request failed and may be retried
+   */
+  virtual esp_err_t post(const Batch &batch) = 0;
+};
+
+/**
+ * @brief Maps an HTTP status to the result of Transport::post()
+ */
+esp_err_t status_error(int status);
+
+/**
+ * @brief Compresses 'data' into the format of Update::Decompressor
+ *
+ * @return The compressed size, 0 if it does not fit 'capacity'
+ */
+size_t compress(const uint8_t *data, size_t size, uint8_t *dest,
+                size_t capacity);
+
+struct UploaderConfig {
+  const char *device_id = "esp32";
+  size_t send_bytes = TELEMETRY_BATCH_SIZE * 3 / 4; /*!< Send once this
+                                                         much is gathered */
+  uint32_t max_age_ms = 60000; /*!< Or once the oldest is this old */
+  bool compress = true;
+  uint32_t retry_ms = 500;     /*!< First backoff, doubled per retry */
+  uint32_t max_retry_ms = 60000;
+  bool (*online)() = nullptr;  /*!< nullptr for EasyWifi::is_connected()
+                                    on the device, always natively */
+};
+
+struct UploaderStats {
+  uint32_t records;   /*!< Accepted by the backend */
+  uint32_t batches;
+  uint32_t retries;
+  uint32_t rejected;  /*!< Records in batches refused with a 4xx */
+  uint32_t raw_bytes; /*!< Batch sizes before compression */
+  uint32_t sent_bytes;
+  uint64_t radio_us;  /*!< Time spent in requests, retries included */
+};
+
+class Uploader : public Async::Flow {
+ public:
+  explicit Uploader(Transport &transport,
+                    const UploaderConfig &config = UploaderConfig());
+
+  /**
+   * @brief Spawns the flow, see Async::spawn()
+   */
+  esp_err_t start();
+
+  /**
+   * @brief Stops after the batch in flight, keeping the records gathered.
+   * done() once stopped.
+   */
+  void stop();
+
+  /**
+   * @brief Gathers one record for the next batch
+   *
+   * @param item  One encoded CBOR item, usually a map
+   *
+   * @return
+   *  - ESP_OK                Gathered
+   *  - ESP_ERR_INVALID_ARG   Larger than a batch
+   *  - ESP_ERR_NO_MEM        The batch is full while the last one is still
+   *                          being sent, keep the record elsewhere
+   */
+  esp_err_t add(const void *item, size_t size);
+
+  /**
+   * @brief Sends the records gathered so far once online, without waiting
+   * for 'send_bytes' or 'max_age_ms'
+   */
+  void flush();
+
+  /* Records gathered and not yet sent */
+  uint32_t pending();
+
+  UploaderStats stats();
+
+  Async::Status resume() override;
+
+ private:
+  bool online() const;
+  bool due();
+  void seal();
+  void settle();
+  static esp_err_t send(void *self);
+
+  Transport &transport_;
+  UploaderConfig config_;
+  Port::Mutex lock_;
+  std::atomic<bool> stopping_;
+  bool flushing_;
+  bool sealed_;  // A batch waits to be sent
+  bool pack_;    // Compress it before the first attempt
+
+  /* Gathered records */
+  uint8_t items_[TELEMETRY_BATCH_SIZE];
+  size_t used_;
+  uint32_t count_;
+  uint64_t oldest_us_;
+
+  /* The batch being sent */
+  uint8_t body_[TELEMETRY_BATCH_SIZE + TELEMETRY_ENVELOPE_SIZE];
+  uint8_t packed_[TELEMETRY_BATCH_SIZE + TELEMETRY_ENVELOPE_SIZE];
+  char key_[TELEMETRY_KEY_SIZE];
+  Batch batch_;
+  size_t raw_size_;
+  uint32_t boot_;  // Random per boot, so keys are not reused after a reset
+  uint32_t sequence_;
+
+  Async::Call call_;
+  esp_err_t started_;
+  esp_err_t result_;
+  uint64_t sent_us_;
+  uint32_t backoff_ms_;
+  UploaderStats stats_;
+};
+
+}  // namespace Telemetry
+
+#endif
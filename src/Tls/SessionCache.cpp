@@ -0,0 +1,195 @@
+#include "SessionCache.h"
+#include <string.h>
+#include "Metrics/Metrics.h"
+#include "NVS/NVS.h"
+#include "Port/Port.h"
+
+#define TLS_CACHE_MAGIC 0x544c5331  // "TLS1"
+
+namespace Tls {
+
+struct Entry {
+  char key[TLS_CACHE_KEY_SIZE];
+  uint8_t pin[TLS_PIN_SIZE];
+  uint8_t session[TLS_SESSION_MAX_SIZE];
+  uint16_t size;  // 0 for a free entry
+  uint16_t reserved;
+  uint32_t expires_s;
+  uint32_t order;  // Higher for the more recently stored
+};
+
+/* As saved in NVS */
+struct Image {
+  uint32_t magic;
+  uint32_t order;
+  Entry entries[TLS_CACHE_ENTRIES];
+};
+
+static Image cache;
+/* The cert_pem pointer each entry last matched its pin through, so a
+ * lookup through it skips the digest. Kept in RAM only, pointers do not
+ * survive a reboot or an update. */
+static const char *certs[TLS_CACHE_ENTRIES];
+static bool checked[TLS_CACHE_ENTRIES];
+static bool persistent = false;
+static CacheStats counts;
+static Port::Mutex lock;
+
+static Metrics::Histogram handshake_us("tls.handshake_us");
+static Metrics::Histogram resume_us("tls.resume_us");
+static Metrics::Counter resumptions("tls.resumed");
+
+/* Call with 'lock' held */
+static Entry *lookup(const char *key) {
+  for (int i = 0; i < TLS_CACHE_ENTRIES; i++) {
+    Entry &entry = cache.entries[i];
+    if (entry.size > 0 && strcmp(entry.key, key) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+/* Whether 'entry' was checked against 'cert_pem', call with 'lock' held */
+static bool same_cert(Entry &entry, const char *cert_pem) {
+  size_t i = &entry - cache.entries;
+  if (checked[i] && certs[i] == cert_pem) {
+    return true;
+  }
+  uint8_t digest[TLS_PIN_SIZE];
+  pin(cert_pem, digest);
+  if (memcmp(entry.pin, digest, TLS_PIN_SIZE) != 0) {
+    return false;
+  }
+  certs[i] = cert_pem;
+  checked[i] = true;
+  return true;
+}
+
+/* Call with 'lock' held */
+static esp_err_t save() {
+  cache.magic = TLS_CACHE_MAGIC;
+  return NVS.write(TLS_CACHE_NVS_KEY, &cache, sizeof(cache));
+}
+}  // namespace Tls
+
+void Tls::pin(const char *cert_pem, uint8_t *digest) {
+  if (cert_pem == nullptr) {
+    memset(digest, 0, TLS_PIN_SIZE);
+    return;
+  }
+  Sha256::digest(cert_pem, strlen(cert_pem), digest);
+}
+
+esp_err_t Tls::find(const char *key, const char *cert_pem, uint32_t now_s,
+                    void *dest, size_t capacity, size_t *size) {
+  Port::Lock guard(lock);
+  Entry *entry = lookup(key);
+  if (entry == nullptr) {
+    counts.misses++;
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (!same_cert(*entry, cert_pem)) {
+    counts.invalidated++;
+    entry->size = 0;
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (now_s >= entry->expires_s) {
+    counts.expired++;
+    entry->size = 0;
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (entry->size > capacity) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  counts.hits++;
+  memcpy(dest, entry->session, entry->size);
+  *size = entry->size;
+  return ESP_OK;
+}
+
+esp_err_t Tls::store(const char *key, const char *cert_pem,
+                     const void *session, size_t size, uint32_t now_s,
+                     uint32_t lifetime_s) {
+  if (strlen(key) >= TLS_CACHE_KEY_SIZE || size == 0 ||
+      size > TLS_SESSION_MAX_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  Port::Lock guard(lock);
+  Entry *entry = lookup(key);
+  for (int i = 0; i < TLS_CACHE_ENTRIES && entry == nullptr; i++) {
+    if (cache.entries[i].size == 0) {
+      entry = &cache.entries[i];
+    }
+  }
+  if (entry == nullptr) {
+    /* The least recently stored */
+    entry = &cache.entries[0];
+    for (int i = 1; i < TLS_CACHE_ENTRIES; i++) {
+      if (cache.entries[i].order < entry->order) {
+        entry = &cache.entries[i];
+      }
+    }
+  }
+  memset(entry, 0, sizeof(*entry));
+  strncpy(entry->key, key, TLS_CACHE_KEY_SIZE - 1);
+  pin(cert_pem, entry->pin);
+  certs[entry - cache.entries] = cert_pem;
+  checked[entry - cache.entries] = true;
+  memcpy(entry->session, session, size);
+  entry->size = size;
+  entry->expires_s =
+      now_s + (lifetime_s > 0 ? lifetime_s : TLS_SESSION_LIFETIME_S);
+  entry->order = ++cache.order;
+  return persistent ? save() : ESP_OK;
+}
+
+void Tls::forget(const char *key) {
+  Port::Lock guard(lock);
+  Entry *entry = lookup(key);
+  if (entry != nullptr) {
+    entry->size = 0;
+  }
+}
+
+void Tls::clear() {
+  Port::Lock guard(lock);
+  memset(&cache, 0, sizeof(cache));
+  memset(checked, 0, sizeof(checked));
+}
+
+void Tls::persist(bool on) {
+  Port::Lock guard(lock);
+  persistent = on;
+}
+
+esp_err_t Tls::load(uint32_t now_s) {
+  Port::Lock guard(lock);
+  memset(checked, 0, sizeof(checked));
+  esp_err_t err = NVS.read(TLS_CACHE_NVS_KEY, cache);
+  if (err != ESP_OK || cache.magic != TLS_CACHE_MAGIC) {
+    memset(&cache, 0, sizeof(cache));
+    return err != ESP_OK ? err : ESP_ERR_INVALID_VERSION;
+  }
+  for (int i = 0; i < TLS_CACHE_ENTRIES; i++) {
+    Entry &entry = cache.entries[i];
+    if (entry.size > TLS_SESSION_MAX_SIZE || now_s >= entry.expires_s) {
+      entry.size = 0;
+    }
+  }
+  return ESP_OK;
+}
+
+void Tls::record_handshake(uint32_t us, bool resumed) {
+  if (resumed) {
+    resumptions.add();
+    resume_us.record(us);
+  } else {
+    handshake_us.record(us);
+  }
+}
+
+Tls::CacheStats Tls::stats() {
+  Port::Lock guard(lock);
+  return counts;
+}
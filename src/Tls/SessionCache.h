@@ -0,0 +1,133 @@
+/**
+ * Cache of TLS sessions, so a reconnect to a host resumes its last session
+ * with an abbreviated handshake instead of a full ECDHE one:
+ *
+ *   if (Tls::find(key, cert_pem, now, session, sizeof(session), &size) ==
+ *       ESP_OK)
+ *     ... offer 'session' in the ClientHello ...
+ *   ... after a full handshake ...
+ *   Tls::store(key, cert_pem, session, size, now, lifetime_s);
+ *
+ * Sessions are kept under Http::host_key() of the URL and the cert_pem
+ * pointer, as the connection pool keys its connections. A resumed session
+ * skips the certificate check, so each is also stored with a digest of the
+ * CA certificate it was checked against. A lookup through another pointer,
+ * or the first one after load(), compares digests and drops the session if
+ * the certificate changed. Sessions also expire after the lifetime the
+ * server gave them.
+ *
+ * The cache lives in RAM. After persist(true) it is also saved through
+ * NVSStatic on every store(), and load() restores it after a reboot. The
+ * sessions hold their master secrets, so use NVS encryption with it.
+ * Http::TlsConnection resumes through it on the device.
+ */
+
+#ifndef __TLS_SESSION_CACHE_H__
+#define __TLS_SESSION_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Sha256.h"
+#include "esp_err.h"
+
+/* Hosts with a session kept, the least recently stored is dropped first */
+#ifndef TLS_CACHE_ENTRIES
+#define TLS_CACHE_ENTRIES 4
+#endif
+
+/* Largest session kept, a ticket of up to 180 bytes with its master secret
+ * fits. The saved cache must stay within an NVS blob. */
+#ifndef TLS_SESSION_MAX_SIZE
+#define TLS_SESSION_MAX_SIZE 288
+#endif
+
+/* For servers that do not give a ticket lifetime */
+#define TLS_SESSION_LIFETIME_S (2 * 60 * 60)
+
+/* "scheme://host:port" with the terminator */
+#define TLS_CACHE_KEY_SIZE 72
+
+#define TLS_PIN_SIZE SHA256_DIGEST_SIZE
+
+/* NVS key of the saved cache */
+#define TLS_CACHE_NVS_KEY "tls_sessions"
+
+namespace Tls {
+
+struct CacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t expired;      /*!< Dropped past their lifetime */
+  uint32_t invalidated;  /*!< Dropped for a changed certificate */
+};
+
+/**
+ * @brief Gets the digest identifying the CA certificate 'cert_pem', all
+ * zeros for nullptr
+ */
+void pin(const char *cert_pem, uint8_t *digest);
+
+/**
+ * @brief Gets the session for 'key'
+ *
+ * @param cert_pem  CA certificate the connection checks against
+ * @param now_s     Seconds since the epoch
+ * @param size   Set to the session size
+ *
+ * @return
+ *  - ESP_OK                The session is in 'dest'
+ *  - ESP_ERR_NOT_FOUND     None, or it expired
+ *  - ESP_ERR_INVALID_STATE It was checked against another certificate, and
+ *                          is dropped
+ *  - ESP_ERR_INVALID_SIZE  It does not fit 'capacity'
+ */
+esp_err_t find(const char *key, const char *cert_pem, uint32_t now_s,
+               void *dest, size_t capacity, size_t *size);
+
+/**
+ * @brief Keeps the session of a full handshake, replacing the host's last
+ *
+ * @param lifetime_s  From the server's ticket, 0 for TLS_SESSION_LIFETIME_S
+ *
+ * @return
+ *  - ESP_OK                Stored, and saved if persist() is on
+ *  - ESP_ERR_INVALID_ARG   The key or session is too long
+ *  - Else the NVS error saving it, it is still cached in RAM
+ */
+esp_err_t store(const char *key, const char *cert_pem, const void *session,
+                size_t size, uint32_t now_s, uint32_t lifetime_s);
+
+/**
+ * @brief Drops the session for 'key', after the server declined it say
+ */
+void forget(const char *key);
+
+/**
+ * @brief Drops every session from RAM, leaving the saved copy
+ */
+void clear();
+
+/**
+ * @brief Saves the cache through NVSStatic on every store() from now on
+ */
+void persist(bool on);
+
+/**
+ * @brief Restores the cache saved by persist(), dropping expired sessions.
+ * Call after NVS.begin().
+ *
+ * @return ESP_OK, or the NVSStatic::read() error
+ */
+esp_err_t load(uint32_t now_s);
+
+/**
+ * @brief Records a handshake in the tls.handshake_us or tls.resume_us
+ * histogram
+ */
+void record_handshake(uint32_t us, bool resumed);
+
+CacheStats stats();
+
+}  // namespace Tls
+
+#endif
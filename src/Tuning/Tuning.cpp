@@ -0,0 +1,74 @@
+#include "Tuning.h"
+#include <string.h>
+#include "Port/Socket.h"
+#include "esp_log.h"
+
+namespace Tuning {
+static const char *TAG = "Tuning";
+
+/* Windows in whole segments of CONFIG_TCP_MSS, 1436 bytes */
+static const Profile PROFILES[TUNING_PROFILE_COUNT] = {
+    {"low-memory", 2872, 2872, 4, 16, 0},
+    {"balanced", 5744, 5744, 10, 32, 6},
+    {"high-throughput", 22976, 22976, 16, 64, 12},
+};
+
+static const Profile *selected = nullptr;
+}  // namespace Tuning
+
+const Tuning::Profile &Tuning::profile(size_t index) {
+  return PROFILES[index < TUNING_PROFILE_COUNT ? index : 0];
+}
+
+const Tuning::Profile *Tuning::find(const char *name) {
+  for (const Profile &profile : PROFILES) {
+    if (strcmp(profile.name, name) == 0) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+esp_err_t Tuning::select(const char *name) {
+  const Profile *profile = find(name);
+  if (profile == nullptr) {
+    ESP_LOGE(TAG, "No profile %s", name);
+    return ESP_ERR_NOT_FOUND;
+  }
+  selected = profile;
+  return ESP_OK;
+}
+
+const Tuning::Profile &Tuning::current() {
+  if (selected == nullptr) {
+    selected = find(TUNING_PROFILE);
+  }
+  return selected != nullptr ? *selected : PROFILES[1];
+}
+
+esp_err_t Tuning::apply_socket(int fd) {
+  const Profile &profile = current();
+  int window = profile.tcp_window;
+  int send_buffer = profile.tcp_send_buffer;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window)) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer,
+                 sizeof(send_buffer)) != 0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+#ifdef ESP_PLATFORM
+void Tuning::apply_wifi(wifi_init_config_t *config) {
+  const Profile &profile = current();
+  config->static_rx_buf_num = profile.static_rx_buffers;
+  config->dynamic_rx_buf_num = profile.dynamic_rx_buffers;
+  config->ampdu_rx_enable = profile.ba_window > 0;
+  config->ampdu_tx_enable = profile.ba_window > 0;
+  if (profile.ba_window > 0) {
+    config->rx_ba_win = profile.ba_window;
+    config->tx_ba_win = profile.ba_window;
+  }
+  ESP_LOGI(TAG, "Wi-Fi profile %s", profile.name);
+}
+#endif
@@ -0,0 +1,87 @@
+/**
+ * Named TCP and Wi-Fi tuning profiles, trading RAM for throughput:
+ *
+ *   low-memory       2 segment window, 4 static RX buffers, no AMPDU
+ *   balanced         The values of src/sdkconfig.h
+ *   high-throughput  16 segment window, 16 static RX buffers, BA window 12
+ *
+ * The profile is chosen by name with -DTUNING_PROFILE="..." or select()
+ * before EasyWifi::configure(), which passes its buffer counts to
+ * esp_wifi_init(). apply_socket() sets a socket's receive window and send
+ * buffer. lwIP takes them per socket only where ESP_PER_SOC_TCP_WND is on,
+ * elsewhere the sdkconfig.h defaults hold, so copy the profile's values
+ * into CONFIG_TCP_WND_DEFAULT and CONFIG_TCP_SND_BUF_DEFAULT to be sure.
+ *
+ * Measure a profile with the iperf build target, see Iperf.h.
+ */
+
+#ifndef __TUNING_H__
+#define __TUNING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_wifi.h"
+#endif
+
+#ifndef TUNING_PROFILE
+#define TUNING_PROFILE "balanced"
+#endif
+
+#define TUNING_PROFILE_COUNT 3
+
+namespace Tuning {
+
+struct Profile {
+  const char *name;
+  uint32_t tcp_window;        /*!< Receive window, SO_RCVBUF */
+  uint32_t tcp_send_buffer;   /*!< SO_SNDBUF */
+  uint8_t static_rx_buffers;  /*!< Wi-Fi RX buffers, 1.6 KiB each, held
+                                   from esp_wifi_init() on */
+  uint8_t dynamic_rx_buffers; /*!< Allocated as frames arrive */
+  uint8_t ba_window;          /*!< Block ack window, 0 turns AMPDU off */
+};
+
+/**
+ * @brief Gets a profile by index, in order of RAM used
+ */
+const Profile &profile(size_t index);
+
+/**
+ * @return The profile named 'name', or nullptr
+ */
+const Profile *find(const char *name);
+
+/**
+ * @brief Makes 'name' the current profile. Call before
+ * EasyWifi::configure() for the Wi-Fi settings to take effect.
+ *
+ * @return
+ *  - ESP_OK              Selected
+ *  - ESP_ERR_NOT_FOUND   No profile of that name
+ */
+esp_err_t select(const char *name);
+
+/* The selected profile, TUNING_PROFILE until select() */
+const Profile &current();
+
+/**
+ * @brief Sets the TCP buffers of 'fd' from the current profile
+ *
+ * @return ESP_FAIL if the stack refused them
+ */
+esp_err_t apply_socket(int fd);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Sets the buffer counts and block ack windows of 'config' from the
+ * current profile
+ */
+void apply_wifi(wifi_init_config_t *config);
+#endif
+
+}  // namespace Tuning
+
+#endif
@@ -0,0 +1,95 @@
+#include "ChunkTable.h"
+#include <string.h>
+
+static void put_le32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+uint32_t Update::chunk_count(uint32_t image_size) {
+  return (image_size + PEER_CHUNK_SIZE - 1) / PEER_CHUNK_SIZE;
+}
+
+size_t Update::chunk_table_size(uint32_t image_size) {
+  return PEER_TABLE_SIZE(chunk_count(image_size));
+}
+
+esp_err_t Update::sign_chunk_table(const uint8_t *image, uint32_t size,
+                                   const uint8_t *seed, uint8_t *table) {
+  uint32_t count = chunk_count(size);
+  if (size == 0 || count > PEER_MAX_CHUNKS) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(table, PEER_TABLE_MAGIC, 4);
+  put_le32(table + 4, size);
+  put_le32(table + 8, PEER_CHUNK_SIZE);
+  Sha256::digest(image, size, table + 12);
+
+  uint8_t *digests = table + PEER_TABLE_HEADER_SIZE;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t offset = i * PEER_CHUNK_SIZE;
+    uint32_t length = size - offset < PEER_CHUNK_SIZE ? size - offset
+                                                      : PEER_CHUNK_SIZE;
+    Sha256::digest(image + offset, length,
+                   digests + i * SHA256_DIGEST_SIZE);
+  }
+
+  size_t body = PEER_TABLE_SIZE(count) - ED25519_SIGNATURE_SIZE;
+  Ed25519::sign(seed, table, body, table + body);
+  return ESP_OK;
+}
+
+Update::ChunkTable::ChunkTable()
+    : image_size_(0),
+      chunk_count_(0),
+      image_digest_(nullptr),
+      chunk_digests_(nullptr) {}
+
+esp_err_t Update::ChunkTable::set(const uint8_t *data, size_t size,
+                                  const uint8_t *public_key) {
+  image_size_ = 0;
+  chunk_count_ = 0;
+  if (size < PEER_TABLE_SIZE(0)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (memcmp(data, PEER_TABLE_MAGIC, 4) != 0) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+  if (get_le32(data + 8) != PEER_CHUNK_SIZE) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  uint32_t image_size = get_le32(data + 4);
+  uint32_t count = Update::chunk_count(image_size);
+  if (image_size == 0 || count > PEER_MAX_CHUNKS ||
+      size != PEER_TABLE_SIZE(count)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  size_t body = size - ED25519_SIGNATURE_SIZE;
+  if (!Ed25519::verify(data + body, data, body, public_key)) {
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  image_size_ = image_size;
+  chunk_count_ = count;
+  image_digest_ = data + 12;
+  chunk_digests_ = data + PEER_TABLE_HEADER_SIZE;
+  return ESP_OK;
+}
+
+uint32_t Update::ChunkTable::chunk_length(uint32_t index) const {
+  uint32_t offset = index * PEER_CHUNK_SIZE;
+  return image_size_ - offset < PEER_CHUNK_SIZE ? image_size_ - offset
+                                                : PEER_CHUNK_SIZE;
+}
+
+bool Update::ChunkTable::check(uint32_t index, const uint8_t *digest) const {
+  return index < chunk_count_ &&
+         memcmp(chunk_digests_ + index * SHA256_DIGEST_SIZE, digest,
+                SHA256_DIGEST_SIZE) == 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * Signed tables of the SHA-256 of each chunk of an image, so parts of an
+ * image from an untrusted source can be checked one by one.
+ *
+ * Table format, little endian, produced by tools/signimage:
+ *
+ *   "EUC1", u32 image_size, u32 chunk_size, SHA-256 of the image,
+ *   SHA-256 of each chunk, Ed25519 signature of the preceding bytes
+ */
+
+#ifndef __OTA_CHUNK_TABLE_H__
+#define __OTA_CHUNK_TABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Ed25519.h"
+#include "Crypto/Sha256.h"
+#include "Port/Port.h"
+
+/* A multiple of OTA_SECTOR_SIZE, so chunks erase independently */
+#define PEER_CHUNK_SIZE (16 * 1024)
+
+/* Images up to 4 MiB */
+#define PEER_MAX_CHUNKS 256
+
+#define PEER_TABLE_MAGIC "EUC1"
+#define PEER_TABLE_HEADER_SIZE (4 + 4 + 4 + SHA256_DIGEST_SIZE)
+#define PEER_TABLE_SIZE(chunks)                           \
+  (PEER_TABLE_HEADER_SIZE + (chunks)*SHA256_DIGEST_SIZE + \
+   ED25519_SIGNATURE_SIZE)
+#define PEER_TABLE_MAX_SIZE PEER_TABLE_SIZE(PEER_MAX_CHUNKS)
+
+/* Appended to an image URL to fetch its chunk table */
+#define PEER_TABLE_SUFFIX ".chunks"
+
+namespace Update {
+
+/**
+ * @brief Gets the number of chunks of an image
+ */
+uint32_t chunk_count(uint32_t image_size);
+
+/**
+ * @brief Gets the size of the chunk table of an image
+ */
+size_t chunk_table_size(uint32_t image_size);
+
+/**
+ * @brief Makes the signed chunk table of an image
+ *
+ * @param seed   Ed25519 secret key
+ * @param table  Receives chunk_table_size(size) bytes
+ *
+ * @return ESP_ERR_INVALID_SIZE if the image has more than PEER_MAX_CHUNKS
+ */
+esp_err_t sign_chunk_table(const uint8_t *image, uint32_t size,
+                           const uint8_t *seed, uint8_t *table);
+
+/**
+ * A chunk table whose signature was checked. Refers to the caller's copy of
+ * the table, which must outlive it.
+ */
+class ChunkTable {
+ public:
+  ChunkTable();
+
+  /**
+   * @brief Checks a table and its signature
+   *
+   * @return
+   *  - ESP_OK                    The table is authentic
+   *  - ESP_ERR_INVALID_VERSION   Not a chunk table
+   *  - ESP_ERR_NOT_SUPPORTED     Chunk size other than PEER_CHUNK_SIZE
+   *  - ESP_ERR_INVALID_SIZE      Truncated, or too many chunks
+   *  - ESP_ERR_INVALID_CRC       Bad signature
+   */
+  esp_err_t set(const uint8_t *data, size_t size, const uint8_t *public_key);
+
+  uint32_t image_size() const { return image_size_; }
+  uint32_t chunk_count() const { return chunk_count_; }
+  const uint8_t *image_digest() const { return image_digest_; }
+
+  /* Bytes in chunk 'index', the last one may be short */
+  uint32_t chunk_length(uint32_t index) const;
+
+  /**
+   * @brief Compares the SHA-256 of a received chunk to the table
+   */
+  bool check(uint32_t index, const uint8_t *digest) const;
+
+ private:
+  uint32_t image_size_;
+  uint32_t chunk_count_;
+  const uint8_t *image_digest_;
+  const uint8_t *chunk_digests_;
+};
+
+}  // namespace Update
+
+#endif
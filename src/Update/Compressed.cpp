@@ -0,0 +1,161 @@
+#include "Compressed.h"
+#include <string.h>
+
+Update::Decompressor::Decompressor(ChunkSink &out)
+    : out_(out),
+      state_(State::HEADER),
+      error_(ESP_OK),
+      header_used_(0),
+      window_bits_(0),
+      lookahead_bits_(0),
+      image_size_(0),
+      bits_(0),
+      pending_(0),
+      index_(0),
+      produced_(0),
+      out_used_(0) {}
+
+esp_err_t Update::Decompressor::write(const uint8_t *data, size_t size) {
+  for (size_t i = 0; error_ == ESP_OK && i < size; i++) {
+    if (state_ == State::HEADER) {
+      header_[header_used_++] = data[i];
+      if (header_used_ == COMPRESSED_HEADER_SIZE) {
+        error_ = parse_header();
+      }
+      continue;
+    }
+    if (state_ == State::DONE) {
+      /* Only the padding of the last byte may follow the image */
+      error_ = ESP_ERR_INVALID_SIZE;
+      break;
+    }
+
+    bits_ = bits_ << 8 | data[i];
+    pending_ += 8;
+    while (error_ == ESP_OK && step()) {
+    }
+  }
+  return error_;
+}
+
+esp_err_t Update::Decompressor::finish() {
+  if (error_ != ESP_OK) {
+    return error_;
+  }
+  if (state_ != State::DONE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = flush();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  hash_.finish(digest);
+  hash_.reset();
+  return memcmp(digest, digest_, sizeof(digest)) == 0 ? ESP_OK
+                                                      : ESP_ERR_INVALID_CRC;
+}
+
+esp_err_t Update::Decompressor::parse_header() {
+  if (memcmp(header_, COMPRESSED_MAGIC, 4) != 0) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+  window_bits_ = header_[4];
+  lookahead_bits_ = header_[5];
+  image_size_ = (uint32_t)header_[8] | (uint32_t)header_[9] << 8 |
+                (uint32_t)header_[10] << 16 | (uint32_t)header_[11] << 24;
+  memcpy(digest_, header_ + 12, SHA256_DIGEST_SIZE);
+
+  if (window_bits_ < COMPRESSED_WINDOW_BITS_MIN ||
+      window_bits_ > COMPRESSED_WINDOW_BITS_MAX || lookahead_bits_ == 0 ||
+      lookahead_bits_ >= window_bits_) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  state_ = image_size_ > 0 ? State::TAG : State::DONE;
+  return ESP_OK;
+}
+
+/* Decodes one field if enough bits are pending, false otherwise */
+bool Update::Decompressor::step() {
+  switch (state_) {
+    case State::TAG:
+      if (pending_ < 1) {
+        return false;
+      }
+      state_ = take(1) ? State::LITERAL : State::INDEX;
+      return true;
+
+    case State::LITERAL:
+      if (pending_ < 8) {
+        return false;
+      }
+      error_ = put(take(8));
+      break;
+
+    case State::INDEX:
+      if (pending_ < window_bits_) {
+        return false;
+      }
+      index_ = take(window_bits_) + 1;
+      if (index_ > produced_) {
+        error_ = ESP_ERR_INVALID_SIZE;
+        return false;
+      }
+      state_ = State::COUNT;
+      return true;
+
+    case State::COUNT: {
+      if (pending_ < lookahead_bits_) {
+        return false;
+      }
+      uint32_t count = take(lookahead_bits_) + 1;
+      const uint32_t mask = (1u << window_bits_) - 1;
+      for (uint32_t i = 0; error_ == ESP_OK && i < count; i++) {
+        error_ = put(window_[(produced_ - index_) & mask]);
+      }
+      break;
+    }
+
+    default:
+      return false;
+  }
+
+  if (state_ != State::DONE) {
+    state_ = State::TAG;
+  }
+  return state_ != State::DONE;
+}
+
+uint32_t Update::Decompressor::take(uint8_t bits) {
+  pending_ -= bits;
+  return (bits_ >> pending_) & ((1u << bits) - 1);
+}
+
+esp_err_t Update::Decompressor::put(uint8_t byte) {
+  if (produced_ == image_size_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  window_[produced_ & ((1u << window_bits_) - 1)] = byte;
+  produced_++;
+  out_buf_[out_used_++] = byte;
+
+  esp_err_t err = ESP_OK;
+  if (out_used_ == OTA_BUFFER_SIZE) {
+    err = flush();
+  }
+  if (produced_ == image_size_) {
+    state_ = State::DONE;
+  }
+  return err;
+}
+
+esp_err_t Update::Decompressor::flush() {
+  if (out_used_ == 0) {
+    return ESP_OK;
+  }
+  hash_.update(out_buf_, out_used_);
+  esp_err_t err = out_.write(out_buf_, out_used_);
+  out_used_ = 0;
+  return err;
+}
@@ -0,0 +1,107 @@
+/**
+ * Incremental decompression of compressed firmware images, so a compressed
+ * image streams straight into the update partition without staging.
+ *
+ * Image format, little endian, produced by tools/mkcompressed:
+ *
+ *   header   "EUZ1", u8 window_bits, u8 lookahead_bits, u16 reserved,
+ *            u32 image_size, SHA-256 of the image
+ *   body     LZSS bit stream, most significant bit first
+ *              1, 8 bit byte                      a literal
+ *              0, window_bits index, lookahead_bits count
+ *                                                 copy count + 1 bytes
+ *                                                 from index + 1 back
+ *
+ * The body uses the heatshrink bit layout. RAM use is the 2^window_bits
+ * byte window and one output sector.
+ */
+
+#ifndef __OTA_COMPRESSED_H__
+#define __OTA_COMPRESSED_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Sha256.h"
+#include "OtaPipeline.h"
+
+#define COMPRESSED_MAGIC "EUZ1"
+#define COMPRESSED_HEADER_SIZE (4 + 1 + 1 + 2 + 4 + SHA256_DIGEST_SIZE)
+
+/* Largest window the decoder accepts, sizes its buffer */
+#define COMPRESSED_WINDOW_BITS_MAX 12
+#define COMPRESSED_WINDOW_BITS_MIN 4
+
+namespace Update {
+
+class Decompressor : public ImageDecoder {
+ public:
+  /**
+   * @param out  Receives the image in OTA_BUFFER_SIZE writes
+   */
+  explicit Decompressor(ChunkSink &out);
+
+  /**
+   * @brief Consumes the next part of the compressed image
+   *
+   * @return
+   *  - ESP_OK                    Consumed
+   *  - ESP_ERR_INVALID_VERSION   Not a compressed image
+   *  - ESP_ERR_NOT_SUPPORTED     Window larger than
+   *                              COMPRESSED_WINDOW_BITS_MAX
+   *  - ESP_ERR_INVALID_SIZE      The stream is longer than the image, or
+   *                              refers to data before its start
+   *  - Any error from writing 'out'
+   */
+  esp_err_t write(const uint8_t *data, size_t size) override;
+
+  /**
+   * @brief Flushes the last output and checks the image
+   *
+   * @return
+   *  - ESP_OK                    The image was decompressed and matches
+   *  - ESP_ERR_INVALID_SIZE      The stream ended early
+   *  - ESP_ERR_INVALID_CRC       The image does not match its digest
+   */
+  esp_err_t finish() override;
+
+  uint32_t image_size() const override { return image_size_; }
+
+ private:
+  enum class State : uint8_t { HEADER, TAG, LITERAL, INDEX, COUNT, DONE };
+
+  Decompressor(const Decompressor &) = delete;
+  Decompressor &operator=(const Decompressor &) = delete;
+
+  esp_err_t parse_header();
+  bool step();
+  uint32_t take(uint8_t bits);
+  esp_err_t put(uint8_t byte);
+  esp_err_t flush();
+
+  ChunkSink &out_;
+  State state_;
+  esp_err_t error_;
+
+  uint8_t header_[COMPRESSED_HEADER_SIZE];
+  uint32_t header_used_;
+  uint8_t window_bits_;
+  uint8_t lookahead_bits_;
+  uint32_t image_size_;
+  uint8_t digest_[SHA256_DIGEST_SIZE];
+
+  /* Bits not yet consumed, the lowest 'pending_' of 'bits_' */
+  uint32_t bits_;
+  uint8_t pending_;
+  uint32_t index_;
+
+  uint8_t window_[1 << COMPRESSED_WINDOW_BITS_MAX];
+  uint32_t produced_;
+
+  uint8_t out_buf_[OTA_BUFFER_SIZE];
+  uint32_t out_used_;
+  Sha256 hash_;
+};
+
+}  // namespace Update
+
+#endif
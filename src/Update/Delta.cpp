@@ -0,0 +1,286 @@
+#include "Delta.h"
+#include <string.h>
+
+static uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+Update::DeltaDecoder::DeltaDecoder(Partition &old, ChunkSink &out)
+    : old_(old),
+      out_(out),
+      state_(State::HEADER),
+      error_(ESP_OK),
+      header_used_(0),
+      new_size_(0),
+      old_size_(0),
+      varint_(0),
+      varint_shift_(0),
+      diff_left_(0),
+      extra_left_(0),
+      run_left_(0),
+      seek_(0),
+      old_pos_(0),
+      produced_(0),
+      window_start_(0),
+      window_len_(0),
+      out_used_(0) {}
+
+esp_err_t Update::DeltaDecoder::write(const uint8_t *data, size_t size) {
+  size_t i = 0;
+  while (error_ == ESP_OK && i < size) {
+    size_t n;
+    switch (state_) {
+      case State::HEADER:
+        n = DELTA_HEADER_SIZE - header_used_ < size - i
+                ? DELTA_HEADER_SIZE - header_used_
+                : size - i;
+        memcpy(header_ + header_used_, data + i, n);
+        header_used_ += n;
+        i += n;
+        if (header_used_ == DELTA_HEADER_SIZE) {
+          error_ = parse_header();
+        }
+        break;
+
+      case State::DIFF_LEN:
+        if (read_varint(data[i++])) {
+          diff_left_ = varint_;
+          state_ = State::EXTRA_LEN;
+        }
+        break;
+
+      case State::EXTRA_LEN:
+        if (read_varint(data[i++])) {
+          extra_left_ = varint_;
+          state_ = State::SEEK;
+        }
+        break;
+
+      case State::SEEK:
+        if (read_varint(data[i++])) {
+          /* zigzag */
+          seek_ = (int64_t)(varint_ >> 1) ^ -(int64_t)(varint_ & 1);
+          if ((uint64_t)produced_ + diff_left_ + extra_left_ > new_size_) {
+            error_ = ESP_ERR_INVALID_SIZE;
+          } else if (diff_left_ > 0) {
+            state_ = State::ZEROS;
+          } else {
+            error_ = end_of_run();
+          }
+        }
+        break;
+
+      case State::ZEROS:
+        if (read_varint(data[i++])) {
+          if (varint_ > diff_left_) {
+            error_ = ESP_ERR_INVALID_SIZE;
+          } else {
+            error_ = copy_old(varint_, nullptr);
+            diff_left_ -= varint_;
+            state_ = State::LITERAL_LEN;
+          }
+        }
+        break;
+
+      case State::LITERAL_LEN:
+        if (read_varint(data[i++])) {
+          if (varint_ > diff_left_) {
+            error_ = ESP_ERR_INVALID_SIZE;
+          } else if (varint_ == 0) {
+            error_ = end_of_run();
+          } else {
+            run_left_ = varint_;
+            state_ = State::LITERAL;
+          }
+        }
+        break;
+
+      case State::LITERAL:
+        n = run_left_ < size - i ? run_left_ : size - i;
+        error_ = copy_old(n, data + i);
+        i += n;
+        run_left_ -= n;
+        diff_left_ -= n;
+        if (error_ == ESP_OK && run_left_ == 0) {
+          error_ = end_of_run();
+        }
+        break;
+
+      case State::EXTRA:
+        n = extra_left_ < size - i ? extra_left_ : size - i;
+        error_ = emit(data + i, n);
+        i += n;
+        extra_left_ -= n;
+        if (error_ == ESP_OK && extra_left_ == 0) {
+          error_ = next_block();
+        }
+        break;
+
+      case State::DONE:
+        /* Trailing bytes after the last block */
+        error_ = ESP_ERR_INVALID_SIZE;
+        break;
+    }
+  }
+  return error_;
+}
+
+esp_err_t Update::DeltaDecoder::finish() {
+  if (error_ != ESP_OK) {
+    return error_;
+  }
+  if (state_ != State::DONE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = flush();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  hash_.finish(digest);
+  hash_.reset();
+  return memcmp(digest, new_digest_, sizeof(digest)) == 0
+             ? ESP_OK
+             : ESP_ERR_INVALID_CRC;
+}
+
+/* Checks the magic, and that the old image is the one the patch expects */
+esp_err_t Update::DeltaDecoder::parse_header() {
+  if (memcmp(header_, DELTA_MAGIC, 4) != 0) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+  new_size_ = read_le32(header_ + 4);
+  old_size_ = read_le32(header_ + 8);
+  const uint8_t *old_digest = header_ + 12;
+  memcpy(new_digest_, header_ + 12 + SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE);
+
+  if (old_size_ > old_.size()) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  Sha256 old_hash;
+  for (uint32_t pos = 0; pos < old_size_; pos += DELTA_OLD_WINDOW) {
+    uint32_t n = old_size_ - pos < DELTA_OLD_WINDOW ? old_size_ - pos
+                                                    : DELTA_OLD_WINDOW;
+    esp_err_t err = old_.read(pos, window_, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+    old_hash.update(window_, n);
+  }
+  window_len_ = 0;
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  old_hash.finish(digest);
+  if (memcmp(digest, old_digest, sizeof(digest)) != 0) {
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  state_ = new_size_ > 0 ? State::DIFF_LEN : State::DONE;
+  return ESP_OK;
+}
+
+/* Feeds one byte of a LEB128 varint, true once the value is complete */
+bool Update::DeltaDecoder::read_varint(uint8_t byte) {
+  if (varint_shift_ == 0) {
+    varint_ = 0;
+  }
+  varint_ |= (uint64_t)(byte & 0x7F) << varint_shift_;
+  varint_shift_ += 7;
+  if (byte & 0x80) {
+    if (varint_shift_ >= 64) {
+      error_ = ESP_ERR_INVALID_SIZE;
+    }
+    return false;
+  }
+  varint_shift_ = 0;
+  return true;
+}
+
+/* Called when a zero run + literal pair ends */
+esp_err_t Update::DeltaDecoder::end_of_run() {
+  if (diff_left_ > 0) {
+    state_ = State::ZEROS;
+  } else if (extra_left_ > 0) {
+    state_ = State::EXTRA;
+  } else {
+    return next_block();
+  }
+  return ESP_OK;
+}
+
+esp_err_t Update::DeltaDecoder::next_block() {
+  int64_t pos = (int64_t)old_pos_ + seek_;
+  if (pos < 0 || pos > old_size_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  old_pos_ = pos;
+  state_ = produced_ == new_size_ ? State::DONE : State::DIFF_LEN;
+  return ESP_OK;
+}
+
+/* Emits 'count' old bytes, each plus the matching 'add' byte if given */
+esp_err_t Update::DeltaDecoder::copy_old(uint32_t count, const uint8_t *add) {
+  for (uint32_t j = 0; j < count; j++) {
+    uint8_t byte;
+    esp_err_t err = old_byte(old_pos_++, &byte);
+    if (err != ESP_OK) {
+      return err;
+    }
+    out_buf_[out_used_++] = add != nullptr ? byte + add[j] : byte;
+    if (out_used_ == OTA_BUFFER_SIZE && (err = flush()) != ESP_OK) {
+      return err;
+    }
+  }
+  produced_ += count;
+  return ESP_OK;
+}
+
+esp_err_t Update::DeltaDecoder::emit(const uint8_t *data, size_t size) {
+  produced_ += size;
+  while (size > 0) {
+    size_t n = OTA_BUFFER_SIZE - out_used_ < size ? OTA_BUFFER_SIZE - out_used_
+                                                  : size;
+    memcpy(out_buf_ + out_used_, data, n);
+    out_used_ += n;
+    data += n;
+    size -= n;
+    if (out_used_ == OTA_BUFFER_SIZE) {
+      esp_err_t err = flush();
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t Update::DeltaDecoder::flush() {
+  if (out_used_ == 0) {
+    return ESP_OK;
+  }
+  hash_.update(out_buf_, out_used_);
+  esp_err_t err = out_.write(out_buf_, out_used_);
+  out_used_ = 0;
+  return err;
+}
+
+esp_err_t Update::DeltaDecoder::old_byte(uint32_t pos, uint8_t *byte) {
+  if (pos >= old_size_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (pos < window_start_ || pos >= window_start_ + window_len_) {
+    window_start_ = pos;
+    window_len_ = old_size_ - pos < DELTA_OLD_WINDOW ? old_size_ - pos
+                                                     : DELTA_OLD_WINDOW;
+    esp_err_t err = old_.read(pos, window_, window_len_);
+    if (err != ESP_OK) {
+      window_len_ = 0;
+      return err;
+    }
+  }
+  *byte = window_[pos - window_start_];
+  return ESP_OK;
+}
@@ -0,0 +1,135 @@
+/**
+ * Streaming decoder for delta (binary diff) updates. The new image is
+ * rebuilt from the running image and a compact patch, so only the patch is
+ * downloaded.
+ *
+ * Patch format, little endian, produced by tools/mkdelta:
+ *
+ *   header   "EUD1", u32 new_size, u32 old_size,
+ *            SHA-256 of the old image, SHA-256 of the new image
+ *   blocks   until new_size bytes are produced, each
+ *              varint diff_len, varint extra_len, zigzag varint seek
+ *              diff:  (varint zeros, varint n, n bytes) until diff_len
+ *              extra: extra_len bytes
+ *
+ * A diff block adds its bytes to the old image at the current old offset, a
+ * run of zeros copies old bytes unchanged. Extra bytes are new data. After
+ * a block the old offset moves by diff_len + seek. This is the bsdiff
+ * control stream, with zero runs coded inline instead of relying on a
+ * compressor.
+ *
+ * RAM use is one output sector and a small window of the old image,
+ * independent of the image size.
+ */
+
+#ifndef __OTA_DELTA_H__
+#define __OTA_DELTA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Sha256.h"
+#include "OtaPipeline.h"
+#include "Partition.h"
+
+#define DELTA_MAGIC "EUD1"
+#define DELTA_HEADER_SIZE (4 + 4 + 4 + 2 * SHA256_DIGEST_SIZE)
+
+/* Bytes of the old image cached at a time */
+#define DELTA_OLD_WINDOW 256
+
+namespace Update {
+
+class DeltaDecoder : public ImageDecoder {
+ public:
+  /**
+   * @param old  The image the patch was made against, normally the running
+   *             partition
+   * @param out  Receives the rebuilt image in OTA_BUFFER_SIZE writes
+   */
+  DeltaDecoder(Partition &old, ChunkSink &out);
+
+  /**
+   * @brief Consumes the next part of the patch
+   *
+   * @return
+   *  - ESP_OK                    Consumed
+   *  - ESP_ERR_INVALID_VERSION   Not a patch
+   *  - ESP_ERR_INVALID_CRC       The old image does not match the patch
+   *  - ESP_ERR_INVALID_SIZE      The patch reaches outside either image
+   *  - Any error from reading 'old' or writing 'out'
+   */
+  esp_err_t write(const uint8_t *data, size_t size) override;
+
+  /**
+   * @brief Flushes the last output and checks the rebuilt image
+   *
+   * @return
+   *  - ESP_OK                    The new image was rebuilt and matches
+   *  - ESP_ERR_INVALID_SIZE      The patch ended early
+   *  - ESP_ERR_INVALID_CRC       The rebuilt image does not match
+   */
+  esp_err_t finish() override;
+
+  uint32_t image_size() const override { return new_size_; }
+
+ private:
+  enum class State : uint8_t {
+    HEADER,
+    DIFF_LEN,
+    EXTRA_LEN,
+    SEEK,
+    ZEROS,
+    LITERAL_LEN,
+    LITERAL,
+    EXTRA,
+    DONE,
+  };
+
+  DeltaDecoder(const DeltaDecoder &) = delete;
+  DeltaDecoder &operator=(const DeltaDecoder &) = delete;
+
+  esp_err_t parse_header();
+  bool read_varint(uint8_t byte);
+  esp_err_t next_block();
+  esp_err_t end_of_run();
+  esp_err_t copy_old(uint32_t count, const uint8_t *add);
+  esp_err_t emit(const uint8_t *data, size_t size);
+  esp_err_t flush();
+  esp_err_t old_byte(uint32_t pos, uint8_t *byte);
+
+  Partition &old_;
+  ChunkSink &out_;
+  State state_;
+  esp_err_t error_;
+
+  uint8_t header_[DELTA_HEADER_SIZE];
+  uint32_t header_used_;
+  uint32_t new_size_;
+  uint32_t old_size_;
+  uint8_t new_digest_[SHA256_DIGEST_SIZE];
+
+  /* Varint being decoded */
+  uint64_t varint_;
+  uint8_t varint_shift_;
+
+  /* Current block */
+  uint32_t diff_left_;
+  uint32_t extra_left_;
+  uint32_t run_left_;
+  int64_t seek_;
+
+  uint32_t old_pos_;
+  uint32_t produced_;
+
+  uint8_t window_[DELTA_OLD_WINDOW];
+  uint32_t window_start_;
+  uint32_t window_len_;
+
+  uint8_t out_buf_[OTA_BUFFER_SIZE];
+  uint32_t out_used_;
+  Sha256 hash_;
+};
+
+}  // namespace Update
+
+#endif
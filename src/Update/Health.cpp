@@ -0,0 +1,109 @@
+#include "Health.h"
+#include <string.h>
+
+Update::HealthMonitor::HealthMonitor(BootStore &store, BootControl &control)
+    : store_(store),
+      control_(control),
+      verdict_(Verdict::IDLE),
+      start_ms_(0),
+      deadline_ms_(0),
+      check_count_(0) {
+  memset(&record_, 0, sizeof(record_));
+}
+
+esp_err_t Update::HealthMonitor::add_check(const char *name, HealthCheck check,
+                                           void *arg) {
+  if (check_count_ == OTA_HEALTH_MAX_CHECKS) {
+    return ESP_ERR_NO_MEM;
+  }
+  checks_[check_count_++] = {name, check, arg, false};
+  return ESP_OK;
+}
+
+esp_err_t Update::HealthMonitor::mark_pending(uint32_t partition,
+                                              uint32_t previous) {
+  memset(&record_, 0, sizeof(record_));
+  record_.version = OTA_BOOT_RECORD_VERSION;
+  record_.state = BootState::PENDING;
+  record_.partition = partition;
+  record_.previous = previous;
+  return store_.save(record_);
+}
+
+Update::Verdict Update::HealthMonitor::boot(uint32_t now_ms,
+                                            uint32_t deadline_ms) {
+  verdict_ = Verdict::IDLE;
+  if (store_.load(record_) != ESP_OK ||
+      record_.version != OTA_BOOT_RECORD_VERSION ||
+      record_.state != BootState::PENDING) {
+    return verdict_;
+  }
+
+  /* The bootloader already fell back, the new image did not even start */
+  if (control_.running() != record_.partition) {
+    record_.state = BootState::ROLLED_BACK;
+    store_.save(record_);
+    verdict_ = Verdict::ROLLED_BACK;
+    return verdict_;
+  }
+
+  /* Counted before any check runs, so a crash or watchdog reset counts */
+  record_.attempts++;
+  store_.save(record_);
+  if (record_.attempts > OTA_HEALTH_MAX_ATTEMPTS) {
+    return rollback();
+  }
+
+  for (size_t i = 0; i < check_count_; i++) {
+    checks_[i].passed = false;
+  }
+  start_ms_ = now_ms;
+  deadline_ms_ = deadline_ms;
+  verdict_ = Verdict::CHECKING;
+  return verdict_;
+}
+
+Update::Verdict Update::HealthMonitor::poll(uint32_t now_ms) {
+  if (verdict_ != Verdict::CHECKING) {
+    return verdict_;
+  }
+
+  bool healthy = true;
+  for (size_t i = 0; i < check_count_; i++) {
+    Check &check = checks_[i];
+    if (!check.passed) {
+      check.passed = check.fn(check.arg);
+      healthy = healthy && check.passed;
+    }
+  }
+
+  if (healthy) {
+    record_.state = BootState::CONFIRMED;
+    store_.save(record_);
+    verdict_ = Verdict::CONFIRMED;
+  } else if (now_ms - start_ms_ >= deadline_ms_) {
+    return rollback();
+  }
+  return verdict_;
+}
+
+const char *Update::HealthMonitor::failing() const {
+  for (size_t i = 0; i < check_count_; i++) {
+    if (!checks_[i].passed) {
+      return checks_[i].name;
+    }
+  }
+  return nullptr;
+}
+
+Update::Verdict Update::HealthMonitor::rollback() {
+  /* If this fails the image stays pending, the next boot counts another
+   * attempt and tries again */
+  if (control_.set_boot(record_.previous) == ESP_OK) {
+    record_.state = BootState::ROLLED_BACK;
+    store_.save(record_);
+  }
+  verdict_ = Verdict::ROLLED_BACK;
+  control_.restart();
+  return verdict_;
+}
@@ -0,0 +1,169 @@
+/**
+ * Post-update health checks with automatic rollback.
+ *
+ * Before an update switches the boot partition it marks the new image
+ * pending. On each boot of a pending image the attempt counter in the
+ * BootRecord is incremented before anything else runs, so boots that crash
+ * or trip the watchdog still count. The image is confirmed once every
+ * registered check has passed within the deadline. It is rolled back to the
+ * previous partition when the deadline passes, or when it has been booted
+ * OTA_HEALTH_MAX_ATTEMPTS times without being confirmed.
+ *
+ * The state machine is platform independent, the device binds it to NVS
+ * and esp_ota_* in Update.cpp.
+ */
+
+#ifndef __OTA_HEALTH_H__
+#define __OTA_HEALTH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+#define OTA_HEALTH_MAX_CHECKS 8
+
+/* Boots of an unconfirmed image before it is rolled back */
+#define OTA_HEALTH_MAX_ATTEMPTS 3
+
+/* Time a new image has to pass every check */
+#define OTA_HEALTH_DEADLINE_MS 60000
+
+/* Bump when the layout of Update::BootRecord changes */
+#define OTA_BOOT_RECORD_VERSION 1
+
+namespace Update {
+
+enum class BootState : uint8_t {
+  NONE,        /*!< No update since the record was cleared */
+  PENDING,     /*!< New image not confirmed yet */
+  CONFIRMED,   /*!< New image passed its checks */
+  ROLLED_BACK, /*!< New image failed, the previous one boots */
+};
+
+/* Persisted as one blob */
+struct BootRecord {
+  uint8_t version;
+  BootState state;
+  uint8_t attempts;   /*!< Boots of the pending image so far */
+  uint8_t reserved;
+  uint32_t partition; /*!< Address of the new image */
+  uint32_t previous;  /*!< Address of the image to roll back to */
+};
+
+/**
+ * Persists the BootRecord, e.g. in NVS
+ */
+class BootStore {
+ public:
+  virtual ~BootStore() {}
+
+  /**
+   * @return
+   *  - ESP_OK              'record' was loaded
+   *  - ESP_ERR_NOT_FOUND   Nothing saved (any error is treated this way)
+   */
+  virtual esp_err_t load(BootRecord &record) = 0;
+  virtual esp_err_t save(const BootRecord &record) = 0;
+};
+
+/**
+ * Boot partition control, esp_ota_* on the device
+ */
+class BootControl {
+ public:
+  virtual ~BootControl() {}
+
+  /* Address of the running partition */
+  virtual uint32_t running() = 0;
+  virtual esp_err_t set_boot(uint32_t partition) = 0;
+  virtual void restart() = 0;
+};
+
+/**
+ * @brief A health check, polled until it first returns true
+ *
+ * @param arg  As given to HealthMonitor::add_check()
+ */
+typedef bool (*HealthCheck)(void *arg);
+
+enum class Verdict : uint8_t {
+  IDLE,        /*!< The running image is not pending */
+  CHECKING,    /*!< Waiting for checks to pass */
+  CONFIRMED,   /*!< All checks passed */
+  ROLLED_BACK, /*!< The previous image was restored */
+};
+
+class HealthMonitor {
+ public:
+  HealthMonitor(BootStore &store, BootControl &control);
+
+  /**
+   * @brief Registers a check, before boot()
+   *
+   * @param name  For logs, must outlive the monitor
+   *
+   * @return
+   *  - ESP_OK
+   *  - ESP_ERR_NO_MEM  More than OTA_HEALTH_MAX_CHECKS checks
+   */
+  esp_err_t add_check(const char *name, HealthCheck check, void *arg);
+
+  /**
+   * @brief Marks a newly written image pending, before it is made the boot
+   * partition
+   *
+   * @param partition Address of the new image
+   * @param previous  Address of the running image, to roll back to
+   */
+  esp_err_t mark_pending(uint32_t partition, uint32_t previous);
+
+  /**
+   * @brief Called once at startup. Counts a boot of a pending image, and
+   * rolls it back if it has had too many.
+   *
+   * @param now_ms       Current time
+   * @param deadline_ms  Time from now for the checks to pass
+   *
+   * @return CHECKING if poll() should be called until it returns otherwise
+   */
+  Verdict boot(uint32_t now_ms, uint32_t deadline_ms = OTA_HEALTH_DEADLINE_MS);
+
+  /**
+   * @brief Runs the checks that have not passed yet. Confirms the image
+   * once all have passed, rolls it back once the deadline has passed.
+   */
+  Verdict poll(uint32_t now_ms);
+
+  Verdict verdict() const { return verdict_; }
+  const BootRecord &record() const { return record_; }
+
+  /* Name of a check that has not passed, nullptr if all have */
+  const char *failing() const;
+
+ private:
+  struct Check {
+    const char *name;
+    HealthCheck fn;
+    void *arg;
+    bool passed;
+  };
+
+  HealthMonitor(const HealthMonitor &) = delete;
+  HealthMonitor &operator=(const HealthMonitor &) = delete;
+
+  Verdict rollback();
+
+  BootStore &store_;
+  BootControl &control_;
+  BootRecord record_;
+  Verdict verdict_;
+  uint32_t start_ms_;
+  uint32_t deadline_ms_;
+
+  Check checks_[OTA_HEALTH_MAX_CHECKS];
+  size_t check_count_;
+};
+
+}  // namespace Update
+
+#endif
@@ -0,0 +1,75 @@
+#include "Manifest.h"
+#include <string.h>
+
+static void put_le32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+void Update::sign_manifest(const uint8_t *digest, uint32_t size,
+                           const uint8_t *seed, uint8_t *manifest) {
+  memcpy(manifest, MANIFEST_MAGIC, 4);
+  put_le32(manifest + 4, size);
+  memcpy(manifest + 8, digest, SHA256_DIGEST_SIZE);
+  Ed25519::sign(seed, manifest, MANIFEST_BODY_SIZE,
+                manifest + MANIFEST_BODY_SIZE);
+}
+
+Update::ImageVerifier::ImageVerifier() { reset(); }
+
+void Update::ImageVerifier::reset() {
+  hash_.reset();
+  size_ = 0;
+  has_manifest_ = false;
+  image_size_ = 0;
+  memset(image_digest_, 0, sizeof(image_digest_));
+}
+
+void Update::ImageVerifier::update(const uint8_t *data, size_t size) {
+  hash_.update(data, size);
+  size_ += size;
+}
+
+esp_err_t Update::ImageVerifier::set_manifest(const uint8_t *data,
+                                              size_t size,
+                                              const uint8_t *public_key) {
+  has_manifest_ = false;
+  if (size != MANIFEST_SIZE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (memcmp(data, MANIFEST_MAGIC, 4) != 0) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+  if (public_key != nullptr &&
+      !Ed25519::verify(data + MANIFEST_BODY_SIZE, data, MANIFEST_BODY_SIZE,
+                       public_key)) {
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  image_size_ = (uint32_t)data[4] | (uint32_t)data[5] << 8 |
+                (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+  memcpy(image_digest_, data + 8, SHA256_DIGEST_SIZE);
+  has_manifest_ = true;
+  return ESP_OK;
+}
+
+esp_err_t Update::ImageVerifier::verify() const {
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256 copy(hash_);
+  copy.finish(digest);
+  return verify(digest, size_);
+}
+
+esp_err_t Update::ImageVerifier::verify(const uint8_t *digest,
+                                        uint32_t size) const {
+  if (!has_manifest_) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (size != image_size_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return memcmp(digest, image_digest_, SHA256_DIGEST_SIZE) == 0
+             ? ESP_OK
+             : ESP_ERR_INVALID_CRC;
+}
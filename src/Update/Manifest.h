@@ -0,0 +1,98 @@
+/**
+ * Signed manifests authenticating firmware images. The image is hashed as
+ * it is written, so checking it against the manifest needs no second pass
+ * over the partition.
+ *
+ * Manifest format, little endian, produced by tools/signimage:
+ *
+ *   "EUM1", u32 image_size, SHA-256 of the image,
+ *   Ed25519 signature of the preceding bytes
+ */
+
+#ifndef __OTA_MANIFEST_H__
+#define __OTA_MANIFEST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Ed25519.h"
+#include "Crypto/Sha256.h"
+#include "Port/Port.h"
+
+#define MANIFEST_MAGIC "EUM1"
+#define MANIFEST_BODY_SIZE (4 + 4 + SHA256_DIGEST_SIZE)
+#define MANIFEST_SIZE (MANIFEST_BODY_SIZE + ED25519_SIGNATURE_SIZE)
+
+namespace Update {
+
+/**
+ * @brief Makes a manifest for an image
+ *
+ * @param digest    SHA-256 of the image
+ * @param size      Size of the image
+ * @param seed      Ed25519 secret key
+ * @param manifest  Receives MANIFEST_SIZE bytes
+ */
+void sign_manifest(const uint8_t *digest, uint32_t size, const uint8_t *seed,
+                   uint8_t *manifest);
+
+/**
+ * Hashes an image as it is written and checks it against a manifest
+ */
+class ImageVerifier {
+ public:
+  ImageVerifier();
+
+  /**
+   * @brief Forgets the image and the manifest, for the next update
+   */
+  void reset();
+
+  /**
+   * @brief Hashes the next part of the image
+   */
+  void update(const uint8_t *data, size_t size);
+
+  /**
+   * @brief Checks the signature of a manifest and keeps it for verify()
+   *
+   * @param public_key  ED25519_PUBLIC_KEY_SIZE bytes of the trusted key,
+   *                    nullptr to skip the signature for unsigned updates
+   *
+   * @return
+   *  - ESP_OK                    The manifest is authentic
+   *  - ESP_ERR_INVALID_SIZE      Not MANIFEST_SIZE bytes
+   *  - ESP_ERR_INVALID_VERSION   Not a manifest
+   *  - ESP_ERR_INVALID_CRC       Bad signature
+   */
+  esp_err_t set_manifest(const uint8_t *data, size_t size,
+                         const uint8_t *public_key);
+
+  /**
+   * @brief Checks everything passed to update() against the manifest
+   *
+   * @return
+   *  - ESP_OK                    The image is the one the manifest describes
+   *  - ESP_ERR_NOT_FOUND         No manifest was set
+   *  - ESP_ERR_INVALID_SIZE      The image size differs
+   *  - ESP_ERR_INVALID_CRC       The image digest differs
+   */
+  esp_err_t verify() const;
+
+  /**
+   * @brief As verify(), for an image hashed elsewhere
+   */
+  esp_err_t verify(const uint8_t *digest, uint32_t size) const;
+
+  uint32_t size() const { return size_; }
+
+ private:
+  Sha256 hash_;
+  uint32_t size_;
+  bool has_manifest_;
+  uint32_t image_size_;
+  uint8_t image_digest_[SHA256_DIGEST_SIZE];
+};
+
+}  // namespace Update
+
+#endif
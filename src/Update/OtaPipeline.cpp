@@ -0,0 +1,105 @@
+#include "OtaPipeline.h"
+#include <string.h>
+
+Update::Pipeline::Pipeline() : abort_(false), source_(nullptr) {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+esp_err_t Update::Pipeline::run(ChunkSource &source, ChunkSink &sink,
+                                size_t buffer_count) {
+  if (buffer_count == 0 || buffer_count > OTA_BUFFER_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(&stats_, 0, sizeof(stats_));
+  const uint64_t start = Port::micros();
+  Chunk chunk;
+  uint8_t index;
+
+  /* Drain anything left over from a previous run */
+  while (filled_.pop(chunk)) {
+  }
+  while (free_.pop(index)) {
+  }
+  for (size_t i = 0; i < buffer_count; i++) {
+    free_.push(i);
+  }
+  abort_ = false;
+  source_ = &source;
+
+  Port::Task receiver;
+  esp_err_t ret = receiver.start(receive_task, this, "ota_recv",
+                                 OTA_RECV_TASK_STACK_SIZE,
+                                 OTA_RECV_TASK_PRIORITY);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  for (;;) {
+    while (!filled_.pop(chunk)) {
+      stats_.write_stalls++;
+      filled_signal_.take();
+    }
+    if (chunk.len <= 0) {
+      ret = chunk.len == 0 ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+      break;
+    }
+
+    ret = sink.write(pool_[chunk.index], chunk.len);
+    if (ret != ESP_OK) {
+      break;
+    }
+    stats_.bytes += chunk.len;
+    stats_.chunks++;
+
+    free_.push(chunk.index);
+    free_signal_.give();
+  }
+
+  /* Unblock the receiver if it is waiting for a buffer */
+  abort_ = true;
+  free_signal_.give();
+  receiver.join();
+
+  stats_.elapsed_us = Port::micros() - start;
+  return ret;
+}
+
+void Update::Pipeline::receive_task(void *self) {
+  static_cast<Pipeline *>(self)->receive();
+}
+
+void Update::Pipeline::receive() {
+  int n = 1;
+  while (n > 0) {
+    uint8_t index;
+    while (!free_.pop(index)) {
+      if (abort_) {
+        return;
+      }
+      stats_.recv_stalls++;
+      free_signal_.take();
+    }
+    if (abort_) {
+      return;
+    }
+
+    /* Fill whole buffers so the sink sees sector sized writes */
+    size_t filled = 0;
+    while (filled < OTA_BUFFER_SIZE) {
+      n = source_->read(pool_[index] + filled, OTA_BUFFER_SIZE - filled);
+      if (n <= 0) {
+        break;
+      }
+      filled += n;
+    }
+
+    if (filled > 0) {
+      filled_.push(Chunk{index, static_cast<int32_t>(filled)});
+    }
+    if (n <= 0) {
+      filled_.push(Chunk{0, n < 0 ? -1 : 0});
+    }
+    filled_signal_.give();
+  }
+}
@@ -0,0 +1,142 @@
+/**
+ * Double-buffered streaming of a firmware image from a source (the HTTP
+ * response) to a sink (the update partition).
+ *
+ * A receive task fills buffers from a fixed pool while the calling task
+ * writes previously filled buffers, so network receive and flash erase/write
+ * overlap instead of taking turns. Filled and free buffers are handed between
+ * the two tasks through SPSC rings, and the pool is allocated once with the
+ * Pipeline, so nothing is allocated per chunk.
+ */
+
+#ifndef __OTA_PIPELINE_H__
+#define __OTA_PIPELINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "Port/Port.h"
+#include "Ring/SpscRing.h"
+
+/* Size of each pooled buffer, one flash sector */
+#define OTA_BUFFER_SIZE 4096
+
+/* Number of pooled buffers, must be a power of two */
+#define OTA_BUFFER_COUNT 4
+
+#define OTA_RECV_TASK_STACK_SIZE 4096
+#define OTA_RECV_TASK_PRIORITY 5
+
+namespace Update {
+
+/**
+ * Produces image bytes, e.g. the body of an HTTP response
+ */
+class ChunkSource {
+ public:
+  virtual ~ChunkSource() {}
+
+  /**
+   * @brief Reads up to 'size' bytes, blocking until some are available
+   *
+   * @return Number of bytes read, 0 at the end of the image, negative on error
+   */
+  virtual int read(uint8_t *dest, size_t size) = 0;
+};
+
+/**
+ * Consumes image bytes, e.g. the OTA update partition
+ */
+class ChunkSink {
+ public:
+  virtual ~ChunkSink() {}
+
+  /**
+   * @brief Writes 'size' bytes following the previously written data
+   *
+   * @return esp_err_t
+   */
+  virtual esp_err_t write(const uint8_t *data, size_t size) = 0;
+};
+
+/**
+ * A sink that decodes the stream into the image on the way, e.g. a patch or
+ * a compressed image, passing the result to another sink
+ */
+class ImageDecoder : public ChunkSink {
+ public:
+  /**
+   * @brief Called after the last write, checks the decoded image
+   *
+   * @return ESP_OK if the whole image was decoded intact
+   */
+  virtual esp_err_t finish() = 0;
+
+  /* Size of the decoded image, known once the header was consumed */
+  virtual uint32_t image_size() const = 0;
+};
+
+/* Counters collected during Pipeline::run() */
+struct PipelineStats {
+  size_t bytes;          /*!< Bytes handed to the sink */
+  uint32_t chunks;       /*!< Buffers handed to the sink */
+  uint64_t elapsed_us;   /*!< Wall time of run() */
+  uint32_t write_stalls; /*!< Times the writer waited on the network */
+  uint32_t recv_stalls;  /*!< Times the receiver waited on the writer */
+};
+
+class Pipeline {
+ public:
+  Pipeline();
+
+  /**
+   * @brief Streams 'source' into 'sink' until the source ends or fails
+   *
+   * The sink is written from the calling task, the source is read from a
+   * background task that lives for the duration of the call.
+   *
+   * @param source        Where the image is read from
+   * @param sink          Where the image is written to
+   * @param buffer_count  Buffers to use, 1 to OTA_BUFFER_COUNT. With one
+   *                      buffer receive and write take turns.
+   *
+   * @return
+   *  - ESP_OK                The whole source was written
+   *  - ESP_ERR_INVALID_ARG   Bad buffer count
+   *  - ESP_ERR_INVALID_RESPONSE  The source failed
+   *  - Any error returned by the sink
+   */
+  esp_err_t run(ChunkSource &source, ChunkSink &sink,
+                size_t buffer_count = OTA_BUFFER_COUNT);
+
+  const PipelineStats &stats() const { return stats_; }
+
+ private:
+  /* A filled buffer. 'len' of 0 marks the end, negative a source error */
+  struct Chunk {
+    uint8_t index;
+    int32_t len;
+  };
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  static void receive_task(void *self);
+  void receive();
+
+  uint8_t pool_[OTA_BUFFER_COUNT][OTA_BUFFER_SIZE];
+
+  /* Room for every buffer plus the end marker */
+  SpscRing<Chunk, OTA_BUFFER_COUNT * 2> filled_;
+  SpscRing<uint8_t, OTA_BUFFER_COUNT> free_;
+  Port::Signal filled_signal_;
+  Port::Signal free_signal_;
+  std::atomic<bool> abort_;
+
+  ChunkSource *source_;
+  PipelineStats stats_;
+};
+
+}  // namespace Update
+
+#endif
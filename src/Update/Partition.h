@@ -0,0 +1,41 @@
+/**
+ * Random access to a flash partition, with the NOR flash rule that a region
+ * must be erased before it is written.
+ */
+
+#ifndef __OTA_PARTITION_H__
+#define __OTA_PARTITION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+/* Erase granularity of the ESP32 flash */
+#define OTA_SECTOR_SIZE 4096
+
+namespace Update {
+
+class Partition {
+ public:
+  virtual ~Partition() {}
+
+  virtual esp_err_t read(size_t offset, void *dest, size_t size) = 0;
+  virtual esp_err_t write(size_t offset, const void *src, size_t size) = 0;
+
+  /**
+   * @brief Erases whole sectors
+   *
+   * @param offset  Sector aligned start
+   * @param size    Multiple of OTA_SECTOR_SIZE
+   */
+  virtual esp_err_t erase(size_t offset, size_t size) = 0;
+
+  virtual size_t size() const = 0;
+
+  /* Identifies the partition, e.g. its flash address */
+  virtual uint32_t id() const = 0;
+};
+
+}  // namespace Update
+
+#endif
@@ -0,0 +1,550 @@
+#include "Peer.h"
+#include <string.h>
+
+static void put_le32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+static void put_le16(uint8_t *p, uint16_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint16_t get_le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+/* Reads the body of a chunk response */
+class SocketSource : public Update::ChunkSource {
+ public:
+  explicit SocketSource(int fd) : fd_(fd) {}
+  int read(uint8_t *dest, size_t size) override {
+    return recv(fd_, dest, size, 0);
+  }
+
+ private:
+  int fd_;
+};
+
+void Update::ChunkMap::clear() { memset(bits_, 0, sizeof(bits_)); }
+
+void Update::ChunkMap::fill(uint32_t count) {
+  clear();
+  for (uint32_t i = 0; i < count; i++) {
+    set(i);
+  }
+}
+
+uint32_t Update::ChunkMap::count() const {
+  uint32_t count = 0;
+  for (size_t i = 0; i < sizeof(bits_); i++) {
+    for (uint8_t byte = bits_[i]; byte; byte &= byte - 1) {
+      count++;
+    }
+  }
+  return count;
+}
+
+Update::PeerNode::PeerNode(Partition &partition, const PeerOptions &options)
+    : partition_(partition),
+      options_(options),
+      running_(false),
+      image_size_(0),
+      chunk_count_(0),
+      table_(nullptr),
+      server_(nullptr),
+      server_busy_(false),
+      server_failures_(0),
+      fetch_start_us_(0),
+      progress_us_(0),
+      fetch_error_(ESP_OK),
+      peer_count_(0),
+      udp_fd_(-1),
+      listen_fd_(-1),
+      tcp_port_(0) {
+  memset(digest_, 0, sizeof(digest_));
+  memset(&stats_, 0, sizeof(stats_));
+  /* Tells our own beacons apart when the group loops back */
+  nonce_ = (uint32_t)(Port::micros() * 2654435761u) ^
+           (uint32_t)(uintptr_t)this;
+  seed_ = nonce_ | 1;
+  for (size_t i = 0; i < PEER_WORKERS; i++) {
+    workers_[i].owner = this;
+  }
+}
+
+Update::PeerNode::~PeerNode() { stop(); }
+
+esp_err_t Update::PeerNode::seed(const uint8_t *digest, uint32_t image_size) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (image_size == 0 || chunk_count(image_size) > PEER_MAX_CHUNKS) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(digest_, digest, SHA256_DIGEST_SIZE);
+  image_size_ = image_size;
+  chunk_count_ = chunk_count(image_size);
+  have_.fill(chunk_count_);
+  return start();
+}
+
+esp_err_t Update::PeerNode::fetch(const ChunkTable &table,
+                                  RangeSource *server) {
+  if (running_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (table.image_size() == 0 || table.image_size() > partition_.size()) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(digest_, table.image_digest(), SHA256_DIGEST_SIZE);
+  image_size_ = table.image_size();
+  chunk_count_ = table.chunk_count();
+  have_.clear();
+  claimed_.clear();
+  table_ = &table;
+  server_ = server;
+  server_busy_ = false;
+  server_failures_ = 0;
+  fetch_error_ = ESP_OK;
+
+  esp_err_t err = start();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  fetch_start_us_ = progress_us_ = Port::micros();
+  for (size_t i = 0; i < PEER_WORKERS; i++) {
+    err = workers_[i].task.start(worker_task, &workers_[i], "peer_fetch",
+                                 PEER_TASK_STACK_SIZE, PEER_TASK_PRIORITY);
+    if (err != ESP_OK) {
+      Port::Lock lock(lock_);
+      fetch_error_ = err;
+      break;
+    }
+  }
+  for (size_t i = 0; i < PEER_WORKERS; i++) {
+    workers_[i].task.join();
+  }
+
+  Port::Lock lock(lock_);
+  server_ = nullptr;
+  if (have_.count() == chunk_count_) {
+    return ESP_OK;
+  }
+  return fetch_error_ != ESP_OK ? fetch_error_ : ESP_ERR_INVALID_STATE;
+}
+
+void Update::PeerNode::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  beacon_runner_.join();
+  server_runner_.join();
+  Port::close_socket(udp_fd_);
+  Port::close_socket(listen_fd_);
+  udp_fd_ = listen_fd_ = -1;
+}
+
+Update::PeerStats Update::PeerNode::stats() {
+  Port::Lock lock(lock_);
+  return stats_;
+}
+
+esp_err_t Update::PeerNode::start() {
+  udp_fd_ = Port::udp_multicast(options_.group, options_.port,
+                                options_.interface);
+  tcp_port_ = 0;
+  listen_fd_ = Port::tcp_listen(PORT_IPV4_ANY, &tcp_port_, 4);
+  if (udp_fd_ < 0 || listen_fd_ < 0) {
+    Port::close_socket(udp_fd_);
+    Port::close_socket(listen_fd_);
+    udp_fd_ = listen_fd_ = -1;
+    return ESP_FAIL;
+  }
+
+  /* Both tasks wake regularly to notice stop() */
+  uint32_t poll_ms = options_.beacon_interval_ms / 4;
+  Port::set_timeout(udp_fd_, poll_ms > 10 ? poll_ms : 10);
+  Port::set_timeout(listen_fd_, 200);
+
+  running_ = true;
+  esp_err_t err = beacon_runner_.start(beacon_task, this, "peer_beacon",
+                                PEER_TASK_STACK_SIZE, PEER_TASK_PRIORITY);
+  if (err == ESP_OK) {
+    err = server_runner_.start(server_task, this, "peer_server",
+                        PEER_TASK_STACK_SIZE, PEER_TASK_PRIORITY);
+  }
+  if (err != ESP_OK) {
+    stop();
+  }
+  return err;
+}
+
+void Update::PeerNode::beacon_task(void *self) {
+  PeerNode *node = static_cast<PeerNode *>(self);
+  uint8_t datagram[PEER_BEACON_SIZE + 1];
+  uint64_t next_us = 0;
+  while (node->running_) {
+    uint64_t now = Port::micros();
+    if (now >= next_us) {
+      node->send_beacon(node->udp_fd_);
+      next_us = now + node->options_.beacon_interval_ms * 1000ull;
+    }
+    uint32_t addr;
+    int n = Port::udp_receive(node->udp_fd_, datagram, sizeof(datagram),
+                              &addr);
+    if (n > 0) {
+      node->receive_beacon(datagram, n, addr);
+    }
+  }
+}
+
+void Update::PeerNode::server_task(void *self) {
+  PeerNode *node = static_cast<PeerNode *>(self);
+  while (node->running_) {
+    int fd = accept(node->listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    Port::set_timeout(fd, PEER_TIMEOUT_MS);
+    node->serve(fd, node->serve_buffer_);
+    Port::close_socket(fd);
+  }
+}
+
+void Update::PeerNode::worker_task(void *worker) {
+  Worker *self = static_cast<Worker *>(worker);
+  self->owner->work(self->buffer);
+}
+
+void Update::PeerNode::send_beacon(int fd) {
+  uint8_t beacon[PEER_BEACON_SIZE];
+  memcpy(beacon, PEER_BEACON_MAGIC, 4);
+  put_le32(beacon + 4, nonce_);
+  put_le16(beacon + 8, tcp_port_);
+  put_le16(beacon + 10, chunk_count_);
+  memcpy(beacon + 12, digest_, SHA256_DIGEST_SIZE);
+  {
+    Port::Lock lock(lock_);
+    memcpy(beacon + 12 + SHA256_DIGEST_SIZE, have_.data(),
+           PEER_MAX_CHUNKS / 8);
+  }
+  Port::udp_send(fd, options_.group, options_.port, beacon, sizeof(beacon));
+}
+
+void Update::PeerNode::receive_beacon(const uint8_t *data, size_t size,
+                                      uint32_t addr) {
+  if (size != PEER_BEACON_SIZE || memcmp(data, PEER_BEACON_MAGIC, 4) != 0 ||
+      get_le32(data + 4) == nonce_ || get_le16(data + 10) != chunk_count_ ||
+      memcmp(data + 12, digest_, SHA256_DIGEST_SIZE) != 0) {
+    return;
+  }
+  uint16_t port = get_le16(data + 8);
+
+  Port::Lock lock(lock_);
+  uint64_t now = Port::micros();
+  Peer *peer = nullptr;
+  for (uint32_t i = 0; i < peer_count_ && peer == nullptr; i++) {
+    if (peers_[i].addr == addr && peers_[i].port == port) {
+      peer = &peers_[i];
+    }
+  }
+  if (peer == nullptr) {
+    /* A new peer, in a free slot or one of a peer that went away */
+    for (uint32_t i = 0; i < peer_count_ && peer == nullptr; i++) {
+      if (!peers_[i].busy && !live(peers_[i], now)) {
+        peer = &peers_[i];
+      }
+    }
+    if (peer == nullptr && peer_count_ < PEER_MAX_PEERS) {
+      peer = &peers_[peer_count_++];
+    }
+    if (peer == nullptr) {
+      return;
+    }
+    peer->addr = addr;
+    peer->port = port;
+    peer->failures = 0;
+    peer->busy = false;
+    stats_.peers++;
+  }
+  peer->seen_us = now;
+  memcpy(peer->have.data(), data + 12 + SHA256_DIGEST_SIZE,
+         PEER_MAX_CHUNKS / 8);
+}
+
+void Update::PeerNode::serve(int fd, uint8_t *buffer) {
+  uint8_t request[PEER_REQUEST_SIZE];
+  if (!Port::recv_all(fd, request, sizeof(request)) ||
+      memcmp(request, PEER_REQUEST_MAGIC, 4) != 0) {
+    return;
+  }
+  uint32_t chunk = get_le32(request + 4 + SHA256_DIGEST_SIZE);
+  uint8_t status;
+  {
+    Port::Lock lock(lock_);
+    status = memcmp(request + 4, digest_, SHA256_DIGEST_SIZE) == 0 &&
+                     chunk < chunk_count_ && have_.test(chunk)
+                 ? 0
+                 : 1;
+  }
+  if (!Port::send_all(fd, &status, 1) || status != 0) {
+    return;
+  }
+
+  uint32_t offset = chunk * PEER_CHUNK_SIZE;
+  uint32_t length = image_size_ - offset < PEER_CHUNK_SIZE
+                        ? image_size_ - offset
+                        : PEER_CHUNK_SIZE;
+  uint64_t start = Port::micros();
+  for (uint32_t sent = 0; sent < length;) {
+    uint32_t n = length - sent < OTA_BUFFER_SIZE ? length - sent
+                                                 : OTA_BUFFER_SIZE;
+    esp_err_t err;
+    {
+      Port::Lock lock(io_);
+      err = partition_.read(offset + sent, buffer, n);
+    }
+    if (err != ESP_OK || !Port::send_all(fd, buffer, n)) {
+      return;
+    }
+    sent += n;
+
+    if (options_.serve_bytes_per_s) {
+      uint64_t due = start + sent * 1000000ull / options_.serve_bytes_per_s;
+      uint64_t now = Port::micros();
+      if (due > now) {
+        Port::sleep_ms((due - now) / 1000);
+      }
+    }
+  }
+  Port::Lock lock(lock_);
+  stats_.served++;
+}
+
+void Update::PeerNode::work(uint8_t *buffer) {
+  while (running_) {
+    uint32_t chunk;
+    int peer;
+    uint32_t addr = 0;
+    uint16_t port = 0;
+    bool picked;
+    {
+      Port::Lock lock(lock_);
+      if (fetch_error_ != ESP_OK || have_.count() == chunk_count_) {
+        return;
+      }
+      picked = pick(&chunk, &peer);
+      if (picked && peer >= 0) {
+        addr = peers_[peer].addr;
+        port = peers_[peer].port;
+      } else if (!picked && server_ == nullptr &&
+                 Port::micros() - progress_us_ > PEER_TIMEOUT_MS * 1000ull) {
+        fetch_error_ = ESP_ERR_TIMEOUT;
+        return;
+      }
+    }
+    if (!picked) {
+      Port::sleep_ms(20);
+      continue;
+    }
+
+    esp_err_t err = peer >= 0 ? fetch_peer(addr, port, chunk, buffer)
+                              : fetch_server(chunk, buffer);
+
+    Port::Lock lock(lock_);
+    claimed_.reset(chunk);
+    if (peer >= 0) {
+      peers_[peer].busy = false;
+    } else {
+      server_busy_ = false;
+    }
+    if (err == ESP_OK) {
+      have_.set(chunk);
+      progress_us_ = Port::micros();
+      if (peer >= 0) {
+        stats_.peer_chunks++;
+      } else {
+        stats_.server_chunks++;
+      }
+      continue;
+    }
+
+    if (err == ESP_ERR_INVALID_CRC) {
+      stats_.rejected++;
+    }
+    if (peer >= 0) {
+      peers_[peer].failures++;
+    } else if (++server_failures_ >= PEER_MAX_SERVER_FAILURES) {
+      fetch_error_ = ESP_ERR_TIMEOUT;
+    }
+  }
+}
+
+bool Update::PeerNode::live(const Peer &peer, uint64_t now) const {
+  return now - peer.seen_us <=
+         options_.beacon_interval_ms * 1000ull * PEER_EXPIRY_INTERVALS;
+}
+
+bool Update::PeerNode::pick(uint32_t *chunk, int *peer) {
+  uint64_t now = Port::micros();
+  /* Hear every neighbour once before choosing, rather than draining the
+   * first to beacon */
+  if (now - fetch_start_us_ < options_.beacon_interval_ms * 1000ull) {
+    return false;
+  }
+  int best = -1;
+  int best_peer = -1;
+  uint32_t best_holders = UINT32_MAX;
+  int unheld = -1;
+
+  /* Random starting points spread nodes over different chunks and peers */
+  uint32_t first = random() % chunk_count_;
+  uint32_t first_peer = peer_count_ ? random() % peer_count_ : 0;
+  for (uint32_t k = 0; k < chunk_count_; k++) {
+    uint32_t i = (first + k) % chunk_count_;
+    if (have_.test(i) || claimed_.test(i)) {
+      continue;
+    }
+    uint32_t holders = 0;
+    int idle = -1;
+    for (uint32_t j = 0; j < peer_count_; j++) {
+      uint32_t p = (first_peer + j) % peer_count_;
+      const Peer &candidate = peers_[p];
+      if (!live(candidate, now) || candidate.failures >= PEER_MAX_FAILURES ||
+          !candidate.have.test(i)) {
+        continue;
+      }
+      holders++;
+      if (!candidate.busy && idle < 0) {
+        idle = p;
+      }
+    }
+    if (holders == 0) {
+      if (unheld < 0) {
+        unheld = i;
+      }
+    } else if (idle >= 0 && holders < best_holders) {
+      /* Rarest first, so chunks spread before their holders leave */
+      best = i;
+      best_peer = idle;
+      best_holders = holders;
+    }
+  }
+
+  if (best >= 0) {
+    claimed_.set(best);
+    peers_[best_peer].busy = true;
+    *chunk = best;
+    *peer = best_peer;
+    return true;
+  }
+
+  /* Only chunks no peer has go to the server, one at a time, after the
+   * first beacons had a chance to arrive */
+  if (unheld >= 0 && server_ != nullptr && !server_busy_ &&
+      now - fetch_start_us_ >= options_.discovery_ms * 1000ull) {
+    claimed_.set(unheld);
+    server_busy_ = true;
+    *chunk = unheld;
+    *peer = -1;
+    return true;
+  }
+  return false;
+}
+
+esp_err_t Update::PeerNode::fetch_peer(uint32_t addr, uint16_t port,
+                                       uint32_t chunk, uint8_t *buffer) {
+  int fd = Port::tcp_connect(addr, port, PEER_TIMEOUT_MS);
+  if (fd < 0) {
+    return ESP_FAIL;
+  }
+  uint8_t request[PEER_REQUEST_SIZE];
+  memcpy(request, PEER_REQUEST_MAGIC, 4);
+  memcpy(request + 4, digest_, SHA256_DIGEST_SIZE);
+  put_le32(request + 4 + SHA256_DIGEST_SIZE, chunk);
+
+  uint8_t status = 1;
+  esp_err_t err = ESP_ERR_NOT_FOUND;
+  if (Port::send_all(fd, request, sizeof(request)) &&
+      Port::recv_all(fd, &status, 1) && status == 0) {
+    SocketSource source(fd);
+    err = store(source, chunk, buffer);
+  }
+  Port::close_socket(fd);
+  return err;
+}
+
+esp_err_t Update::PeerNode::fetch_server(uint32_t chunk, uint8_t *buffer) {
+  uint32_t offset = chunk * PEER_CHUNK_SIZE;
+  uint32_t start, total;
+  esp_err_t err = server_->open(offset, &start, &total);
+  if (err == ESP_OK && start > offset) {
+    err = ESP_ERR_INVALID_RESPONSE;
+  }
+
+  /* A server ignoring the range starts from the beginning */
+  while (err == ESP_OK && start < offset) {
+    uint32_t skip = offset - start < OTA_BUFFER_SIZE ? offset - start
+                                                     : OTA_BUFFER_SIZE;
+    int n = server_->read(buffer, skip);
+    if (n <= 0) {
+      err = ESP_FAIL;
+    }
+    start += n;
+  }
+  if (err == ESP_OK) {
+    err = store(*server_, chunk, buffer);
+  }
+  server_->close();
+  return err;
+}
+
+esp_err_t Update::PeerNode::store(ChunkSource &source, uint32_t chunk,
+                                  uint8_t *buffer) {
+  uint32_t offset = chunk * PEER_CHUNK_SIZE;
+  uint32_t length = table_->chunk_length(chunk);
+  esp_err_t err;
+  {
+    /* Also clears what a corrupt earlier attempt left */
+    Port::Lock lock(io_);
+    err = partition_.erase(
+        offset, (length + OTA_SECTOR_SIZE - 1) & ~(OTA_SECTOR_SIZE - 1));
+  }
+
+  Sha256 hash;
+  for (uint32_t done = 0; err == ESP_OK && done < length;) {
+    uint32_t want = length - done < OTA_BUFFER_SIZE ? length - done
+                                                    : OTA_BUFFER_SIZE;
+    int n = source.read(buffer, want);
+    if (n <= 0) {
+      return ESP_FAIL;
+    }
+    hash.update(buffer, n);
+    Port::Lock lock(io_);
+    err = partition_.write(offset + done, buffer, n);
+    done += n;
+  }
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  hash.finish(digest);
+  return table_->check(chunk, digest) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+uint32_t Update::PeerNode::random() {
+  /* xorshift32, only spreads load so need not be strong */
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return seed_;
+}
@@ -0,0 +1,245 @@
+/**
+ * Peer-to-peer distribution of OTA images between devices on one LAN, so a
+ * fleet behind a slow uplink fetches most of an image from its neighbours
+ * rather than the update server.
+ *
+ * Images are split into PEER_CHUNK_SIZE chunks, each listed with its
+ * SHA-256 in a signed ChunkTable. Every node multicasts a beacon naming the
+ * image it has and which of its chunks it holds, and serves those chunks
+ * over TCP. A fetching node
+ * takes chunks from several peers at once, the rarest first, and fetches
+ * chunks no peer has from the update server. Every chunk is checked against
+ * the table before it is kept or served on, so a bad peer costs a retry and
+ * nothing else.
+ *
+ * Beacon, one UDP datagram to the group:
+ *
+ *   "EUB1", u32 nonce, u16 tcp port, u16 chunk count, SHA-256 of the image,
+ *   bitmap of the chunks held
+ *
+ * Chunk request, answered with a u8 status and, if 0, the chunk:
+ *
+ *   "EUR1", SHA-256 of the image, u32 chunk index
+ */
+
+#ifndef __OTA_PEER_H__
+#define __OTA_PEER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "ChunkTable.h"
+#include "Crypto/Sha256.h"
+#include "OtaPipeline.h"
+#include "Partition.h"
+#include "Port/Port.h"
+#include "Port/Socket.h"
+#include "Resumable.h"
+
+#define PEER_BEACON_MAGIC "EUB1"
+#define PEER_BEACON_SIZE \
+  (4 + 4 + 2 + 2 + SHA256_DIGEST_SIZE + PEER_MAX_CHUNKS / 8)
+#define PEER_REQUEST_MAGIC "EUR1"
+#define PEER_REQUEST_SIZE (4 + SHA256_DIGEST_SIZE + 4)
+
+/* Beacons go to this group and UDP port, 239.255.52.33 */
+#define PEER_GROUP PORT_IPV4(239, 255, 52, 33)
+#define PEER_PORT 5233
+
+#define PEER_BEACON_INTERVAL_MS 500
+
+/* Peers silent for this many beacon intervals are forgotten */
+#define PEER_EXPIRY_INTERVALS 4
+
+/* Wait for beacons this long before fetching from the server */
+#define PEER_DISCOVERY_MS 1500
+
+/* Chunks fetched at once, each worker holds one OTA_BUFFER_SIZE buffer */
+#define PEER_WORKERS 3
+
+#define PEER_MAX_PEERS 8
+
+/* Failed or corrupt chunks before a peer is no longer asked */
+#define PEER_MAX_FAILURES 3
+
+/* Failed server fetches before giving up */
+#define PEER_MAX_SERVER_FAILURES 5
+
+#define PEER_TIMEOUT_MS 5000
+
+#define PEER_TASK_STACK_SIZE 4096
+#define PEER_TASK_PRIORITY 4
+
+namespace Update {
+
+/**
+ * One bit per chunk
+ */
+class ChunkMap {
+ public:
+  ChunkMap() { clear(); }
+
+  void clear();
+  void fill(uint32_t count);
+  void set(uint32_t index) { bits_[index / 8] |= 1 << (index % 8); }
+  void reset(uint32_t index) { bits_[index / 8] &= ~(1 << (index % 8)); }
+  bool test(uint32_t index) const {
+    return bits_[index / 8] >> (index % 8) & 1;
+  }
+  uint32_t count() const;
+
+  uint8_t *data() { return bits_; }
+  const uint8_t *data() const { return bits_; }
+
+ private:
+  uint8_t bits_[PEER_MAX_CHUNKS / 8];
+};
+
+struct PeerOptions {
+  uint32_t group = PEER_GROUP;
+  uint16_t port = PEER_PORT;          /*!< UDP port of the beacons */
+  uint32_t interface = PORT_IPV4_ANY; /*!< Interface for the group */
+  uint32_t beacon_interval_ms = PEER_BEACON_INTERVAL_MS;
+  uint32_t discovery_ms = PEER_DISCOVERY_MS;
+  uint32_t serve_bytes_per_s = 0; /*!< Limits serving, 0 for no limit */
+};
+
+struct PeerStats {
+  uint32_t peer_chunks;   /*!< Chunks fetched from peers */
+  uint32_t server_chunks; /*!< Chunks fetched from the server */
+  uint32_t rejected;      /*!< Chunks that did not match the table */
+  uint32_t served;        /*!< Chunks sent to peers */
+  uint32_t peers;         /*!< Peers seen with the same image */
+};
+
+/**
+ * Shares one image on the LAN, and fetches it first if needed. Runs a
+ * beacon task and a server task until stop().
+ */
+class PeerNode {
+ public:
+  /**
+   * @param partition  Holds the image. Fetched chunks are written here.
+   */
+  explicit PeerNode(Partition &partition,
+                    const PeerOptions &options = PeerOptions());
+  ~PeerNode();
+
+  /**
+   * @brief Shares an image that is already complete and verified in the
+   * partition
+   *
+   * @param digest  SHA-256 of the image
+   *
+   * @return
+   *  - ESP_OK                The image is being shared
+   *  - ESP_ERR_INVALID_STATE Already running
+   *  - ESP_ERR_INVALID_SIZE  More than PEER_MAX_CHUNKS
+   *  - ESP_FAIL              The sockets could not be opened
+   */
+  esp_err_t seed(const uint8_t *digest, uint32_t image_size);
+
+  /**
+   * @brief Fetches the image of 'table' into the partition from peers,
+   * sharing chunks as they arrive. Keeps sharing after returning, until
+   * stop().
+   *
+   * @param table   Checked chunk table, must outlive the node
+   * @param server  Fallback for chunks no peer has, or nullptr to rely on
+   *                peers alone
+   *
+   * @return
+   *  - ESP_OK                Every chunk is in the partition and matches
+   *  - ESP_ERR_TIMEOUT       The server failed PEER_MAX_SERVER_FAILURES
+   *                          times, or without a server no peer had a chunk
+   *                          for PEER_TIMEOUT_MS
+   *  - ESP_ERR_INVALID_SIZE  The image does not fit the partition
+   *  - As seed()
+   */
+  esp_err_t fetch(const ChunkTable &table, RangeSource *server);
+
+  /**
+   * @brief Stops sharing and waits for the tasks to end
+   */
+  void stop();
+
+  /* TCP port chunks are served on */
+  uint16_t port() const { return tcp_port_; }
+
+  PeerStats stats();
+
+ private:
+  struct Peer {
+    uint32_t addr;
+    uint16_t port;
+    uint64_t seen_us;
+    uint8_t failures;
+    bool busy;
+    ChunkMap have;
+  };
+
+  struct Worker {
+    PeerNode *owner;
+    Port::Task task;
+    uint8_t buffer[OTA_BUFFER_SIZE];
+  };
+
+  PeerNode(const PeerNode &) = delete;
+  PeerNode &operator=(const PeerNode &) = delete;
+
+  esp_err_t start();
+  static void beacon_task(void *self);
+  static void server_task(void *self);
+  static void worker_task(void *worker);
+
+  void send_beacon(int fd);
+  void receive_beacon(const uint8_t *data, size_t size, uint32_t addr);
+  void serve(int fd, uint8_t *buffer);
+  void work(uint8_t *buffer);
+
+  /* Picks a chunk and its source under lock_, peer -1 for the server */
+  bool pick(uint32_t *chunk, int *peer);
+  bool live(const Peer &peer, uint64_t now) const;
+  esp_err_t fetch_peer(uint32_t addr, uint16_t port, uint32_t chunk,
+                       uint8_t *buffer);
+  esp_err_t fetch_server(uint32_t chunk, uint8_t *buffer);
+  esp_err_t store(ChunkSource &source, uint32_t chunk, uint8_t *buffer);
+  uint32_t random();
+
+  Partition &partition_;
+  PeerOptions options_;
+  Port::Mutex lock_;
+  Port::Mutex io_;
+  std::atomic<bool> running_;
+
+  uint8_t digest_[SHA256_DIGEST_SIZE];
+  uint32_t image_size_;
+  uint32_t chunk_count_;
+  ChunkMap have_;
+  ChunkMap claimed_;
+  const ChunkTable *table_;
+  RangeSource *server_;
+  bool server_busy_;
+  uint32_t server_failures_;
+  uint64_t fetch_start_us_;
+  uint64_t progress_us_;
+  esp_err_t fetch_error_;
+
+  Peer peers_[PEER_MAX_PEERS];
+  uint32_t peer_count_;
+  uint32_t nonce_;
+  uint32_t seed_;
+  PeerStats stats_;
+
+  int udp_fd_;
+  int listen_fd_;
+  uint16_t tcp_port_;
+  Port::Task beacon_runner_;
+  Port::Task server_runner_;
+  Worker workers_[PEER_WORKERS];
+  uint8_t serve_buffer_[OTA_BUFFER_SIZE];
+};
+
+}  // namespace Update
+
+#endif
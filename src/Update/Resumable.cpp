@@ -0,0 +1,191 @@
+#include "Resumable.h"
+#include <string.h>
+
+Update::ResumableDownload::ResumableDownload(RangeSource &source,
+                                             Partition &partition,
+                                             ProgressStore &store)
+    : source_(source),
+      partition_(partition),
+      store_(store),
+      sink_(*this),
+      offset_(0),
+      total_(0),
+      erased_end_(0),
+      write_error_(ESP_OK) {
+  memset(image_id_, 0, sizeof(image_id_));
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+esp_err_t Update::ResumableDownload::run(const char *image,
+                                         uint32_t max_attempts,
+                                         uint32_t retry_delay_ms) {
+  uint8_t id[SHA256_DIGEST_SIZE];
+  Sha256::digest(image, strlen(image), id);
+  memcpy(image_id_, id, sizeof(image_id_));
+  memset(&stats_, 0, sizeof(stats_));
+  restart();
+
+  if (restore()) {
+    stats_.resumed_from = offset_;
+  } else {
+    store_.clear();
+  }
+
+  uint32_t delay_ms = retry_delay_ms;
+  for (uint32_t attempt = 0; attempt < max_attempts; attempt++) {
+    if (attempt > 0) {
+      Port::sleep_ms(delay_ms);
+      delay_ms = delay_ms * 2 < OTA_RETRY_DELAY_MAX_MS
+                     ? delay_ms * 2
+                     : OTA_RETRY_DELAY_MAX_MS;
+    }
+
+    uint32_t start, total;
+    stats_.attempts++;
+    if (source_.open(offset_, &start, &total) != ESP_OK) {
+      continue;
+    }
+
+    /* A different size means the image changed on the server */
+    if (start != offset_ || (total_ != 0 && total != total_)) {
+      if (start != 0) {
+        source_.close();
+        continue;
+      }
+      restart();
+      store_.clear();
+    }
+    total_ = total;
+    if (total_ > partition_.size()) {
+      source_.close();
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint32_t before = offset_;
+    write_error_ = ESP_OK;
+    esp_err_t err = pipeline_.run(source_, sink_);
+    source_.close();
+    stats_.downloaded += offset_ - before;
+
+    if (write_error_ != ESP_OK) {
+      return write_error_;
+    }
+    if (err == ESP_OK && (total_ == 0 || offset_ == total_)) {
+      store_.clear();
+      return ESP_OK;
+    }
+    if (offset_ > before) {
+      delay_ms = retry_delay_ms;
+    }
+  }
+  return ESP_ERR_TIMEOUT;
+}
+
+void Update::ResumableDownload::digest(uint8_t *digest) const {
+  Sha256 copy(hash_);
+  copy.finish(digest);
+}
+
+/* Loads a checkpoint for this image and checks the partition against it */
+bool Update::ResumableDownload::restore() {
+  Progress progress;
+  if (store_.load(progress) != ESP_OK ||
+      progress.version != OTA_PROGRESS_VERSION ||
+      progress.partition != partition_.id() ||
+      memcmp(progress.image_id, image_id_, sizeof(image_id_)) != 0 ||
+      progress.offset % OTA_SECTOR_SIZE != 0 ||
+      progress.offset > partition_.size()) {
+    return false;
+  }
+
+  uint8_t buf[512];
+  for (uint32_t pos = 0; pos < progress.offset; pos += sizeof(buf)) {
+    size_t n = progress.offset - pos < sizeof(buf) ? progress.offset - pos
+                                                    : sizeof(buf);
+    if (partition_.read(pos, buf, n) != ESP_OK) {
+      restart();
+      return false;
+    }
+    hash_.update(buf, n);
+  }
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256 copy(hash_);
+  copy.finish(digest);
+  if (memcmp(digest, progress.digest, sizeof(digest)) != 0) {
+    restart();
+    return false;
+  }
+
+  offset_ = progress.offset;
+  total_ = progress.total;
+  erased_end_ = progress.offset;
+  return true;
+}
+
+void Update::ResumableDownload::restart() {
+  hash_.reset();
+  offset_ = 0;
+  total_ = 0;
+  erased_end_ = 0;
+}
+
+esp_err_t Update::ResumableDownload::checkpoint() {
+  Progress progress;
+  memset(&progress, 0, sizeof(progress));
+  progress.version = OTA_PROGRESS_VERSION;
+  progress.partition = partition_.id();
+  progress.total = total_;
+  progress.offset = offset_;
+  memcpy(progress.image_id, image_id_, sizeof(image_id_));
+  digest(progress.digest);
+  stats_.checkpoints++;
+  return store_.save(progress);
+}
+
+esp_err_t Update::ResumableDownload::Sink::write(const uint8_t *data,
+                                                 size_t size) {
+  ResumableDownload &d = owner_;
+  if (d.offset_ + size > d.partition_.size()) {
+    d.write_error_ = ESP_ERR_INVALID_SIZE;
+    return d.write_error_;
+  }
+
+  /* Erase whole sectors just ahead of the data */
+  uint32_t end = d.offset_ + size;
+  if (end > d.erased_end_) {
+    uint32_t erase_end =
+        (end + OTA_SECTOR_SIZE - 1) / OTA_SECTOR_SIZE * OTA_SECTOR_SIZE;
+    esp_err_t err =
+        d.partition_.erase(d.erased_end_, erase_end - d.erased_end_);
+    if (err != ESP_OK) {
+      d.write_error_ = err;
+      return err;
+    }
+    d.erased_end_ = erase_end;
+  }
+
+  esp_err_t err = d.partition_.write(d.offset_, data, size);
+  if (err != ESP_OK) {
+    d.write_error_ = err;
+    return err;
+  }
+
+  /* After a dropped connection writes are no longer sector aligned. Hash up
+   * to each interval boundary crossed and checkpoint there, so the record
+   * holds an aligned offset and the digest of exactly that much. Failing to
+   * checkpoint only costs progress after a reboot. */
+  while (size > 0) {
+    uint32_t to_boundary =
+        OTA_PROGRESS_INTERVAL - d.offset_ % OTA_PROGRESS_INTERVAL;
+    size_t n = size < to_boundary ? size : to_boundary;
+    d.hash_.update(data, n);
+    d.offset_ += n;
+    data += n;
+    size -= n;
+    if (d.offset_ % OTA_PROGRESS_INTERVAL == 0) {
+      d.checkpoint();
+    }
+  }
+  return ESP_OK;
+}
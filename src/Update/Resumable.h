@@ -0,0 +1,155 @@
+/**
+ * Resumable OTA downloads. The written offset and a SHA-256 of everything
+ * before it are checkpointed at sector boundaries. After a dropped
+ * connection the download continues from where it stopped with an HTTP
+ * Range request. After a reboot the checkpoint is loaded, the partially
+ * written partition is re-hashed and compared to the saved digest, and the
+ * download continues only if they match.
+ */
+
+#ifndef __OTA_RESUMABLE_H__
+#define __OTA_RESUMABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Crypto/Sha256.h"
+#include "OtaPipeline.h"
+#include "Partition.h"
+
+/* Bytes between checkpoints, a multiple of OTA_SECTOR_SIZE */
+#define OTA_PROGRESS_INTERVAL (64 * 1024)
+
+/* Bump when the layout of Update::Progress changes */
+#define OTA_PROGRESS_VERSION 1
+
+/* Backoff between attempts, doubled after each attempt without progress */
+#define OTA_RETRY_DELAY_MS 1000
+#define OTA_RETRY_DELAY_MAX_MS 30000
+
+#define OTA_IMAGE_ID_SIZE 8
+
+namespace Update {
+
+/* Checkpoint of an interrupted download, persisted as one blob */
+struct Progress {
+  uint32_t version;
+  uint32_t partition;                   /*!< Partition::id() being written */
+  uint32_t total;                       /*!< Image size, 0 if unknown */
+  uint32_t offset;                      /*!< Sector aligned bytes written */
+  uint8_t image_id[OTA_IMAGE_ID_SIZE];  /*!< Hash of the image URL */
+  uint8_t digest[SHA256_DIGEST_SIZE];   /*!< SHA-256 of [0, offset) */
+};
+
+/**
+ * Persists a single Progress record, e.g. in NVS
+ */
+class ProgressStore {
+ public:
+  virtual ~ProgressStore() {}
+
+  /**
+   * @return
+   *  - ESP_OK              'progress' was loaded
+   *  - ESP_ERR_NOT_FOUND   Nothing saved (any error is treated this way)
+   */
+  virtual esp_err_t load(Progress &progress) = 0;
+  virtual esp_err_t save(const Progress &progress) = 0;
+  virtual esp_err_t clear() = 0;
+};
+
+/**
+ * An image source that can start part way through, e.g. an HTTP server
+ * honouring Range requests
+ */
+class RangeSource : public ChunkSource {
+ public:
+  /**
+   * @brief Starts reading the image at 'offset'
+   *
+   * @param offset  Requested start
+   * @param start   Set to where the body actually starts. Servers ignoring
+   *                the range start at 0.
+   * @param total   Set to the full image size, 0 if unknown
+   *
+   * @return esp_err_t
+   */
+  virtual esp_err_t open(uint32_t offset, uint32_t *start,
+                         uint32_t *total) = 0;
+
+  virtual void close() = 0;
+};
+
+struct ResumableStats {
+  uint32_t attempts;     /*!< Connections opened */
+  uint32_t resumed_from; /*!< Offset restored from the checkpoint */
+  uint32_t downloaded;   /*!< Image bytes received over all attempts */
+  uint32_t checkpoints;  /*!< Progress records saved */
+};
+
+class ResumableDownload {
+ public:
+  ResumableDownload(RangeSource &source, Partition &partition,
+                    ProgressStore &store);
+
+  /**
+   * @brief Downloads the image into the partition, resuming any checkpoint
+   * saved for the same image and partition
+   *
+   * @param image           Identifies the image, normally its URL
+   * @param max_attempts    Connections to try before giving up
+   * @param retry_delay_ms  First backoff delay between attempts
+   *
+   * @return
+   *  - ESP_OK                The whole image is in the partition
+   *  - ESP_ERR_TIMEOUT       Gave up after 'max_attempts'
+   *  - ESP_ERR_INVALID_SIZE  The image does not fit the partition
+   *  - Any error writing the partition
+   */
+  esp_err_t run(const char *image, uint32_t max_attempts,
+                uint32_t retry_delay_ms = OTA_RETRY_DELAY_MS);
+
+  /**
+   * @brief Gets the SHA-256 of the downloaded image after run() succeeds
+   */
+  void digest(uint8_t *digest) const;
+
+  uint32_t size() const { return offset_; }
+
+  const ResumableStats &stats() const { return stats_; }
+
+ private:
+  /* Writes at the current offset, erasing ahead and checkpointing */
+  class Sink : public ChunkSink {
+   public:
+    explicit Sink(ResumableDownload &owner) : owner_(owner) {}
+    esp_err_t write(const uint8_t *data, size_t size) override;
+
+   private:
+    ResumableDownload &owner_;
+  };
+
+  ResumableDownload(const ResumableDownload &) = delete;
+  ResumableDownload &operator=(const ResumableDownload &) = delete;
+
+  bool restore();
+  void restart();
+  esp_err_t checkpoint();
+
+  RangeSource &source_;
+  Partition &partition_;
+  ProgressStore &store_;
+  Sink sink_;
+  Pipeline pipeline_;
+
+  Sha256 hash_;
+  uint8_t image_id_[OTA_IMAGE_ID_SIZE];
+  uint32_t offset_;
+  uint32_t total_;
+  uint32_t erased_end_;
+  esp_err_t write_error_;
+  ResumableStats stats_;
+};
+
+}  // namespace Update
+
+#endif
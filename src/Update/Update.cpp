@@ -0,0 +1,677 @@
+#include "Update.h"
+#include <new>
+#include <string>
+
+namespace Update {
+const char *const TAG = "OTA";
+
+/* set with esp_ota_begin(), free with esp_ota_end() */
+static esp_ota_handle_t _updateHandle;
+static const esp_partition_t *_pUpdatePartition = nullptr;
+static bool _began = false;
+
+/* Hashes what write_update() writes, checked against the manifest */
+static ImageVerifier _verifier;
+static const uint8_t *_signing_key = nullptr;
+static bool _allow_unsigned = false;
+
+static NvsBootStore _boot_store;
+static EspBootControl _boot_control;
+static HealthMonitor _health(_boot_store, _boot_control);
+
+/* The health task runs once per boot and is never joined, so it keeps its
+ * slot for the life of the image */
+static Port::Task _health_runner;
+
+static Metrics::Counter _downloads("ota.downloads");
+static Metrics::Counter _failures("ota.failures");
+static Metrics::Counter _bytes("ota.bytes");
+static Metrics::Histogram _throughput("ota.bytes_per_s");
+
+static uint32_t _now_ms() { return Port::micros() / 1000; }
+static void _health_task(void *arg);
+
+/* Counts a finished download, 'bytes' received in 'elapsed_us' */
+static void _record_download(esp_err_t err, uint32_t bytes,
+                             uint64_t elapsed_us) {
+  _bytes.add(bytes);
+  if (err != ESP_OK) {
+    _failures.add();
+    return;
+  }
+  _downloads.add();
+  if (elapsed_us > 0) {
+    _throughput.record(bytes * 1000000ull / elapsed_us);
+  }
+}
+
+/* Shares an image on the LAN, kept after download_peer() returns */
+struct PeerSession {
+  explicit PeerSession(const esp_partition_t *part)
+      : partition(part), node(partition) {}
+
+  EspPartition partition;
+  PeerNode node;
+  ChunkTable table;
+  uint8_t table_data[PEER_TABLE_MAX_SIZE];
+};
+static PeerSession *_peer = nullptr;
+}  // namespace Update
+
+void Update::set_signing_key(const uint8_t *public_key) {
+  _signing_key = public_key;
+}
+
+void Update::allow_unsigned(bool allow) { _allow_unsigned = allow; }
+
+/* Checks that the update partition is valid and ready to go */
+esp_err_t Update::begin() {
+  ESP_LOGI(TAG, "Beginning OTA update");
+
+  if (_began) {
+    ESP_LOGE(TAG, "Update already in progress");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  _pUpdatePartition = esp_ota_get_next_update_partition(NULL);
+
+  // Make sure partition is available
+  if (_pUpdatePartition == nullptr) {
+    ESP_LOGE(TAG, "Unable to get next update partition");
+    return ESP_ERR_OTA_BASE;
+  }
+
+  /* Check partitions */
+  _partition_check();
+
+  esp_err_t ret =
+      esp_ota_begin(_pUpdatePartition, OTA_SIZE_UNKNOWN, &_updateHandle);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) in esp_ota_begin", ret);
+    return ret;
+  }
+  _verifier.reset();
+  _began = true;
+  return ESP_OK;
+}
+
+esp_err_t Update::add_health_check(const char *name, HealthCheck check,
+                                   void *arg) {
+  return _health.add_check(name, check, arg);
+}
+
+Update::Verdict Update::start_health_check(uint32_t deadline_ms) {
+  Verdict verdict = _health.boot(_now_ms(), deadline_ms);
+  const BootRecord &record = _health.record();
+  if (verdict == Verdict::ROLLED_BACK) {
+    ESP_LOGE(TAG, "Update to partition 0x%08x failed, running 0x%08x",
+             record.partition, record.previous);
+  } else if (verdict == Verdict::CHECKING) {
+    ESP_LOGI(TAG, "Checking new image, boot %u of %u", record.attempts,
+             OTA_HEALTH_MAX_ATTEMPTS);
+    esp_err_t err = _health_runner.start(_health_task, nullptr, "ota_health",
+                                         OTA_HEALTH_TASK_STACK_SIZE,
+                                         OTA_HEALTH_TASK_PRIORITY);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Error (%i) starting health task", err);
+    }
+  }
+  return verdict;
+}
+
+bool Update::check_wifi(void *arg) {
+  tcpip_adapter_ip_info_t info;
+  return tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &info) == ESP_OK &&
+         info.ip.addr != 0;
+}
+
+bool Update::check_heap(void *min_free) {
+  return esp_get_free_heap_size() >= reinterpret_cast<uintptr_t>(min_free);
+}
+
+bool Update::check_backend(void *url) {
+  esp_http_client_config_t config = {};
+  config.url = static_cast<const char *>(url);
+  /* Well inside the task watchdog timeout */
+  config.timeout_ms = 2000;
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == nullptr) {
+    return false;
+  }
+  int status = 0;
+  if (esp_http_client_open(client, 0) == ESP_OK) {
+    esp_http_client_fetch_headers(client);
+    status = esp_http_client_get_status_code(client);
+    esp_http_client_close(client);
+  }
+  esp_http_client_cleanup(client);
+  return status >= 200 && status < 300;
+}
+
+esp_err_t Update::download_update(const char *url, const char *cert_pem) {
+  const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+  if (part == nullptr) {
+    ESP_LOGE(TAG, "Unable to get next update partition");
+    return ESP_ERR_OTA_BASE;
+  }
+  _partition_check();
+
+  ImageVerifier verifier;
+  esp_err_t err = _fetch_manifest(url, cert_pem, verifier);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  HttpRangeSource source(url, cert_pem);
+  EspPartition partition(part);
+  NvsProgressStore store;
+
+  /* Pool buffers live only for the duration of the download */
+  ResumableDownload *download =
+      new (std::nothrow) ResumableDownload(source, partition, store);
+  if (download == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  uint64_t start_us = Port::micros();
+  err = download->run(url, OTA_MAX_ATTEMPTS);
+  const ResumableStats &stats = download->stats();
+  _record_download(err, stats.downloaded, Port::micros() - start_us);
+  ESP_LOGI(TAG,
+           "Downloaded %u bytes over %u attempts (resumed from %u, %u "
+           "checkpoints)",
+           stats.downloaded, stats.attempts, stats.resumed_from,
+           stats.checkpoints);
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  download->digest(digest);
+  uint32_t size = download->size();
+  delete download;
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) downloading update", err);
+    return err;
+  }
+  return _activate(part, digest, size, verifier);
+}
+
+esp_err_t Update::download_delta(const char *url, const char *cert_pem) {
+  EspPartition running(esp_ota_get_running_partition());
+  esp_err_t err = begin();
+  if (err != ESP_OK) {
+    return err;
+  }
+  PartitionSink sink;
+  DeltaDecoder *decoder = new (std::nothrow) DeltaDecoder(running, sink);
+  err = _download_decoded(url, cert_pem, decoder);
+  delete decoder;
+  return err;
+}
+
+esp_err_t Update::download_compressed(const char *url, const char *cert_pem) {
+  esp_err_t err = begin();
+  if (err != ESP_OK) {
+    return err;
+  }
+  PartitionSink sink;
+  Decompressor *decoder = new (std::nothrow) Decompressor(sink);
+  err = _download_decoded(url, cert_pem, decoder);
+  delete decoder;
+  return err;
+}
+
+esp_err_t Update::download_peer(const char *url, const char *cert_pem) {
+  if (_signing_key == nullptr) {
+    /* Chunks from peers can only be trusted through the signed table */
+    ESP_LOGE(TAG, "Sharing updates needs a signing key");
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (_peer != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+  if (part == nullptr) {
+    ESP_LOGE(TAG, "Unable to get next update partition");
+    return ESP_ERR_OTA_BASE;
+  }
+  _partition_check();
+
+  ImageVerifier verifier;
+  esp_err_t err = _fetch_manifest(url, cert_pem, verifier);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  _peer = new (std::nothrow) PeerSession(part);
+  if (_peer == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  size_t size;
+  err = _fetch(url, PEER_TABLE_SUFFIX, cert_pem, _peer->table_data,
+               sizeof(_peer->table_data), &size);
+  if (err == ESP_OK) {
+    err = _peer->table.set(_peer->table_data, size, _signing_key);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) in chunk table", err);
+    stop_sharing();
+    return err;
+  }
+
+  HttpRangeSource source(url, cert_pem);
+  uint64_t start_us = Port::micros();
+  err = _peer->node.fetch(_peer->table, &source);
+  PeerStats stats = _peer->node.stats();
+  _record_download(err, err == ESP_OK ? _peer->table.image_size() : 0,
+                   Port::micros() - start_us);
+  ESP_LOGI(TAG,
+           "Fetched %u chunks from %u peers and %u from the server, %u "
+           "rejected",
+           stats.peer_chunks, stats.peers, stats.server_chunks,
+           stats.rejected);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) downloading update", err);
+    stop_sharing();
+    return err;
+  }
+
+  /* Each chunk matched the signed table, so this only ties the table to
+   * the manifest */
+  err = _activate(part, _peer->table.image_digest(),
+                  _peer->table.image_size(), verifier);
+  if (err != ESP_OK) {
+    stop_sharing();
+  }
+  return err;
+}
+
+esp_err_t Update::start_sharing() {
+  if (_peer != nullptr) {
+    return ESP_OK;
+  }
+  if (_health.verdict() == Verdict::CHECKING) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  esp_partition_pos_t pos = {running->address, running->size};
+  esp_image_metadata_t image;
+  esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &image);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  _peer = new (std::nothrow) PeerSession(running);
+  if (_peer == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  /* Peers name the image by its SHA-256, as in the chunk table */
+  Sha256 hash;
+  for (uint32_t offset = 0; err == ESP_OK && offset < image.image_len;
+       offset += sizeof(_peer->table_data)) {
+    uint32_t n = image.image_len - offset < sizeof(_peer->table_data)
+                     ? image.image_len - offset
+                     : sizeof(_peer->table_data);
+    err = _peer->partition.read(offset, _peer->table_data, n);
+    hash.update(_peer->table_data, n);
+  }
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  hash.finish(digest);
+  if (err == ESP_OK) {
+    err = _peer->node.seed(digest, image.image_len);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) sharing the running image", err);
+    stop_sharing();
+    return err;
+  }
+  ESP_LOGI(TAG, "Sharing the running image on port %u", _peer->node.port());
+  return ESP_OK;
+}
+
+void Update::stop_sharing() {
+  delete _peer;
+  _peer = nullptr;
+}
+
+esp_err_t Update::write_update(const uint8_t *data, size_t size) {
+  if (!_began) {
+    ESP_LOGE(TAG, "Cannot call write() before begin()");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  esp_err_t ret = esp_ota_write(_updateHandle, data, size);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Could not write OTA data");
+    return ret;
+  }
+
+  /* In the writer task of a Pipeline, so this overlaps the next receive */
+  _verifier.update(data, size);
+  return ESP_OK;
+}
+
+esp_err_t Update::set_manifest(const uint8_t *data, size_t size) {
+  if (!_began) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (_signing_key == nullptr && !_allow_unsigned) {
+    ESP_LOGE(TAG, "No signing key set, refusing the update");
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = _verifier.set_manifest(data, size, _signing_key);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) in manifest", err);
+  }
+  return err;
+}
+
+esp_err_t Update::end() {
+  if (!_began) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  /* Validates the written image */
+  const esp_partition_t *part = _pUpdatePartition;
+  esp_err_t ret = esp_ota_end(_updateHandle);
+  _began = false;
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) in esp_ota_end", ret);
+  } else {
+    ret = _activate(part, nullptr, 0, _verifier);
+  }
+  _reset();
+  return ret;
+}
+
+esp_err_t Update::HttpRangeSource::open(uint32_t offset, uint32_t *start,
+                                        uint32_t *total) {
+  esp_http_client_handle_t client = session_.client();
+  if (client == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  char range[32];
+  if (offset > 0) {
+    snprintf(range, sizeof(range), "bytes=%u-", offset);
+    esp_http_client_set_header(client, "Range", range);
+  } else {
+    esp_http_client_delete_header(client, "Range");
+  }
+
+  esp_err_t err = session_.open();
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Error (%i) opening connection", err);
+    return err;
+  }
+
+  int length = esp_http_client_fetch_headers(client);
+  int status = esp_http_client_get_status_code(client);
+  ESP_LOGI(TAG, "Status = %d, content_length = %d, offset = %u", status,
+           length, offset);
+  if (status == 206) {
+    *start = offset;
+  } else if (status == 200) {
+    *start = 0;
+  } else {
+    esp_http_client_close(client);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  *total = length > 0 ? *start + length : 0;
+  return ESP_OK;
+}
+
+int Update::HttpRangeSource::read(uint8_t *dest, size_t size) {
+  return esp_http_client_read(session_.client(),
+                              reinterpret_cast<char *>(dest), size);
+}
+
+/* The pooled handle goes back without the Range header, which the other
+ * users of the pool would otherwise send */
+static void _drop_range(esp_http_client_handle_t client) {
+  if (client != nullptr) {
+    esp_http_client_delete_header(client, "Range");
+  }
+}
+
+Update::HttpRangeSource::~HttpRangeSource() { _drop_range(session_.client()); }
+
+void Update::HttpRangeSource::close() {
+  session_.close();
+  _drop_range(session_.client());
+}
+
+esp_err_t Update::EspPartition::read(size_t offset, void *dest, size_t size) {
+  return esp_partition_read(partition_, offset, dest, size);
+}
+
+esp_err_t Update::EspPartition::write(size_t offset, const void *src,
+                                      size_t size) {
+  return esp_partition_write(partition_, offset, src, size);
+}
+
+esp_err_t Update::EspPartition::erase(size_t offset, size_t size) {
+  return esp_partition_erase_range(partition_, offset, size);
+}
+
+esp_err_t Update::NvsProgressStore::load(Progress &progress) {
+  return NVS.read(OTA_PROGRESS_KEY, progress);
+}
+
+esp_err_t Update::NvsProgressStore::save(const Progress &progress) {
+  Progress copy = progress;
+  return NVS.write(OTA_PROGRESS_KEY, copy);
+}
+
+/* Cleared before every fresh download, so usually there is nothing to
+ * erase */
+esp_err_t Update::NvsProgressStore::clear() {
+  esp_err_t err = NVS.erase_key(OTA_PROGRESS_KEY);
+  if (err == ESP_ERR_NVS_NOT_FOUND) {
+    return ESP_OK;
+  }
+  return err == ESP_OK ? NVS.nvsCommit() : err;
+}
+
+esp_err_t Update::NvsBootStore::load(BootRecord &record) {
+  return NVS.read(OTA_BOOT_RECORD_KEY, record);
+}
+
+esp_err_t Update::NvsBootStore::save(const BootRecord &record) {
+  BootRecord copy = record;
+  return NVS.write(OTA_BOOT_RECORD_KEY, copy);
+}
+
+uint32_t Update::EspBootControl::running() {
+  return esp_ota_get_running_partition()->address;
+}
+
+esp_err_t Update::EspBootControl::set_boot(uint32_t partition) {
+  esp_partition_iterator_t it = esp_partition_find(
+      ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, nullptr);
+  const esp_partition_t *found = nullptr;
+  for (; it != nullptr && found == nullptr; it = esp_partition_next(it)) {
+    const esp_partition_t *part = esp_partition_get(it);
+    if (part->address == partition) {
+      found = part;
+    }
+  }
+  esp_partition_iterator_release(it);
+  if (found == nullptr) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return esp_ota_set_boot_partition(found);
+}
+
+void Update::EspBootControl::restart() {
+  ESP_LOGW(TAG, "Rolling back, restarting");
+  esp_restart();
+}
+
+esp_err_t Update::PartitionSink::write(const uint8_t *data, size_t size) {
+  return write_update(data, size);
+}
+
+/**
+ *
+ *  Privates
+ *
+ */
+
+esp_err_t Update::_reset() {
+  if (_began) {
+    /* Releases the handle, the partial image is discarded */
+    esp_ota_end(_updateHandle);
+    _began = false;
+  }
+  _pUpdatePartition = nullptr;
+  return ESP_OK;
+}
+
+/* Streams the download through 'decoder' into the update partition started
+ * by begin(), then ends the update and boots the new image */
+esp_err_t Update::_download_decoded(const char *url, const char *cert_pem,
+                                    ImageDecoder *decoder) {
+  esp_err_t err = _fetch_manifest(url, cert_pem, _verifier);
+  HttpRangeSource source(url, cert_pem);
+  Pipeline *pipeline = new (std::nothrow) Pipeline();
+
+  uint32_t start, total;
+  if (err == ESP_OK && (decoder == nullptr || pipeline == nullptr)) {
+    err = ESP_ERR_NO_MEM;
+  }
+  if (err == ESP_OK && (err = source.open(0, &start, &total)) == ESP_OK) {
+    err = pipeline->run(source, *decoder);
+    source.close();
+  }
+  if (err == ESP_OK) {
+    err = decoder->finish();
+  }
+  if (pipeline != nullptr) {
+    _record_download(err, pipeline->stats().bytes,
+                     pipeline->stats().elapsed_us);
+  }
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Decoded %u byte image from %u bytes in %llu us",
+             decoder->image_size(), pipeline->stats().bytes,
+             pipeline->stats().elapsed_us);
+  }
+  delete pipeline;
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) decoding update", err);
+    _reset();
+    return err;
+  }
+  return end();
+}
+
+esp_err_t Update::_fetch(const char *url, const char *suffix,
+                         const char *cert_pem, uint8_t *dest,
+                         size_t capacity, size_t *size) {
+  std::string file_url = std::string(url) + suffix;
+  HttpRangeSource source(file_url.c_str(), cert_pem);
+  uint32_t start, total;
+  esp_err_t err = source.open(0, &start, &total);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) fetching %s", err, file_url.c_str());
+    return err;
+  }
+
+  *size = 0;
+  int n;
+  while (*size < capacity &&
+         (n = source.read(dest + *size, capacity - *size)) > 0) {
+    *size += n;
+  }
+  /* One byte more tells a file that filled 'dest' from a larger one */
+  uint8_t extra;
+  if (*size == capacity && source.read(&extra, 1) > 0) {
+    err = ESP_ERR_INVALID_SIZE;
+  }
+  source.close();
+  return err;
+}
+
+esp_err_t Update::_fetch_manifest(const char *url, const char *cert_pem,
+                                  ImageVerifier &verifier) {
+  if (_signing_key == nullptr && !_allow_unsigned) {
+    ESP_LOGE(TAG, "No signing key set, refusing the update");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  uint8_t manifest[MANIFEST_SIZE];
+  size_t size;
+  esp_err_t err = _fetch(url, OTA_MANIFEST_SUFFIX, cert_pem, manifest,
+                         sizeof(manifest), &size);
+  if (err == ESP_OK) {
+    err = verifier.set_manifest(manifest, size, _signing_key);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) in manifest for %s", err, url);
+  }
+  return err;
+}
+
+esp_err_t Update::_activate(const esp_partition_t *partition,
+                            const uint8_t *digest, uint32_t size,
+                            const ImageVerifier &verifier) {
+  /* Whatever wrote the image, its digest is checked before it can boot */
+  esp_err_t err =
+      digest != nullptr ? verifier.verify(digest, size) : verifier.verify();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) verifying image, not booting it", err);
+    return err;
+  }
+  ESP_LOGI(TAG, "Image matches its %smanifest",
+           _signing_key != nullptr ? "signed " : "");
+
+  /* Without the record a bad image could not be rolled back */
+  err = _health.mark_pending(partition->address,
+                             esp_ota_get_running_partition()->address);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) saving the boot record", err);
+    return err;
+  }
+
+  err = esp_ota_set_boot_partition(partition);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%i) setting boot partition", err);
+  }
+  return err;
+}
+
+void Update::_health_task(void *arg) {
+  esp_task_wdt_add(nullptr);
+  Verdict verdict;
+  while ((verdict = _health.poll(_now_ms())) == Verdict::CHECKING) {
+    esp_task_wdt_reset();
+    vTaskDelay(pdMS_TO_TICKS(OTA_HEALTH_POLL_MS));
+  }
+  esp_task_wdt_delete(nullptr);
+
+  /* A rollback restarts inside poll() */
+  if (verdict == Verdict::CONFIRMED) {
+    ESP_LOGI(TAG, "New image confirmed");
+  }
+}
+
+esp_err_t Update::_partition_check() {
+  const esp_partition_t *_pRunning = esp_ota_get_running_partition();
+  const esp_partition_t *_pConfigured = esp_ota_get_boot_partition();
+
+  if (_pConfigured != _pRunning) {
+    ESP_LOGW(TAG,
+             "Configured OTA boot partition at offset 0x%08x, but running from "
+             "offset 0x%08x",
+             _pConfigured->address, _pRunning->address);
+    ESP_LOGW(TAG,
+             "(This can happen if either the OTA boot data or preferred boot "
+             "image become corrupted somehow.)");
+    return ESP_ERR_OTA_PARTITION_CONFLICT;
+  }
+  ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
+           _pRunning->type, _pRunning->subtype, _pRunning->address);
+
+  return ESP_OK;
+}
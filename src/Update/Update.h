@@ -0,0 +1,397 @@
+/*
+  Update.h
+  Scott Chase Waggener  tidalpaladin@gmail.com
+  10/10/2017
+
+  Implemented using ESP-IDF
+
+  Deisgned to handle writing firmware updates to the ESP32
+
+*/
+
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Compressed.h"
+#include "Delta.h"
+#include "Health.h"
+#include "Http/Http.h"
+#include "Manifest.h"
+#include "Metrics/Metrics.h"
+#include "NVS/NVS.h"
+#include "OtaPipeline.h"
+#include "Partition.h"
+#include "Peer.h"
+#include "Resumable.h"
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tcpip_adapter.h"
+
+/* NVS key holding the Progress of an interrupted download */
+#define OTA_PROGRESS_KEY "OTA_PROGRESS"
+
+/* Connections download_update() tries before giving up */
+#define OTA_MAX_ATTEMPTS 10
+
+/* Appended to an image URL to fetch its manifest */
+#define OTA_MANIFEST_SUFFIX ".sig"
+
+/* NVS key holding the BootRecord of the last update */
+#define OTA_BOOT_RECORD_KEY "OTA_BOOT"
+
+#define OTA_HEALTH_POLL_MS 1000
+#define OTA_HEALTH_TASK_STACK_SIZE 4096
+#define OTA_HEALTH_TASK_PRIORITY 3
+
+namespace Update {
+
+extern const char *const TAG;
+
+/**
+ * @brief Requires every following update to be signed with this key. Each
+ * image is then checked against a signed manifest, and is not booted
+ * unless it matches.
+ *
+ * The download functions fetch the manifest from the image URL with
+ * OTA_MANIFEST_SUFFIX appended. Updates written with write_update() must
+ * pass it to set_manifest().
+ *
+ * Without a key updates are refused, unless allow_unsigned() was called.
+ *
+ * @param public_key  ED25519_PUBLIC_KEY_SIZE bytes, kept by reference, as
+ *                    generated by tools/signimage
+ */
+void set_signing_key(const uint8_t *public_key);
+
+/**
+ * @brief Accepts updates while no signing key is set, for development
+ * builds. The manifest is still fetched and the image must match its
+ * digest, but the signature is not checked. Off by default.
+ */
+void allow_unsigned(bool allow);
+
+/**
+ * @brief Registers a check a new image must pass before it is confirmed.
+ * Call before start_health_check().
+ *
+ * @param name  For logs
+ * @param check Polled every OTA_HEALTH_POLL_MS until it returns true. Must
+ *              return within the task watchdog timeout.
+ *
+ * @return ESP_ERR_NO_MEM if OTA_HEALTH_MAX_CHECKS are registered
+ */
+esp_err_t add_health_check(const char *name, HealthCheck check,
+                           void *arg = nullptr);
+
+/**
+ * @brief Call once at startup, after NVS has been started. If the running
+ * image is an unconfirmed update, counts the boot and starts a task that runs
+ * the health checks. The image is confirmed when they all pass, and rolled
+ * back with a restart if they have not passed within 'deadline_ms', or if
+ * the image has already been booted OTA_HEALTH_MAX_ATTEMPTS times.
+ *
+ * The task is watched by the task watchdog, so a hung check resets the
+ * device, which counts as a failed boot.
+ *
+ * @return
+ *  - IDLE          No update is pending, nothing to do
+ *  - CHECKING      The health task was started
+ *  - ROLLED_BACK   The update failed earlier and the previous image runs.
+ *                  When rolling back now this does not return.
+ */
+Verdict start_health_check(uint32_t deadline_ms = OTA_HEALTH_DEADLINE_MS);
+
+/**
+ * @brief Health check passing once the station has an IP address
+ */
+bool check_wifi(void *arg);
+
+/**
+ * @brief Health check passing while the free heap is at least 'min_free'
+ * bytes, cast to a void *
+ */
+bool check_heap(void *min_free);
+
+/**
+ * @brief Health check passing once a GET of 'url', a const char *, answers
+ * with a 2xx status
+ */
+bool check_backend(void *url);
+
+/**
+ * @brief Initializes the update process
+ *
+ * @return esp_err_t
+ */
+esp_err_t begin();
+
+/**
+ * @brief Fetches a firmware.bin file from a HTTP(S) server, streams it into
+ * the update partition and makes it the boot partition. Receiving and flash
+ * writes overlap through a Pipeline, and the image is hashed as it is
+ * written for the manifest check.
+ *
+ * Dropped connections are resumed with Range requests. Progress is saved in
+ * NVS, so a download interrupted by a reboot continues where it stopped the
+ * next time this is called with the same URL. NVS must have been started.
+ *
+ * @param url       The location of the firmware file
+ * @param cert_pem  Server certificate for HTTPS, or nullptr
+ *
+ * @return esp_err_t
+ */
+esp_err_t download_update(const char *url, const char *cert_pem = nullptr);
+
+/**
+ * @brief Fetches a delta patch made by tools/mkdelta and rebuilds the new
+ * image from the running partition into the update partition, then makes it
+ * the boot partition.
+ *
+ * The patch must have been made against the running image. Unlike
+ * download_update() an interrupted delta download starts over.
+ *
+ * @param url       The location of the patch
+ * @param cert_pem  Server certificate for HTTPS, or nullptr
+ *
+ * @return
+ *  - ESP_ERR_INVALID_CRC   The running image is not the patch base, or the
+ *                          rebuilt image is corrupt
+ *  - Otherwise as download_update()
+ */
+esp_err_t download_delta(const char *url, const char *cert_pem = nullptr);
+
+/**
+ * @brief Fetches an image compressed with tools/mkcompressed, decompressing
+ * it into the update partition as it arrives, then makes it the boot
+ * partition. An interrupted download starts over.
+ *
+ * @param url       The location of the compressed image
+ * @param cert_pem  Server certificate for HTTPS, or nullptr
+ *
+ * @return
+ *  - ESP_ERR_NOT_SUPPORTED The window is too large for this build
+ *  - ESP_ERR_INVALID_CRC   The decompressed image is corrupt
+ *  - Otherwise as download_update()
+ */
+esp_err_t download_compressed(const char *url, const char *cert_pem = nullptr);
+
+/**
+ * @brief Fetches an image from devices on the LAN that already have it, and
+ * the parts no device has from the server, then makes it the boot
+ * partition. The chunk table made by tools/signimage is fetched from the
+ * server, at 'url' with PEER_TABLE_SUFFIX appended, and every chunk from a
+ * peer is checked against it. Requires a signing key.
+ *
+ * Chunks are shared with other devices as they arrive, and the new image
+ * stays shared until stop_sharing() or a restart.
+ *
+ * @param url       The location of the firmware file
+ * @param cert_pem  Server certificate for HTTPS, or nullptr
+ *
+ * @return
+ *  - ESP_ERR_INVALID_STATE No signing key set, or already sharing
+ *  - ESP_ERR_INVALID_CRC   The chunk table is not signed with the key
+ *  - ESP_ERR_TIMEOUT       The server kept failing
+ *  - Otherwise as download_update()
+ */
+esp_err_t download_peer(const char *url, const char *cert_pem = nullptr);
+
+/**
+ * @brief Shares the running image with devices on the LAN calling
+ * download_peer(). Call once start_health_check() has confirmed the image,
+ * after the network is up.
+ *
+ * @return
+ *  - ESP_ERR_INVALID_STATE The image is still being checked
+ *  - ESP_OK                Shared, or already being shared
+ *  - Any error reading the image or opening the sockets
+ */
+esp_err_t start_sharing();
+
+/**
+ * @brief Stops sharing and frees what it used
+ */
+void stop_sharing();
+
+/**
+ * @brief Writes supplied data to the update partition
+ *
+ * @param data A uint8_t array to write
+ * @param size The size of the incoming data block
+ *
+ * @return esp_err_t
+ */
+esp_err_t write_update(const uint8_t *data, size_t size);
+
+/**
+ * @brief Gives the signed manifest of the image being written, after
+ * begin(). end() refuses images without one.
+ *
+ * @return
+ *  - ESP_ERR_INVALID_STATE No update begun, or no signing key set and
+ *                          unsigned updates not allowed
+ *  - As ImageVerifier::set_manifest()
+ */
+esp_err_t set_manifest(const uint8_t *data, size_t size);
+
+/**
+ * @brief Ends the update and makes the new image the boot partition.
+ *
+ * The image must match its manifest, or the boot partition is left alone.
+ *
+ * @return
+ *  - ESP_OK                The new image will boot next
+ *  - ESP_ERR_NOT_FOUND     No manifest was given
+ *  - ESP_ERR_INVALID_CRC   The image does not match the manifest
+ *  - ESP_ERR_INVALID_SIZE  The image size does not match the manifest
+ *  - Any error from esp_ota_end() or esp_ota_set_boot_partition()
+ */
+esp_err_t end();
+
+/**
+ * @brief Verifies that the currently running partition matches
+ * the configured partition.
+ *
+ * Configured and running partitions will mismatch if the configured
+ * partition is bad and the ESP falls back to a different partition.
+ *
+ * @return
+ *  - ESP_OK                          The partitions are the same
+ *  - ESP_ERR_OTA_PARTITION_CONFLICT  They differ
+ */
+esp_err_t _partition_check();
+
+/**
+ * @brief Cleans up the updating process. Call this if an error
+ * is encountered or the update has completed successfully
+ *
+ * @return esp_err_t
+ */
+esp_err_t _reset();
+
+/**
+ * @brief Fetches a small file at 'url' with 'suffix' appended
+ *
+ * @param capacity  Size of 'dest'
+ * @param size      Set to the file size
+ *
+ * @return ESP_ERR_INVALID_SIZE if the file is larger than 'capacity'
+ */
+esp_err_t _fetch(const char *url, const char *suffix, const char *cert_pem,
+                 uint8_t *dest, size_t capacity, size_t *size);
+
+/**
+ * @brief Fetches the manifest for 'url' into 'verifier' if a signing key is
+ * set
+ */
+esp_err_t _fetch_manifest(const char *url, const char *cert_pem,
+                          ImageVerifier &verifier);
+
+/**
+ * @brief Checks an image against its manifest, if a signing key is set,
+ * and makes it the boot partition
+ *
+ * @param digest  SHA-256 of the image, or nullptr to use what 'verifier'
+ *                hashed itself
+ */
+esp_err_t _activate(const esp_partition_t *partition, const uint8_t *digest,
+                    uint32_t size, const ImageVerifier &verifier);
+
+/**
+ * @brief Feeds a download through 'decoder' into the update partition after
+ * begin(), then end()s the update. Takes care of _reset() on errors. A
+ * null decoder is reported as ESP_ERR_NO_MEM.
+ */
+esp_err_t _download_decoded(const char *url, const char *cert_pem,
+                            ImageDecoder *decoder);
+
+/**
+ * Reads an image with esp_http_client, using Range requests to resume. The
+ * connection comes from Http::pool(), so the manifest, the image and later
+ * requests to the host share one handshake.
+ */
+class HttpRangeSource : public RangeSource {
+ public:
+  HttpRangeSource(const char *url, const char *cert_pem)
+      : session_(url, cert_pem) {}
+
+  /* Also after a failed open(), before the handle goes back to the pool */
+  ~HttpRangeSource();
+
+  esp_err_t open(uint32_t offset, uint32_t *start, uint32_t *total) override;
+  int read(uint8_t *dest, size_t size) override;
+  void close() override;
+
+ private:
+  Http::Session session_;
+};
+
+/**
+ * Random access to a flash partition through esp_partition_*
+ */
+class EspPartition : public Partition {
+ public:
+  explicit EspPartition(const esp_partition_t *partition)
+      : partition_(partition) {}
+
+  esp_err_t read(size_t offset, void *dest, size_t size) override;
+  esp_err_t write(size_t offset, const void *src, size_t size) override;
+  esp_err_t erase(size_t offset, size_t size) override;
+  size_t size() const override { return partition_->size; }
+  uint32_t id() const override { return partition_->address; }
+
+ private:
+  const esp_partition_t *partition_;
+};
+
+/**
+ * Keeps download progress in NVS under OTA_PROGRESS_KEY
+ */
+class NvsProgressStore : public ProgressStore {
+ public:
+  esp_err_t load(Progress &progress) override;
+  esp_err_t save(const Progress &progress) override;
+  esp_err_t clear() override;
+};
+
+/**
+ * Keeps the BootRecord in NVS under OTA_BOOT_RECORD_KEY
+ */
+class NvsBootStore : public BootStore {
+ public:
+  esp_err_t load(BootRecord &record) override;
+  esp_err_t save(const BootRecord &record) override;
+};
+
+/**
+ * Boot partition control through esp_ota_*, partitions are identified by
+ * their address
+ */
+class EspBootControl : public BootControl {
+ public:
+  uint32_t running() override;
+  esp_err_t set_boot(uint32_t partition) override;
+  void restart() override;
+};
+
+/**
+ * Writes to the update partition through write_update()
+ */
+class PartitionSink : public ChunkSink {
+ public:
+  esp_err_t write(const uint8_t *data, size_t size) override;
+};
+
+};  // namespace Update
+
+#endif
@@ -0,0 +1,135 @@
+#include "Work.h"
+#include <atomic>
+#include "Metrics/Metrics.h"
+#include "Ring/MpmcRing.h"
+
+namespace Work {
+struct Job {
+  Function fn;
+  void *arg;
+  uint32_t queued_us;
+};
+
+struct Worker {
+  MpmcRing<Job, WORK_QUEUE_SIZE> queues[WORK_PRIORITIES];
+  std::atomic<bool> idle;
+  Port::Signal wake;
+  Port::Task task;
+};
+
+static Worker workers[WORK_WORKERS];
+static std::atomic<bool> running(false);
+
+static Metrics::Counter jobs("work.jobs");
+static Metrics::Counter steals("work.steals");
+static Metrics::Counter rejected("work.rejected");
+static Metrics::Histogram latency_us("work.latency_us");
+
+/* Wakes 'target' if it sleeps, else any sleeping worker to steal the job */
+static void wake_for(uint32_t target) {
+  /* Pairs with the fence in worker_task(), so either the worker sees the
+   * job or this sees the worker idle */
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (workers[target].idle) {
+    workers[target].wake.give();
+    return;
+  }
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    if (workers[i].idle) {
+      workers[i].wake.give();
+      return;
+    }
+  }
+}
+
+static void worker_task(void *arg) {
+  uint32_t self = (uint32_t)(uintptr_t)arg;
+  Worker &worker = workers[self];
+  while (running) {
+    if (run_one(self)) {
+      continue;
+    }
+    worker.idle = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!run_one(self)) {
+      worker.wake.take();
+    }
+    worker.idle = false;
+  }
+}
+}  // namespace Work
+
+esp_err_t Work::submit(Function fn, void *arg, Priority priority) {
+  Job job = {fn, arg, (uint32_t)Port::micros()};
+  uint32_t level = (uint32_t)priority;
+  uint32_t home = Port::core() % WORK_WORKERS;
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    uint32_t target = (home + i) % WORK_WORKERS;
+    if (workers[target].queues[level].push(job)) {
+      wake_for(target);
+      return ESP_OK;
+    }
+  }
+  rejected.add();
+  return ESP_ERR_NO_MEM;
+}
+
+bool Work::run_one(uint32_t worker) {
+  Job job;
+  for (uint32_t level = 0; level < WORK_PRIORITIES; level++) {
+    for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+      uint32_t victim = (worker + i) % WORK_WORKERS;
+      if (workers[victim].queues[level].pop(job)) {
+        if (i > 0) {
+          steals.add();
+        }
+        jobs.add();
+        latency_us.record((uint32_t)Port::micros() - job.queued_us);
+        job.fn(job.arg);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t Work::pending() {
+  size_t count = 0;
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    for (uint32_t level = 0; level < WORK_PRIORITIES; level++) {
+      count += workers[i].queues[level].size();
+    }
+  }
+  return count;
+}
+
+esp_err_t Work::start() {
+  if (running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  running = true;
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    int32_t core = WORK_WORKERS == PORT_CORES ? (int32_t)i : PORT_ANY_CORE;
+    esp_err_t err = workers[i].task.start(worker_task, (void *)(uintptr_t)i,
+                                          "work", WORK_TASK_STACK_SIZE,
+                                          WORK_TASK_PRIORITY, core);
+    if (err != ESP_OK) {
+      stop();
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+void Work::stop() {
+  if (!running) {
+    return;
+  }
+  running = false;
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    workers[i].wake.give();
+  }
+  for (uint32_t i = 0; i < WORK_WORKERS; i++) {
+    workers[i].task.join();
+  }
+}
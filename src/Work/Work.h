@@ -0,0 +1,91 @@
+/**
+ * Shared worker pool. Short blocking jobs, such as NVS commits, run here
+ * instead of in a task of their own:
+ *
+ *   static void save(void *arg) { NVS.write("count", *(uint32_t *)arg); }
+ *
+ *   Work::submit(save, &count, Work::Priority::LOW);
+ *
+ * There is one worker pinned to each core, each with a bounded lock-free
+ * queue per priority. A job goes to the queue of the submitting core's
+ * worker. Workers take the highest priority job they can find, from their
+ * own queues first and then from the other workers', so an idle core steals
+ * from a busy one.
+ *
+ * Jobs share the workers' stacks and hold up the jobs behind them, keep
+ * them short. A session that blocks for seconds wants its own task.
+ */
+
+#ifndef __WORK_H__
+#define __WORK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Port/Port.h"
+
+/* One pinned worker per core on device. Natively two, so stealing runs. */
+#ifndef WORK_WORKERS
+#ifdef ESP_PLATFORM
+#define WORK_WORKERS PORT_CORES
+#else
+#define WORK_WORKERS 2
+#endif
+#endif
+
+/* Jobs queued per worker and priority, a power of two */
+#ifndef WORK_QUEUE_SIZE
+#define WORK_QUEUE_SIZE 32
+#endif
+
+#define WORK_PRIORITIES 3
+
+#define WORK_TASK_STACK_SIZE 4096
+#define WORK_TASK_PRIORITY 4
+
+namespace Work {
+
+typedef void (*Function)(void *arg);
+
+enum class Priority { HIGH, NORMAL, LOW };
+
+/**
+ * @brief Queues 'fn(arg)' to run on a worker. May be called before
+ * start(), the jobs then run once it is called.
+ *
+ * @return
+ *  - ESP_OK          The job is queued
+ *  - ESP_ERR_NO_MEM  Every queue of this priority is full
+ */
+esp_err_t submit(Function fn, void *arg, Priority priority = Priority::NORMAL);
+
+/**
+ * @brief Runs one queued job, the highest priority first. Workers call this,
+ * tests may instead.
+ *
+ * @param worker  Whose queues to try first
+ *
+ * @return false if every queue was empty
+ */
+bool run_one(uint32_t worker = 0);
+
+/**
+ * @brief Gets the number of jobs queued, approximate while they change
+ */
+size_t pending();
+
+/**
+ * @brief Starts the workers
+ *
+ * @return As Port::Task::start()
+ */
+esp_err_t start();
+
+/**
+ * @brief Stops the workers after their current jobs. Queued jobs run after
+ * the next start().
+ */
+void stop();
+
+}  // namespace Work
+
+#endif
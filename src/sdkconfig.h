@@ -8,6 +8,7 @@
 #define CONFIG_ESP32_PHY_MAX_TX_POWER 20
 #define CONFIG_TRACEMEM_RESERVE_DRAM 0x0
 #define CONFIG_FREERTOS_MAX_TASK_NAME_LEN 16
+#define CONFIG_SUPPORT_STATIC_ALLOCATION 1
 #define CONFIG_BLE_SMP_ENABLE 1
 #define CONFIG_FATFS_LFN_NONE 1
 #define CONFIG_TCP_RECVMBOX_SIZE 6
@@ -95,6 +96,7 @@
 #define CONFIG_SPIFFS_PAGE_CHECK 1
 #define CONFIG_LWIP_MAX_ACTIVE_TCP 16
 #define CONFIG_TASK_WDT_TIMEOUT_S 5
+#define CONFIG_TASK_WDT_PANIC 1
 #define CONFIG_INT_WDT_TIMEOUT_MS 300
 #define CONFIG_ESPTOOLPY_FLASHMODE "dio"
 #define CONFIG_BTC_TASK_STACK_SIZE 3072
@@ -152,6 +154,10 @@
 #define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 160
 #define CONFIG_MBEDTLS_HARDWARE_AES 1
 #define CONFIG_FREERTOS_HZ 100
+#define CONFIG_FREERTOS_USE_TRACE_FACILITY 1
+#define CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS 1
+#define CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER 1
+#define CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID 1
 #define CONFIG_LOG_COLORS 1
 #define CONFIG_ESP32_PHY_CALIBRATION_AND_DATA_STORAGE 1
 #define CONFIG_STACK_CHECK_NONE 1
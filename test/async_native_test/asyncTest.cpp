@@ -0,0 +1,210 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <atomic>
+#include "Async/Async.h"
+#include "NVS/NVS.h"
+
+/* Waits for 'flag', counting the steps taken */
+class Steps : public Async::Flow {
+ public:
+  Steps() : flag(false), steps(0) {}
+
+  Async::Status resume() override {
+    ASYNC_BEGIN();
+    steps++;
+    ASYNC_AWAIT(flag.load());
+    steps++;
+    ASYNC_END();
+  }
+
+  std::atomic<bool> flag;
+  int steps;
+};
+
+/* Sleeps, then waits for a condition that never holds */
+class Sleeper : public Async::Flow {
+ public:
+  Sleeper() : slept_us(0), gave_up(false) {}
+
+  Async::Status resume() override {
+    ASYNC_BEGIN();
+    start_us_ = Port::micros();
+    ASYNC_SLEEP_MS(20);
+    slept_us = Port::micros() - start_us_;
+    ASYNC_AWAIT_MS(false, 10);
+    gave_up = timed_out();
+    ASYNC_END();
+  }
+
+  uint64_t slept_us;
+  bool gave_up;
+
+ private:
+  uint64_t start_us_;
+};
+
+/* Resolves a name after a short sleep */
+class Lookup : public Async::Flow {
+ public:
+  Lookup() : host(nullptr), result(ESP_FAIL) {}
+
+  Async::Status resume() override {
+    ASYNC_BEGIN();
+    ASYNC_SLEEP_MS(5);
+    if (lookup_.start(host) != ESP_OK) {
+      result = lookup_.result();
+      return Async::Status::DONE;
+    }
+    ASYNC_AWAIT(lookup_.ready());
+    result = lookup_.result();
+    addr = lookup_.addr();
+    ASYNC_END();
+  }
+
+  const char *host;
+  esp_err_t result;
+  ip_addr_t addr;
+
+ private:
+  Async::Resolve lookup_;
+};
+
+/* Writes a value, then waits for the commit on the worker */
+class Save : public Async::Flow {
+ public:
+  Save() : result(ESP_FAIL) {}
+
+  Async::Status resume() override {
+    ASYNC_BEGIN();
+    flush_.start();
+    ASYNC_AWAIT(flush_.ready());
+    result = flush_.result();
+    ASYNC_END();
+  }
+
+  esp_err_t result;
+
+ private:
+  Async::Flush flush_;
+};
+
+static void run_until_done(uint32_t timeout_ms) {
+  uint64_t deadline = Port::micros() + timeout_ms * 1000ull;
+  while (Async::active() > 0 && Port::micros() < deadline) {
+    Port::sleep_ms(1);
+  }
+}
+
+/* Polled by hand, a flow resumes where it waited */
+void resumes_after_await() {
+  Steps flow;
+  TEST_ASSERT_TRUE(flow.done());
+  TEST_ASSERT_EQUAL(ESP_OK, Async::spawn(&flow));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, Async::spawn(&flow));
+  TEST_ASSERT_FALSE(flow.done());
+
+  TEST_ASSERT_EQUAL(ASYNC_POLL_MS, Async::poll());
+  TEST_ASSERT_EQUAL(1, flow.steps);
+  Async::poll();
+  TEST_ASSERT_EQUAL(1, flow.steps);
+  TEST_ASSERT_EQUAL(1, Async::active());
+
+  flow.flag = true;
+  Async::poll();
+  TEST_ASSERT_EQUAL(2, flow.steps);
+  TEST_ASSERT_TRUE(flow.done());
+  TEST_ASSERT_EQUAL(0, Async::active());
+
+  /* Spawning again starts over */
+  flow.flag = false;
+  TEST_ASSERT_EQUAL(ESP_OK, Async::spawn(&flow));
+  flow.flag = true;
+  Async::poll();
+  TEST_ASSERT_EQUAL(4, flow.steps);
+  TEST_ASSERT_TRUE(flow.done());
+}
+
+/* poll() reports the nearest deadline, and timeouts are seen by the flow */
+void sleeps_and_times_out() {
+  Sleeper flow;
+  Async::spawn(&flow);
+  uint32_t wait_ms = Async::poll();
+  TEST_ASSERT_TRUE(wait_ms > 0 && wait_ms <= 20);
+  while (!flow.done()) {
+    Port::sleep_ms(Async::poll());
+  }
+  printf("slept %u us\n", (unsigned)flow.slept_us);
+  TEST_ASSERT_TRUE(flow.slept_us >= 20000);
+  TEST_ASSERT_TRUE(flow.gave_up);
+}
+
+/* Lookups of many flows overlap on the one executor task */
+void resolves_concurrently() {
+  const int count = 32;
+  static Lookup flows[count];
+  static char hosts[count][24];
+  Host::dns_flush();
+  Host::dns_set_latency_ms(50);
+  Port::PoolStats before = Port::task_pool();
+  TEST_ASSERT_EQUAL(ESP_OK, Async::start());
+  TEST_ASSERT_EQUAL(before.in_use + 1, Port::task_pool().in_use);
+
+  uint64_t start = Port::micros();
+  for (int i = 0; i < count; i++) {
+    snprintf(hosts[i], sizeof(hosts[i]), "host%d.example.com", i);
+    flows[i].host = i == 0 ? "missing.invalid" : hosts[i];
+    Async::spawn(&flows[i]);
+  }
+  run_until_done(2000);
+  uint64_t elapsed = Port::micros() - start;
+  Async::stop();
+  Host::dns_set_latency_ms(0);
+  printf("%d lookups of 50 ms in %u ms\n", count, (unsigned)(elapsed / 1000));
+
+  TEST_ASSERT_EQUAL(0, Async::active());
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, flows[0].result);
+  for (int i = 1; i < count; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, flows[i].result);
+    TEST_ASSERT_TRUE(flows[i].addr.u_addr.ip4.addr != 0);
+  }
+  TEST_ASSERT_TRUE(elapsed < 500000);
+  TEST_ASSERT_EQUAL(before.in_use, Port::task_pool().in_use);
+}
+
+/* A slow commit runs on the Work pool while other flows keep going */
+void flushes_on_pool() {
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.begin());
+  Host::nvs_set_commit_us(50000);
+  Save save;
+  Steps steps;
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  TEST_ASSERT_EQUAL(ESP_OK, Async::start());
+  Async::spawn(&save);
+  Async::spawn(&steps);
+  Port::sleep_ms(10);
+  steps.flag = true;
+  Async::notify();
+  Port::sleep_ms(10);
+  TEST_ASSERT_TRUE(steps.done());
+  TEST_ASSERT_FALSE(save.done());
+
+  run_until_done(1000);
+  Async::stop();
+  Work::stop();
+  Host::nvs_set_commit_us(0);
+  TEST_ASSERT_TRUE(save.done());
+  TEST_ASSERT_EQUAL(ESP_OK, save.result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(resumes_after_await);
+  RUN_TEST(sleeps_and_times_out);
+  RUN_TEST(resolves_concurrently);
+  RUN_TEST(flushes_on_pool);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "Bench/Scenarios.h"
+#include "DNS/DNS.h"
+#include "Host/FilePartition.h"
+#include "NVS/NVS.h"
+
+static const char *const PARTITION_FILE = "bench_native_test.bin";
+
+/* Delays take a tick per iteration, fewer keep the suite short */
+static const Bench::Options DELAY_OPTIONS = {2, 50};
+
+static uint32_t counting_sample(void *arg) {
+  uint32_t &next = *static_cast<uint32_t *>(arg);
+  return next++;
+}
+
+static void check(const Bench::Result &result, uint32_t n) {
+  TEST_ASSERT_EQUAL(n, result.n);
+  TEST_ASSERT_TRUE(result.min <= result.p50);
+  TEST_ASSERT_TRUE(result.p50 <= result.p90);
+  TEST_ASSERT_TRUE(result.p90 <= result.p99);
+  TEST_ASSERT_TRUE(result.p99 <= result.max);
+}
+
+/* Warm-up samples are dropped, percentiles are nearest rank */
+void computes_percentiles() {
+  uint32_t next = 0;
+  Bench::Scenario scenario = {"test.count", "n", counting_sample, &next, 10,
+                              100};
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(scenario, result));
+  TEST_ASSERT_EQUAL(110, next);
+  TEST_ASSERT_EQUAL(10, result.min);
+  TEST_ASSERT_EQUAL(59, result.p50);
+  TEST_ASSERT_EQUAL(99, result.p90);
+  TEST_ASSERT_EQUAL(108, result.p99);
+  TEST_ASSERT_EQUAL(109, result.max);
+  TEST_ASSERT_EQUAL(59, result.mean);
+
+  char line[256];
+  Bench::write_json(result, line, sizeof(line));
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"bench\":\"test.count\",\"platform\":\"native\",\"unit\":\"n\","
+      "\"n\":100,\"min\":10,\"p50\":59,\"p90\":99,\"p99\":108,\"max\":109,"
+      "\"mean\":59}",
+      line);
+
+  scenario.iterations = BENCH_MAX_ITERATIONS + 1;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, Bench::run(scenario, result));
+}
+
+/* The stand-in keeps the device's typing rules */
+void nvs_stand_in() {
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.begin());
+  uint32_t value = 42;
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.write("answer", value));
+  value = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.read("answer", value));
+  TEST_ASSERT_EQUAL(42, value);
+  int8_t narrow;
+  TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, NVS.read("answer", narrow));
+  TEST_ASSERT_EQUAL(ESP_ERR_NVS_KEY_TOO_LONG,
+                    NVS.write("a_key_over_15_chars", value));
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.erase_key("answer"));
+  TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, NVS.read("answer", value));
+}
+
+void nvs_latency() {
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::nvs_read(Bench::DEFAULT_OPTIONS, result));
+  check(result, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::nvs_write(Bench::DEFAULT_OPTIONS, result));
+  check(result, BENCH_ITERATIONS);
+
+  /* Commits model 100 us of flash */
+  Host::nvs_set_commit_us(100);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::nvs_commit(Bench::DEFAULT_OPTIONS, result));
+  Host::nvs_set_commit_us(0);
+  check(result, BENCH_ITERATIONS);
+  TEST_ASSERT_TRUE(result.min >= 100000);
+}
+
+/* A 20 ms delay is two ticks, the first of them partial */
+void delay_accuracy() {
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::delay_accuracy(DELAY_OPTIONS, result));
+  check(result, 50);
+  TEST_ASSERT_TRUE(result.min >=
+                   (BENCH_DELAY_MS - portTICK_PERIOD_MS) * 1000);
+  TEST_ASSERT_TRUE(result.p50 <= BENCH_DELAY_MS * 1000 + 2000);
+
+  /* Periodic wakes hold the period however long each delay was */
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::delay_period(DELAY_OPTIONS, result));
+  check(result, 50);
+  TEST_ASSERT_TRUE(result.p50 >= BENCH_DELAY_MS * 1000 - 2000);
+  TEST_ASSERT_TRUE(result.p50 <= BENCH_DELAY_MS * 1000 + 2000);
+  TEST_ASSERT_TRUE(result.mean >= BENCH_DELAY_MS * 1000 - 1000);
+  TEST_ASSERT_TRUE(result.mean <= BENCH_DELAY_MS * 1000 + 1000);
+}
+
+/* Cached answers return at once, others wait for the resolver */
+void dns_latency() {
+  Host::dns_set_latency_ms(2);
+  ip_addr_t addr;
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve("localhost", &addr));
+  TEST_ASSERT_EQUAL(127, ip4_addr1(&addr.u_addr.ip4));
+  TEST_ASSERT_EQUAL(1, ip4_addr4(&addr.u_addr.ip4));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, DNS::resolve("nowhere.invalid", &addr));
+
+  Bench::Result cached, uncached;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::dns_cached("example.com",
+                                              Bench::DEFAULT_OPTIONS, cached));
+  check(cached, BENCH_ITERATIONS);
+  Bench::Options options = {2, 50};
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::dns_uncached("example.com", options, uncached));
+  check(uncached, 50);
+  TEST_ASSERT_TRUE(uncached.min >= 2000);
+  TEST_ASSERT_TRUE(cached.p50 < uncached.p50 * 1000);
+  Host::dns_set_latency_ms(0);
+}
+
+void ota_throughput() {
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Bench::Options options = {2, 50};
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::ota_write(partition, options, result));
+  check(result, 50);
+  TEST_ASSERT_TRUE(result.min > 0);
+
+  uint8_t sector[OTA_SECTOR_SIZE];
+  TEST_ASSERT_EQUAL(ESP_OK, partition.read(BENCH_OTA_SIZE - sizeof(sector),
+                                           sector, sizeof(sector)));
+  TEST_ASSERT_EQUAL(BENCH_OTA_SIZE / OTA_SECTOR_SIZE - 1, sector[0]);
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+/* Jobs start within a wake-up of being submitted and all of a batch run */
+void work_pool() {
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  Bench::Result latency, throughput;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::work_latency(Bench::DEFAULT_OPTIONS, latency));
+  check(latency, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::work_throughput(Bench::DEFAULT_OPTIONS, throughput));
+  check(throughput, BENCH_ITERATIONS);
+  TEST_ASSERT_TRUE(throughput.min > 0);
+  Work::stop();
+  TEST_ASSERT_EQUAL(0, Work::pending());
+}
+
+/* Both kinds of post wake the waiting task */
+void wake_up() {
+  Bench::Result group, notification;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::wake_event_group(Bench::DEFAULT_OPTIONS, group));
+  check(group, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(
+      ESP_OK, Bench::wake_notification(Bench::DEFAULT_OPTIONS, notification));
+  check(notification, BENCH_ITERATIONS);
+}
+
+/* Rough flash costs show the shape of a wake, restoring the mirror skips
+ * them all */
+void wake_to_ready() {
+  Host::nvs_set_init_us(2000);
+  Host::nvs_set_read_us(50);
+  Bench::Result nvs, rtc;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::wake_ready_nvs(Bench::DEFAULT_OPTIONS, nvs));
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::wake_ready_rtc(Bench::DEFAULT_OPTIONS, rtc));
+  Host::nvs_set_init_us(0);
+  Host::nvs_set_read_us(0);
+  check(nvs, BENCH_ITERATIONS);
+  check(rtc, BENCH_ITERATIONS);
+  TEST_ASSERT_TRUE(nvs.min >= 2000 + BENCH_WAKE_KEYS * 50);
+  TEST_ASSERT_TRUE(rtc.p50 < nvs.min);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(computes_percentiles);
+  RUN_TEST(nvs_stand_in);
+  RUN_TEST(nvs_latency);
+  RUN_TEST(delay_accuracy);
+  RUN_TEST(dns_latency);
+  RUN_TEST(ota_throughput);
+  RUN_TEST(work_pool);
+  RUN_TEST(wake_up);
+  RUN_TEST(wake_to_ready);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "Bench/Scenarios.h"
+#include "NVS/NVS.h"
+#include "SmartConfig/EasyWifi.h"
+#include "Update/Update.h"
+
+extern "C" {
+void app_main();
+}
+
+/* Cached and uncached lookups, reached over the stored Wi-Fi network */
+static const char *DNS_HOST = "espressif.com";
+static const char *DNS_DOMAIN = "example.com";
+
+static const Bench::Options DELAY_OPTIONS = {2, 50};
+static const Bench::Options SLOW_OPTIONS = {2, 50};
+
+static void check(const Bench::Result &result, uint32_t n) {
+  TEST_ASSERT_EQUAL(n, result.n);
+  TEST_ASSERT_TRUE(result.min <= result.p50);
+  TEST_ASSERT_TRUE(result.p50 <= result.p99);
+  TEST_ASSERT_TRUE(result.p99 <= result.max);
+}
+
+void nvs_latency() {
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::nvs_read(Bench::DEFAULT_OPTIONS, result));
+  check(result, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::nvs_write(Bench::DEFAULT_OPTIONS, result));
+  check(result, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::nvs_commit(Bench::DEFAULT_OPTIONS, result));
+  check(result, BENCH_ITERATIONS);
+}
+
+void delay_accuracy() {
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::delay_accuracy(DELAY_OPTIONS, result));
+  check(result, 50);
+  TEST_ASSERT_TRUE(result.min >=
+                   (BENCH_DELAY_MS - portTICK_PERIOD_MS) * 1000);
+  TEST_ASSERT_TRUE(result.p99 <= BENCH_DELAY_MS * 1000 + 1000);
+
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::delay_period(DELAY_OPTIONS, result));
+  check(result, 50);
+  TEST_ASSERT_TRUE(result.mean >= BENCH_DELAY_MS * 1000 - 200);
+  TEST_ASSERT_TRUE(result.mean <= BENCH_DELAY_MS * 1000 + 200);
+}
+
+void dns_latency() {
+  if (!EasyWifi::is_connected()) {
+    TEST_IGNORE_MESSAGE("No Wi-Fi connection");
+  }
+  Bench::Result cached, uncached;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::dns_cached(DNS_HOST, Bench::DEFAULT_OPTIONS,
+                                              cached));
+  check(cached, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::dns_uncached(DNS_DOMAIN, SLOW_OPTIONS, uncached));
+  check(uncached, 50);
+  TEST_ASSERT_TRUE(cached.p50 < uncached.p50 * 1000);
+}
+
+/* Overwrites the start of the next OTA slot, never the running image */
+void ota_throughput() {
+  const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+  TEST_ASSERT_NOT_NULL(next);
+  Update::EspPartition partition(next);
+  Bench::Result result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::ota_write(partition, SLOW_OPTIONS, result));
+  check(result, 50);
+}
+
+void work_pool() {
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  Bench::Result latency, throughput;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::work_latency(Bench::DEFAULT_OPTIONS, latency));
+  check(latency, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::work_throughput(Bench::DEFAULT_OPTIONS, throughput));
+  check(throughput, BENCH_ITERATIONS);
+  Work::stop();
+}
+
+void wake_up() {
+  Bench::Result group, notification;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Bench::wake_event_group(Bench::DEFAULT_OPTIONS, group));
+  check(group, BENCH_ITERATIONS);
+  TEST_ASSERT_EQUAL(
+      ESP_OK, Bench::wake_notification(Bench::DEFAULT_OPTIONS, notification));
+  check(notification, BENCH_ITERATIONS);
+}
+
+void test_task(void *) {
+  vTaskDelay(2000 / portTICK_PERIOD_MS);
+  EasyWifi::init_hardware();
+  EasyWifi::init_software();
+  EasyWifi::wait_for_wifi(30);
+  NVS.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(nvs_latency);
+  RUN_TEST(delay_accuracy);
+  RUN_TEST(dns_latency);
+  RUN_TEST(ota_throughput);
+  RUN_TEST(work_pool);
+  RUN_TEST(wake_up);
+  UNITY_END();
+  vTaskDelete(NULL);
+}
+
+void app_main() { xTaskCreate(test_task, "test", 8192, NULL, 1, NULL); }
+
+#endif
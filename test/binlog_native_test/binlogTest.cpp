@@ -0,0 +1,215 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Log/BinLog.h"
+
+static const char *TAG = "NVS";
+static const int BENCH_CALLS = 64 * 1000;
+
+static std::string next_line() {
+  BinLog::Record record;
+  if (!BinLog::pop(record)) {
+    return "";
+  }
+  char line[BINLOG_LINE_SIZE];
+  BinLog::format(record, line, sizeof(line));
+  return line;
+}
+
+/* Message after the "I (time) TAG: " prefix */
+static std::string next_message() {
+  std::string line = next_line();
+  size_t colon = line.find(": ");
+  return colon == std::string::npos ? "" : line.substr(colon + 2);
+}
+
+static void drain() {
+  BinLog::Record record;
+  while (BinLog::pop(record)) {
+  }
+  BinLog::dropped();
+}
+
+void formats_like_esp_log() {
+  drain();
+  const char *key = "wifi_ssid";
+  BLOGI(TAG, "Read key \"%s\" from NVS", key);
+  std::string line = next_line();
+  unsigned time;
+  char tag[8];
+  TEST_ASSERT_EQUAL(2, sscanf(line.c_str(), "I (%u) %7[^:]:", &time, tag));
+  TEST_ASSERT_EQUAL_STRING("NVS", tag);
+  TEST_ASSERT_TRUE(line.find(": Read key \"wifi_ssid\" from NVS") !=
+                   std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("", next_line().c_str());
+}
+
+void formats_arguments() {
+  drain();
+  int32_t error = -4354;
+  uint32_t size = 4000000000u;
+  uint8_t ip[4] = {192, 168, 1, 20};
+  BLOGW(TAG, "Error (%i), %lu bytes, 0x%04x, %%", error, size, 0xbeef);
+  BLOGI(TAG, "IP:%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  BLOGE(TAG, "%.2f %c %s", 3.14159f, 'x', "done");
+  TEST_ASSERT_EQUAL_STRING("Error (-4354), 4000000000 bytes, 0xbeef, %",
+                           next_message().c_str());
+  TEST_ASSERT_EQUAL_STRING("IP:192.168.1.20", next_message().c_str());
+  TEST_ASSERT_EQUAL_STRING("3.14 x done", next_message().c_str());
+}
+
+void truncates_strings() {
+  drain();
+  BLOGI(TAG, "[%s]", "a host name much longer than the record holds");
+  std::string expected =
+      "[" +
+      std::string("a host name much longer than the record holds")
+          .substr(0, BINLOG_TEXT_SIZE - 1) +
+      "]";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), next_message().c_str());
+
+  char line[16];
+  BLOGI(TAG, "%s", "0123456789");
+  BinLog::Record record;
+  TEST_ASSERT_TRUE(BinLog::pop(record));
+  TEST_ASSERT_EQUAL(sizeof(line) - 1,
+                    BinLog::format(record, line, sizeof(line)));
+}
+
+/* BINLOG_LEVEL is INFO natively */
+void filters_levels() {
+  drain();
+  BLOGD(TAG, "debug %d", 1);
+  BLOGV(TAG, "verbose %d", 2);
+  TEST_ASSERT_EQUAL_STRING("", next_line().c_str());
+}
+
+void counts_dropped() {
+  drain();
+  for (int i = 0; i < BINLOG_RING_SIZE + 5; i++) {
+    BLOGI(TAG, "%d", i);
+  }
+  TEST_ASSERT_EQUAL(5, BinLog::dropped());
+  TEST_ASSERT_EQUAL(0, BinLog::dropped());
+  for (int i = 0; i < BINLOG_RING_SIZE; i++) {
+    TEST_ASSERT_EQUAL_STRING(std::to_string(i).c_str(),
+                             next_message().c_str());
+  }
+  TEST_ASSERT_EQUAL_STRING("", next_line().c_str());
+}
+
+static std::atomic<int> output_lines;
+static std::atomic<int> output_dropped;
+
+static void count_lines(uint8_t level, const char *line) {
+  unsigned lost;
+  if (sscanf(line, "W (%*u) BinLog: %u records dropped", &lost) == 1) {
+    output_dropped += lost;
+  } else {
+    output_lines++;
+  }
+}
+
+/* Every record from several tasks is either output or counted as dropped */
+void concurrent_producers() {
+  drain();
+  output_lines = 0;
+  output_dropped = 0;
+  BinLog::set_output(count_lines);
+  TEST_ASSERT_EQUAL(ESP_OK, BinLog::start());
+
+  const int tasks = 4, calls = 5000;
+  std::vector<std::thread> producers;
+  for (int t = 0; t < tasks; t++) {
+    producers.emplace_back([t] {
+      for (int i = 0; i < calls; i++) {
+        BLOGI(TAG, "task %d call %d", t, i);
+        if (i % 16 == 0) {
+          Port::sleep_ms(1);
+        }
+      }
+    });
+  }
+  for (std::thread &producer : producers) {
+    producer.join();
+  }
+  BinLog::stop();
+  BinLog::set_output(nullptr);
+
+  printf("%d lines output, %d dropped\n", output_lines.load(),
+         output_dropped.load());
+  TEST_ASSERT_EQUAL(tasks * calls, output_lines + output_dropped);
+  TEST_ASSERT_TRUE(output_lines > 0);
+}
+
+/* ESP_LOGI formats and writes each line before returning. Natively the UART
+ * is a descriptor that discards the line. */
+static FILE *uart;
+
+static void esp_logi(const char *tag, const char *format, ...) {
+  char line[BINLOG_LINE_SIZE];
+  int n = snprintf(line, sizeof(line), "I (%u) %s: ",
+                   static_cast<unsigned>(Port::micros() / 1000), tag);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line + n, sizeof(line) - n, format, args);
+  va_end(args);
+  fprintf(uart, "%s\n", line);
+}
+
+/* Nanoseconds per call, best of three. The rings are drained between
+ * batches, outside the timed part. */
+static double bench(bool binary) {
+  double best = 1e9;
+  for (int run = 0; run < 3; run++) {
+    uint64_t total = 0;
+    for (int done = 0; done < BENCH_CALLS; done += BINLOG_RING_SIZE) {
+      const char *key = "wifi_ssid";
+      uint64_t start = Port::micros();
+      for (int i = 0; i < BINLOG_RING_SIZE; i++) {
+        if (binary) {
+          BLOGI(TAG, "Read key \"%s\" from NVS", key);
+        } else {
+          esp_logi(TAG, "Read key \"%s\" from NVS", key);
+        }
+      }
+      total += Port::micros() - start;
+      drain();
+    }
+    best = std::min(best, total * 1000.0 / BENCH_CALLS);
+  }
+  return best;
+}
+
+void per_call_cost() {
+  uart = fopen("/dev/null", "w");
+  setvbuf(uart, nullptr, _IONBF, 0);
+  double text = bench(false);
+  double binary = bench(true);
+  fclose(uart);
+  printf("per call: ESP_LOGI %.0f ns, BLOGI %.0f ns\n", text, binary);
+  TEST_ASSERT_EQUAL(0, BinLog::dropped());
+  TEST_ASSERT_TRUE(binary * 3 < text);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(formats_like_esp_log);
+  RUN_TEST(formats_arguments);
+  RUN_TEST(truncates_strings);
+  RUN_TEST(filters_levels);
+  RUN_TEST(counts_dropped);
+  RUN_TEST(concurrent_producers);
+  RUN_TEST(per_call_cost);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "Log/BinLog.h"
+
+extern "C" {
+void app_main();
+}
+
+static const char *TAG = "NVS";
+static const int BATCHES = 8;
+
+static void discard(uint8_t level, const char *line) {}
+
+/* Microseconds per call over BATCHES rings worth of calls. Formatting the
+ * binary records happens between batches, outside the timed part. */
+static float per_call_us(bool binary) {
+  const char *key = "wifi_ssid";
+  int64_t total = 0;
+  for (int batch = 0; batch < BATCHES; batch++) {
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BINLOG_RING_SIZE; i++) {
+      if (binary) {
+        BLOGI(TAG, "Read key \"%s\" from NVS", key);
+      } else {
+        ESP_LOGI(TAG, "Read key \"%s\" from NVS", key);
+      }
+    }
+    total += esp_timer_get_time() - start;
+    BinLog::flush();
+  }
+  return total / (float)(BATCHES * BINLOG_RING_SIZE);
+}
+
+void per_call_cost() {
+  BinLog::set_output(discard);
+  float text = per_call_us(false);
+  float binary = per_call_us(true);
+  BinLog::set_output(nullptr);
+  printf("per call: ESP_LOGI %.2f us, BLOGI %.2f us\n", text, binary);
+  TEST_ASSERT_EQUAL(0, BinLog::dropped());
+  TEST_ASSERT_TRUE(binary * 10 < text);
+}
+
+void test_task(void *) {
+  vTaskDelay(2000 / portTICK_PERIOD_MS);
+  UNITY_BEGIN();
+  RUN_TEST(per_call_cost);
+  UNITY_END();
+  vTaskDelete(NULL);
+}
+
+void app_main() { xTaskCreate(test_task, "test", 4096, NULL, 1, NULL); }
+
+#endif
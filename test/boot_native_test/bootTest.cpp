@@ -0,0 +1,91 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include "Boot/Boot.h"
+#include "Work/Work.h"
+
+/* Stages are defined inside the tests, so each run() only sees its own */
+
+static esp_err_t ok() { return ESP_OK; }
+
+static esp_err_t sleep_50ms() {
+  Port::sleep_ms(50);
+  return ESP_OK;
+}
+
+static esp_err_t fails() { return ESP_ERR_NOT_FOUND; }
+
+/* Every stage starts after the stages it needs have ended */
+void runs_after_dependencies() {
+  static Boot::Stage nvs("nvs", sleep_50ms);
+  static Boot::Stage netif("netif", ok);
+  static Boot::Stage config("wifi.config", ok, {&nvs, &netif});
+  static Boot::Stage radio("wifi.start", ok, {&config});
+  TEST_ASSERT_EQUAL(ESP_OK, Boot::run());
+  Boot::report();
+
+  TEST_ASSERT_TRUE(radio.state() == Boot::State::DONE);
+  TEST_ASSERT_TRUE(config.start_us() >= nvs.end_us());
+  TEST_ASSERT_TRUE(config.start_us() >= netif.end_us());
+  TEST_ASSERT_TRUE(radio.start_us() >= config.end_us());
+  /* Nothing left to run */
+  TEST_ASSERT_EQUAL(ESP_OK, Boot::run());
+}
+
+/* Independent stages overlap on the workers */
+void runs_independent_stages_at_once() {
+  static Boot::Stage first("first", sleep_50ms);
+  static Boot::Stage second("second", sleep_50ms);
+  static Boot::Stage joined("joined", ok, {&first, &second});
+  uint64_t start = Port::micros();
+  TEST_ASSERT_EQUAL(ESP_OK, Boot::run());
+  uint32_t ms = (Port::micros() - start) / 1000;
+  printf("two 50 ms stages in %u ms\n", ms);
+  TEST_ASSERT_TRUE(ms < 90);
+  TEST_ASSERT_TRUE(second.start_us() < first.end_us());
+  TEST_ASSERT_TRUE(joined.state() == Boot::State::DONE);
+}
+
+/* A failure skips what comes after it, not the stages beside it */
+void skips_after_failure() {
+  static Boot::Stage broken("broken", fails);
+  static Boot::Stage needs("needs", ok, {&broken});
+  static Boot::Stage transitive("transitive", ok, {&needs});
+  static Boot::Stage beside("beside", ok);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, Boot::run());
+  Boot::report();
+  TEST_ASSERT_TRUE(broken.state() == Boot::State::FAILED);
+  TEST_ASSERT_TRUE(needs.state() == Boot::State::SKIPPED);
+  TEST_ASSERT_TRUE(transitive.state() == Boot::State::SKIPPED);
+  TEST_ASSERT_TRUE(beside.state() == Boot::State::DONE);
+  TEST_ASSERT_EQUAL(0, needs.start_us());
+}
+
+/* A cycle is refused without hanging run() */
+void refuses_cycles() {
+  static Boot::Stage ping("ping", ok);
+  static Boot::Stage pong("pong", ok, {&ping});
+  static Boot::Stage after("after", ok, {&pong});
+  static Boot::Stage free("free", ok);
+  TEST_ASSERT_EQUAL(ESP_OK, ping.after(&pong));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, Boot::run());
+  TEST_ASSERT_TRUE(ping.state() != Boot::State::DONE);
+  TEST_ASSERT_TRUE(pong.state() != Boot::State::DONE);
+  TEST_ASSERT_TRUE(after.state() == Boot::State::SKIPPED);
+  TEST_ASSERT_TRUE(free.state() == Boot::State::DONE);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ping.after(&free));
+}
+
+int main() {
+  UNITY_BEGIN();
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  RUN_TEST(runs_after_dependencies);
+  RUN_TEST(runs_independent_stages_at_once);
+  RUN_TEST(skips_after_failure);
+  RUN_TEST(refuses_cycles);
+  Work::stop();
+  return UNITY_END();
+}
+
+#endif
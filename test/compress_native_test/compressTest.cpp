@@ -0,0 +1,230 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include "Host/Compressor.h"
+#include "Host/FilePartition.h"
+#include "Update/Compressed.h"
+
+/* Peak heap tracking through the global allocator */
+static std::atomic<size_t> heap_in_use(0);
+static std::atomic<size_t> heap_peak(0);
+
+void *operator new(size_t size) {
+  size_t *block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *block = size;
+  size_t now = heap_in_use += size;
+  size_t peak = heap_peak;
+  while (now > peak && !heap_peak.compare_exchange_weak(peak, now)) {
+  }
+  return reinterpret_cast<char *>(block) + sizeof(max_align_t);
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  size_t *block = reinterpret_cast<size_t *>(static_cast<char *>(ptr) -
+                                             sizeof(max_align_t));
+  heap_in_use -= *block;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+static const size_t IMAGE_SIZE = 1200 * 1024;
+static const char *const PARTITION_FILE = "compress_native_test.bin";
+
+/* Firmware-like image: instructions drawn unevenly from a small set with
+ * varying operands, interleaved with string and constant tables */
+static std::string make_image(size_t size) {
+  static const char *const strings[] = {
+      "Error (%i) in esp_ota_begin", "HTTP_EVENT_ON_CONNECTED",
+      "Unable to get next update partition", "wifi:state: run -> init",
+      "nvs_flash_init failed", "Beginning OTA update"};
+  uint8_t opcodes[64][2];
+  uint32_t x = 0x9E3779B9;
+  auto next = [&x]() {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  };
+  for (auto &op : opcodes) {
+    op[0] = next();
+    op[1] = next();
+  }
+
+  std::string image;
+  image.reserve(size + 64);
+  while (image.size() < size) {
+    if (next() % 16 == 0) {
+      image += strings[next() % 6];
+      image.push_back('\0');
+      continue;
+    }
+    uint32_t r = next();
+    const uint8_t *op = opcodes[(r % 64) * (r / 64 % 64) / 64];
+    image.push_back(op[0]);
+    image.push_back(op[1]);
+    image.push_back(static_cast<char>(next() % 32));
+  }
+  image.resize(size);
+  return image;
+}
+
+/* Hands out the compressed image in TCP segment sized reads */
+class MemorySource : public Update::ChunkSource {
+ public:
+  MemorySource(const std::string &data, size_t piece)
+      : data_(data), pos_(0), piece_(piece) {}
+
+  int read(uint8_t *dest, size_t size) override {
+    size_t n = std::min(std::min(size, piece_), data_.size() - pos_);
+    memcpy(dest, data_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+ private:
+  const std::string &data_;
+  size_t pos_;
+  size_t piece_;
+};
+
+/* Discards the output, for timing the decoder alone */
+class NullSink : public Update::ChunkSink {
+ public:
+  esp_err_t write(const uint8_t *data, size_t size) override {
+    return ESP_OK;
+  }
+};
+
+static esp_err_t decompress(const std::string &compressed,
+                            Update::ChunkSink &out, size_t piece) {
+  Update::Decompressor *decoder = new Update::Decompressor(out);
+  esp_err_t err = ESP_OK;
+  for (size_t pos = 0; err == ESP_OK && pos < compressed.size();
+       pos += piece) {
+    size_t n = std::min(piece, compressed.size() - pos);
+    err = decoder->write(
+        reinterpret_cast<const uint8_t *>(compressed.data()) + pos, n);
+  }
+  if (err == ESP_OK) {
+    err = decoder->finish();
+  }
+  delete decoder;
+  return err;
+}
+
+void round_trip() {
+  std::string image = make_image(64 * 1024 + 11);
+  for (uint8_t window_bits = 8; window_bits <= 12; window_bits++) {
+    std::string compressed = Host::compress(image, window_bits, 4);
+    Host::FilePartition partition(PARTITION_FILE);
+    TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+    TEST_ASSERT_EQUAL(ESP_OK, decompress(compressed, partition, 997));
+    TEST_ASSERT_TRUE(partition.contents() == image);
+  }
+  remove(PARTITION_FILE);
+}
+
+/* Compressed stream through the pipeline into flash, with no staging */
+void pipeline_benchmark() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string compressed = Host::compress(image);
+  printf("compressed %zu to %zu bytes (%.1f%%)\n", image.size(),
+         compressed.size(), 100.0 * compressed.size() / image.size());
+  TEST_ASSERT_TRUE(compressed.size() * 10 < image.size() * 8);
+
+  /* Decoder alone */
+  NullSink null;
+  auto start = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL(ESP_OK, decompress(compressed, null, 1460));
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("decoder: %.1f MiB/s of output\n",
+         image.size() / 1048576.0 / seconds);
+
+  /* Raw and compressed downloads, peak heap of each */
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  MemorySource raw_source(image, 1460);
+  size_t base = heap_in_use;
+  heap_peak = base;
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  TEST_ASSERT_EQUAL(ESP_OK, pipeline->run(raw_source, partition));
+  delete pipeline;
+  size_t raw_heap = heap_peak - base;
+
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  MemorySource source(compressed, 1460);
+  base = heap_in_use;
+  heap_peak = base;
+  pipeline = new Update::Pipeline();
+  Update::Decompressor *decoder = new Update::Decompressor(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, pipeline->run(source, *decoder));
+  TEST_ASSERT_EQUAL(ESP_OK, decoder->finish());
+  Update::PipelineStats stats = pipeline->stats();
+  delete decoder;
+  delete pipeline;
+  size_t compressed_heap = heap_peak - base;
+
+  printf("pipeline: %zu compressed bytes in %.3f s (%.1f MiB/s of output), "
+         "peak heap %zu bytes, raw image %zu bytes\n",
+         stats.bytes, stats.elapsed_us / 1e6,
+         image.size() / 1048576.0 / (stats.elapsed_us / 1e6),
+         compressed_heap, raw_heap);
+  TEST_ASSERT_TRUE(partition.contents() == image);
+  TEST_ASSERT_TRUE(compressed_heap <
+                   raw_heap + sizeof(Update::Decompressor) + 1024);
+  remove(PARTITION_FILE);
+}
+
+void rejects_bad_streams() {
+  std::string image = make_image(32 * 1024);
+  std::string compressed = Host::compress(image);
+  Host::FilePartition partition(PARTITION_FILE);
+
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    decompress(compressed.substr(0, compressed.size() - 10),
+                               partition, 512));
+
+  std::string corrupt = compressed;
+  corrupt[corrupt.size() / 2] ^= 0x04;
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  esp_err_t err = decompress(corrupt, partition, 512);
+  TEST_ASSERT_TRUE(err == ESP_ERR_INVALID_CRC || err == ESP_ERR_INVALID_SIZE);
+
+  std::string wide = compressed;
+  wide[4] = COMPRESSED_WINDOW_BITS_MAX + 1;
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, decompress(wide, partition, 512));
+
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION,
+                    decompress(image, partition, 512));
+  remove(PARTITION_FILE);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(round_trip);
+  RUN_TEST(pipeline_benchmark);
+  RUN_TEST(rejects_bad_streams);
+  return UNITY_END();
+}
+
+#endif
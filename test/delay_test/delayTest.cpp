@@ -9,34 +9,35 @@ void app_main();
 void ms_to_ticks() {
 	uint32_t ms = 100;
 	TickType_t expected_ticks = ms / portTICK_PERIOD_MS;
-	TickType_t actual_ticks = Delay.millisecondsToTicks(ms);
+	TickType_t actual_ticks = Delay::ms_to_ticks(ms);
 	TEST_ASSERT_EQUAL(expected_ticks, actual_ticks);
 }
 
 void ticks_to_ms() {
 	TickType_t ticks = 100;
 	uint32_t expected_ms = ticks * portTICK_PERIOD_MS;
-	uint32_t actual_ms = Delay.ticksToMilliseconds(ticks);
+	uint32_t actual_ms = Delay::ticks_to_ms(ticks);
 	TEST_ASSERT_EQUAL(expected_ms, actual_ms);
 }
 
 void delay() {
 	uint32_t delay_ms = 100;
 	TickType_t start_count = xTaskGetTickCount();
-	Delay.delay(delay_ms);
+	Delay::delay(delay_ms);
 	TickType_t end_count = xTaskGetTickCount();
 
-	uint32_t actual_ms = Delay.ticksToMilliseconds(end_count - start_count);
+	uint32_t actual_ms = Delay::ticks_to_ms(end_count - start_count);
 	TEST_ASSERT_EQUAL(delay_ms, actual_ms);
 }
 
 void delay_until_ms() {
 	uint32_t delay_ms = 100;
 	TickType_t start_count = xTaskGetTickCount();
-	Delay.waitForFixedPeriod(delay_ms, &start_count);
+	TickType_t wake_count = start_count;
+	Delay::delay_until_ms(delay_ms, &wake_count);
 	TickType_t end_count = xTaskGetTickCount();
 
-	uint32_t actual_ms = Delay.ticksToMilliseconds(end_count - start_count);
+	uint32_t actual_ms = Delay::ticks_to_ms(end_count - start_count);
 	TEST_ASSERT_EQUAL(delay_ms, actual_ms);
 }
 
@@ -0,0 +1,171 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Host/DeltaEncoder.h"
+#include "Host/FilePartition.h"
+#include "Update/Delta.h"
+
+static const size_t IMAGE_SIZE = 256 * 1024 + 77;
+static const char *const OLD_FILE = "delta_native_test_old.bin";
+static const char *const NEW_FILE = "delta_native_test_new.bin";
+
+/* Pseudo-random old image, with some structure for the matcher to find */
+static std::string make_image(size_t size) {
+  std::string image(size, '\0');
+  uint32_t x = 0x12345678;
+  for (size_t i = 0; i < size; i++) {
+    if (i % 1024 < 256) {
+      image[i] = static_cast<char>(i >> 10);
+    } else {
+      x = x * 1103515245 + 12345;
+      image[i] = static_cast<char>(x >> 16);
+    }
+  }
+  return image;
+}
+
+/* A typical release: code inserted and removed, constants and pointers
+ * changed, and everything after an edit shifted */
+static std::string make_release(const std::string &old_image) {
+  std::string image = old_image;
+  image.insert(20000, std::string(1500, 'N'));
+  image.erase(90000, 700);
+  for (size_t i = 100000; i < image.size(); i += 4096) {
+    image[i] = static_cast<char>(image[i] + 4);
+  }
+  image.replace(180000, 64, std::string(64, '\x5a'));
+  image.append("version 1.1");
+  return image;
+}
+
+/* Writes 'image' to a partition file, as flashed */
+static void flash(Host::FilePartition &partition, const std::string &image) {
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  TEST_ASSERT_EQUAL(ESP_OK, partition.erase(0, partition.size()));
+  TEST_ASSERT_EQUAL(ESP_OK, partition.write(0, image.data(), image.size()));
+}
+
+/* Feeds the patch in uneven pieces, like network reads */
+static esp_err_t apply(Update::DeltaDecoder &decoder, const std::string &patch,
+                       size_t piece) {
+  for (size_t pos = 0; pos < patch.size(); pos += piece) {
+    size_t n = patch.size() - pos < piece ? patch.size() - pos : piece;
+    esp_err_t err = decoder.write(
+        reinterpret_cast<const uint8_t *>(patch.data()) + pos, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return decoder.finish();
+}
+
+void round_trip() {
+  std::string old_image = make_image(IMAGE_SIZE);
+  std::string new_image = make_release(old_image);
+  std::string patch = Host::make_delta(old_image, new_image);
+  printf("Patch is %u bytes for a %u byte image\n",
+         (unsigned)patch.size(), (unsigned)new_image.size());
+  TEST_ASSERT_TRUE(patch.size() * 20 < new_image.size());
+
+  Host::FilePartition old_partition(OLD_FILE);
+  flash(old_partition, old_image);
+  Host::FilePartition new_partition(NEW_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+
+  Update::DeltaDecoder *decoder =
+      new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_OK, apply(*decoder, patch, 1373));
+  TEST_ASSERT_EQUAL(new_image.size(), decoder->image_size());
+  delete decoder;
+
+  std::string contents = new_partition.contents();
+  TEST_ASSERT_EQUAL(new_image.size(), contents.size());
+  TEST_ASSERT_TRUE(contents == new_image);
+}
+
+void unrelated_images() {
+  std::string old_image = make_image(IMAGE_SIZE / 4);
+  std::string new_image(IMAGE_SIZE / 4 + 10, '\0');
+  for (size_t i = 0; i < new_image.size(); i++) {
+    new_image[i] = static_cast<char>(i * 7 + (i >> 8));
+  }
+  std::string patch = Host::make_delta(old_image, new_image);
+
+  Host::FilePartition old_partition(OLD_FILE);
+  flash(old_partition, old_image);
+  Host::FilePartition new_partition(NEW_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+
+  Update::DeltaDecoder *decoder =
+      new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_OK, apply(*decoder, patch, 1));
+  delete decoder;
+  TEST_ASSERT_TRUE(new_partition.contents() == new_image);
+}
+
+void rejects_wrong_base() {
+  std::string old_image = make_image(IMAGE_SIZE);
+  std::string patch = Host::make_delta(old_image, make_release(old_image));
+
+  /* The device runs something other than the patch base */
+  std::string running = old_image;
+  running[1234] ^= 1;
+  Host::FilePartition old_partition(OLD_FILE);
+  flash(old_partition, running);
+  Host::FilePartition new_partition(NEW_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+
+  Update::DeltaDecoder *decoder =
+      new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, apply(*decoder, patch, 4096));
+  delete decoder;
+  TEST_ASSERT_EQUAL(0, new_partition.contents().size());
+}
+
+void rejects_bad_patches() {
+  std::string old_image = make_image(IMAGE_SIZE);
+  std::string patch = Host::make_delta(old_image, make_release(old_image));
+  Host::FilePartition old_partition(OLD_FILE);
+  flash(old_partition, old_image);
+  Host::FilePartition new_partition(NEW_FILE);
+
+  /* Truncated */
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+  Update::DeltaDecoder *decoder =
+      new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    apply(*decoder, patch.substr(0, patch.size() - 5), 512));
+  delete decoder;
+
+  /* Not a patch */
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+  decoder = new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION,
+                    apply(*decoder, std::string(200, 'x'), 512));
+  delete decoder;
+
+  /* Corrupted body, caught by the digest of the new image */
+  std::string corrupt = patch;
+  corrupt[corrupt.size() - 3] ^= 0x10;
+  TEST_ASSERT_EQUAL(ESP_OK, new_partition.open());
+  decoder = new Update::DeltaDecoder(old_partition, new_partition);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, apply(*decoder, corrupt, 512));
+  delete decoder;
+
+  remove(OLD_FILE);
+  remove(NEW_FILE);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(round_trip);
+  RUN_TEST(unrelated_images);
+  RUN_TEST(rejects_wrong_base);
+  RUN_TEST(rejects_bad_patches);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Bench/Bench.h"
+#include "Fifo/Fifo.h"
+#include "Host/FilePartition.h"
+
+#define PARTITION_FILE "fifo_native_test.bin"
+
+/* Four sectors, small enough to wrap quickly */
+#define SMALL_PARTITION (4 * FIFO_SECTOR_SIZE)
+
+/* Records holding their index */
+struct Reading {
+  uint32_t index;
+  uint8_t fill[28];
+};
+
+static Reading reading(uint32_t index) {
+  Reading r;
+  r.index = index;
+  memset(r.fill, index & 0xFF, sizeof(r.fill));
+  return r;
+}
+
+/* Checks each drained record follows the one before */
+struct Expect {
+  uint32_t next;
+  size_t limit;  // Stop after this many
+};
+
+static bool expect_next(const uint8_t *data, size_t size, void *arg) {
+  Expect &expect = *static_cast<Expect *>(arg);
+  if (expect.limit == 0) {
+    return false;
+  }
+  Reading r;
+  TEST_ASSERT_EQUAL(sizeof(r), size);
+  memcpy(&r, data, size);
+  TEST_ASSERT_EQUAL(expect.next, r.index);
+  expect.next++;
+  expect.limit--;
+  return true;
+}
+
+static void push_range(Fifo::Queue &queue, uint32_t first, uint32_t count) {
+  for (uint32_t i = first; i < first + count; i++) {
+    Reading r = reading(i);
+    TEST_ASSERT_EQUAL(ESP_OK, queue.push(&r, sizeof(r)));
+  }
+}
+
+/* Records come back in order, and are still there after a reset */
+void keeps_order() {
+  Host::FilePartition partition(PARTITION_FILE, 0, SMALL_PARTITION);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, queue.push("x", 1));
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  TEST_ASSERT_EQUAL(4, queue.sectors());
+  TEST_ASSERT_EQUAL(0, queue.size());
+
+  push_range(queue, 0, 10);
+  Reading r;
+  size_t size;
+  TEST_ASSERT_EQUAL(ESP_OK, queue.peek(&r, sizeof(r), &size));
+  TEST_ASSERT_EQUAL(0, r.index);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, queue.peek(&r, 4, &size));
+  TEST_ASSERT_EQUAL(ESP_OK, queue.pop(3));
+  TEST_ASSERT_EQUAL(7, queue.size());
+
+  partition.open(false);
+  Fifo::Queue rebooted(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, rebooted.open());
+  TEST_ASSERT_EQUAL(7, rebooted.size());
+  Expect expect = {3, 100};
+  size_t drained;
+  TEST_ASSERT_EQUAL(ESP_OK, rebooted.drain(expect_next, &expect, 100,
+                                           &drained));
+  TEST_ASSERT_EQUAL(7, drained);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, rebooted.peek(&r, sizeof(r), &size));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    rebooted.push(&r, FIFO_MAX_RECORD_SIZE + 1));
+}
+
+/* The ring wraps many times, full sectors are erased as they drain */
+void wraps_around() {
+  Host::FilePartition partition(PARTITION_FILE, 0, SMALL_PARTITION);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+
+  Expect expect = {0, 0};
+  uint32_t pushed = 0;
+  for (int round = 0; round < 20; round++) {
+    push_range(queue, pushed, 100);
+    pushed += 100;
+    expect.limit = 95;
+    size_t drained;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      queue.drain(expect_next, &expect, 1000, &drained));
+    TEST_ASSERT_EQUAL(95, drained);
+    TEST_ASSERT_TRUE(queue.used() <= 2);
+
+    /* Across a reset every few rounds */
+    if (round % 5 == 4) {
+      partition.open(false);
+      TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+    }
+    TEST_ASSERT_EQUAL(pushed - expect.next, queue.size());
+  }
+
+  /* Full */
+  Reading r = reading(pushed);
+  esp_err_t err;
+  while ((err = queue.push(&r, sizeof(r))) == ESP_OK) {
+    r.index = ++pushed;
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, err);
+  TEST_ASSERT_EQUAL(4, queue.used());
+  expect.limit = 1000;
+  size_t drained;
+  TEST_ASSERT_EQUAL(ESP_OK, queue.drain(expect_next, &expect, 1000, &drained));
+  TEST_ASSERT_EQUAL(pushed, expect.next);
+  TEST_ASSERT_EQUAL(0, queue.size());
+  TEST_ASSERT_TRUE(queue.used() <= 1);
+}
+
+/* A batch is queued whole or not at all, unless the oldest may be dropped */
+void batches_and_overwrites() {
+  Host::FilePartition partition(PARTITION_FILE, 0, SMALL_PARTITION);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+
+  static Reading readings[600];
+  Fifo::Record records[600];
+  for (uint32_t i = 0; i < 600; i++) {
+    readings[i] = reading(i);
+    records[i] = {&readings[i], sizeof(readings[i])};
+  }
+  /* 40 bytes each, 102 to a sector */
+  TEST_ASSERT_EQUAL(ESP_OK, queue.push(records, 400));
+  TEST_ASSERT_EQUAL(400, queue.size());
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, queue.push(records + 400, 200));
+  TEST_ASSERT_EQUAL(400, queue.size());
+
+  Fifo::Queue lossy(partition, true);
+  TEST_ASSERT_EQUAL(ESP_OK, lossy.open());
+  TEST_ASSERT_EQUAL(ESP_OK, lossy.push(records + 400, 200));
+  Fifo::Stats stats = lossy.stats();
+  TEST_ASSERT_EQUAL(200, stats.appended);
+  TEST_ASSERT_EQUAL(600 - lossy.size(), stats.dropped);
+  Expect expect = {(uint32_t)stats.dropped, 1000};
+  size_t drained;
+  TEST_ASSERT_EQUAL(ESP_OK, lossy.drain(expect_next, &expect, 1000, &drained));
+  TEST_ASSERT_EQUAL(600, expect.next);
+}
+
+/* A record cut short by a reset is dropped, and appends move to the next
+ * sector */
+void recovers_torn_write() {
+  Host::FilePartition partition(PARTITION_FILE, 0, SMALL_PARTITION);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  push_range(queue, 0, 5);
+
+  /* Only the header and half the payload of the sixth reached flash */
+  Reading r = reading(5);
+  uint8_t torn[8 + sizeof(Reading) / 2];
+  uint16_t size = sizeof(r);
+  memset(torn, 0, sizeof(torn));
+  memcpy(torn, &size, sizeof(size));
+  torn[2] = 0xFF;
+  memcpy(torn + 8, &r, sizeof(torn) - 8);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.write(16 + 5 * 40, torn, sizeof(torn)));
+
+  partition.open(false);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  TEST_ASSERT_EQUAL(5, queue.size());
+  TEST_ASSERT_EQUAL(1, queue.stats().corrupt);
+  push_range(queue, 5, 5);
+  TEST_ASSERT_EQUAL(2, queue.used());
+
+  partition.open(false);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  Expect expect = {0, 100};
+  size_t drained;
+  TEST_ASSERT_EQUAL(ESP_OK, queue.drain(expect_next, &expect, 100, &drained));
+  TEST_ASSERT_EQUAL(10, drained);
+}
+
+/* A reset while a consumed sector is erased delivers its records again or
+ * drops the sector, never records still queued */
+void survives_interrupted_consume() {
+  Host::FilePartition partition(PARTITION_FILE, 0, SMALL_PARTITION);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  push_range(queue, 0, 150);
+  std::string before = partition.contents();
+
+  /* The whole first sector is consumed, and erased */
+  TEST_ASSERT_EQUAL(ESP_OK, queue.pop(102));
+  TEST_ASSERT_EQUAL(1, queue.used());
+
+  /* Reset during the erase, half the sector header is left */
+  std::string first = before.substr(0, FIFO_SECTOR_SIZE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.write(8, first.data() + 8,
+                                            FIFO_SECTOR_SIZE - 8));
+  partition.open(false);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  TEST_ASSERT_EQUAL(48, queue.size());
+
+  /* Reset before the erase, the sector reappears whole */
+  TEST_ASSERT_EQUAL(ESP_OK, partition.write(0, first.data(), first.size()));
+  partition.open(false);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  TEST_ASSERT_EQUAL(150, queue.size());
+
+  /* Records cleared one by one stay consumed */
+  TEST_ASSERT_EQUAL(ESP_OK, queue.pop(10));
+  partition.open(false);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  Expect expect = {10, 1000};
+  size_t drained;
+  TEST_ASSERT_EQUAL(ESP_OK, queue.drain(expect_next, &expect, 1000, &drained));
+  TEST_ASSERT_EQUAL(140, drained);
+}
+
+struct FifoRun {
+  Fifo::Queue *queue;
+  Fifo::Record records[16];
+};
+
+/* Keeps the benchmark from filling the queue */
+static bool make_room(FifoRun &run) {
+  if (run.queue->used() == run.queue->sectors()) {
+    return run.queue->clear() == ESP_OK;
+  }
+  return true;
+}
+
+static uint32_t push_single(void *arg) {
+  FifoRun &run = *static_cast<FifoRun *>(arg);
+  if (!make_room(run)) {
+    return BENCH_FAILED;
+  }
+  uint64_t start = Port::micros();
+  for (size_t i = 0; i < 16; i++) {
+    if (run.queue->push(run.records[i].data, run.records[i].size) != ESP_OK) {
+      return BENCH_FAILED;
+    }
+  }
+  return (Port::micros() - start) * 1000 / 16;
+}
+
+static uint32_t push_batch(void *arg) {
+  FifoRun &run = *static_cast<FifoRun *>(arg);
+  if (!make_room(run)) {
+    return BENCH_FAILED;
+  }
+  uint64_t start = Port::micros();
+  if (run.queue->push(run.records, 16) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  return (Port::micros() - start) * 1000 / 16;
+}
+
+static uint32_t reopen_us(void *arg) {
+  FifoRun &run = *static_cast<FifoRun *>(arg);
+  uint64_t start = Port::micros();
+  if (run.queue->open() != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  return Port::micros() - start;
+}
+
+/* Time per appended record one by one and in batches of 16, and to recover
+ * a full 64 KiB queue */
+void append_throughput() {
+  Host::FilePartition partition(PARTITION_FILE, 0, 16 * FIFO_SECTOR_SIZE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Fifo::Queue queue(partition, true);
+  TEST_ASSERT_EQUAL(ESP_OK, queue.open());
+  FifoRun run;
+  run.queue = &queue;
+  static Reading readings[16];
+  for (uint32_t i = 0; i < 16; i++) {
+    readings[i] = reading(i);
+    run.records[i] = {&readings[i], sizeof(readings[i])};
+  }
+
+  Bench::Scenario single = {"fifo.push", "ns", push_single, &run, 5, 200};
+  Bench::Scenario batch = {"fifo.push_batch", "ns", push_batch, &run, 5,
+                           200};
+  Bench::Result single_result, batch_result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(single, single_result));
+  Bench::print(single_result);
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(batch, batch_result));
+  Bench::print(batch_result);
+  printf("single %u records/s, batched %u records/s\n",
+         (unsigned)(1000000000ull / single_result.mean),
+         (unsigned)(1000000000ull / batch_result.mean));
+  TEST_ASSERT_TRUE(batch_result.p50 < single_result.p50);
+
+  /* Full, then recovered */
+  while (queue.used() < queue.sectors()) {
+    TEST_ASSERT_EQUAL(ESP_OK, queue.push(run.records, 16));
+  }
+  size_t queued = queue.size();
+  Bench::Scenario recovery = {"fifo.open_full", "us", reopen_us, &run, 2,
+                              50};
+  Bench::Result recovery_result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(recovery, recovery_result));
+  Bench::print(recovery_result);
+  TEST_ASSERT_EQUAL(queued, queue.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(keeps_order);
+  RUN_TEST(wraps_around);
+  RUN_TEST(batches_and_overwrites);
+  RUN_TEST(recovers_torn_write);
+  RUN_TEST(survives_interrupted_consume);
+  RUN_TEST(append_throughput);
+  return UNITY_END();
+}
+
+#endif
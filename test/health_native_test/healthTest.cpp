@@ -0,0 +1,215 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <string.h>
+#include "Update/Health.h"
+
+using Update::BootRecord;
+using Update::BootState;
+using Update::HealthMonitor;
+using Update::Verdict;
+
+static const uint32_t OLD_IMAGE = 0x10000;
+static const uint32_t NEW_IMAGE = 0x190000;
+static const uint32_t DEADLINE_MS = 30000;
+
+/* NVS stand-in, survives simulated reboots */
+class MemoryBootStore : public Update::BootStore {
+ public:
+  MemoryBootStore() : saved_(false) {}
+
+  esp_err_t load(BootRecord &record) override {
+    if (!saved_) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    record = record_;
+    return ESP_OK;
+  }
+  esp_err_t save(const BootRecord &record) override {
+    record_ = record;
+    saved_ = true;
+    return ESP_OK;
+  }
+
+  bool saved_;
+  BootRecord record_;
+};
+
+/* Boots whatever set_boot() chose on the next restart() */
+class FakeBootControl : public Update::BootControl {
+ public:
+  FakeBootControl()
+      : running_(OLD_IMAGE), boot_(OLD_IMAGE), restarts_(0), fail_(false) {}
+
+  uint32_t running() override { return running_; }
+  esp_err_t set_boot(uint32_t partition) override {
+    if (fail_) {
+      return ESP_FAIL;
+    }
+    boot_ = partition;
+    return ESP_OK;
+  }
+  void restart() override {
+    restarts_++;
+    running_ = boot_;
+  }
+
+  uint32_t running_;
+  uint32_t boot_;
+  uint32_t restarts_;
+  bool fail_;
+};
+
+static bool wifi_up = false;
+static bool check_wifi(void *arg) { return wifi_up; }
+
+static bool check_flag(void *arg) { return *static_cast<bool *>(arg); }
+
+/* Writes the new image and switches to it, as Update::end() does */
+static void install(MemoryBootStore &store, FakeBootControl &control) {
+  HealthMonitor monitor(store, control);
+  TEST_ASSERT_EQUAL(ESP_OK, monitor.mark_pending(NEW_IMAGE, OLD_IMAGE));
+  control.set_boot(NEW_IMAGE);
+  control.restart();
+}
+
+void confirms_healthy_image() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  install(store, control);
+  TEST_ASSERT_EQUAL(NEW_IMAGE, control.running_);
+
+  wifi_up = false;
+  bool backend = false;
+  HealthMonitor monitor(store, control);
+  monitor.add_check("wifi", check_wifi, nullptr);
+  monitor.add_check("backend", check_flag, &backend);
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.boot(1000, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(1, store.record_.attempts);
+
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.poll(2000));
+  TEST_ASSERT_EQUAL_STRING("wifi", monitor.failing());
+  wifi_up = true;
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.poll(3000));
+  TEST_ASSERT_EQUAL_STRING("backend", monitor.failing());
+
+  /* Passed checks stay passed */
+  wifi_up = false;
+  backend = true;
+  TEST_ASSERT_EQUAL(Verdict::CONFIRMED, monitor.poll(4000));
+  TEST_ASSERT_NULL(monitor.failing());
+  TEST_ASSERT_TRUE(store.record_.state == BootState::CONFIRMED);
+  TEST_ASSERT_EQUAL(1, control.restarts_);
+
+  /* Later boots have nothing to do */
+  HealthMonitor next(store, control);
+  TEST_ASSERT_EQUAL(Verdict::IDLE, next.boot(0, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(NEW_IMAGE, control.running_);
+}
+
+void rolls_back_after_deadline() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  install(store, control);
+
+  wifi_up = false;
+  HealthMonitor monitor(store, control);
+  monitor.add_check("wifi", check_wifi, nullptr);
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.boot(500, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.poll(500 + DEADLINE_MS - 1));
+  TEST_ASSERT_EQUAL(Verdict::ROLLED_BACK, monitor.poll(500 + DEADLINE_MS));
+
+  TEST_ASSERT_EQUAL(OLD_IMAGE, control.running_);
+  TEST_ASSERT_TRUE(store.record_.state == BootState::ROLLED_BACK);
+
+  HealthMonitor next(store, control);
+  TEST_ASSERT_EQUAL(Verdict::IDLE, next.boot(0, DEADLINE_MS));
+}
+
+/* Each boot crashes or trips the watchdog before the checks finish */
+void rolls_back_after_crash_loop() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  install(store, control);
+
+  for (uint32_t boot = 1; boot <= OTA_HEALTH_MAX_ATTEMPTS; boot++) {
+    HealthMonitor monitor(store, control);
+    monitor.add_check("wifi", check_wifi, nullptr);
+    TEST_ASSERT_EQUAL(Verdict::CHECKING, monitor.boot(0, DEADLINE_MS));
+    TEST_ASSERT_EQUAL(boot, store.record_.attempts);
+    control.restart();
+  }
+  TEST_ASSERT_EQUAL(NEW_IMAGE, control.running_);
+
+  HealthMonitor monitor(store, control);
+  TEST_ASSERT_EQUAL(Verdict::ROLLED_BACK, monitor.boot(0, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(OLD_IMAGE, control.running_);
+  TEST_ASSERT_TRUE(store.record_.state == BootState::ROLLED_BACK);
+}
+
+/* The new image did not boot at all and the bootloader fell back */
+void reports_bootloader_fallback() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  HealthMonitor installer(store, control);
+  TEST_ASSERT_EQUAL(ESP_OK, installer.mark_pending(NEW_IMAGE, OLD_IMAGE));
+
+  HealthMonitor monitor(store, control);
+  TEST_ASSERT_EQUAL(Verdict::ROLLED_BACK, monitor.boot(0, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(0, control.restarts_);
+  TEST_ASSERT_EQUAL(0, store.record_.attempts);
+  TEST_ASSERT_TRUE(store.record_.state == BootState::ROLLED_BACK);
+}
+
+/* A failed set_boot() leaves the image pending, the next boot retries */
+void retries_failed_rollback() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  install(store, control);
+  control.fail_ = true;
+
+  HealthMonitor monitor(store, control);
+  monitor.add_check("wifi", check_wifi, nullptr);
+  wifi_up = false;
+  monitor.boot(0, DEADLINE_MS);
+  TEST_ASSERT_EQUAL(Verdict::ROLLED_BACK, monitor.poll(DEADLINE_MS));
+  TEST_ASSERT_EQUAL(NEW_IMAGE, control.running_);
+  TEST_ASSERT_TRUE(store.record_.state == BootState::PENDING);
+
+  control.fail_ = false;
+  HealthMonitor retry(store, control);
+  retry.add_check("wifi", check_wifi, nullptr);
+  TEST_ASSERT_EQUAL(Verdict::CHECKING, retry.boot(0, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(2, store.record_.attempts);
+  TEST_ASSERT_EQUAL(Verdict::ROLLED_BACK, retry.poll(DEADLINE_MS));
+  TEST_ASSERT_EQUAL(OLD_IMAGE, control.running_);
+}
+
+void limits_checks() {
+  MemoryBootStore store;
+  FakeBootControl control;
+  HealthMonitor monitor(store, control);
+  for (int i = 0; i < OTA_HEALTH_MAX_CHECKS; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, monitor.add_check("wifi", check_wifi, nullptr));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM,
+                    monitor.add_check("wifi", check_wifi, nullptr));
+
+  /* No record at all */
+  TEST_ASSERT_EQUAL(Verdict::IDLE, monitor.boot(0, DEADLINE_MS));
+  TEST_ASSERT_EQUAL(Verdict::IDLE, monitor.poll(DEADLINE_MS * 2));
+  TEST_ASSERT_EQUAL(0, control.restarts_);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(confirms_healthy_image);
+  RUN_TEST(rolls_back_after_deadline);
+  RUN_TEST(rolls_back_after_crash_loop);
+  RUN_TEST(reports_bootloader_fallback);
+  RUN_TEST(retries_failed_rollback);
+  RUN_TEST(limits_checks);
+  return UNITY_END();
+}
+
+#endif
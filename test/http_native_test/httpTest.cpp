@@ -0,0 +1,187 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Bench/Bench.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "Http/Pool.h"
+
+/* Stands in for a TLS handshake, scaled down from the device's seconds */
+#define HANDSHAKE_US 5000
+
+static Host::HttpConnector connector;
+
+/* One GET through 'pool', reading the body to the end */
+static esp_err_t fetch(Http::Pool &pool, const std::string &url) {
+  Http::Connection *connection = pool.acquire(url.c_str());
+  if (connection == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  Host::HttpClient &client =
+      static_cast<Host::HttpConnection *>(connection)->client();
+  esp_err_t err = client.get(url);
+  uint8_t buf[512];
+  int n;
+  while (err == ESP_OK && (n = client.read(buf, sizeof(buf))) > 0) {
+  }
+  pool.release(connection, connection->reusable());
+  return err;
+}
+
+static Host::HttpServerOptions keep_alive(uint32_t ms) {
+  Host::HttpServerOptions options;
+  options.keep_alive_ms = ms;
+  return options;
+}
+
+void keys_by_host() {
+  char key[HTTP_POOL_KEY_SIZE];
+  TEST_ASSERT_EQUAL(ESP_OK, Http::host_key("https://example.com/fw.bin", key,
+                                           sizeof(key)));
+  TEST_ASSERT_EQUAL_STRING("https://example.com:443", key);
+  TEST_ASSERT_EQUAL(ESP_OK, Http::host_key("http://127.0.0.1:8080?v=2", key,
+                                           sizeof(key)));
+  TEST_ASSERT_EQUAL_STRING("http://127.0.0.1:8080", key);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    Http::host_key("ftp://example.com/", key, sizeof(key)));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    Http::host_key("http://example.com/", key, 8));
+}
+
+/* Requests to one host share a connection */
+void reuses_connection() {
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", keep_alive(1000)));
+  Http::Pool pool(connector);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, server.url()));
+  }
+  TEST_ASSERT_EQUAL(3, server.requests());
+  TEST_ASSERT_EQUAL(1, server.connections());
+  Http::PoolStats stats = pool.stats();
+  TEST_ASSERT_EQUAL(1, stats.created);
+  TEST_ASSERT_EQUAL(2, stats.reused);
+  TEST_ASSERT_EQUAL(1, pool.idle());
+  pool.clear();
+  TEST_ASSERT_EQUAL(0, pool.idle());
+  server.stop();
+}
+
+/* Past max_idle, the least recently used connection is closed */
+void evicts_least_recent() {
+  Host::HttpServer servers[3];
+  for (Host::HttpServer &server : servers) {
+    TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", keep_alive(1000)));
+  }
+  Http::Pool pool(connector, 2);
+  for (Host::HttpServer &server : servers) {
+    TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, server.url()));
+  }
+  TEST_ASSERT_EQUAL(1, pool.stats().evicted);
+  TEST_ASSERT_EQUAL(2, pool.idle());
+
+  /* The first was evicted, the second is still kept */
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, servers[1].url()));
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, servers[0].url()));
+  TEST_ASSERT_EQUAL(1, servers[1].connections());
+  TEST_ASSERT_EQUAL(2, servers[0].connections());
+  pool.clear();
+  for (Host::HttpServer &server : servers) {
+    server.stop();
+  }
+}
+
+/* A connection the server closed, or idle too long, is not handed out */
+void replaces_stale() {
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", keep_alive(20)));
+  Http::Pool pool(connector);
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, server.url()));
+  Port::sleep_ms(100);
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(pool, server.url()));
+  TEST_ASSERT_EQUAL(1, pool.stats().stale);
+  TEST_ASSERT_EQUAL(2, server.connections());
+  server.stop();
+
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", keep_alive(1000)));
+  Http::Pool short_lived(connector, HTTP_POOL_MAX_IDLE, 20);
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(short_lived, server.url()));
+  Port::sleep_ms(50);
+  TEST_ASSERT_EQUAL(ESP_OK, fetch(short_lived, server.url()));
+  TEST_ASSERT_EQUAL(1, short_lived.stats().stale);
+  TEST_ASSERT_EQUAL(2, server.connections());
+  short_lived.clear();
+  server.stop();
+}
+
+struct HttpRun {
+  std::string url;
+  Http::Pool *pool;
+};
+
+/* A new connection, and handshake, per request */
+static uint32_t fresh_once(void *arg) {
+  HttpRun &run = *static_cast<HttpRun *>(arg);
+  uint64_t start = Port::micros();
+  Host::HttpClient client;
+  if (client.get(run.url) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  uint8_t buf[512];
+  while (client.read(buf, sizeof(buf)) > 0) {
+  }
+  return Port::micros() - start;
+}
+
+static uint32_t pooled_once(void *arg) {
+  HttpRun &run = *static_cast<HttpRun *>(arg);
+  uint64_t start = Port::micros();
+  if (fetch(*run.pool, run.url) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  return Port::micros() - start;
+}
+
+/* Requests per second and latency against a server that charges a
+ * handshake per connection */
+void pooled_throughput() {
+  Host::HttpServerOptions options = keep_alive(1000);
+  options.handshake_us = HANDSHAKE_US;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(std::string(1024, 'x'), options));
+  Http::Pool pool(connector);
+  HttpRun run = {server.url("/status"), &pool};
+
+  Bench::Scenario fresh = {"http.get_fresh", "us", fresh_once, &run, 5, 100};
+  Bench::Scenario pooled = {"http.get_pooled", "us", pooled_once, &run, 5,
+                            100};
+  Bench::Result fresh_result, pooled_result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(fresh, fresh_result));
+  Bench::print(fresh_result);
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(pooled, pooled_result));
+  Bench::print(pooled_result);
+  printf("fresh %u requests/s, pooled %u requests/s\n",
+         1000000 / fresh_result.mean, 1000000 / pooled_result.mean);
+
+  TEST_ASSERT_TRUE(fresh_result.min >= HANDSHAKE_US);
+  TEST_ASSERT_TRUE(pooled_result.p50 < fresh_result.p50 / 2);
+  /* One connection for the warm-up, then reused */
+  TEST_ASSERT_EQUAL(1, pool.stats().created);
+  pool.clear();
+  server.stop();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(keys_by_host);
+  RUN_TEST(reuses_connection);
+  RUN_TEST(evicts_least_recent);
+  RUN_TEST(replaces_stale);
+  RUN_TEST(pooled_throughput);
+  return UNITY_END();
+}
+
+#endif
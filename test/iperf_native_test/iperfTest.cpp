@@ -0,0 +1,156 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "Iperf/Iperf.h"
+#include "Tuning/Tuning.h"
+
+#define TEST_DURATION_MS 300
+
+static Iperf::Server server;
+
+static Iperf::Test make_test(Iperf::Mode mode) {
+  Iperf::Test test;
+  test.mode = mode;
+  test.port = server.port();
+  test.duration_ms = TEST_DURATION_MS;
+  return test;
+}
+
+void finds_profiles() {
+  TEST_ASSERT_EQUAL_STRING("balanced", Tuning::current().name);
+  TEST_ASSERT_NULL(Tuning::find("turbo"));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, Tuning::select("turbo"));
+
+  /* Ordered by RAM, balanced being src/sdkconfig.h */
+  for (size_t i = 1; i < TUNING_PROFILE_COUNT; i++) {
+    TEST_ASSERT_TRUE(Tuning::profile(i).tcp_window >
+                     Tuning::profile(i - 1).tcp_window);
+    TEST_ASSERT_TRUE(Tuning::profile(i).static_rx_buffers >
+                     Tuning::profile(i - 1).static_rx_buffers);
+  }
+  const Tuning::Profile *balanced = Tuning::find("balanced");
+  TEST_ASSERT_NOT_NULL(balanced);
+  TEST_ASSERT_EQUAL(5744, balanced->tcp_window);
+  TEST_ASSERT_EQUAL(5744, balanced->tcp_send_buffer);
+  TEST_ASSERT_EQUAL(10, balanced->static_rx_buffers);
+  TEST_ASSERT_EQUAL(6, balanced->ba_window);
+
+  /* The kernel doubles what it is given */
+  TEST_ASSERT_EQUAL(ESP_OK, Tuning::select("low-memory"));
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  TEST_ASSERT_EQUAL(ESP_OK, Tuning::apply_socket(fd));
+  int window = 0;
+  socklen_t len = sizeof(window);
+  getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &window, &len);
+  TEST_ASSERT_TRUE(window >= 2872);
+  TEST_ASSERT_TRUE(window <= 2 * 5744);
+  Port::close_socket(fd);
+  TEST_ASSERT_EQUAL(ESP_OK, Tuning::select("balanced"));
+}
+
+void tcp_both_ways() {
+  Iperf::Report report;
+  Iperf::Test test = make_test(Iperf::Mode::TCP_UPLOAD);
+  TEST_ASSERT_EQUAL(ESP_OK, Iperf::run(test, report));
+  Iperf::print(test, report);
+  TEST_ASSERT_TRUE(report.bytes > 0);
+  TEST_ASSERT_TRUE(report.elapsed_us > TEST_DURATION_MS * 1000 / 2);
+  TEST_ASSERT_TRUE(report.kbps > 0);
+
+  test.mode = Iperf::Mode::TCP_DOWNLOAD;
+  TEST_ASSERT_EQUAL(ESP_OK, Iperf::run(test, report));
+  Iperf::print(test, report);
+  TEST_ASSERT_TRUE(report.bytes > 0);
+  TEST_ASSERT_TRUE(report.kbps > 0);
+  TEST_ASSERT_EQUAL(2, server.tests());
+}
+
+/* At a fixed rate nothing is lost on the loopback */
+void udp_at_rate() {
+  Iperf::Test test = make_test(Iperf::Mode::UDP_UPLOAD);
+  test.length = 1024;
+  test.rate_bytes_per_s = 1024 * 1000;
+  Iperf::Report report;
+  TEST_ASSERT_EQUAL(ESP_OK, Iperf::run(test, report));
+  Iperf::print(test, report);
+  TEST_ASSERT_EQUAL(0, report.lost);
+  TEST_ASSERT_TRUE(report.datagrams >= TEST_DURATION_MS * 8 / 10);
+  TEST_ASSERT_TRUE(report.datagrams <= TEST_DURATION_MS + 1);
+  TEST_ASSERT_EQUAL(report.datagrams * 1024, report.bytes);
+  TEST_ASSERT_TRUE(report.kbps > 8000 * 8 / 10);
+  TEST_ASSERT_TRUE(report.kbps < 8000 * 12 / 10);
+}
+
+void echo_latency() {
+  Iperf::Test test = make_test(Iperf::Mode::ECHO);
+  test.length = 64;
+  test.echoes = 100;
+  Iperf::Report report;
+  TEST_ASSERT_EQUAL(ESP_OK, Iperf::run(test, report));
+  Iperf::print(test, report);
+  TEST_ASSERT_EQUAL(100, report.rtt.n);
+  TEST_ASSERT_TRUE(report.rtt.p50 <= report.rtt.p99);
+  TEST_ASSERT_TRUE(report.rtt.p50 < 5000);
+}
+
+void rejects_bad_requests() {
+  Iperf::Test test = make_test(Iperf::Mode::TCP_UPLOAD);
+  test.length = IPERF_BUFFER_SIZE + 1;
+  Iperf::Report report;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, Iperf::run(test, report));
+
+  /* A stranger's bytes are answered with a refusal */
+  int fd = Port::tcp_connect(PORT_IPV4_LOOPBACK, server.port(), 1000);
+  TEST_ASSERT_TRUE(fd >= 0);
+  char request[IPERF_REQUEST_SIZE];
+  memset(request, 'x', sizeof(request));
+  TEST_ASSERT_TRUE(Port::send_all(fd, request, sizeof(request)));
+  uint8_t status = 0;
+  TEST_ASSERT_TRUE(Port::recv_all(fd, &status, 1));
+  TEST_ASSERT_EQUAL(1, status);
+  Port::close_socket(fd);
+
+  test.port = 1;
+  test.length = IPERF_DEFAULT_LENGTH;
+  TEST_ASSERT_EQUAL(ESP_FAIL, Iperf::run(test, report));
+}
+
+/* The same tests under every profile, for the table in the README. The
+ * loopback has no radio, so only the TCP buffers differ here. */
+void profile_sweep() {
+  Iperf::Mode modes[] = {Iperf::Mode::TCP_UPLOAD, Iperf::Mode::TCP_DOWNLOAD,
+                         Iperf::Mode::ECHO};
+  for (size_t i = 0; i < TUNING_PROFILE_COUNT; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, Tuning::select(Tuning::profile(i).name));
+    /* The listening socket takes the profile when it starts */
+    server.stop();
+    TEST_ASSERT_EQUAL(ESP_OK, server.start(0));
+    for (Iperf::Mode mode : modes) {
+      Iperf::Test test = make_test(mode);
+      Iperf::Report report;
+      TEST_ASSERT_EQUAL(ESP_OK, Iperf::run(test, report));
+      Iperf::print(test, report);
+    }
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, Tuning::select("balanced"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  if (server.start(0) != ESP_OK) {
+    printf("Could not start the server\n");
+    return 1;
+  }
+  RUN_TEST(finds_profiles);
+  RUN_TEST(tcp_both_ways);
+  RUN_TEST(udp_at_rate);
+  RUN_TEST(echo_latency);
+  RUN_TEST(rejects_bad_requests);
+  RUN_TEST(profile_sweep);
+  server.stop();
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include "Host/FilePartition.h"
+#include "Update/Manifest.h"
+#include "Update/OtaPipeline.h"
+
+static const size_t IMAGE_SIZE = 256 * 1024 + 300;
+static const char *const PARTITION_FILE = "manifest_native_test.bin";
+
+/* Test keys, generated for each run */
+static uint8_t seed[ED25519_SEED_SIZE];
+static uint8_t public_key[ED25519_PUBLIC_KEY_SIZE];
+
+static void generate_keys() {
+  std::random_device random;
+  for (size_t i = 0; i < sizeof(seed); i++) {
+    seed[i] = random();
+  }
+  Ed25519::public_key(seed, public_key);
+}
+
+static std::string make_image(size_t size) {
+  std::string image(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    image[i] = static_cast<char>((i * 2654435761u) >> 11);
+  }
+  return image;
+}
+
+static std::string make_manifest(const std::string &image,
+                                 const uint8_t *key_seed) {
+  uint8_t digest[SHA256_DIGEST_SIZE], manifest[MANIFEST_SIZE];
+  Sha256::digest(image.data(), image.size(), digest);
+  Update::sign_manifest(digest, image.size(), key_seed, manifest);
+  return std::string(reinterpret_cast<char *>(manifest), sizeof(manifest));
+}
+
+static esp_err_t set_manifest(Update::ImageVerifier &verifier,
+                              const std::string &manifest,
+                              const uint8_t *key = public_key) {
+  return verifier.set_manifest(
+      reinterpret_cast<const uint8_t *>(manifest.data()), manifest.size(),
+      key);
+}
+
+/* Hands out an image one TCP segment at a time, optionally throttled */
+class MemorySource : public Update::ChunkSource {
+ public:
+  MemorySource(const std::string &data, uint32_t us_per_segment = 0)
+      : data_(data), pos_(0), us_per_segment_(us_per_segment) {}
+
+  int read(uint8_t *dest, size_t size) override {
+    size_t n = std::min(std::min<size_t>(size, 1460), data_.size() - pos_);
+    if (us_per_segment_ > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(us_per_segment_));
+    }
+    memcpy(dest, data_.data() + pos_, n);
+    pos_ += n;
+    reader_ = std::this_thread::get_id();
+    return n;
+  }
+
+  /* Thread of the last read */
+  std::thread::id reader() const { return reader_; }
+
+ private:
+  const std::string &data_;
+  size_t pos_;
+  uint32_t us_per_segment_;
+  std::thread::id reader_;
+};
+
+/* Writes to flash and hashes each chunk, as Update::write_update() does */
+class VerifyingSink : public Update::ChunkSink {
+ public:
+  VerifyingSink(Update::ChunkSink &out, Update::ImageVerifier *verifier)
+      : out_(out), verifier_(verifier), hasher_() {}
+
+  esp_err_t write(const uint8_t *data, size_t size) override {
+    esp_err_t err = out_.write(data, size);
+    if (err == ESP_OK && verifier_ != nullptr) {
+      verifier_->update(data, size);
+      hasher_ = std::this_thread::get_id();
+    }
+    return err;
+  }
+
+  /* Thread of the last hash */
+  std::thread::id hasher() const { return hasher_; }
+
+ private:
+  Update::ChunkSink &out_;
+  Update::ImageVerifier *verifier_;
+  std::thread::id hasher_;
+};
+
+/* Where the last stream() read and hashed */
+static std::thread::id last_reader;
+static std::thread::id last_hasher;
+
+static uint64_t stream(const std::string &image,
+                       Update::ImageVerifier *verifier,
+                       uint32_t us_per_segment = 0) {
+  MemorySource source(image, us_per_segment);
+  Host::FilePartition partition(PARTITION_FILE, us_per_segment ? 1000 : 0);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  VerifyingSink sink(partition, verifier);
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  TEST_ASSERT_EQUAL(ESP_OK, pipeline->run(source, sink));
+  uint64_t elapsed = pipeline->stats().elapsed_us;
+  delete pipeline;
+  remove(PARTITION_FILE);
+  last_reader = source.reader();
+  last_hasher = sink.hasher();
+  return elapsed;
+}
+
+void rfc8032_vector() {
+  /* RFC 8032 section 7.1, test 2 */
+  static const uint8_t secret[32] = {
+      0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3,
+      0x46, 0xec, 0x11, 0x4e, 0x0f, 0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab,
+      0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb};
+  static const uint8_t expected_key[32] = {
+      0x3d, 0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a, 0x92, 0xb7, 0x0a,
+      0xa7, 0x4d, 0x1b, 0x7e, 0xbc, 0x9c, 0x98, 0x2c, 0xcf, 0x2e, 0xc4,
+      0x96, 0x8c, 0xc0, 0xcd, 0x55, 0xf1, 0x2a, 0xf4, 0x66, 0x0c};
+  static const uint8_t expected_sig[64] = {
+      0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8, 0x72, 0x0e, 0x82,
+      0x0b, 0x5f, 0x64, 0x25, 0x40, 0xa2, 0xb2, 0x7b, 0x54, 0x16, 0x50,
+      0x3f, 0x8f, 0xb3, 0x76, 0x22, 0x23, 0xeb, 0xdb, 0x69, 0xda, 0x08,
+      0x5a, 0xc1, 0xe4, 0x3e, 0x15, 0x99, 0x6e, 0x45, 0x8f, 0x36, 0x13,
+      0xd0, 0xf1, 0x1d, 0x8c, 0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a,
+      0xee, 0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00};
+  const uint8_t message = 0x72;
+
+  uint8_t key[32], sig[64];
+  Ed25519::public_key(secret, key);
+  TEST_ASSERT_EQUAL_MEMORY(expected_key, key, sizeof(key));
+  Ed25519::sign(secret, &message, 1, sig);
+  TEST_ASSERT_EQUAL_MEMORY(expected_sig, sig, sizeof(sig));
+  TEST_ASSERT_TRUE(Ed25519::verify(sig, &message, 1, key));
+}
+
+void accepts_signed_image() {
+  std::string image = make_image(IMAGE_SIZE);
+  Update::ImageVerifier verifier;
+  TEST_ASSERT_EQUAL(ESP_OK, set_manifest(verifier, make_manifest(image, seed)));
+  stream(image, &verifier);
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, verifier.size());
+  TEST_ASSERT_EQUAL(ESP_OK, verifier.verify());
+
+  /* Images hashed elsewhere, as by a resumable download */
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256::digest(image.data(), image.size(), digest);
+  TEST_ASSERT_EQUAL(ESP_OK, verifier.verify(digest, image.size()));
+}
+
+void rejects_modified_image() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string manifest = make_manifest(image, seed);
+
+  std::string modified = image;
+  modified[IMAGE_SIZE / 3] ^= 0x01;
+  Update::ImageVerifier verifier;
+  TEST_ASSERT_EQUAL(ESP_OK, set_manifest(verifier, manifest));
+  stream(modified, &verifier);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, verifier.verify());
+
+  verifier.reset();
+  TEST_ASSERT_EQUAL(ESP_OK, set_manifest(verifier, manifest));
+  stream(image.substr(0, IMAGE_SIZE - 1), &verifier);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, verifier.verify());
+
+  verifier.reset();
+  stream(image, &verifier);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, verifier.verify());
+}
+
+void rejects_forged_manifest() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string manifest = make_manifest(image, seed);
+  Update::ImageVerifier verifier;
+
+  /* Signed with another key */
+  uint8_t other[ED25519_SEED_SIZE];
+  memcpy(other, seed, sizeof(other));
+  other[0] ^= 0x80;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC,
+                    set_manifest(verifier, make_manifest(image, other)));
+
+  /* Digest swapped for another image's */
+  std::string forged = make_manifest(make_image(IMAGE_SIZE + 1), seed);
+  forged.replace(MANIFEST_BODY_SIZE, ED25519_SIGNATURE_SIZE, manifest,
+                 MANIFEST_BODY_SIZE, ED25519_SIGNATURE_SIZE);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, set_manifest(verifier, forged));
+
+  /* Signature scalar pushed past the group order */
+  std::string malleable = manifest;
+  malleable[MANIFEST_SIZE - 1] |= 0xF0;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, set_manifest(verifier, malleable));
+
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    set_manifest(verifier, manifest.substr(1)));
+  std::string magic = manifest;
+  magic[0] = 'X';
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, set_manifest(verifier, magic));
+
+  stream(image, &verifier);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, verifier.verify());
+}
+
+/* Without a key the signature is skipped, but the digest still counts */
+void unsigned_checks_digest() {
+  std::string image = make_image(IMAGE_SIZE);
+  uint8_t other[ED25519_SEED_SIZE];
+  memcpy(other, seed, sizeof(other));
+  other[0] ^= 0x80;
+  std::string manifest = make_manifest(image, other);
+
+  Update::ImageVerifier verifier;
+  TEST_ASSERT_EQUAL(ESP_OK, set_manifest(verifier, manifest, nullptr));
+  stream(image, &verifier);
+  TEST_ASSERT_EQUAL(ESP_OK, verifier.verify());
+
+  std::string modified = image;
+  modified[IMAGE_SIZE / 2] ^= 0x01;
+  verifier.reset();
+  TEST_ASSERT_EQUAL(ESP_OK, set_manifest(verifier, manifest, nullptr));
+  stream(modified, &verifier);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, verifier.verify());
+}
+
+/* Hashing runs in the writer while the receiver waits on the network, so a
+ * network bound update takes no longer with it. The timings depend on the
+ * host and are only printed. */
+void hashing_overlaps_io() {
+  std::string image = make_image(IMAGE_SIZE);
+  Update::ImageVerifier verifier;
+  uint64_t plain = stream(image, nullptr, 350);
+  uint64_t hashed = stream(image, &verifier, 350);
+  printf("throttled update: %.3f s plain, %.3f s hashed\n", plain / 1e6,
+         hashed / 1e6);
+  TEST_ASSERT_TRUE(last_hasher == std::this_thread::get_id());
+  TEST_ASSERT_TRUE(last_reader != std::thread::id());
+  TEST_ASSERT_TRUE(last_reader != last_hasher);
+}
+
+int main() {
+  generate_keys();
+  UNITY_BEGIN();
+  RUN_TEST(rfc8032_vector);
+  RUN_TEST(accepts_signed_image);
+  RUN_TEST(rejects_modified_image);
+  RUN_TEST(rejects_forged_manifest);
+  RUN_TEST(unsigned_checks_digest);
+  RUN_TEST(hashing_overlaps_io);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include "Bench/Bench.h"
+#include "DNS/DNS.h"
+#include "DNS/Mdns.h"
+
+#define SENSOR_ADDR PORT_IPV4(192, 168, 1, 50)
+#define TIMEOUT_MS 300
+#define RETRY_MS 100
+
+/* Another node on the loopback, answering for its own name */
+static DNS::Mdns responder;
+
+/* Group port for this run, so concurrent runs do not hear each other */
+static uint16_t group_port;
+
+static DNS::MdnsOptions loopback_options() {
+  DNS::MdnsOptions options;
+  options.port = group_port;
+  options.interface = PORT_IPV4_LOOPBACK;
+  options.retry_ms = RETRY_MS;
+  options.timeout_ms = TIMEOUT_MS;
+  return options;
+}
+
+static uint32_t counter(const char *name) {
+  return ((Metrics::Counter *)Metrics::find(name))->value();
+}
+
+static uint32_t ip4(const ip_addr_t &addr) {
+  return ntohl(addr.u_addr.ip4.addr);
+}
+
+/* Waits for the shared cache to hold, or not hold, 'name' */
+static bool wait_cached(const char *name, bool cached) {
+  uint32_t addr;
+  for (int i = 0; i < 100; i++) {
+    if (DNS::mdns().lookup(name, &addr) == cached) {
+      return true;
+    }
+    Port::sleep_ms(5);
+  }
+  return false;
+}
+
+/* Sends a datagram to the group, as some other node would */
+static void inject(const uint8_t *packet, size_t size) {
+  int fd = Port::udp_multicast(MDNS_GROUP, group_port, PORT_IPV4_LOOPBACK);
+  TEST_ASSERT_TRUE(fd >= 0);
+  TEST_ASSERT_TRUE(Port::udp_send(fd, MDNS_GROUP, group_port, packet, size));
+  Port::close_socket(fd);
+}
+
+void names() {
+  TEST_ASSERT_TRUE(DNS::is_local("sensor-3.local"));
+  TEST_ASSERT_TRUE(DNS::is_local("Sensor-3.LOCAL"));
+  TEST_ASSERT_FALSE(DNS::is_local("local"));
+  TEST_ASSERT_FALSE(DNS::is_local(".local"));
+  TEST_ASSERT_FALSE(DNS::is_local("tidalpaladin.com"));
+  TEST_ASSERT_FALSE(DNS::is_local("sensor.localhost"));
+
+  ip_addr_t addr;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    DNS::mdns().resolve("tidalpaladin.com", &addr));
+  char longest[MDNS_MAX_NAME + 2];
+  memset(longest, 'a', sizeof(longest));
+  strcpy(longest + sizeof(longest) - 7, ".local");
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, DNS::mdns().resolve(longest, &addr));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    responder.set_hostname("sensor-3.lan", SENSOR_ADDR));
+}
+
+/* An announcement fills the cache before anyone asks */
+void caches_announcements() {
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    responder.set_hostname("sensor-3.local", SENSOR_ADDR));
+  TEST_ASSERT_TRUE(wait_cached("sensor-3.local", true));
+
+  uint32_t queries = counter("mdns.queries");
+  uint32_t hits = counter("mdns.hits");
+  ip_addr_t addr;
+  uint64_t start = Port::micros();
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve("sensor-3.local", &addr));
+  TEST_ASSERT_TRUE(Port::micros() - start < 1000);
+  TEST_ASSERT_EQUAL(SENSOR_ADDR, ip4(addr));
+  TEST_ASSERT_EQUAL(IPADDR_TYPE_V4, addr.type);
+  TEST_ASSERT_EQUAL(queries, counter("mdns.queries"));
+  TEST_ASSERT_EQUAL(hits + 1, counter("mdns.hits"));
+}
+
+void queries_on_miss() {
+  DNS::mdns().flush();
+  TEST_ASSERT_EQUAL(0, DNS::mdns().cached());
+  uint32_t queries = counter("mdns.queries");
+  ip_addr_t addr;
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve("SENSOR-3.local", &addr));
+  TEST_ASSERT_EQUAL(SENSOR_ADDR, ip4(addr));
+  TEST_ASSERT_TRUE(counter("mdns.queries") > queries);
+  TEST_ASSERT_TRUE(DNS::mdns().cached() >= 1);
+
+  /* Unicast names still go to the resolver */
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve("localhost", &addr));
+  TEST_ASSERT_EQUAL(PORT_IPV4_LOOPBACK, ip4(addr));
+}
+
+static std::atomic<int> answered;
+static std::atomic<esp_err_t> async_result;
+
+static void found(DNS::Query *query, esp_err_t result) {
+  async_result = result;
+  answered++;
+}
+
+void resolves_async() {
+  DNS::mdns().flush();
+  DNS::Query query;
+  query.done = found;
+  answered = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve_async("sensor-3.local", &query));
+  for (int i = 0; i < 100 && answered == 0; i++) {
+    Port::sleep_ms(5);
+  }
+  TEST_ASSERT_EQUAL(1, answered.load());
+  TEST_ASSERT_EQUAL(ESP_OK, async_result.load());
+  TEST_ASSERT_EQUAL(SENSOR_ADDR, ip4(query.addr));
+
+  /* Cached, so answered before returning */
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve_async("sensor-3.local", &query));
+  TEST_ASSERT_EQUAL(2, answered.load());
+}
+
+/* Unanswered queries are repeated, then fail. Only MDNS_MAX_PENDING wait
+ * at once. */
+void times_out() {
+  uint32_t queries = counter("mdns.queries");
+  ip_addr_t addr;
+  uint64_t start = Port::micros();
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, DNS::resolve("nobody.local", &addr));
+  uint64_t elapsed_ms = (Port::micros() - start) / 1000;
+  TEST_ASSERT_TRUE(elapsed_ms >= TIMEOUT_MS);
+  TEST_ASSERT_TRUE(elapsed_ms < TIMEOUT_MS + 200);
+  TEST_ASSERT_TRUE(counter("mdns.queries") - queries >= TIMEOUT_MS / RETRY_MS);
+
+  DNS::Query queries_[MDNS_MAX_PENDING + 1];
+  answered = 0;
+  for (size_t i = 0; i < MDNS_MAX_PENDING; i++) {
+    queries_[i].done = found;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      DNS::resolve_async("nobody.local", &queries_[i]));
+  }
+  queries_[MDNS_MAX_PENDING].done = found;
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, DNS::resolve_async(
+                                        "nobody.local",
+                                        &queries_[MDNS_MAX_PENDING]));
+  Port::sleep_ms(TIMEOUT_MS + 200);
+  TEST_ASSERT_EQUAL(MDNS_MAX_PENDING, answered.load());
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, async_result.load());
+}
+
+/* Compressed names are followed, pointer loops and truncated records are
+ * dropped without harm */
+void parses_responses() {
+  DNS::mdns().flush();
+  const uint8_t response[] = {
+      0, 0, 0x84, 0, 0, 0, 0, 2, 0, 0, 0, 0,
+      /* printer.local A 10.0.0.7, offset 12 */
+      7, 'p', 'r', 'i', 'n', 't', 'e', 'r', 5, 'l', 'o', 'c', 'a', 'l', 0,
+      0, 1, 0x80, 1, 0, 0, 0, 120, 0, 4, 10, 0, 0, 7,
+      /* hub, then a pointer to "local" at offset 20 */
+      3, 'h', 'u', 'b', 0xc0, 20,
+      0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 0, 0, 8};
+  inject(response, sizeof(response));
+  TEST_ASSERT_TRUE(wait_cached("hub.local", true));
+  uint32_t addr = 0;
+  TEST_ASSERT_TRUE(DNS::mdns().lookup("printer.local", &addr));
+  TEST_ASSERT_EQUAL(PORT_IPV4(10, 0, 0, 7), addr);
+  TEST_ASSERT_TRUE(DNS::mdns().lookup("hub.local", &addr));
+  TEST_ASSERT_EQUAL(PORT_IPV4(10, 0, 0, 8), addr);
+
+  const uint8_t loop[] = {0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0,
+                          0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4,
+                          10, 0, 0, 9};
+  inject(loop, sizeof(loop));
+  inject(response, 20);
+  const uint8_t query_garbage[] = {0, 0, 0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 63};
+  inject(query_garbage, sizeof(query_garbage));
+  Port::sleep_ms(50);
+  TEST_ASSERT_EQUAL(2, DNS::mdns().cached());
+  TEST_ASSERT_TRUE(DNS::mdns().running());
+  TEST_ASSERT_TRUE(responder.running());
+}
+
+/* A host leaving says goodbye with a TTL of 0 */
+void forgets_on_goodbye() {
+  ip_addr_t addr;
+  TEST_ASSERT_EQUAL(ESP_OK, DNS::resolve("sensor-3.local", &addr));
+  TEST_ASSERT_EQUAL(ESP_OK, responder.set_hostname(nullptr, 0));
+  TEST_ASSERT_TRUE(wait_cached("sensor-3.local", false));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, DNS::resolve("sensor-3.local", &addr));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    responder.set_hostname("sensor-3.local", SENSOR_ADDR));
+}
+
+static uint32_t sample_cached(void *arg) {
+  ip_addr_t addr;
+  uint64_t start = Port::nanos();
+  if (DNS::resolve("sensor-3.local", &addr) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  return Port::nanos() - start;
+}
+
+static uint32_t sample_query(void *arg) {
+  DNS::mdns().flush();
+  ip_addr_t addr;
+  uint64_t start = Port::micros();
+  if (DNS::resolve("sensor-3.local", &addr) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  return Port::micros() - start;
+}
+
+/* Cached answers against a round trip on the loopback */
+void lookup_latency() {
+  Bench::Scenario cached = {"mdns.resolve_cached", "ns", sample_cached,
+                            nullptr, 10, 1000};
+  Bench::Scenario query = {"mdns.resolve_query", "us", sample_query, nullptr,
+                           2, 100};
+  Bench::Result hit, miss;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(cached, hit));
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(query, miss));
+  Bench::print(hit);
+  Bench::print(miss);
+  TEST_ASSERT_TRUE(hit.p50 < 50000);
+  TEST_ASSERT_TRUE(hit.p50 / 1000 < miss.p50);
+}
+
+int main() {
+  group_port = 20000 + getpid() % 20000;
+  UNITY_BEGIN();
+  if (DNS::mdns().start(loopback_options()) != ESP_OK ||
+      responder.start(loopback_options()) != ESP_OK) {
+    printf("Could not join the group on the loopback\n");
+    return 1;
+  }
+  RUN_TEST(names);
+  RUN_TEST(caches_announcements);
+  RUN_TEST(queries_on_miss);
+  RUN_TEST(resolves_async);
+  RUN_TEST(times_out);
+  RUN_TEST(parses_responses);
+  RUN_TEST(forgets_on_goodbye);
+  RUN_TEST(lookup_latency);
+  responder.stop();
+  DNS::mdns().stop();
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "Metrics/Metrics.h"
+
+static Metrics::Counter requests("test.requests");
+static Metrics::Gauge connected("test.connected");
+static Metrics::Histogram latency_us("test.latency_us");
+static Metrics::Counter contended("test.contended");
+static Metrics::Histogram contended_us("test.contended_us");
+
+void registers_by_name() {
+  TEST_ASSERT_TRUE(Metrics::find("test.requests") == &requests);
+  TEST_ASSERT_TRUE(Metrics::find("test.latency_us") == &latency_us);
+  TEST_ASSERT_TRUE(Metrics::find("test.missing") == nullptr);
+  TEST_ASSERT_EQUAL(Metrics::GAUGE, Metrics::find("test.connected")->type());
+
+  /* In definition order, after or before the metrics of linked modules */
+  Metrics::Metric *ours[5];
+  int count = 0;
+  for (Metrics::Metric *m = Metrics::first(); m != nullptr; m = m->next()) {
+    if (strncmp(m->name(), "test.", 5) == 0) {
+      TEST_ASSERT_TRUE(count < 5);
+      ours[count++] = m;
+    }
+  }
+  TEST_ASSERT_EQUAL(5, count);
+  TEST_ASSERT_TRUE(ours[0] == &requests);
+  TEST_ASSERT_TRUE(ours[4] == &contended_us);
+}
+
+void counts_and_gauges() {
+  uint32_t before = requests.value();
+  requests.add();
+  requests.add(4);
+  TEST_ASSERT_EQUAL(before + 5, requests.value());
+
+  connected.set(1);
+  connected.add(-3);
+  TEST_ASSERT_EQUAL(-2, connected.value());
+  connected.set(0);
+}
+
+/* Every value lands in the bucket whose bounds hold it, within 25% */
+void buckets_are_log_linear() {
+  for (uint32_t i = 0; i < 8; i++) {
+    TEST_ASSERT_EQUAL(i, Metrics::Histogram::bucket(i));
+  }
+  uint32_t previous = 0;
+  for (uint64_t v = 1; v < (1ull << 32); v = v * 9 / 8 + 1) {
+    uint32_t value = v;
+    uint32_t index = Metrics::Histogram::bucket(value);
+    TEST_ASSERT_TRUE(index < METRICS_BUCKETS);
+    TEST_ASSERT_TRUE(index >= previous);
+    previous = index;
+    TEST_ASSERT_TRUE(value <= Metrics::Histogram::upper_bound(index));
+    if (index > 0) {
+      TEST_ASSERT_TRUE(value > Metrics::Histogram::upper_bound(index - 1));
+    }
+    if (value < (1u << METRICS_MAX_BITS)) {
+      TEST_ASSERT_TRUE(Metrics::Histogram::upper_bound(index) <=
+                       value + value / 4);
+    }
+  }
+  TEST_ASSERT_EQUAL(METRICS_BUCKETS - 1,
+                    Metrics::Histogram::bucket(UINT32_MAX));
+}
+
+void histogram_quantiles() {
+  for (uint32_t v = 1; v <= 1000; v++) {
+    latency_us.record(v);
+  }
+  Metrics::HistogramSnapshot snap;
+  latency_us.snapshot(snap);
+  TEST_ASSERT_EQUAL(1000, snap.count);
+  TEST_ASSERT_EQUAL(500500, snap.sum);
+  uint32_t p50 = snap.quantile(0.5f);
+  uint32_t p99 = snap.quantile(0.99f);
+  printf("p50 %u p99 %u\n", p50, p99);
+  TEST_ASSERT_TRUE(p50 >= 500 && p50 <= 625);
+  TEST_ASSERT_TRUE(p99 >= 990 && p99 <= 1238);
+  TEST_ASSERT_EQUAL(1023, snap.quantile(1.0f));
+}
+
+/* Tasks recording at once lose no updates */
+void concurrent_recording() {
+  const int tasks = 4, calls = 200000;
+  uint64_t start = Port::micros();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < tasks; t++) {
+    threads.emplace_back([] {
+      for (int i = 0; i < calls; i++) {
+        contended.add();
+        contended_us.record(i & 1023);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  uint64_t elapsed = Port::micros() - start;
+  printf("%.1f ns per counter and histogram update\n",
+         elapsed * 1000.0 / (tasks * calls));
+
+  Metrics::HistogramSnapshot snap;
+  contended_us.snapshot(snap);
+  TEST_ASSERT_EQUAL(tasks * calls, contended.value());
+  TEST_ASSERT_EQUAL(tasks * calls, snap.count);
+  uint32_t buckets = 0;
+  for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+    buckets += snap.buckets[i];
+  }
+  TEST_ASSERT_EQUAL(tasks * calls, buckets);
+}
+
+void writes_text() {
+  char text[512];
+  size_t length = Metrics::write_text(text, sizeof(text));
+  TEST_ASSERT_EQUAL(strlen(text), length);
+  printf("%s", text);
+
+  char expected[64];
+  snprintf(expected, sizeof(expected), "test.requests %u\n",
+           requests.value());
+  TEST_ASSERT_TRUE(strstr(text, expected) != nullptr);
+  TEST_ASSERT_TRUE(strstr(text, "test.connected 0\n") != nullptr);
+  TEST_ASSERT_TRUE(strstr(text, "test.latency_us count=1000 sum=500500 ") !=
+                   nullptr);
+
+  /* Cut at a line boundary, fitting the first line only */
+  size_t first = strchr(text, '\n') + 1 - text;
+  TEST_ASSERT_TRUE(first < 24);
+  char small[24];
+  length = Metrics::write_text(small, first + 1);
+  TEST_ASSERT_EQUAL(first, length);
+  TEST_ASSERT_TRUE(strncmp(text, small, first) == 0);
+  TEST_ASSERT_EQUAL(0, Metrics::write_text(small, 4));
+  TEST_ASSERT_EQUAL_STRING("", small);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(registers_by_name);
+  RUN_TEST(counts_and_gauges);
+  RUN_TEST(buckets_are_log_linear);
+  RUN_TEST(histogram_quantiles);
+  RUN_TEST(concurrent_recording);
+  RUN_TEST(writes_text);
+  return UNITY_END();
+}
+
+#endif
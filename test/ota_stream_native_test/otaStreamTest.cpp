@@ -0,0 +1,261 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include "Host/FilePartition.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "Update/OtaPipeline.h"
+
+/* Peak heap tracking through the global allocator */
+static std::atomic<size_t> heap_in_use(0);
+static std::atomic<size_t> heap_peak(0);
+
+void *operator new(size_t size) {
+  size_t *block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *block = size;
+  size_t now = heap_in_use += size;
+  size_t peak = heap_peak;
+  while (now > peak && !heap_peak.compare_exchange_weak(peak, now)) {
+  }
+  return reinterpret_cast<char *>(block) + sizeof(max_align_t);
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  size_t *block = reinterpret_cast<size_t *>(static_cast<char *>(ptr) -
+                                             sizeof(max_align_t));
+  heap_in_use -= *block;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+/* 256 KiB image. The link delivers 16 KiB bursts at ~800 KiB/s, like
+ * aggregated wifi frames, and flash also writes at ~800 KiB/s */
+static const size_t IMAGE_SIZE = 256 * 1024;
+static const size_t LINK_BURST = 16 * 1024;
+static const uint32_t LINK_DELAY_US = 20000;
+static const uint32_t FLASH_US_PER_SECTOR = 5000;
+
+static std::string make_image(size_t size) {
+  std::string image(size, '\0');
+  uint32_t x = 2463534242u;
+  for (size_t i = 0; i < size; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    image[i] = static_cast<char>(x);
+  }
+  return image;
+}
+
+struct Result {
+  esp_err_t err;
+  Update::PipelineStats stats;
+  size_t peak_heap;
+  bool matches;
+};
+
+static Result stream_update(size_t buffer_count) {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.chunk_size = LINK_BURST;
+  options.chunk_delay_us = LINK_DELAY_US;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+
+  Host::HttpClient client;
+  TEST_ASSERT_EQUAL(ESP_OK, client.get(server.url()));
+  TEST_ASSERT_EQUAL(200, client.status());
+
+  Host::FilePartition partition("ota_stream_native_test.bin",
+                                FLASH_US_PER_SECTOR);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+
+  size_t base = heap_in_use;
+  heap_peak = base;
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  Result result;
+  result.err = pipeline->run(client, partition, buffer_count);
+  result.stats = pipeline->stats();
+  delete pipeline;
+  result.peak_heap = heap_peak - base;
+
+  partition.close();
+  result.matches = partition.contents() == image;
+  remove(partition.path().c_str());
+  server.stop();
+  return result;
+}
+
+static void report(const char *name, const Result &result) {
+  double seconds = result.stats.elapsed_us / 1e6;
+  printf("%s: %zu bytes in %.3f s (%.1f KiB/s), peak heap %zu bytes, "
+         "%u write stalls, %u recv stalls\n",
+         name, result.stats.bytes, seconds,
+         result.stats.bytes / 1024.0 / seconds, result.peak_heap,
+         result.stats.write_stalls, result.stats.recv_stalls);
+}
+
+void pipelined_update() {
+  Result result = stream_update(OTA_BUFFER_COUNT);
+  report("pipelined", result);
+  TEST_ASSERT_EQUAL(ESP_OK, result.err);
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, result.stats.bytes);
+  TEST_ASSERT_TRUE(result.matches);
+}
+
+void sequential_update() {
+  Result result = stream_update(1);
+  report("sequential", result);
+  TEST_ASSERT_EQUAL(ESP_OK, result.err);
+  TEST_ASSERT_TRUE(result.matches);
+}
+
+/* Delivers one TCP segment per read, at a fixed rate. Without kernel socket
+ * buffering in the way, any overlap comes from the pipeline itself. */
+class ThrottledSource : public Update::ChunkSource {
+ public:
+  ThrottledSource(size_t size, uint32_t us_per_segment)
+      : remaining_(size), us_per_segment_(us_per_segment), read_(0) {}
+
+  int read(uint8_t *dest, size_t size) override {
+    size_t n = std::min<size_t>(std::min<size_t>(size, 1460), remaining_);
+    std::this_thread::sleep_for(std::chrono::microseconds(us_per_segment_));
+    memset(dest, 0x5A, n);
+    remaining_ -= n;
+    read_ += n;
+    return n;
+  }
+
+  /* Bytes delivered so far */
+  size_t delivered() const { return read_; }
+
+ private:
+  size_t remaining_;
+  uint32_t us_per_segment_;
+  std::atomic<size_t> read_;
+};
+
+/* Holds every write, but the last, until the source has delivered the
+ * buffer after it, or 'wait_ms' passed. A write let through early proves
+ * the network was read while flash was written. */
+class OverlapSink : public Update::ChunkSink {
+ public:
+  OverlapSink(const ThrottledSource &source, uint32_t wait_ms)
+      : source_(source), wait_ms_(wait_ms), written_(0), overlapped_(0) {}
+
+  esp_err_t write(const uint8_t *data, size_t size) override {
+    written_ += size;
+    if (written_ < IMAGE_SIZE) {
+      size_t ahead = std::min(written_ + OTA_BUFFER_SIZE, IMAGE_SIZE);
+      uint64_t deadline = Port::micros() + wait_ms_ * 1000ull;
+      while (source_.delivered() < ahead && Port::micros() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      if (source_.delivered() >= ahead) {
+        overlapped_++;
+      }
+    }
+    return ESP_OK;
+  }
+
+  uint32_t overlapped() const { return overlapped_; }
+
+ private:
+  const ThrottledSource &source_;
+  uint32_t wait_ms_;
+  size_t written_;
+  uint32_t overlapped_;
+};
+
+static uint32_t overlapped_writes(size_t buffer_count, uint32_t wait_ms) {
+  ThrottledSource source(IMAGE_SIZE, 50);
+  OverlapSink sink(source, wait_ms);
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  TEST_ASSERT_EQUAL(ESP_OK, pipeline->run(source, sink, buffer_count));
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, pipeline->stats().bytes);
+  delete pipeline;
+  return sink.overlapped();
+}
+
+/* Every buffer but the last is received while the one before is written,
+ * which a single buffer cannot do */
+void receives_while_writing() {
+  const uint32_t writes = IMAGE_SIZE / OTA_BUFFER_SIZE;
+  TEST_ASSERT_EQUAL(writes - 1, overlapped_writes(OTA_BUFFER_COUNT, 5000));
+  TEST_ASSERT_EQUAL(0, overlapped_writes(1, 5));
+}
+
+static uint64_t throttled_update(size_t buffer_count) {
+  /* ~1 ms per sector on both sides */
+  ThrottledSource source(IMAGE_SIZE, 350);
+  Host::FilePartition partition("ota_stream_native_test.bin", 1000);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  TEST_ASSERT_EQUAL(ESP_OK, pipeline->run(source, partition, buffer_count));
+  uint64_t elapsed = pipeline->stats().elapsed_us;
+  delete pipeline;
+  partition.close();
+  remove(partition.path().c_str());
+  return elapsed;
+}
+
+/* Figures only, wall time depends on the machine */
+void throttled_benchmark() {
+  uint64_t sequential = throttled_update(1);
+  uint64_t pipelined = throttled_update(OTA_BUFFER_COUNT);
+  printf("throttled source: sequential %.3f s, pipelined %.3f s\n",
+         sequential / 1e6, pipelined / 1e6);
+}
+
+void truncated_source_fails() {
+  /* Server closes before Content-Length, the pipeline must report it */
+  class Truncated : public Update::ChunkSource {
+   public:
+    int read(uint8_t *dest, size_t size) override {
+      if (sent_ >= 10000) {
+        return -1;
+      }
+      size_t n = size < 1000 ? size : 1000;
+      memset(dest, 0xAA, n);
+      sent_ += n;
+      return n;
+    }
+    size_t sent_ = 0;
+  } source;
+
+  Host::FilePartition partition("ota_stream_native_test.bin");
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Update::Pipeline *pipeline = new Update::Pipeline();
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, pipeline->run(source, partition));
+  delete pipeline;
+  partition.close();
+  remove(partition.path().c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(pipelined_update);
+  RUN_TEST(sequential_update);
+  RUN_TEST(receives_while_writing);
+  RUN_TEST(throttled_benchmark);
+  RUN_TEST(truncated_source_fails);
+  return UNITY_END();
+}
+
+#endif
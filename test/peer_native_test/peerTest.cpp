@@ -0,0 +1,386 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "Host/FilePartition.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "Update/Peer.h"
+#include "Update/Resumable.h"
+
+extern char **environ;
+
+static const size_t IMAGE_SIZE = 384 * 1024 + 321;
+static const uint32_t UPLINK_BYTES_PER_S = 1024 * 1024;
+static const uint32_t LAN_BYTES_PER_S = 4 * 1024 * 1024;
+static const int FLEET_SIZES[] = {1, 2, 4, 8};
+
+static uint8_t secret[ED25519_SEED_SIZE];
+static uint8_t public_key[ED25519_PUBLIC_KEY_SIZE];
+
+/* Beacon port for this run, so concurrent runs do not hear each other */
+static uint16_t beacon_port;
+
+static void generate_keys() {
+  for (size_t i = 0; i < sizeof(secret); i++) {
+    secret[i] = i * 7 + 1;
+  }
+  Ed25519::public_key(secret, public_key);
+}
+
+static std::string make_image(size_t size) {
+  std::string image(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    image[i] = static_cast<char>((i * 2654435761u) >> 13);
+  }
+  return image;
+}
+
+static std::string make_table(const std::string &image) {
+  std::string table(Update::chunk_table_size(image.size()), '\0');
+  Update::sign_chunk_table(reinterpret_cast<const uint8_t *>(image.data()),
+                           image.size(), secret,
+                           reinterpret_cast<uint8_t *>(&table[0]));
+  return table;
+}
+
+static Update::PeerOptions loopback_options(uint16_t port) {
+  Update::PeerOptions options;
+  options.port = port;
+  options.interface = PORT_IPV4_LOOPBACK;
+  options.beacon_interval_ms = 100;
+  options.discovery_ms = 300;
+  options.serve_bytes_per_s = LAN_BYTES_PER_S;
+  return options;
+}
+
+static esp_err_t set_table(Update::ChunkTable &table, const std::string &data) {
+  return table.set(reinterpret_cast<const uint8_t *>(data.data()),
+                   data.size(), public_key);
+}
+
+/* Keeps the checkpoint of a server-only download */
+class MemoryStore : public Update::ProgressStore {
+ public:
+  esp_err_t load(Update::Progress &progress) override {
+    return ESP_ERR_NOT_FOUND;
+  }
+  esp_err_t save(const Update::Progress &progress) override { return ESP_OK; }
+  esp_err_t clear() override { return ESP_OK; }
+};
+
+/* A node sharing a complete image from its own partition, claiming it is
+ * 'advertised' */
+struct Seeder {
+  Seeder(const std::string &image, const std::string &advertised,
+         const std::string &path, uint16_t port)
+      : partition(path), node(partition, loopback_options(port)) {
+    partition.open();
+    partition.write(reinterpret_cast<const uint8_t *>(image.data()),
+                    image.size());
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    Sha256::digest(advertised.data(), advertised.size(), digest);
+    node.seed(digest, advertised.size());
+  }
+  ~Seeder() {
+    node.stop();
+    remove(partition.path().c_str());
+  }
+
+  Host::FilePartition partition;
+  Update::PeerNode node;
+};
+
+void table_round_trip() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string data = make_table(image);
+  Update::ChunkTable table;
+  TEST_ASSERT_EQUAL(ESP_OK, set_table(table, data));
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, table.image_size());
+  TEST_ASSERT_EQUAL(25, table.chunk_count());
+  TEST_ASSERT_EQUAL(321, table.chunk_length(24));
+
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  Sha256::digest(image.data() + 3 * PEER_CHUNK_SIZE, PEER_CHUNK_SIZE, digest);
+  TEST_ASSERT_TRUE(table.check(3, digest));
+  TEST_ASSERT_FALSE(table.check(4, digest));
+  Sha256::digest(image.data(), image.size(), digest);
+  TEST_ASSERT_EQUAL_MEMORY(digest, table.image_digest(), sizeof(digest));
+}
+
+void rejects_forged_table() {
+  std::string data = make_table(make_image(IMAGE_SIZE));
+  Update::ChunkTable table;
+
+  std::string forged = data;
+  forged[PEER_TABLE_HEADER_SIZE + 5] ^= 1;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, set_table(table, forged));
+  TEST_ASSERT_EQUAL(0, table.chunk_count());
+
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    set_table(table, data.substr(0, data.size() - 1)));
+  forged = data;
+  forged[0] = 'X';
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, set_table(table, forged));
+  forged = data;
+  forged[9] ^= 0x80;
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, set_table(table, forged));
+
+  uint8_t other[ED25519_PUBLIC_KEY_SIZE];
+  uint8_t other_secret[ED25519_SEED_SIZE] = {1};
+  Ed25519::public_key(other_secret, other);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC,
+                    table.set(reinterpret_cast<const uint8_t *>(data.data()),
+                              data.size(), other));
+}
+
+void fetches_from_several_peers() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string data = make_table(image);
+  Update::ChunkTable table;
+  TEST_ASSERT_EQUAL(ESP_OK, set_table(table, data));
+
+  uint16_t port = beacon_port;
+  Seeder a(image, image, "peer_native_test_a.bin", port);
+  Seeder b(image, image, "peer_native_test_b.bin", port);
+  Seeder c(image, image, "peer_native_test_c.bin", port);
+
+  Host::FilePartition partition("peer_native_test.bin");
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Update::PeerNode node(partition, loopback_options(port));
+  TEST_ASSERT_EQUAL(ESP_OK, node.fetch(table, nullptr));
+  TEST_ASSERT_TRUE(partition.contents().compare(0, image.size(), image) == 0);
+
+  Update::PeerStats stats = node.stats();
+  TEST_ASSERT_EQUAL(table.chunk_count(), stats.peer_chunks);
+  TEST_ASSERT_EQUAL(0, stats.server_chunks);
+  TEST_ASSERT_EQUAL(3, stats.peers);
+
+  /* The chunks came from more than one source at once */
+  int sources = (a.node.stats().served > 0) + (b.node.stats().served > 0) +
+                (c.node.stats().served > 0);
+  printf("chunks served by peers: %u %u %u\n", a.node.stats().served,
+         b.node.stats().served, c.node.stats().served);
+  TEST_ASSERT_TRUE(sources >= 2);
+  node.stop();
+  remove(partition.path().c_str());
+}
+
+/* A peer serving a corrupt image is caught chunk by chunk, and the server
+ * fills in */
+void rejects_corrupt_peer() {
+  std::string image = make_image(IMAGE_SIZE);
+  std::string data = make_table(image);
+  Update::ChunkTable table;
+  TEST_ASSERT_EQUAL(ESP_OK, set_table(table, data));
+
+  std::string corrupt = image;
+  for (size_t i = 0; i < corrupt.size(); i += PEER_CHUNK_SIZE) {
+    corrupt[i + 100] ^= 0x5A;
+  }
+  uint16_t port = beacon_port + 1;
+  Seeder bad(corrupt, image, "peer_native_test_bad.bin", port);
+
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image));
+  Host::HttpRangeSource source(server.url());
+
+  Host::FilePartition partition("peer_native_test.bin");
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Update::PeerNode node(partition, loopback_options(port));
+  TEST_ASSERT_EQUAL(ESP_OK, node.fetch(table, &source));
+  TEST_ASSERT_TRUE(partition.contents().compare(0, image.size(), image) == 0);
+
+  Update::PeerStats stats = node.stats();
+  TEST_ASSERT_EQUAL(PEER_MAX_FAILURES, stats.rejected);
+  TEST_ASSERT_EQUAL(0, stats.peer_chunks);
+  TEST_ASSERT_EQUAL(table.chunk_count(), stats.server_chunks);
+  node.stop();
+  server.stop();
+  remove(partition.path().c_str());
+}
+
+/* One simulated device, run in its own process. Reports on stdout, then
+ * keeps sharing until stdin closes. */
+static int run_device(const char *mode, uint16_t server_port,
+                      uint16_t port) {
+  std::string url =
+      "http://127.0.0.1:" + std::to_string(server_port) + "/firmware.bin";
+  std::string image = make_image(IMAGE_SIZE);
+  std::string path = "peer_native_test_" + std::to_string(getpid()) + ".bin";
+  Host::FilePartition partition(path);
+  partition.open();
+  Host::HttpRangeSource source(url);
+  Update::PeerNode node(partition, loopback_options(port));
+
+  uint64_t start = Port::micros();
+  esp_err_t err;
+  Update::PeerStats stats = {};
+  if (strcmp(mode, "server") == 0) {
+    MemoryStore store;
+    Update::ResumableDownload *download =
+        new Update::ResumableDownload(source, partition, store);
+    err = download->run(url.c_str(), 20, 1);
+    delete download;
+  } else {
+    Host::HttpClient client;
+    std::string data;
+    err = client.get(url + PEER_TABLE_SUFFIX);
+    uint8_t buf[1024];
+    int n;
+    while (err == ESP_OK && (n = client.read(buf, sizeof(buf))) > 0) {
+      data.append(reinterpret_cast<char *>(buf), n);
+    }
+    client.close();
+    Update::ChunkTable table;
+    if (err == ESP_OK) {
+      err = set_table(table, data);
+    }
+    if (err == ESP_OK) {
+      err = node.fetch(table, &source);
+    }
+    stats = node.stats();
+  }
+  bool ok = err == ESP_OK &&
+            partition.contents().compare(0, image.size(), image) == 0;
+  printf("%d %llu %u %u %u\n", ok,
+         (unsigned long long)(Port::micros() - start) / 1000,
+         stats.server_chunks, stats.peer_chunks, stats.rejected);
+  fflush(stdout);
+
+  char c;
+  while (read(0, &c, 1) > 0) {
+  }
+  node.stop();
+  partition.close();
+  remove(path.c_str());
+  return 0;
+}
+
+struct FleetResult {
+  double seconds;
+  size_t uplink_bytes;
+  bool ok;
+};
+
+/* Starts 'size' devices at once against one throttled server */
+static FleetResult run_fleet(const char *mode, int size, uint16_t port) {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.uplink_bytes_per_s = UPLINK_BYTES_PER_S;
+  Host::HttpServer server;
+  server.add_file(std::string("/firmware.bin") + PEER_TABLE_SUFFIX,
+                  make_table(image));
+  server.start(image, options);
+
+  std::string server_port = std::to_string(server.port());
+  std::string beacons = std::to_string(port);
+  std::vector<pid_t> pids;
+  std::vector<int> inputs;
+  std::vector<FILE *> outputs;
+  uint64_t start = Port::micros();
+  for (int i = 0; i < size; i++) {
+    /* Close-on-exec, so devices hold only their own pipes */
+    int in[2], out[2];
+    pipe2(in, O_CLOEXEC);
+    pipe2(out, O_CLOEXEC);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    posix_spawn_file_actions_addclose(&actions, in[1]);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    char *argv[] = {(char *)"peer_native_test", (char *)"device",
+                    (char *)mode, (char *)server_port.c_str(),
+                    (char *)beacons.c_str(), nullptr};
+    pid_t pid;
+    posix_spawn(&pid, "/proc/self/exe", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+    pids.push_back(pid);
+    inputs.push_back(in[1]);
+    outputs.push_back(fdopen(out[0], "r"));
+  }
+
+  FleetResult result = {0, 0, true};
+  uint32_t server_chunks = 0, peer_chunks = 0;
+  for (FILE *output : outputs) {
+    int ok = 0;
+    unsigned long long ms;
+    unsigned from_server = 0, from_peers = 0, rejected = 0;
+    if (fscanf(output, "%d %llu %u %u %u", &ok, &ms, &from_server,
+               &from_peers, &rejected) != 5) {
+      ok = 0;
+    }
+    result.ok = result.ok && ok && rejected == 0;
+    server_chunks += from_server;
+    peer_chunks += from_peers;
+  }
+  result.seconds = (Port::micros() - start) / 1e6;
+  result.uplink_bytes = server.bytes_sent();
+
+  for (size_t i = 0; i < pids.size(); i++) {
+    close(inputs[i]);
+  }
+  for (size_t i = 0; i < pids.size(); i++) {
+    waitpid(pids[i], nullptr, 0);
+    fclose(outputs[i]);
+  }
+  server.stop();
+
+  printf("%-6s %5d %9.2f s %9.2f images", mode, size, result.seconds,
+         result.uplink_bytes / (double)IMAGE_SIZE);
+  if (strcmp(mode, "peer") == 0) {
+    printf("   %u chunks from server, %u from peers", server_chunks,
+           peer_chunks);
+  }
+  printf("\n");
+  return result;
+}
+
+/* Fleet update time and uplink use with and without sharing. Without it
+ * both grow linearly with the fleet. With it the uplink carries a few
+ * images, fetched before the nodes hear of each other's chunks, and time
+ * grows slowly. */
+void fleet_simulation() {
+  printf("mode   fleet   update time   uplink use\n");
+  FleetResult server[4], peer[4];
+  for (int i = 0; i < 4; i++) {
+    server[i] = run_fleet("server", FLEET_SIZES[i], beacon_port + 2);
+    TEST_ASSERT_TRUE(server[i].ok);
+  }
+  for (int i = 0; i < 4; i++) {
+    peer[i] = run_fleet("peer", FLEET_SIZES[i], beacon_port + 3 + i);
+    TEST_ASSERT_TRUE(peer[i].ok);
+  }
+
+  /* Fleet of 8 */
+  TEST_ASSERT_TRUE(peer[3].uplink_bytes * 2 < server[3].uplink_bytes);
+  TEST_ASSERT_TRUE(peer[3].seconds < server[3].seconds);
+}
+
+int main(int argc, char **argv) {
+  generate_keys();
+  if (argc == 5 && strcmp(argv[1], "device") == 0) {
+    return run_device(argv[2], atoi(argv[3]), atoi(argv[4]));
+  }
+  beacon_port = 20000 + getpid() % 20000;
+
+  UNITY_BEGIN();
+  RUN_TEST(table_round_trip);
+  RUN_TEST(rejects_forged_table);
+  RUN_TEST(fetches_from_several_peers);
+  RUN_TEST(rejects_corrupt_peer);
+  RUN_TEST(fleet_simulation);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include "Async/Async.h"
+#include "Metrics/Metrics.h"
+#include "PowerSave/PowerSave.h"
+#include "esp_wifi.h"
+
+/* A 2 ms beacon and DTIM 2, so MIN_MODEM wakes every 4 ms and MAX_MODEM
+ * every 20 ms, scaled down from 100 TU */
+#define BEACON_US 2000
+#define DTIM 2
+#define LISTEN_INTERVAL 10
+#define DWELL_MS 50
+
+/* What an exchange takes with the radio on */
+#define NETWORK_US 300
+
+static PowerSave::Requirement control("test.control");
+static PowerSave::Requirement strict("test.strict");
+
+static PowerSave::Config make_config() {
+  PowerSave::Config config;
+  config.beacon_us = BEACON_US;
+  config.dtim = DTIM;
+  config.listen_interval = LISTEN_INTERVAL;
+  config.dwell_ms = DWELL_MS;
+  return config;
+}
+
+/* An exchange with a peer, waiting for the modelled wake first */
+static void exchange(uint32_t network_us) {
+  PowerSave::record_rtt(network_us + Host::wifi_wake_delay_us());
+}
+
+static uint32_t switches() {
+  return ((Metrics::Counter *)Metrics::find("power.switches"))->value();
+}
+
+void starts_deepest() {
+  PowerSave::Config bad = make_config();
+  bad.listen_interval = 0;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, PowerSave::begin(bad));
+
+  /* As EasyWifi::configure() sets it, begin() leaves it alone */
+  wifi_config_t station;
+  station.sta.listen_interval = LISTEN_INTERVAL;
+  esp_wifi_set_config(ESP_IF_WIFI_STA, &station);
+  Host::wifi_set_beacon(BEACON_US, DTIM);
+  TEST_ASSERT_EQUAL(ESP_OK, PowerSave::begin(make_config()));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, PowerSave::begin(make_config()));
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MAX_MODEM);
+
+  wifi_ps_type_t ps = WIFI_PS_NONE;
+  esp_wifi_get_ps(&ps);
+  TEST_ASSERT_EQUAL(WIFI_PS_MAX_MODEM, ps);
+  station.sta.listen_interval = 0;
+  esp_wifi_get_config(ESP_IF_WIFI_STA, &station);
+  TEST_ASSERT_EQUAL(LISTEN_INTERVAL, station.sta.listen_interval);
+
+  /* Half a wake until something is observed */
+  TEST_ASSERT_EQUAL(0, PowerSave::expected_rtt_us(PowerSave::Policy::NONE));
+  TEST_ASSERT_EQUAL(BEACON_US * DTIM / 2, PowerSave::expected_rtt_us(
+                                              PowerSave::Policy::MIN_MODEM));
+  TEST_ASSERT_EQUAL(BEACON_US * LISTEN_INTERVAL / 2,
+                    PowerSave::expected_rtt_us(PowerSave::Policy::MAX_MODEM));
+}
+
+/* The tightest requirement picks the deepest policy meeting it, at once
+ * when it is faster and after the dwell time when it is slower */
+void requirements_pick_policy() {
+  uint32_t before = switches();
+  control.set(5);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MIN_MODEM);
+  strict.set(1);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::NONE);
+  TEST_ASSERT_EQUAL(before + 2, switches());
+
+  strict.clear();
+  TEST_ASSERT_TRUE(PowerSave::wanted() == PowerSave::Policy::MIN_MODEM);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::NONE);
+  Port::sleep_ms(DWELL_MS * 3);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MIN_MODEM);
+
+  control.clear();
+  Port::sleep_ms(DWELL_MS * 3);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MAX_MODEM);
+  TEST_ASSERT_EQUAL(before + 4, switches());
+}
+
+void hint_holds_none() {
+  PowerSave::hint(4 * DWELL_MS);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::NONE);
+  Port::sleep_ms(2 * DWELL_MS);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::NONE);
+  Port::sleep_ms(5 * DWELL_MS);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MAX_MODEM);
+}
+
+/* Observed round trips replace the estimate, and a slow network pushes a
+ * requirement to a faster policy */
+void tracks_observed_latency() {
+  for (int i = 0; i < 50; i++) {
+    exchange(NETWORK_US);
+  }
+  PowerSave::Stats max = PowerSave::stats(PowerSave::Policy::MAX_MODEM);
+  TEST_ASSERT_EQUAL(50, max.rtt_count);
+  TEST_ASSERT_TRUE(max.rtt_max_us < NETWORK_US + BEACON_US * LISTEN_INTERVAL);
+  TEST_ASSERT_TRUE(max.rtt_avg_us > NETWORK_US);
+  TEST_ASSERT_EQUAL(max.rtt_avg_us, PowerSave::expected_rtt_us(
+                                        PowerSave::Policy::MAX_MODEM));
+
+  control.set(8);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MIN_MODEM);
+  for (int i = 0; i < 50; i++) {
+    exchange(NETWORK_US);
+  }
+  PowerSave::Stats min = PowerSave::stats(PowerSave::Policy::MIN_MODEM);
+  TEST_ASSERT_TRUE(min.rtt_count >= 50);
+  TEST_ASSERT_TRUE(min.rtt_max_us < NETWORK_US + BEACON_US * DTIM);
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MIN_MODEM);
+
+  /* The network slows down, waking for every DTIM is no longer enough */
+  for (int i = 0; i < 50 &&
+                  PowerSave::current() == PowerSave::Policy::MIN_MODEM;
+       i++) {
+    exchange(9000);
+  }
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::NONE);
+  TEST_ASSERT_TRUE(PowerSave::expected_rtt_us(PowerSave::Policy::MIN_MODEM) >
+                   8000);
+  control.clear();
+  Port::sleep_ms(DWELL_MS * 3);
+}
+
+/* The radio is on all the time without power save, for a beacon per wake
+ * with it */
+void estimates_duty_cycle() {
+  TEST_ASSERT_TRUE(PowerSave::current() == PowerSave::Policy::MAX_MODEM);
+  PowerSave::Stats before = PowerSave::stats(PowerSave::Policy::MAX_MODEM);
+  Port::sleep_ms(200);
+  PowerSave::Stats after = PowerSave::stats(PowerSave::Policy::MAX_MODEM);
+  uint64_t time_us = after.time_us - before.time_us;
+  uint64_t awake_us = after.awake_us - before.awake_us;
+  TEST_ASSERT_TRUE(time_us >= 200000);
+  uint64_t permille = awake_us * 1000 / time_us;
+  TEST_ASSERT_TRUE(permille <= 1000 * POWERSAVE_BEACON_AWAKE_US /
+                                   (BEACON_US * LISTEN_INTERVAL));
+  TEST_ASSERT_TRUE(permille >= 1000 * POWERSAVE_BEACON_AWAKE_US /
+                                   (BEACON_US * LISTEN_INTERVAL) - 1);
+
+  strict.set(1);
+  before = PowerSave::stats(PowerSave::Policy::NONE);
+  Port::sleep_ms(100);
+  after = PowerSave::stats(PowerSave::Policy::NONE);
+  TEST_ASSERT_EQUAL(after.time_us - before.time_us,
+                    after.awake_us - before.awake_us);
+  TEST_ASSERT_EQUAL(1000, after.duty_permille);
+  strict.clear();
+
+  for (size_t i = 0; i < POWERSAVE_POLICY_COUNT; i++) {
+    PowerSave::Policy policy = (PowerSave::Policy)i;
+    PowerSave::Stats stats = PowerSave::stats(policy);
+    printf("%-10s %6u ms  duty %4u/1000  %3u entries  rtt %5u us avg\n",
+           PowerSave::name(policy), (unsigned)(stats.time_us / 1000),
+           stats.duty_permille, stats.entries, stats.rtt_avg_us);
+    TEST_ASSERT_TRUE(stats.entries > 0);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  Async::start();
+  RUN_TEST(starts_deepest);
+  RUN_TEST(requirements_pick_policy);
+  RUN_TEST(hint_holds_none);
+  RUN_TEST(tracks_observed_latency);
+  RUN_TEST(estimates_duty_cycle);
+  PowerSave::end();
+  Async::stop();
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Profile/Profile.h"
+
+static Profile::Site test_wait("test.wait_us");
+
+static std::vector<std::string> lines;
+
+static void capture(const char *line) { lines.push_back(line); }
+
+static void append(const char *data, size_t size, void *ctx) {
+  static_cast<std::string *>(ctx)->append(data, size);
+}
+
+static Profile::TaskSample task(const char *name, uint32_t id,
+                                uint32_t runtime, uint32_t stack_free) {
+  Profile::TaskSample sample;
+  memset(&sample, 0, sizeof(sample));
+  strncpy(sample.name, name, sizeof(sample.name) - 1);
+  sample.id = id;
+  sample.runtime = runtime;
+  sample.stack_free = stack_free;
+  sample.priority = 5;
+  sample.core = id == 1 ? 0 : -1;
+  return sample;
+}
+
+static size_t count(const std::string &text, const char *needle) {
+  size_t n = 0;
+  for (size_t at = text.find(needle); at != std::string::npos;
+       at = text.find(needle, at + 1)) {
+    n++;
+  }
+  return n;
+}
+
+/* CPU is measured against the previous update, busiest first */
+void cpu_share() {
+  Profile::TaskSample first[] = {task("IDLE0", 1, 900, 512),
+                                 task("dns_resolve", 2, 100, 700)};
+  Profile::update(first, 2, 1000);
+  const Profile::TaskStats *stats;
+  TEST_ASSERT_EQUAL(2, Profile::stats(&stats));
+  TEST_ASSERT_EQUAL_STRING("IDLE0", stats[0].name);
+  TEST_ASSERT_EQUAL(900, stats[0].cpu_permille);
+
+  /* Counters wrap between updates, and a task starts */
+  uint32_t base = UINT32_MAX - 499;
+  Profile::TaskSample before[] = {task("IDLE0", 1, base, 512),
+                                  task("dns_resolve", 2, base, 700)};
+  Profile::update(before, 2, base);
+  Profile::TaskSample after[] = {task("IDLE0", 1, base + 200, 512),
+                                 task("dns_resolve", 2, base + 700, 640),
+                                 task("smart_config", 3, 50, 1800)};
+  Profile::update(after, 3, base + 1000);
+
+  TEST_ASSERT_EQUAL(3, Profile::stats(&stats));
+  TEST_ASSERT_EQUAL_STRING("dns_resolve", stats[0].name);
+  TEST_ASSERT_EQUAL(700, stats[0].cpu_permille);
+  TEST_ASSERT_EQUAL(640, stats[0].stack_free);
+  TEST_ASSERT_EQUAL_STRING("IDLE0", stats[1].name);
+  TEST_ASSERT_EQUAL(200, stats[1].cpu_permille);
+  TEST_ASSERT_EQUAL(0, stats[1].core);
+  TEST_ASSERT_EQUAL_STRING("smart_config", stats[2].name);
+  TEST_ASSERT_EQUAL(50, stats[2].cpu_permille);
+}
+
+void reports_lines() {
+  lines.clear();
+  Profile::set_output(capture);
+  Profile::report();
+  Profile::set_output(nullptr);
+  TEST_ASSERT_EQUAL(4, lines.size());
+  for (std::string &line : lines) {
+    printf("%s\n", line.c_str());
+    TEST_ASSERT_TRUE(line.compare(0, 3, "I (") == 0);
+  }
+  TEST_ASSERT_TRUE(lines[0].find("stack_free") != std::string::npos);
+  TEST_ASSERT_TRUE(lines[1].find("dns_resolve") != std::string::npos);
+  TEST_ASSERT_TRUE(lines[1].find("70.0") != std::string::npos);
+  TEST_ASSERT_TRUE(lines[3].find(" 5.0 ") != std::string::npos);
+}
+
+void blocked_records_site() {
+  Metrics::HistogramSnapshot before, after;
+  test_wait.snapshot(before);
+  {
+    Profile::Blocked blocked(test_wait);
+    Port::sleep_ms(5);
+  }
+  test_wait.snapshot(after);
+  TEST_ASSERT_EQUAL(before.count + 1, after.count);
+  TEST_ASSERT_TRUE(after.sum - before.sum >= 5000);
+}
+
+/* Spans and counters come out in time order, tasks named once */
+void writes_chrome_trace() {
+  Profile::set_tracing(true);
+  for (int i = 0; i < 3; i++) {
+    Profile::Blocked blocked(test_wait);
+    Port::sleep_ms(1);
+  }
+  Profile::TaskSample tasks[] = {task("IDLE0", 1, 0, 512)};
+  Profile::update(tasks, 1, 0);
+  Profile::set_tracing(false);
+  {
+    /* Not traced */
+    Profile::Blocked blocked(test_wait);
+  }
+
+  std::string trace;
+  TEST_ASSERT_EQUAL(4, Profile::write_trace(append, &trace));
+  printf("%s", trace.c_str());
+  TEST_ASSERT_TRUE(trace.compare(0, 16, "{\"traceEvents\":[") == 0);
+  TEST_ASSERT_EQUAL(3, count(trace, "\"ph\":\"X\""));
+  TEST_ASSERT_EQUAL(3, count(trace, "\"name\":\"test.wait_us\""));
+  TEST_ASSERT_EQUAL(2, count(trace, "\"ph\":\"M\""));
+  TEST_ASSERT_EQUAL(1, count(trace, "\"args\":{\"name\":\"native\"}"));
+  TEST_ASSERT_EQUAL(1, count(trace, "\"name\":\"IDLE0 cpu%\""));
+  TEST_ASSERT_EQUAL(1, count(trace, "\"args\":{\"bytes\":512}"));
+  TEST_ASSERT_EQUAL(count(trace, "{"), count(trace, "}"));
+  TEST_ASSERT_TRUE(trace.find("}\n]") != std::string::npos);
+  TEST_ASSERT_TRUE(trace.find(",\n]") == std::string::npos);
+
+  /* Drained */
+  trace.clear();
+  TEST_ASSERT_EQUAL(0, Profile::write_trace(append, &trace));
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"traceEvents\":[\n],\"displayTimeUnit\":\"ms\"}\n", trace.c_str());
+}
+
+void counts_dropped() {
+  Profile::dropped();
+  Profile::set_tracing(true);
+  for (int i = 0; i < PROFILE_TRACE_SIZE + 5; i++) {
+    Profile::Blocked blocked(test_wait);
+  }
+  Profile::set_tracing(false);
+  TEST_ASSERT_EQUAL(5, Profile::dropped());
+  std::string trace;
+  TEST_ASSERT_EQUAL(PROFILE_TRACE_SIZE, Profile::write_trace(append, &trace));
+}
+
+/* Natively there is nothing to sample, so nothing is reported, but the
+ * task starts and stops without waiting out its period */
+void starts_and_stops() {
+  lines.clear();
+  Profile::set_output(capture);
+  TEST_ASSERT_EQUAL(ESP_OK, Profile::start(60000));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, Profile::start());
+  Port::sleep_ms(10);
+  uint64_t start = Port::micros();
+  Profile::stop();
+  TEST_ASSERT_TRUE(Port::micros() - start < 1000000);
+  Profile::set_output(nullptr);
+  TEST_ASSERT_EQUAL(0, lines.size());
+  TEST_ASSERT_EQUAL(0, Profile::sample());
+  TEST_ASSERT_EQUAL(ESP_OK, Profile::start(60000));
+  Profile::stop();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(cpu_share);
+  RUN_TEST(reports_lines);
+  RUN_TEST(blocked_records_site);
+  RUN_TEST(writes_chrome_trace);
+  RUN_TEST(counts_dropped);
+  RUN_TEST(starts_and_stops);
+  return UNITY_END();
+}
+
+#endif
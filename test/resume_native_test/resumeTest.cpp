@@ -0,0 +1,219 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Host/FilePartition.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "Update/Resumable.h"
+
+static const size_t IMAGE_SIZE = 300 * 1024 + 123;
+static const char *const PARTITION_FILE = "resume_native_test.bin";
+
+/* Keeps the checkpoint in RAM, surviving a simulated reboot */
+class MemoryStore : public Update::ProgressStore {
+ public:
+  MemoryStore() : saved_(false), saves_(0) {}
+
+  esp_err_t load(Update::Progress &progress) override {
+    if (!saved_) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    progress = progress_;
+    return ESP_OK;
+  }
+  esp_err_t save(const Update::Progress &progress) override {
+    progress_ = progress;
+    saved_ = true;
+    saves_++;
+    return ESP_OK;
+  }
+  esp_err_t clear() override {
+    saved_ = false;
+    return ESP_OK;
+  }
+
+  bool saved_;
+  uint32_t saves_;
+  Update::Progress progress_;
+};
+
+static std::string make_image(size_t size) {
+  std::string image(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    image[i] = static_cast<char>((i * 2654435761u) >> 13);
+  }
+  return image;
+}
+
+static bool partition_holds(Host::FilePartition &partition,
+                            const std::string &image) {
+  return partition.contents().compare(0, image.size(), image) == 0;
+}
+
+void completes_through_disconnects() {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.drop_after = 40 * 1024;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+
+  Host::HttpRangeSource source(server.url());
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  MemoryStore store;
+
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_OK, download->run(server.url().c_str(), 20, 1));
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, download->size());
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, download->stats().downloaded);
+  TEST_ASSERT_TRUE(download->stats().attempts > 1);
+  TEST_ASSERT_FALSE(store.saved_);
+
+  uint8_t expected[SHA256_DIGEST_SIZE], actual[SHA256_DIGEST_SIZE];
+  Sha256::digest(image.data(), image.size(), expected);
+  download->digest(actual);
+  TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(expected));
+  delete download;
+
+  TEST_ASSERT_TRUE(partition_holds(partition, image));
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+/* Drops part way through a buffer leave writes unaligned, checkpoints must
+ * still be taken at every interval */
+void checkpoints_after_unaligned_drop() {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.drop_after = 40 * 1024 + 1000;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+
+  Host::HttpRangeSource source(server.url());
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  MemoryStore store;
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_OK, download->run(server.url().c_str(), 20, 1));
+  delete download;
+
+  const uint32_t last = IMAGE_SIZE / OTA_PROGRESS_INTERVAL *
+                        OTA_PROGRESS_INTERVAL;
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / OTA_PROGRESS_INTERVAL, store.saves_);
+  TEST_ASSERT_EQUAL(last, store.progress_.offset);
+  uint8_t expected[SHA256_DIGEST_SIZE];
+  Sha256::digest(image.data(), last, expected);
+  TEST_ASSERT_EQUAL_MEMORY(expected, store.progress_.digest,
+                           sizeof(expected));
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+/* Runs until the link gives up, leaving a checkpoint behind */
+static void interrupted_download(Host::HttpServer &server, MemoryStore &store) {
+  Host::HttpRangeSource source(server.url());
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT,
+                    download->run(server.url().c_str(), 1, 1));
+  delete download;
+  partition.close();
+  TEST_ASSERT_TRUE(store.saved_);
+}
+
+void resumes_after_reboot() {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.drop_after = 200 * 1024;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+  MemoryStore store;
+  interrupted_download(server, store);
+  uint32_t checkpoint = store.progress_.offset;
+  TEST_ASSERT_EQUAL(192 * 1024, checkpoint);
+
+  /* New objects, as after a reboot, reopening the same partition */
+  Host::HttpRangeSource source(server.url());
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open(false));
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_OK, download->run(server.url().c_str(), 5, 1));
+  TEST_ASSERT_EQUAL(checkpoint, download->stats().resumed_from);
+  TEST_ASSERT_EQUAL(IMAGE_SIZE - checkpoint, download->stats().downloaded);
+  delete download;
+
+  TEST_ASSERT_TRUE(partition_holds(partition, image));
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+void restarts_on_corrupt_partition() {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.drop_after = 200 * 1024;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+  MemoryStore store;
+  interrupted_download(server, store);
+
+  /* Flip bits inside the checkpointed region */
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open(false));
+  uint8_t zero = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, partition.write(1000, &zero, 1));
+
+  Host::HttpRangeSource source(server.url());
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_OK, download->run(server.url().c_str(), 5, 1));
+  TEST_ASSERT_EQUAL(0, download->stats().resumed_from);
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, download->stats().downloaded);
+  delete download;
+
+  TEST_ASSERT_TRUE(partition_holds(partition, image));
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+void restarts_when_server_ignores_range() {
+  std::string image = make_image(IMAGE_SIZE);
+  Host::HttpServerOptions options;
+  options.drop_after = 100 * 1024;
+  options.ranges = false;
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(image, options));
+
+  /* Every attempt starts over and fails the same way */
+  Host::HttpRangeSource source(server.url());
+  Host::FilePartition partition(PARTITION_FILE);
+  TEST_ASSERT_EQUAL(ESP_OK, partition.open());
+  MemoryStore store;
+  Update::ResumableDownload *download =
+      new Update::ResumableDownload(source, partition, store);
+  TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT,
+                    download->run(server.url().c_str(), 3, 1));
+  TEST_ASSERT_EQUAL(3, server.requests());
+  delete download;
+  partition.close();
+  remove(PARTITION_FILE);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(completes_through_disconnects);
+  RUN_TEST(checkpoints_after_unaligned_drop);
+  RUN_TEST(resumes_after_reboot);
+  RUN_TEST(restarts_on_corrupt_partition);
+  RUN_TEST(restarts_when_server_ignores_range);
+  return UNITY_END();
+}
+
+#endif
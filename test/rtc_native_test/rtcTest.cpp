@@ -0,0 +1,123 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <string.h>
+#include "NVS/RtcMirror.h"
+
+/* A power-on reset, the bootloader zeroes RTC memory */
+static void power_cycle() {
+  size_t size;
+  uint8_t *image = RtcMirror::retained(&size);
+  memset(image, 0, size);
+}
+
+/* The first boot reads through to NVS, later wakes do not open it */
+void reads_through_once() {
+  power_cycle();
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.begin());
+  uint32_t interval = 60;
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.write("interval", interval));
+
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, RtcMirror::begin());
+  interval = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::read("interval", interval));
+  TEST_ASSERT_EQUAL(60, interval);
+  TEST_ASSERT_TRUE(RtcMirror::nvs_opened());
+
+  /* Deep sleep */
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::begin());
+  interval = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::read("interval", interval));
+  TEST_ASSERT_EQUAL(60, interval);
+  uint16_t narrow;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, RtcMirror::read("interval", narrow));
+  TEST_ASSERT_FALSE(RtcMirror::nvs_opened());
+}
+
+/* Writes stay in RTC memory over sleep until flushed, with their type */
+void writes_back_on_flush() {
+  power_cycle();
+  RtcMirror::begin();
+  uint32_t count = 5;
+  int64_t total = -7;
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::write("count", count));
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::write("total", total));
+  TEST_ASSERT_EQUAL(2, RtcMirror::dirty());
+  uint32_t generation = RtcMirror::generation();
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::write("count", count));
+  TEST_ASSERT_EQUAL(generation, RtcMirror::generation());
+
+  RtcMirror::begin();
+  TEST_ASSERT_EQUAL(2, RtcMirror::dirty());
+  TEST_ASSERT_FALSE(RtcMirror::nvs_opened());
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::flush());
+  TEST_ASSERT_EQUAL(0, RtcMirror::dirty());
+  TEST_ASSERT_TRUE(RtcMirror::nvs_opened());
+
+  count = 0;
+  total = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.read("count", count));
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.read("total", total));
+  TEST_ASSERT_EQUAL(5, count);
+  TEST_ASSERT_TRUE(total == -7);
+}
+
+/* A damaged copy falls back to the other, two start empty */
+void survives_damaged_copy() {
+  power_cycle();
+  RtcMirror::begin();
+  uint8_t level = 1;
+  RtcMirror::write("level", level);
+  level = 2;
+  RtcMirror::write("level", level);
+  uint32_t generation = RtcMirror::generation();
+
+  size_t size;
+  uint8_t *image = RtcMirror::retained(&size);
+  size_t copy = size / 2;
+  /* A byte of the newest copy's first entry */
+  image[(generation & 1) * copy + 40] ^= 0xFF;
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::begin());
+  TEST_ASSERT_EQUAL(generation - 1, RtcMirror::generation());
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::read("level", level));
+  TEST_ASSERT_EQUAL(1, level);
+
+  for (size_t i = 0; i < size; i += copy) {
+    image[i + 40] ^= 0x55;
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, RtcMirror::begin());
+  TEST_ASSERT_EQUAL(0, RtcMirror::dirty());
+}
+
+/* The access point is remembered until forgotten */
+void remembers_access_point() {
+  power_cycle();
+  RtcMirror::WifiState ap;
+  RtcMirror::begin();
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, RtcMirror::wifi(&ap));
+
+  memset(&ap, 0, sizeof(ap));
+  ap.bssid[5] = 0x42;
+  ap.channel = 6;
+  RtcMirror::set_wifi(ap);
+  RtcMirror::begin();
+  memset(&ap, 0, sizeof(ap));
+  TEST_ASSERT_EQUAL(ESP_OK, RtcMirror::wifi(&ap));
+  TEST_ASSERT_EQUAL(6, ap.channel);
+  TEST_ASSERT_EQUAL(0x42, ap.bssid[5]);
+
+  RtcMirror::forget_wifi();
+  RtcMirror::begin();
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, RtcMirror::wifi(&ap));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(reads_through_once);
+  RUN_TEST(writes_back_on_flush);
+  RUN_TEST(survives_damaged_copy);
+  RUN_TEST(remembers_access_point);
+  return UNITY_END();
+}
+
+#endif
@@ -7,20 +7,29 @@ void app_main();
 }
 
 void init_test() {
-	TEST_ASSERT_EQUAL(ESP_OK, SmartConfig.begin(60 * 1000));
-	vTaskDelay(10000);
-	ip4_addr_t ipv4 = SmartConfig.ip();
+	SmartConfig::Future future;
+	TEST_ASSERT_EQUAL(ESP_OK, SmartConfig::sc_start(60, &future));
+	TEST_ASSERT_TRUE(future.wait() == SmartConfig::Result::CONNECTED);
+	ip4_addr_t ipv4 = EasyWifi::getIP();
 	ESP_LOGI("test", "IP:" IPSTR, IP2STR(&ipv4));
 }
 
-void init_test2() {
-	TEST_ASSERT_EQUAL(ESP_OK, SmartConfig.forceSmartConfig(60 * 1000));
+void cancel_test() {
+	SmartConfig::Future future;
+	TEST_ASSERT_EQUAL(ESP_OK, SmartConfig::sc_start(60, &future));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, SmartConfig::sc_start(60));
+	TEST_ASSERT_EQUAL(ESP_OK, SmartConfig::sc_cancel());
+	TEST_ASSERT_TRUE(future.wait() == SmartConfig::Result::CANCELLED);
+	TEST_ASSERT_FALSE(SmartConfig::is_running());
 }
 
 void test_task(void *) {
+	EasyWifi::init_hardware();
+	EasyWifi::init_software();
+
 	UNITY_BEGIN();
+	RUN_TEST(cancel_test);
 	RUN_TEST(init_test);
-	// RUN_TEST(init_test2);
 
 	UNITY_END();
 	vTaskDelete(NULL);
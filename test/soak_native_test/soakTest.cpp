@@ -0,0 +1,172 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include "DNS/DNS.h"
+#include "Port/Port.h"
+
+/* Every heap allocation of the process is counted, with its size kept in a
+ * header in front of the block */
+static std::atomic<int64_t> live_bytes(0);
+static std::atomic<int64_t> live_blocks(0);
+static std::atomic<int64_t> peak_bytes(0);
+
+static const size_t HEADER = alignof(std::max_align_t);
+
+void *operator new(size_t size) {
+  char *block = static_cast<char *>(malloc(size + HEADER));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<size_t *>(block) = size;
+  int64_t now = live_bytes += size;
+  live_blocks++;
+  int64_t peak = peak_bytes.load();
+  while (now > peak && !peak_bytes.compare_exchange_weak(peak, now)) {
+  }
+  return block + HEADER;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  char *block = static_cast<char *>(ptr) - HEADER;
+  live_bytes -= *reinterpret_cast<size_t *>(block);
+  live_blocks--;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+/* A simulated day: a lookup a minute, a reconnect every ten */
+static const int MINUTES_PER_DAY = 24 * 60;
+static const int RECONNECT_MINUTES = 10;
+static const int DAYS = 30;
+
+static const char *const HOSTS[] = {"tidalpaladin.com", "pool.ntp.org",
+                                    "mqtt.example.com"};
+
+static void session_task(void *arg) {
+  ip_addr_t addr;
+  *static_cast<esp_err_t *>(arg) = DNS::resolve(HOSTS[0], &addr);
+}
+
+static void parked_task(void *arg) {
+  static_cast<Port::Signal *>(arg)->take();
+}
+
+/* Runs the day's cycles, returns the number of failed lookups */
+static uint32_t simulate_day() {
+  uint32_t failed = 0;
+  for (int minute = 0; minute < MINUTES_PER_DAY; minute++) {
+    if (minute % RECONNECT_MINUTES == 0) {
+      /* Reconnecting loses the resolver cache and restarts the session */
+      Host::dns_flush();
+      esp_err_t result = ESP_FAIL;
+      Port::Task session;
+      TEST_ASSERT_EQUAL(ESP_OK, session.start(session_task, &result,
+                                              "session", 2048, 5));
+      session.join();
+      failed += result != ESP_OK;
+    }
+    ip_addr_t addr;
+    const char *host = HOSTS[minute % 3];
+    failed += DNS::resolve(host, &addr) != ESP_OK;
+  }
+  return failed;
+}
+
+/* Slots are returned on join and reused by the next start */
+void reuses_slots() {
+  Port::PoolStats before = Port::task_pool();
+  Port::Signal release;
+  for (int i = 0; i < 3 * PORT_TASKS; i++) {
+    Port::Task task;
+    TEST_ASSERT_EQUAL(ESP_OK, task.start(parked_task, &release, "reuse",
+                                         PORT_LARGE_STACK_SIZE, 5));
+    release.give();
+    task.join();
+  }
+  Port::PoolStats after = Port::task_pool();
+  TEST_ASSERT_EQUAL(PORT_TASKS, after.capacity);
+  TEST_ASSERT_EQUAL(before.in_use, after.in_use);
+  TEST_ASSERT_EQUAL(before.exhausted, after.exhausted);
+  TEST_ASSERT_TRUE(after.peak <= PORT_TASKS);
+}
+
+/* Small tasks spill into large slots, past that starts are refused */
+void refuses_when_exhausted() {
+  Port::Signal release[PORT_TASKS];
+  Port::Task tasks[PORT_TASKS];
+  for (int i = 0; i < PORT_TASKS; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, tasks[i].start(parked_task, &release[i],
+                                             "full", 1024, 5));
+  }
+  Port::PoolStats full = Port::task_pool();
+  TEST_ASSERT_EQUAL(PORT_TASKS, full.in_use);
+  TEST_ASSERT_EQUAL(PORT_TASKS, full.peak);
+
+  Port::Task extra;
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM,
+                    extra.start(parked_task, nullptr, "extra", 1024, 5));
+  TEST_ASSERT_EQUAL(full.exhausted + 1, Port::task_pool().exhausted);
+  extra.join();
+
+  for (int i = 0; i < PORT_TASKS; i++) {
+    release[i].give();
+    tasks[i].join();
+  }
+  TEST_ASSERT_EQUAL(0, Port::task_pool().in_use);
+}
+
+void rejects_oversized_stack() {
+  Port::Task task;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    task.start(parked_task, nullptr, "big",
+                               PORT_LARGE_STACK_SIZE + 1, 5));
+  TEST_ASSERT_EQUAL(0, Port::task_pool().in_use);
+}
+
+/* After the first day every allocation is matched by a free, and the heap
+ * never grows past the first day's peak */
+void soaks_30_days() {
+  Host::dns_set_latency_ms(0);
+  uint32_t exhausted = Port::task_pool().exhausted;
+  TEST_ASSERT_EQUAL(0, simulate_day());
+  int64_t bytes = live_bytes, blocks = live_blocks, peak = peak_bytes;
+  printf("day 1: %lld bytes in %lld blocks live, peak %lld\n",
+         (long long)bytes, (long long)blocks, (long long)peak);
+
+  uint64_t start = Port::micros();
+  uint32_t failed = 0;
+  for (int day = 2; day <= DAYS; day++) {
+    failed += simulate_day();
+    TEST_ASSERT_EQUAL(bytes, live_bytes.load());
+    TEST_ASSERT_EQUAL(blocks, live_blocks.load());
+  }
+  printf("day %d: %lld bytes in %lld blocks live, peak %lld, %.1f s\n", DAYS,
+         (long long)live_bytes.load(), (long long)live_blocks.load(),
+         (long long)peak_bytes.load(), (Port::micros() - start) / 1e6);
+
+  TEST_ASSERT_EQUAL(0, failed);
+  TEST_ASSERT_EQUAL(peak, peak_bytes.load());
+  Port::PoolStats pool = Port::task_pool();
+  TEST_ASSERT_EQUAL(0, pool.in_use);
+  TEST_ASSERT_EQUAL(exhausted, pool.exhausted);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(reuses_slots);
+  RUN_TEST(refuses_when_exhausted);
+  RUN_TEST(rejects_oversized_stack);
+  RUN_TEST(soaks_30_days);
+  return UNITY_END();
+}
+
+#endif
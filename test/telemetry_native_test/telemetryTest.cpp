@@ -0,0 +1,401 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "Async/Async.h"
+#include "Bench/Bench.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "Telemetry/Cbor.h"
+#include "Telemetry/Uploader.h"
+#include "Update/Compressed.h"
+#include "Work/Work.h"
+
+/* Round trip of a request, scaled down from a radio waking up */
+#define REQUEST_US 2000
+
+/* Transport::post() over a kept connection, as HttpTransport on the device */
+class LoopbackTransport : public Telemetry::Transport {
+ public:
+  explicit LoopbackTransport(const std::string &url) : url_(url) {
+    client_.set_keep_alive(true);
+  }
+
+  esp_err_t post(const Telemetry::Batch &batch) override {
+    std::string headers = "Content-Type: " TELEMETRY_CONTENT_TYPE "\r\n";
+    headers += "Idempotency-Key: " + std::string(batch.key) + "\r\n";
+    if (batch.compressed) {
+      headers += "Content-Encoding: " TELEMETRY_ENCODING "\r\n";
+    }
+    std::string body((const char *)batch.body, batch.size);
+    esp_err_t err = client_.post(url_, body, headers);
+    uint8_t buf[64];
+    while (err == ESP_OK && client_.read(buf, sizeof(buf)) > 0) {
+    }
+    return err == ESP_OK ? Telemetry::status_error(client_.status())
+                         : ESP_FAIL;
+  }
+
+ private:
+  std::string url_;
+  Host::HttpClient client_;
+};
+
+class StringSink : public Update::ChunkSink {
+ public:
+  esp_err_t write(const uint8_t *data, size_t size) override {
+    out.append((const char *)data, size);
+    return ESP_OK;
+  }
+  std::string out;
+};
+
+static std::atomic<bool> connected(true);
+static bool is_connected() { return connected; }
+
+static bool wait_for(bool (*done)(void *), void *arg, uint32_t ms) {
+  uint64_t deadline = Port::micros() + ms * 1000ull;
+  while (!done(arg)) {
+    if (Port::micros() > deadline) {
+      return false;
+    }
+    Port::sleep_ms(1);
+  }
+  return true;
+}
+
+static bool drained(void *uploader) {
+  return static_cast<Telemetry::Uploader *>(uploader)->pending() == 0;
+}
+
+static bool stopped(void *uploader) {
+  return static_cast<Telemetry::Uploader *>(uploader)->done();
+}
+
+static void stop(Telemetry::Uploader &uploader) {
+  uploader.stop();
+  TEST_ASSERT_TRUE(wait_for(stopped, &uploader, 2000));
+}
+
+/* One record as a sensor would encode it */
+static size_t reading(uint8_t *buf, size_t size, uint32_t i) {
+  Cbor::Writer cbor(buf, size);
+  cbor.map(3);
+  cbor.text("t");
+  cbor.uinteger(1539820800 + i);
+  cbor.text("temp");
+  cbor.float32(21.5f + (i % 4) * 0.25f);
+  cbor.text("rssi");
+  cbor.integer(-60 - (int)(i % 8));
+  return cbor.size();
+}
+
+static std::string hex(const uint8_t *data, size_t size) {
+  std::string out;
+  char byte[3];
+  for (size_t i = 0; i < size; i++) {
+    snprintf(byte, sizeof(byte), "%02x", data[i]);
+    out += byte;
+  }
+  return out;
+}
+
+/* Examples from RFC 7049 appendix A */
+void cbor_encodes() {
+  uint8_t buf[16];
+  Cbor::Writer cbor(buf, sizeof(buf));
+  struct {
+    int64_t value;
+    const char *expected;
+  } ints[] = {{0, "00"},     {23, "17"},       {24, "1818"},
+              {1000, "1903e8"}, {1000000, "1a000f4240"},
+              {-1, "20"},    {-1000, "3903e7"}};
+  for (auto &example : ints) {
+    cbor.reset();
+    cbor.integer(example.value);
+    TEST_ASSERT_EQUAL_STRING(example.expected,
+                             hex(buf, cbor.size()).c_str());
+  }
+
+  cbor.reset();
+  cbor.uinteger(1000000000000ull);
+  TEST_ASSERT_EQUAL_STRING("1b000000e8d4a51000",
+                           hex(buf, cbor.size()).c_str());
+
+  cbor.reset();
+  cbor.text("a");
+  cbor.float32(1.5f);
+  cbor.boolean(true);
+  cbor.null();
+  TEST_ASSERT_EQUAL_STRING("6161fa3fc00000f5f6",
+                           hex(buf, cbor.size()).c_str());
+
+  cbor.reset();
+  cbor.array(2);
+  cbor.map(1);
+  uint8_t raw[] = {0x01, 0x02};
+  cbor.bytes(raw, sizeof(raw));
+  TEST_ASSERT_EQUAL_STRING("82a1420102", hex(buf, cbor.size()).c_str());
+
+  /* Nothing more once past the end */
+  Cbor::Writer small(buf, 4);
+  small.text("abcd");
+  small.null();
+  TEST_ASSERT_TRUE(small.overflowed());
+  TEST_ASSERT_EQUAL(1, small.size());
+}
+
+/* Batches decompress with the decoder used for images */
+void compress_round_trip() {
+  uint8_t batch[TELEMETRY_BATCH_SIZE];
+  size_t size = 0;
+  for (uint32_t i = 0; size + 32 < sizeof(batch); i++) {
+    size += reading(batch + size, sizeof(batch) - size, i);
+  }
+  static uint8_t packed[TELEMETRY_BATCH_SIZE + TELEMETRY_ENVELOPE_SIZE];
+  size_t packed_size = Telemetry::compress(batch, size, packed, sizeof(packed));
+  TEST_ASSERT_TRUE(packed_size > 0);
+  TEST_ASSERT_TRUE(packed_size < size / 2);
+  printf("%u bytes of readings compress to %u\n", (unsigned)size,
+         (unsigned)packed_size);
+
+  StringSink sink;
+  Update::Decompressor decoder(sink);
+  TEST_ASSERT_EQUAL(ESP_OK, decoder.write(packed, packed_size));
+  TEST_ASSERT_EQUAL(ESP_OK, decoder.finish());
+  TEST_ASSERT_EQUAL(size, sink.out.size());
+  TEST_ASSERT_EQUAL(0, memcmp(batch, sink.out.data(), size));
+
+  /* Too little room */
+  TEST_ASSERT_EQUAL(0, Telemetry::compress(batch, size, packed, 64));
+}
+
+/* A batch goes out once full, or once its oldest record is old enough */
+void batches_by_size_and_age() {
+  Host::HttpServer server;
+  Host::HttpServerOptions options;
+  options.keep_alive_ms = 1000;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("", options));
+  LoopbackTransport transport(server.url("/ingest"));
+
+  Telemetry::UploaderConfig config;
+  config.device_id = "dev1";
+  config.send_bytes = 200;
+  config.max_age_ms = 50;
+  config.compress = false;
+  Telemetry::Uploader uploader(transport, config);
+  TEST_ASSERT_EQUAL(ESP_OK, uploader.start());
+
+  /* By size, with the records in the order added */
+  uint8_t records[16][32];
+  size_t sizes[16], total = 0;
+  uint32_t count = 0;
+  while (total < config.send_bytes) {
+    sizes[count] = reading(records[count], sizeof(records[count]), count);
+    total += sizes[count];
+    TEST_ASSERT_EQUAL(ESP_OK, uploader.add(records[count], sizes[count]));
+    count++;
+  }
+  TEST_ASSERT_TRUE(wait_for(drained, &uploader, 1000));
+  std::vector<Host::HttpPost> posts = server.posts();
+  TEST_ASSERT_EQUAL(1, posts.size());
+  TEST_ASSERT_EQUAL_STRING("/ingest", posts[0].path.c_str());
+  TEST_ASSERT_EQUAL_STRING("", posts[0].encoding.c_str());
+  TEST_ASSERT_EQUAL(0, posts[0].key.find("dev1-"));
+
+  uint8_t expected[512];
+  Cbor::Writer cbor(expected, sizeof(expected));
+  cbor.map(3);
+  cbor.text("d");
+  cbor.text("dev1");
+  cbor.text("s");
+  cbor.uinteger(0);
+  cbor.text("r");
+  cbor.array(count);
+  for (uint32_t i = 0; i < count; i++) {
+    cbor.raw(records[i], sizes[i]);
+  }
+  TEST_ASSERT_EQUAL(cbor.size(), posts[0].body.size());
+  TEST_ASSERT_EQUAL(0, memcmp(expected, posts[0].body.data(), cbor.size()));
+
+  /* By age, well short of send_bytes */
+  uint64_t start = Port::micros();
+  TEST_ASSERT_EQUAL(ESP_OK, uploader.add(records[0], sizes[0]));
+  TEST_ASSERT_TRUE(wait_for(drained, &uploader, 1000));
+  uint64_t elapsed = Port::micros() - start;
+  TEST_ASSERT_TRUE(elapsed >= config.max_age_ms * 1000);
+  posts = server.posts();
+  TEST_ASSERT_EQUAL(2, posts.size());
+  TEST_ASSERT_NOT_EQUAL(0, posts[0].key.compare(posts[1].key));
+
+  Telemetry::UploaderStats stats = uploader.stats();
+  TEST_ASSERT_EQUAL(count + 1, stats.records);
+  TEST_ASSERT_EQUAL(2, stats.batches);
+  TEST_ASSERT_EQUAL(0, stats.retries);
+  TEST_ASSERT_EQUAL(1, server.connections());
+  stop(uploader);
+  server.stop();
+}
+
+/* Nothing is sent while offline, and everything once back online */
+void waits_for_connectivity() {
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(""));
+  LoopbackTransport transport(server.url("/ingest"));
+
+  Telemetry::UploaderConfig config;
+  config.online = is_connected;
+  Telemetry::Uploader uploader(transport, config);
+  connected = false;
+  TEST_ASSERT_EQUAL(ESP_OK, uploader.start());
+
+  uint8_t record[32];
+  size_t size = reading(record, sizeof(record), 0);
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, uploader.add(record, size));
+  }
+  uploader.flush();
+  Port::sleep_ms(30);
+  TEST_ASSERT_EQUAL(0, server.requests());
+  TEST_ASSERT_EQUAL(5, uploader.pending());
+
+  /* As EasyWifi does on GOT_IP */
+  connected = true;
+  Async::notify();
+  TEST_ASSERT_TRUE(wait_for(drained, &uploader, 1000));
+  TEST_ASSERT_EQUAL(1, server.posts().size());
+  TEST_ASSERT_EQUAL(5, uploader.stats().records);
+  stop(uploader);
+  server.stop();
+}
+
+/* Lost replies are retried under the same key, and the backend keeps one
+ * copy. A refused batch is dropped. */
+void retries_idempotently() {
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start(""));
+  server.drop_posts(2);
+  LoopbackTransport transport(server.url("/ingest"));
+
+  Telemetry::UploaderConfig config;
+  config.retry_ms = 5;
+  Telemetry::Uploader uploader(transport, config);
+  TEST_ASSERT_EQUAL(ESP_OK, uploader.start());
+
+  uint8_t record[32];
+  size_t size = reading(record, sizeof(record), 0);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, uploader.add(record, size));
+  }
+  uploader.flush();
+  TEST_ASSERT_TRUE(wait_for(drained, &uploader, 1000));
+  TEST_ASSERT_EQUAL(3, server.requests());
+  TEST_ASSERT_EQUAL(1, server.posts().size());
+  TEST_ASSERT_EQUAL(2, server.duplicates());
+  Telemetry::UploaderStats stats = uploader.stats();
+  TEST_ASSERT_EQUAL(2, stats.retries);
+  TEST_ASSERT_EQUAL(3, stats.records);
+  stop(uploader);
+  server.stop();
+
+  Host::HttpServerOptions options;
+  options.post_status = 400;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("", options));
+  LoopbackTransport refused(server.url("/ingest"));
+  Telemetry::Uploader dropping(refused, config);
+  TEST_ASSERT_EQUAL(ESP_OK, dropping.start());
+  TEST_ASSERT_EQUAL(ESP_OK, dropping.add(record, size));
+  dropping.flush();
+  TEST_ASSERT_TRUE(wait_for(drained, &dropping, 1000));
+  TEST_ASSERT_EQUAL(1, server.requests());
+  stats = dropping.stats();
+  TEST_ASSERT_EQUAL(1, stats.rejected);
+  TEST_ASSERT_EQUAL(0, stats.records);
+  TEST_ASSERT_EQUAL(0, stats.retries);
+  stop(dropping);
+  server.stop();
+}
+
+struct Upload {
+  Telemetry::Uploader *uploader;
+  uint32_t batch;
+  uint32_t next;
+};
+
+/* Microseconds per record, sending 'batch' records per request */
+static uint32_t upload_records(void *arg) {
+  Upload *upload = static_cast<Upload *>(arg);
+  uint8_t record[32];
+  uint64_t start = Port::micros();
+  for (uint32_t i = 0; i < upload->batch; i++) {
+    size_t size = reading(record, sizeof(record), upload->next++);
+    if (upload->uploader->add(record, size) != ESP_OK) {
+      return BENCH_FAILED;
+    }
+  }
+  upload->uploader->flush();
+  if (!wait_for(drained, upload->uploader, 2000)) {
+    return BENCH_FAILED;
+  }
+  return (Port::micros() - start) / upload->batch;
+}
+
+/* Per record cost of one request per reading against batches of 32, over
+ * a link with REQUEST_US of latency */
+void upload_throughput() {
+  const uint32_t batches[] = {1, 32};
+  uint32_t per_record[2];
+  for (int i = 0; i < 2; i++) {
+    Host::HttpServer server;
+    Host::HttpServerOptions options;
+    options.keep_alive_ms = 1000;
+    options.request_us = REQUEST_US;
+    TEST_ASSERT_EQUAL(ESP_OK, server.start("", options));
+    LoopbackTransport transport(server.url("/ingest"));
+    Telemetry::Uploader uploader(transport);
+    TEST_ASSERT_EQUAL(ESP_OK, uploader.start());
+
+    Upload upload = {&uploader, batches[i], 0};
+    char name[32];
+    snprintf(name, sizeof(name), "telemetry.upload_x%u",
+             (unsigned)batches[i]);
+    Bench::Scenario scenario = {name, "us", upload_records, &upload, 2, 20};
+    Bench::Result result;
+    TEST_ASSERT_EQUAL(ESP_OK, Bench::run(scenario, result));
+    Bench::print(result);
+    per_record[i] = result.p50;
+
+    Telemetry::UploaderStats stats = uploader.stats();
+    printf("%u records/s, radio on %u us and %u bytes sent per record "
+           "(%u raw)\n",
+           (unsigned)(1000000 / (result.mean ? result.mean : 1)),
+           (unsigned)(stats.radio_us / stats.records),
+           (unsigned)(stats.sent_bytes / stats.records),
+           (unsigned)(stats.raw_bytes / stats.records));
+    TEST_ASSERT_EQUAL(0, stats.retries);
+    stop(uploader);
+    server.stop();
+  }
+  TEST_ASSERT_TRUE(per_record[1] * 4 < per_record[0]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  Work::start();
+  Async::start();
+  RUN_TEST(cbor_encodes);
+  RUN_TEST(compress_round_trip);
+  RUN_TEST(batches_by_size_and_age);
+  RUN_TEST(waits_for_connectivity);
+  RUN_TEST(retries_idempotently);
+  RUN_TEST(upload_throughput);
+  Async::stop();
+  Work::stop();
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Bench/Bench.h"
+#include "Host/HttpClient.h"
+#include "Host/HttpServer.h"
+#include "NVS/NVS.h"
+#include "Tls/SessionCache.h"
+
+/* Scaled down from the device's seconds of ECDHE and milliseconds of
+ * resumption */
+#define HANDSHAKE_US 5000
+#define RESUME_US 200
+
+static const char *const CA = "-----BEGIN CERTIFICATE-----\nca\n";
+static const char *const NEW_CA = "-----BEGIN CERTIFICATE-----\nnew\n";
+
+static Host::HttpServerOptions tls_options() {
+  Host::HttpServerOptions options;
+  options.tickets = true;
+  options.handshake_us = HANDSHAKE_US;
+  options.resume_us = RESUME_US;
+  options.ticket_lifetime_s = 3600;
+  return options;
+}
+
+/* One GET on a new connection, true if it resumed */
+static bool connect_once(const std::string &url, const char *cert_pem) {
+  Host::HttpClient client;
+  client.set_tls(cert_pem);
+  TEST_ASSERT_EQUAL(ESP_OK, client.get(url));
+  uint8_t buf[64];
+  while (client.read(buf, sizeof(buf)) > 0) {
+  }
+  return client.resumed();
+}
+
+/* The second connection resumes the first one's session */
+void resumes_on_reconnect() {
+  Tls::clear();
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", tls_options()));
+  TEST_ASSERT_FALSE(connect_once(server.url(), CA));
+  TEST_ASSERT_TRUE(connect_once(server.url(), CA));
+  TEST_ASSERT_TRUE(connect_once(server.url(), CA));
+  TEST_ASSERT_EQUAL(2, server.resumptions());
+  TEST_ASSERT_EQUAL(3, server.requests());
+
+  /* The server's new certificate declines the ticket, and its next one is
+   * kept instead */
+  server.rotate_certificate();
+  TEST_ASSERT_FALSE(connect_once(server.url(), CA));
+  TEST_ASSERT_TRUE(connect_once(server.url(), CA));
+  server.stop();
+}
+
+/* A session checked against another CA is never offered */
+void drops_on_pin_change() {
+  Tls::clear();
+  uint8_t old_pin[TLS_PIN_SIZE], new_pin[TLS_PIN_SIZE];
+  Tls::pin(CA, old_pin);
+  Tls::pin(NEW_CA, new_pin);
+  TEST_ASSERT_TRUE(memcmp(old_pin, new_pin, TLS_PIN_SIZE) != 0);
+
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Tls::store("https://ota:443", CA, "t1", 2, 1000, 60));
+  char session[TLS_SESSION_MAX_SIZE];
+  size_t size;
+  /* The same certificate at another address, as after an update */
+  std::string copy = CA;
+  TEST_ASSERT_EQUAL(ESP_OK, Tls::find("https://ota:443", copy.c_str(), 1001,
+                                      session, sizeof(session), &size));
+  Tls::CacheStats before = Tls::stats();
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                    Tls::find("https://ota:443", NEW_CA, 1001, session,
+                              sizeof(session), &size));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    Tls::find("https://ota:443", CA, 1001, session,
+                              sizeof(session), &size));
+  TEST_ASSERT_EQUAL(before.invalidated + 1, Tls::stats().invalidated);
+
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", tls_options()));
+  TEST_ASSERT_FALSE(connect_once(server.url(), CA));
+  TEST_ASSERT_FALSE(connect_once(server.url(), NEW_CA));
+  TEST_ASSERT_EQUAL(0, server.resumptions());
+  server.stop();
+}
+
+/* Sessions expire after the server's lifetime, and the oldest host makes
+ * room for a new one */
+void expires_and_evicts() {
+  Tls::clear();
+  char session[TLS_SESSION_MAX_SIZE];
+  size_t size;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Tls::store("https://a:443", CA, "ta", 2, 100, 10));
+  TEST_ASSERT_EQUAL(ESP_OK, Tls::find("https://a:443", CA, 109, session,
+                                      sizeof(session), &size));
+  TEST_ASSERT_EQUAL(2, size);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, Tls::find("https://a:443", CA, 110,
+                                                 session, sizeof(session),
+                                                 &size));
+
+  char key[32];
+  for (int i = 0; i <= TLS_CACHE_ENTRIES; i++) {
+    snprintf(key, sizeof(key), "https://h%i:443", i);
+    TEST_ASSERT_EQUAL(ESP_OK, Tls::store(key, CA, "t", 1, 100, 0));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, Tls::find("https://h0:443", CA, 101,
+                                                 session, sizeof(session),
+                                                 &size));
+  snprintf(key, sizeof(key), "https://h%i:443", TLS_CACHE_ENTRIES);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Tls::find(key, CA, 101, session, sizeof(session), &size));
+  /* No lifetime from the server */
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    Tls::find(key, CA, 100 + TLS_SESSION_LIFETIME_S - 1,
+                              session, sizeof(session), &size));
+}
+
+/* Saved sessions resume the first connection after a reboot */
+void survives_reboot() {
+  TEST_ASSERT_EQUAL(ESP_OK, NVS.begin());
+  Tls::clear();
+  Tls::persist(true);
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", tls_options()));
+  TEST_ASSERT_FALSE(connect_once(server.url(), CA));
+
+  /* RAM is lost, the NVS copy is not */
+  Tls::clear();
+  TEST_ASSERT_EQUAL(ESP_OK, Tls::load(time(nullptr)));
+  TEST_ASSERT_TRUE(connect_once(server.url(), CA));
+  Tls::persist(false);
+  server.stop();
+}
+
+struct TlsRun {
+  std::string url;
+  const char *cert_pem;
+};
+
+static uint32_t connect_us(void *arg) {
+  TlsRun &run = *static_cast<TlsRun *>(arg);
+  uint64_t start = Port::micros();
+  Host::HttpClient client;
+  client.set_tls(run.cert_pem);
+  if (client.get(run.url) != ESP_OK) {
+    return BENCH_FAILED;
+  }
+  uint8_t buf[64];
+  while (client.read(buf, sizeof(buf)) > 0) {
+  }
+  return Port::micros() - start;
+}
+
+/* Without a cached session every connection is a full handshake */
+static uint32_t full_connect_us(void *arg) {
+  Tls::clear();
+  return connect_us(arg);
+}
+
+/* Connection time with a full handshake each time, then resuming */
+void handshake_time() {
+  Host::HttpServer server;
+  TEST_ASSERT_EQUAL(ESP_OK, server.start("hello", tls_options()));
+  TlsRun run = {server.url(), CA};
+  Bench::Scenario full = {"tls.connect_full", "us", full_connect_us, &run, 5,
+                          100};
+  Bench::Scenario resumed = {"tls.connect_resumed", "us", connect_us, &run,
+                             5, 100};
+  Bench::Result full_result, resumed_result;
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(full, full_result));
+  Bench::print(full_result);
+  TEST_ASSERT_EQUAL(ESP_OK, Bench::run(resumed, resumed_result));
+  Bench::print(resumed_result);
+
+  TEST_ASSERT_TRUE(full_result.min >= HANDSHAKE_US);
+  TEST_ASSERT_TRUE(resumed_result.p50 < HANDSHAKE_US);
+  server.stop();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(resumes_on_reconnect);
+  RUN_TEST(drops_on_pin_change);
+  RUN_TEST(expires_and_evicts);
+  RUN_TEST(survives_reboot);
+  RUN_TEST(handshake_time);
+  return UNITY_END();
+}
+
+#endif
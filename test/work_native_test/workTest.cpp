@@ -0,0 +1,179 @@
+#ifdef UNIT_TEST
+#include "unity.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "Metrics/Metrics.h"
+#include "Ring/MpmcRing.h"
+#include "Work/Work.h"
+
+static uint32_t counter(const char *name) {
+  return static_cast<Metrics::Counter *>(Metrics::find(name))->value();
+}
+
+/* Appends its tag to the run order */
+struct Order {
+  int tags[16];
+  int count;
+};
+static Order order;
+static int tags[16];
+
+static void record(void *arg) {
+  order.tags[order.count++] = *static_cast<int *>(arg);
+}
+
+static std::atomic<uint32_t> ran(0);
+static void count(void *arg) { ran++; }
+
+/* Producers and consumers at once lose and duplicate nothing */
+void ring_is_mpmc() {
+  MpmcRing<uint32_t, 64> ring;
+  const int producers = 3, items = 100000;
+  std::atomic<uint64_t> sum(0);
+  std::atomic<int> popped(0);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&ring, p] {
+      for (uint32_t i = 1; i <= items; i++) {
+        while (!ring.push(i + p * items)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < 2; c++) {
+    threads.emplace_back([&] {
+      uint32_t item;
+      while (popped < producers * items) {
+        if (ring.pop(item)) {
+          sum += item;
+          popped++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  uint64_t n = (uint64_t)producers * items;
+  TEST_ASSERT_EQUAL(n, popped.load());
+  TEST_ASSERT_TRUE(sum == n * (n + 1) / 2);
+  TEST_ASSERT_TRUE(ring.empty());
+}
+
+/* Higher priorities run first, in submission order within one */
+void runs_by_priority() {
+  order.count = 0;
+  for (int i = 0; i < 6; i++) {
+    tags[i] = i;
+  }
+  Work::submit(record, &tags[0], Work::Priority::LOW);
+  Work::submit(record, &tags[1], Work::Priority::NORMAL);
+  Work::submit(record, &tags[2], Work::Priority::HIGH);
+  Work::submit(record, &tags[3], Work::Priority::LOW);
+  Work::submit(record, &tags[4], Work::Priority::HIGH);
+  Work::submit(record, &tags[5], Work::Priority::NORMAL);
+  TEST_ASSERT_EQUAL(6, Work::pending());
+  while (Work::run_one()) {
+  }
+  int expected[] = {2, 4, 1, 5, 0, 3};
+  TEST_ASSERT_EQUAL(6, order.count);
+  for (int i = 0; i < 6; i++) {
+    TEST_ASSERT_EQUAL(expected[i], order.tags[i]);
+  }
+}
+
+/* A full queue spills to the other workers', then submit() fails */
+void rejects_when_full() {
+  uint32_t rejected = counter("work.rejected");
+  ran = 0;
+  for (int i = 0; i < WORK_WORKERS * WORK_QUEUE_SIZE; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, Work::submit(count, nullptr));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, Work::submit(count, nullptr));
+  TEST_ASSERT_EQUAL(rejected + 1, counter("work.rejected"));
+  /* Other priorities have queues of their own */
+  TEST_ASSERT_EQUAL(ESP_OK, Work::submit(count, nullptr, Work::Priority::LOW));
+
+  uint32_t steals = counter("work.steals");
+  while (Work::run_one()) {
+  }
+  TEST_ASSERT_EQUAL(WORK_WORKERS * WORK_QUEUE_SIZE + 1, ran.load());
+  TEST_ASSERT_TRUE(counter("work.steals") > steals);
+}
+
+static std::mutex threads_lock;
+static std::set<std::thread::id> workers_seen;
+
+static void slow(void *arg) {
+  {
+    std::lock_guard<std::mutex> lock(threads_lock);
+    workers_seen.insert(std::this_thread::get_id());
+  }
+  Port::sleep_ms(10);
+  ran++;
+}
+
+/* Jobs all submitted to one worker are shared with the idle one */
+void idle_workers_steal() {
+  ran = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  uint64_t start = Port::micros();
+  const int jobs = 8;
+  for (int i = 0; i < jobs; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, Work::submit(slow, nullptr));
+  }
+  while (ran < jobs) {
+    Port::sleep_ms(1);
+  }
+  uint32_t ms = (Port::micros() - start) / 1000;
+  Work::stop();
+  printf("%d jobs of 10 ms on %d workers in %u ms\n", jobs, WORK_WORKERS, ms);
+  TEST_ASSERT_EQUAL(WORK_WORKERS, workers_seen.size());
+  TEST_ASSERT_TRUE(ms < jobs * 10 * 3 / 4);
+}
+
+/* Tasks submitting at once have every job run exactly once */
+void concurrent_submit() {
+  ran = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, Work::start());
+  const int producers = 4, jobs = 20000;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([] {
+      for (int i = 0; i < jobs; i++) {
+        while (Work::submit(count, nullptr) != ESP_OK) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  while (ran < producers * jobs) {
+    Port::sleep_ms(1);
+  }
+  Work::stop();
+  TEST_ASSERT_EQUAL(producers * jobs, ran.load());
+  TEST_ASSERT_EQUAL(0, Work::pending());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(ring_is_mpmc);
+  RUN_TEST(runs_by_priority);
+  RUN_TEST(rejects_when_full);
+  RUN_TEST(idle_workers_steal);
+  RUN_TEST(concurrent_submit);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * Compares two benchmark runs, as printed by the bench_native_test and
+ * bench_test suites.
+ *
+ *   benchdiff [-t percent] old.txt new.txt
+ *
+ * Lines other than the JSON results are skipped, so the captured test
+ * output can be passed as is. Results are matched by name and platform,
+ * and p50 and p99 are compared. A result is marked as a regression when
+ * either got worse by more than 'percent', 10 by default. Units ending in
+ * "/s" are throughputs, where higher is better. Exits with 1 if anything
+ * regressed. Build with
+ *
+ *   g++ -O2 -std=gnu++14 -o benchdiff tools/benchdiff.cpp
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <map>
+#include <string>
+
+struct Result {
+  std::string unit;
+  double p50;
+  double p99;
+};
+
+typedef std::map<std::string, Result> Results;
+
+/* Finds '"key":' in a JSON line and returns what follows, or nullptr */
+static const char *field(const std::string &line, const char *key) {
+  std::string pattern = std::string("\"") + key + "\":";
+  size_t at = line.find(pattern);
+  return at == std::string::npos ? nullptr
+                                 : line.c_str() + at + pattern.size();
+}
+
+static bool string_field(const std::string &line, const char *key,
+                         std::string *out) {
+  const char *value = field(line, key);
+  if (value == nullptr || *value != '"') {
+    return false;
+  }
+  const char *end = strchr(value + 1, '"');
+  if (end == nullptr) {
+    return false;
+  }
+  out->assign(value + 1, end);
+  return true;
+}
+
+static bool number_field(const std::string &line, const char *key,
+                         double *out) {
+  const char *value = field(line, key);
+  if (value == nullptr) {
+    return false;
+  }
+  char *end;
+  *out = strtod(value, &end);
+  return end != value;
+}
+
+static bool load(const char *path, Results *results) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::string name, platform;
+    Result result;
+    if (line.empty() || line[0] != '{' ||
+        !string_field(line, "bench", &name) ||
+        !string_field(line, "platform", &platform) ||
+        !string_field(line, "unit", &result.unit) ||
+        !number_field(line, "p50", &result.p50) ||
+        !number_field(line, "p99", &result.p99)) {
+      continue;
+    }
+    (*results)[name + " " + platform] = result;
+  }
+  return true;
+}
+
+/* Change in percent, positive when worse */
+static double worsening(double before, double after, bool higher_is_better) {
+  if (before == 0) {
+    return after == 0 ? 0 : (higher_is_better ? -100 : 100);
+  }
+  double change = (after - before) * 100 / before;
+  return higher_is_better ? -change : change;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: benchdiff [-t percent] old.txt new.txt\n");
+}
+
+int main(int argc, char **argv) {
+  double threshold = 10;
+  int arg = 1;
+  if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+    threshold = atof(argv[2]);
+    arg = 3;
+  }
+  if (argc - arg != 2) {
+    usage();
+    return 2;
+  }
+  Results before, after;
+  if (!load(argv[arg], &before) || !load(argv[arg + 1], &after)) {
+    return 2;
+  }
+
+  int regressions = 0;
+  printf("%-32s %-6s %10s %10s %8s %10s %10s %8s\n", "bench", "unit",
+         "p50 old", "p50 new", "change", "p99 old", "p99 new", "change");
+  for (const auto &entry : after) {
+    const Result &now = entry.second;
+    auto old = before.find(entry.first);
+    if (old == before.end()) {
+      printf("%-32s %-6s %10s %10.0f %8s %10s %10.0f %8s  new\n",
+             entry.first.c_str(), now.unit.c_str(), "-", now.p50, "", "-",
+             now.p99, "");
+      continue;
+    }
+    const Result &was = old->second;
+    bool throughput = now.unit.size() >= 2 &&
+                      now.unit.compare(now.unit.size() - 2, 2, "/s") == 0;
+    double p50 = worsening(was.p50, now.p50, throughput);
+    double p99 = worsening(was.p99, now.p99, throughput);
+    bool regressed = p50 > threshold || p99 > threshold;
+    regressions += regressed;
+
+    /* Print the signed change in value, not in goodness */
+    printf("%-32s %-6s %10.0f %10.0f %+7.1f%% %10.0f %10.0f %+7.1f%%%s\n",
+           entry.first.c_str(), now.unit.c_str(), was.p50, now.p50,
+           throughput ? -p50 : p50, was.p99, now.p99,
+           throughput ? -p99 : p99, regressed ? "  REGRESSED" : "");
+  }
+  for (const auto &entry : before) {
+    if (after.find(entry.first) == after.end()) {
+      printf("%-32s %-6s %10.0f %10s %8s %10.0f %10s %8s  removed\n",
+             entry.first.c_str(), entry.second.unit.c_str(), entry.second.p50,
+             "-", "", entry.second.p99, "-", "");
+    }
+  }
+  if (regressions > 0) {
+    printf("%d regressed by more than %.0f%%\n", regressions, threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Host side of the network benchmark in src/Iperf, to run against a device
+ * flashed with the iperf build target, or to serve the device's tests.
+ *
+ *   iperf [-p port] [-P profile] -s
+ *   iperf [-p port] [-P profile] [-m mode] [-t seconds] [-l length]
+ *         [-b kbit/s] [-n echoes] host
+ *
+ * Modes are tcp_upload (the default), tcp_download, udp_upload and echo,
+ * as seen from this end. Each test prints one JSON line in the format of
+ * the benchmark suites, so runs can be compared with tools/benchdiff. The
+ * profile sets this end's TCP buffers, see src/Tuning/Tuning.h. Build with
+ *
+ *   g++ -O2 -std=gnu++14 -pthread -Isrc -Isrc/Host/idf -o iperf \
+ *     tools/iperf.cpp src/Iperf/Iperf.cpp src/Tuning/Tuning.cpp \
+ *     src/Bench/Bench.cpp src/Port/Port.cpp src/Port/Socket.cpp
+ */
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Iperf/Iperf.h"
+#include "Tuning/Tuning.h"
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-p port] [-P profile] -s\n"
+          "       %s [-p port] [-P profile] [-m mode] [-t seconds] "
+          "[-l length] [-b kbit/s] [-n echoes] host\n",
+          name, name);
+  return 2;
+}
+
+static bool parse_mode(const char *name, Iperf::Mode *mode) {
+  const Iperf::Mode modes[] = {Iperf::Mode::TCP_UPLOAD,
+                               Iperf::Mode::TCP_DOWNLOAD,
+                               Iperf::Mode::UDP_UPLOAD, Iperf::Mode::ECHO};
+  for (Iperf::Mode candidate : modes) {
+    if (strcmp(name, Iperf::mode_name(candidate)) == 0) {
+      *mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* IPv4 address of 'host' in host byte order */
+static bool resolve(const char *host, uint32_t *addr) {
+  addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(host, nullptr, &hints, &res) != 0) {
+    return false;
+  }
+  *addr = ntohl(((sockaddr_in *)res->ai_addr)->sin_addr.s_addr);
+  freeaddrinfo(res);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Iperf::Test test;
+  bool serve = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg += 2) {
+    if (strcmp(argv[arg], "-s") == 0) {
+      serve = true;
+      arg--;
+      continue;
+    }
+    if (arg + 1 >= argc) {
+      return usage(argv[0]);
+    }
+    const char *value = argv[arg + 1];
+    if (strcmp(argv[arg], "-p") == 0) {
+      test.port = atoi(value);
+    } else if (strcmp(argv[arg], "-P") == 0) {
+      if (Tuning::select(value) != ESP_OK) {
+        return usage(argv[0]);
+      }
+    } else if (strcmp(argv[arg], "-m") == 0) {
+      if (!parse_mode(value, &test.mode)) {
+        return usage(argv[0]);
+      }
+    } else if (strcmp(argv[arg], "-t") == 0) {
+      test.duration_ms = atoi(value) * 1000;
+    } else if (strcmp(argv[arg], "-l") == 0) {
+      test.length = atoi(value);
+    } else if (strcmp(argv[arg], "-b") == 0) {
+      test.rate_bytes_per_s = atoi(value) * 1000 / 8;
+    } else if (strcmp(argv[arg], "-n") == 0) {
+      test.echoes = atoi(value);
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  if (serve) {
+    if (arg != argc) {
+      return usage(argv[0]);
+    }
+    Iperf::Server server;
+    if (server.start(test.port) != ESP_OK) {
+      fprintf(stderr, "Unable to listen on port %u\n", test.port);
+      return 1;
+    }
+    printf("Serving on port %u, profile %s\n", server.port(),
+           Tuning::current().name);
+    fflush(stdout);
+    for (;;) {
+      Port::sleep_ms(1000);
+    }
+  }
+
+  if (argc - arg != 1) {
+    return usage(argv[0]);
+  }
+  if (!resolve(argv[arg], &test.addr)) {
+    fprintf(stderr, "Unable to resolve %s\n", argv[arg]);
+    return 1;
+  }
+  Iperf::Report report;
+  esp_err_t err = Iperf::run(test, report);
+  if (err != ESP_OK) {
+    fprintf(stderr, "%s failed (0x%x)\n", Iperf::mode_name(test.mode), err);
+    return 1;
+  }
+  Iperf::print(test, report);
+  return 0;
+}
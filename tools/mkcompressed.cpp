@@ -0,0 +1,80 @@
+/**
+ * Compresses a firmware image for Update::download_compressed().
+ *
+ *   mkcompressed [-w window_bits] [-l lookahead_bits] firmware.bin out.bin
+ *
+ * The device needs 2^window_bits bytes of RAM for the window. Build with
+ *
+ *   g++ -O2 -std=gnu++14 -Isrc -o mkcompressed tools/mkcompressed.cpp \
+ *     src/Host/Compressor.cpp src/Crypto/Sha256.cpp
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Host/Compressor.h"
+#include "Update/Compressed.h"
+
+static bool read_file(const char *path, std::string *out) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buf;
+  buf << file.rdbuf();
+  *out = buf.str();
+  return true;
+}
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-w window_bits] [-l lookahead_bits] firmware.bin "
+          "out.bin\n",
+          name);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  int window_bits = COMPRESS_WINDOW_BITS;
+  int lookahead_bits = COMPRESS_LOOKAHEAD_BITS;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (strcmp(argv[arg], "-w") == 0) {
+      window_bits = atoi(argv[arg + 1]);
+    } else if (strcmp(argv[arg], "-l") == 0) {
+      lookahead_bits = atoi(argv[arg + 1]);
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (argc - arg != 2) {
+    return usage(argv[0]);
+  }
+  if (window_bits < COMPRESSED_WINDOW_BITS_MIN ||
+      window_bits > COMPRESSED_WINDOW_BITS_MAX || lookahead_bits < 1 ||
+      lookahead_bits >= window_bits) {
+    fprintf(stderr, "window_bits must be %d to %d, lookahead_bits below it\n",
+            COMPRESSED_WINDOW_BITS_MIN, COMPRESSED_WINDOW_BITS_MAX);
+    return 2;
+  }
+
+  std::string image;
+  if (!read_file(argv[arg], &image)) {
+    fprintf(stderr, "Unable to read %s\n", argv[arg]);
+    return 1;
+  }
+
+  std::string out = Host::compress(image, window_bits, lookahead_bits);
+  std::ofstream file(argv[arg + 1], std::ios::binary);
+  if (!file.write(out.data(), out.size())) {
+    fprintf(stderr, "Unable to write %s\n", argv[arg + 1]);
+    return 1;
+  }
+
+  printf("%s: %zu bytes, %.1f%% of %zu\n", argv[arg + 1], out.size(),
+         100.0 * out.size() / (image.size() ? image.size() : 1), image.size());
+  return 0;
+}
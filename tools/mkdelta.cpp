@@ -0,0 +1,53 @@
+/**
+ * Makes a delta OTA patch from two firmware images.
+ *
+ *   mkdelta old.bin new.bin patch.bin
+ *
+ * old.bin must be the exact image running on the device, the patch is
+ * refused otherwise. Build with
+ *
+ *   g++ -O2 -std=gnu++14 -Isrc -o mkdelta tools/mkdelta.cpp \
+ *     src/Host/DeltaEncoder.cpp src/Crypto/Sha256.cpp
+ */
+
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Host/DeltaEncoder.h"
+
+static bool read_file(const char *path, std::string *out) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buf;
+  buf << file.rdbuf();
+  *out = buf.str();
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s old.bin new.bin patch.bin\n", argv[0]);
+    return 2;
+  }
+
+  std::string old_image, new_image;
+  if (!read_file(argv[1], &old_image) || !read_file(argv[2], &new_image)) {
+    fprintf(stderr, "Unable to read the images\n");
+    return 1;
+  }
+
+  std::string patch = Host::make_delta(old_image, new_image);
+  std::ofstream out(argv[3], std::ios::binary);
+  if (!out.write(patch.data(), patch.size())) {
+    fprintf(stderr, "Unable to write %s\n", argv[3]);
+    return 1;
+  }
+
+  printf("%s: %zu bytes, %.1f%% of %zu\n", argv[3], patch.size(),
+         100.0 * patch.size() / (new_image.size() ? new_image.size() : 1),
+         new_image.size());
+  return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * Signs firmware images for Update::set_signing_key().
+ *
+ *   signimage keygen secret.key public_key.h
+ *   signimage sign secret.key firmware.bin firmware.bin.sig
+ *   signimage chunks secret.key firmware.bin firmware.bin.chunks
+ *
+ * keygen writes a random Ed25519 secret key, and a header with the public
+ * key to build into the firmware. Keep secret.key off the device. sign
+ * writes the manifest that is served next to the image. For delta and
+ * compressed updates, sign the full image they rebuild. chunks writes the
+ * chunk table for Update::download_peer(). Build with
+ *
+ *   g++ -O2 -std=gnu++14 -Isrc -o signimage tools/signimage.cpp \
+ *     src/Update/Manifest.cpp src/Update/ChunkTable.cpp \
+ *     src/Crypto/Ed25519.cpp src/Crypto/Sha256.cpp
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include "Update/ChunkTable.h"
+#include "Update/Manifest.h"
+
+static bool read_file(const char *path, std::string *out) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buf;
+  buf << file.rdbuf();
+  *out = buf.str();
+  return true;
+}
+
+static bool write_file(const char *path, const void *data, size_t size) {
+  std::ofstream file(path, std::ios::binary);
+  return static_cast<bool>(
+      file.write(static_cast<const char *>(data), size));
+}
+
+static int keygen(const char *secret_path, const char *header_path) {
+  uint8_t seed[ED25519_SEED_SIZE], public_key[ED25519_PUBLIC_KEY_SIZE];
+  std::random_device random;
+  for (size_t i = 0; i < sizeof(seed); i++) {
+    seed[i] = random();
+  }
+  Ed25519::public_key(seed, public_key);
+
+  std::ostringstream header;
+  header << "/* Generated by tools/signimage, pass to "
+            "Update::set_signing_key() */\n"
+         << "static const uint8_t OTA_PUBLIC_KEY[] = {";
+  for (size_t i = 0; i < sizeof(public_key); i++) {
+    char byte[8];
+    snprintf(byte, sizeof(byte), "0x%02x", public_key[i]);
+    header << (i % 8 == 0 ? "\n    " : " ") << byte
+           << (i + 1 < sizeof(public_key) ? "," : "");
+  }
+  header << "};\n";
+
+  std::string text = header.str();
+  if (!write_file(secret_path, seed, sizeof(seed)) ||
+      !write_file(header_path, text.data(), text.size())) {
+    fprintf(stderr, "Unable to write the keys\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* Reads the secret key and the image for sign and chunks */
+static bool load(const char *secret_path, const char *image_path,
+                 std::string *seed, std::string *image) {
+  if (!read_file(secret_path, seed) || seed->size() != ED25519_SEED_SIZE) {
+    fprintf(stderr, "Unable to read a secret key from %s\n", secret_path);
+    return false;
+  }
+  if (!read_file(image_path, image)) {
+    fprintf(stderr, "Unable to read %s\n", image_path);
+    return false;
+  }
+  return true;
+}
+
+static int sign(const char *secret_path, const char *image_path,
+                const char *manifest_path) {
+  std::string seed, image;
+  if (!load(secret_path, image_path, &seed, &image)) {
+    return 1;
+  }
+
+  uint8_t digest[SHA256_DIGEST_SIZE], manifest[MANIFEST_SIZE];
+  Sha256::digest(image.data(), image.size(), digest);
+  Update::sign_manifest(digest, image.size(),
+                        reinterpret_cast<const uint8_t *>(seed.data()),
+                        manifest);
+  if (!write_file(manifest_path, manifest, sizeof(manifest))) {
+    fprintf(stderr, "Unable to write %s\n", manifest_path);
+    return 1;
+  }
+  return 0;
+}
+
+static int chunks(const char *secret_path, const char *image_path,
+                  const char *table_path) {
+  std::string seed, image;
+  if (!load(secret_path, image_path, &seed, &image)) {
+    return 1;
+  }
+
+  std::string table(Update::chunk_table_size(image.size()), '\0');
+  if (Update::sign_chunk_table(
+          reinterpret_cast<const uint8_t *>(image.data()), image.size(),
+          reinterpret_cast<const uint8_t *>(seed.data()),
+          reinterpret_cast<uint8_t *>(&table[0])) != ESP_OK) {
+    fprintf(stderr, "%s has more than %d chunks\n", image_path,
+            PEER_MAX_CHUNKS);
+    return 1;
+  }
+  if (!write_file(table_path, table.data(), table.size())) {
+    fprintf(stderr, "Unable to write %s\n", table_path);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "keygen") == 0) {
+    return keygen(argv[2], argv[3]);
+  }
+  if (argc == 5 && strcmp(argv[1], "sign") == 0) {
+    return sign(argv[2], argv[3], argv[4]);
+  }
+  if (argc == 5 && strcmp(argv[1], "chunks") == 0) {
+    return chunks(argv[2], argv[3], argv[4]);
+  }
+  fprintf(stderr,
+          "usage: %s keygen secret.key public_key.h\n"
+          "       %s sign secret.key firmware.bin firmware.bin.sig\n"
+          "       %s chunks secret.key firmware.bin firmware.bin.chunks\n",
+          argv[0], argv[0], argv[0]);
+  return 2;
+}